@@ -0,0 +1,90 @@
+#define LEPK_DA_IMPLEMENTATION
+#include "lepk_da.h"
+
+#define LEPK_HT_IMPLEMENTATION
+#include "lepk_ht.h"
+
+#define LEPK_FILE_IMPLEMENTATION
+#include "lepk_file.h"
+
+#define LEPK_CHECKSUM_IMPLEMENTATION
+#include "lepk_checksum.h"
+
+#define LEPK_LZ_IMPLEMENTATION
+#include "lepk_lz.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static double bench_now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Text like data, words picked from a small vocabulary with numbers mixed in. */
+static void bench_fill(char *data, unsigned long length) {
+	static const char *words[] = { "lepk", "record", "segment", "offset", "value", "key", "the", "of", "and", "checksum", "index", "file" };
+	unsigned int state = 12345;
+	unsigned long i = 0;
+	while (i < length) {
+		state = state * 1103515245u + 12345u;
+		char word[32];
+		int n = (state >> 16) % 8 == 0 ? sprintf(word, "%u ", (state >> 8) % 100000) : sprintf(word, "%s ", words[(state >> 16) % 12]);
+		for (int j = 0; j < n && i < length; j++) {
+			data[i++] = word[j];
+		}
+	}
+}
+
+int main(void) {
+	unsigned long length = 64ul * 1024 * 1024;
+	unsigned long block = 256ul * 1024;
+	char *data = malloc(length);
+	unsigned char *compressed = malloc(lepk_lz_bound(length));
+	char *output = malloc(length);
+	unsigned long *sizes = malloc((length / block) * sizeof(unsigned long));
+	if (data == NULL || compressed == NULL || output == NULL || sizes == NULL) {
+		return 1;
+	}
+	bench_fill(data, length);
+
+	/* Blocks like the file format, best of a few runs. */
+	double best_compress = 1e9;
+	double best_decompress = 1e9;
+	unsigned long total = 0;
+	for (int run = 0; run < 5; run++) {
+		double start = bench_now();
+		total = 0;
+		for (unsigned long i = 0; i < length / block; i++) {
+			sizes[i] = lepk_lz_compress(data + i * block, block, compressed + total, lepk_lz_bound(block));
+			total += sizes[i];
+		}
+		double middle = bench_now();
+		unsigned long offset = 0;
+		for (unsigned long i = 0; i < length / block; i++) {
+			unsigned long output_length;
+			lepk_lz_decompress(compressed + offset, sizes[i], output + i * block, block, &output_length);
+			offset += sizes[i];
+		}
+		double end = bench_now();
+		best_compress = middle - start < best_compress ? middle - start : best_compress;
+		best_decompress = end - middle < best_decompress ? end - middle : best_decompress;
+	}
+	if (memcmp(data, output, length) != 0) {
+		printf("Round trip failed.\n");
+		return 1;
+	}
+
+	printf("Ratio:      %.2f\n", (double) length / total);
+	printf("Compress:   %.2f GB/s\n", length / best_compress / 1e9);
+	printf("Decompress: %.2f GB/s\n", length / best_decompress / 1e9);
+
+	free(data);
+	free(compressed);
+	free(output);
+	free(sizes);
+	return 0;
+}
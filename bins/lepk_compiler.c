@@ -1,4 +1,4 @@
-/* Version: 1.0 */
+/* Version: 1.10 */
 
 /*
  * MIT License
@@ -29,7 +29,11 @@
  * Note: Make sure the first "#include" in the source file is the include for the header since this line will be removed.
  *
  * Usage:
- * lepkc [SOURCE] [HEADER] [DEFINE] [OUTPUT]
+ * lepkc [OPTIONS] [SOURCE] [HEADER] [DEFINE] [OUTPUT]
+ * lepkc [OPTIONS] -m [MANIFEST]
+ * lepkc [OPTIONS] -d [SOURCE DIR] [HEADER DIR] [OUTPUT DIR]
+ * Options:
+ *     -j [JOBS] -c [CACHE] -b [BUNDLE DIR] -MD --watch --strip --keep-license --split
  * Source:
  *     .c implementation file.
  * Header:
@@ -38,102 +42,1411 @@
  *     Implementation define.
  * Output:
  *     Output file.
+ * Jobs:
+ *     Amount of libraries compiled at once, default 1.
+ * Cache:
+ *     File remembering a hash of the inputs of every output, libraries whose inputs did not change since the last run are skipped.
+ * Bundle dir:
+ *     Directory of already compiled headers, every #include "lepk_*.h" found there is inlined once at the top of the output,
+ *     together with its own dependencies, so the output does not need any other lepk header.
+ *     Dependencies are deduplicated by their include guard. Use a different output dir than the bundle dir.
+ * -MD:
+ *     Write a make dependency file "OUTPUT.d" next to every output, listing the source, header and inlined dependencies.
+ * --watch:
+ *     Keep running after compiling and recompile the libraries whose inputs change, until interrupted.
+ *     Directories of the inputs are watched so editors replacing files are noticed, bursts of changes are compiled once.
+ * --strip:
+ *     Leave out comments, LEPK_*_TEST blocks, indentation and blank lines to make the output quicker to preprocess.
+ *     The size before and after is reported for every output.
+ * --keep-license:
+ *     Keep the first comment containing "Copyright" when stripping.
+ * --split:
+ *     Next to "NAME.h" also write "NAME.decl.h", the declarations without the implementation, for precompiled headers,
+ *     and "NAME.c", which defines the implementation define and compiles the implementation on its own.
+ *     All three files are checked to hold the same code afterwards.
+ * Manifest:
+ *     File with one "SOURCE HEADER DEFINE OUTPUT" library per line, lines starting with '#' are ignored.
+ * Source dir, header dir and output dir:
+ *     Every "name.c" in source dir with a "name.h" in header dir is compiled into "name.h" in output dir,
+ *     the define is the upper case name followed by "_IMPLEMENTATION".
+ *
+ * An output which is already identical to what would be written is left untouched, so its modification time only changes
+ * when its content does and builds including it are not redone for nothing.
+ *
+ * Inputs are mapped into memory and the output is written as slices of them with vectored writes, inputs are never copied.
  */
 
+#define _GNU_SOURCE
+
 #include "lepk_type.h"
-#define LEPK_FILE_IMPLEMENTATION
-#include "lepk_file.h"
 #define LEPK_DA_IMPLEMENTATION
 #include "lepk_da.h"
+#define LEPK_HT_IMPLEMENTATION
+#include "lepk_ht.h"
+#define LEPK_FILE_IMPLEMENTATION
+#include "lepk_file.h"
+#define LEPK_CHECKSUM_IMPLEMENTATION
+#include "lepk_checksum.h"
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
-static void usage(const char *program) {
-	printf("Usage: %s [SOURCE] [HEADER] [DEFINE] [OUTPUT]\n", program);
+#include <ctype.h>
+#include <pthread.h>
+#include <poll.h>
+#include <time.h>
+
+/* One library to compile. */
+typedef struct {
+	char *source_filepath;
+	char *header_filepath;
+	char *implementation_define;
+	char *output_filepath;
+	/* Hash of the inputs and modification time of the output, from the cache when read and after compiling. */
+	U64 hash;
+	I64 mtime;
+	B8 compiled;
+	/* Set when the job has to be compiled by the next run_jobs. */
+	B8 dirty;
+	/* Dynamic array of the filepaths of the dependencies inlined by the last compile. */
+	char **dependency_filepaths;
+} Job;
+
+/* Bump whenever the output format changes so old cache entries stop matching. */
+#define CACHE_VERSION "lepkc cache 1"
+
+/* Settings shared by every job. */
+typedef struct {
+	B8 incremental;
+	/* NULL when dependencies are not inlined. */
+	const char *bundle_dirpath;
+	B8 depfile;
+	B8 watch;
+	B8 strip;
+	B8 keep_license;
+	B8 split;
+} Settings;
+
+/* Jobs shared by the worker threads, next is the index of the first job nobody took yet. */
+typedef struct {
+	Job *jobs;
+	const Settings *settings;
+	Usize next;
+	B8 failed;
+	pthread_mutex_t mutex;
+} Queue;
+
+static const char *program = "lepkc";
+
+static void usage(void) {
+	printf("Usage: %s [OPTIONS] [SOURCE] [HEADER] [DEFINE] [OUTPUT]\n", program);
+	printf("       %s [OPTIONS] -m [MANIFEST]\n", program);
+	printf("       %s [OPTIONS] -d [SOURCE DIR] [HEADER DIR] [OUTPUT DIR]\n", program);
+	printf("Options:\n    -j [JOBS] -c [CACHE] -b [BUNDLE DIR] -MD --watch --strip --keep-license --split\n");
 	printf("Source:\n    Source C file.\n");
 	printf("Header:\n    Header file.\n");
 	printf("Define:\n    What the user must define to create the implementation.\n");
 	printf("Output:\n    Output file.\n");
+	printf("Jobs:\n    Amount of libraries compiled at once.\n");
+	printf("Cache:\n    File of input hashes, libraries with unchanged inputs are skipped.\n");
+	printf("Bundle dir:\n    Directory of compiled headers, lepk headers included from there are inlined into the output.\n");
+	printf("-MD:\n    Write the inputs of every output to OUTPUT.d as make rules.\n");
+	printf("--watch:\n    Recompile libraries whenever their inputs change.\n");
+	printf("--strip:\n    Leave out comments, tests and redundant whitespace.\n");
+	printf("--keep-license:\n    Keep the license comment when stripping.\n");
+	printf("--split:\n    Also write a declaration only NAME.decl.h and an implementation unit NAME.c.\n");
+	printf("Manifest:\n    File with one \"SOURCE HEADER DEFINE OUTPUT\" line per library.\n");
+	printf("Source dir, header dir and output dir:\n    Compile every name.c in source dir with the name.h in header dir into name.h in output dir.\n");
 	exit(1);
 }
 
-static void write_impl(const char *output_filepath, const char *source, const char *def, U32 first_header, U32 first_header_end) {
-		lepk_file_append(output_filepath, "#ifdef ", 7, LEPK_FILE_MODE_BINARY);
-		lepk_file_append(output_filepath, def, strlen(def), LEPK_FILE_MODE_BINARY);
-		lepk_file_append(output_filepath, "\n", 1, LEPK_FILE_MODE_BINARY);
+/* Allocate room for a string of length characters and its terminator. */
+static char *string_alloc(Usize length) {
+	char *string = malloc(length + 1);
+	if (string == NULL) {
+		fprintf(stderr, "%s: out of memory\n", program);
+		exit(1);
+	}
+	string[length] = '\0';
+	return string;
+}
 
-		lepk_file_append(output_filepath, source, first_header, LEPK_FILE_MODE_BINARY);
-		lepk_file_append(output_filepath, source + first_header_end, strlen(source + first_header_end), LEPK_FILE_MODE_BINARY);
+static char *string_copy(const char *string, Usize length) {
+	char *copy = string_alloc(length);
+	memcpy(copy, string, length);
+	return copy;
+}
 
-		lepk_file_append(output_filepath, "#endif /*", 9, LEPK_FILE_MODE_BINARY);
-		lepk_file_append(output_filepath, def, strlen(def), LEPK_FILE_MODE_BINARY);
-		lepk_file_append(output_filepath, "*/", 2, LEPK_FILE_MODE_BINARY);
-		lepk_file_append(output_filepath, "\n", 1, LEPK_FILE_MODE_BINARY);
+/* Join a directory and a file name, length is the length of the name to use. */
+static char *path_join(const char *dirpath, const char *name, Usize length) {
+	Usize dir_length = strlen(dirpath);
+	char *path = string_alloc(dir_length + 1 + length);
+	memcpy(path, dirpath, dir_length);
+	path[dir_length] = '/';
+	memcpy(path + dir_length + 1, name, length);
+	path[dir_length + 1 + length] = '\0';
+	return path;
 }
 
-I32 main(I32 argc, char **argv) {
-	/* No arguments. */
-	if (argc != 5) {
-		usage(argv[0]);
+/* Filepath of a split output, output with its ".h" replaced by suffix. */
+static char *split_filepath(const char *output_filepath, const char *suffix) {
+	Usize length = strlen(output_filepath);
+	if (length > 2 && strcmp(output_filepath + length - 2, ".h") == 0) {
+		length -= 2;
+	}
+	char *filepath = string_alloc(length + strlen(suffix));
+	memcpy(filepath, output_filepath, length);
+	memcpy(filepath + length, suffix, strlen(suffix));
+	return filepath;
+}
+
+static void job_push(Job **jobs, const char *source_filepath, const char *header_filepath, const char *implementation_define, const char *output_filepath) {
+	Job job = {
+		string_copy(source_filepath, strlen(source_filepath)),
+		string_copy(header_filepath, strlen(header_filepath)),
+		string_copy(implementation_define, strlen(implementation_define)),
+		string_copy(output_filepath, strlen(output_filepath)),
+		0, 0, false, true,
+		lepk_da_create(sizeof(char *)),
+	};
+	lepk_da_push(*jobs, job);
+}
+
+static void jobs_destroy(Job *jobs) {
+	for (Usize i = 0; i < lepk_da_count(jobs); i++) {
+		free(jobs[i].source_filepath);
+		free(jobs[i].header_filepath);
+		free(jobs[i].implementation_define);
+		free(jobs[i].output_filepath);
+		for (Usize j = 0; j < lepk_da_count(jobs[i].dependency_filepaths); j++) {
+			free(jobs[i].dependency_filepaths[j]);
+		}
+		lepk_da_destroy(jobs[i].dependency_filepaths);
+	}
+	lepk_da_destroy(jobs);
+}
+
+/* Read one job from every line of a manifest. */
+static B8 jobs_from_manifest(Job **jobs, const char *manifest_filepath) {
+	char *manifest = lepk_file_read(manifest_filepath, NULL);
+	if (manifest == NULL) {
+		fprintf(stderr, "%s: unable to read %s\n", program, manifest_filepath);
+		return false;
+	}
+
+	B8 ok = true;
+	U32 line = 1;
+	for (char *cursor = manifest; *cursor != '\0'; line++) {
+		char *line_end = strchr(cursor, '\n');
+		if (line_end == NULL) {
+			line_end = cursor + strlen(cursor);
+		}
+
+		/* Split the line into words. */
+		char *words[4];
+		U32 word_count = 0;
+		char *word = cursor;
+		for (;;) {
+			for (; word < line_end && isspace((unsigned char) *word); word++);
+			if (word == line_end || *word == '#') {
+				break;
+			}
+			char *word_end = word;
+			for (; word_end < line_end && !isspace((unsigned char) *word_end); word_end++);
+			if (word_count < 4) {
+				words[word_count] = string_copy(word, word_end - word);
+			}
+			word_count++;
+			word = word_end;
+		}
+
+		if (word_count == 4) {
+			job_push(jobs, words[0], words[1], words[2], words[3]);
+		} else if (word_count != 0) {
+			fprintf(stderr, "%s:%u: expected SOURCE HEADER DEFINE OUTPUT\n", manifest_filepath, line);
+			ok = false;
+		}
+		for (U32 i = 0; i < word_count && i < 4; i++) {
+			free(words[i]);
+		}
+
+		cursor = *line_end == '\0' ? line_end : line_end + 1;
+	}
+
+	free(manifest);
+	return ok;
+}
+
+static I32 compare_jobs(const void *a, const void *b) {
+	return strcmp(((const Job *) a)->source_filepath, ((const Job *) b)->source_filepath);
+}
+
+/* Pair every name.c in source dir with name.h in header dir. */
+static B8 jobs_from_dirs(Job **jobs, const char *source_dirpath, const char *header_dirpath, const char *output_dirpath) {
+	LepkFileDir *dir = lepk_file_dir_open(source_dirpath, NULL);
+	if (dir == NULL) {
+		fprintf(stderr, "%s: unable to open %s\n", program, source_dirpath);
+		return false;
+	}
+
+	const char *name;
+	LepkFileType type;
+	while (lepk_file_dir_next(dir, &name, &type)) {
+		Usize length = strlen(name);
+		if (type == LEPK_FILE_TYPE_DIRECTORY || length < 3 || strcmp(name + length - 2, ".c") != 0) {
+			continue;
+		}
+
+		char *source_filepath = path_join(source_dirpath, name, length);
+		char *header_filepath = path_join(header_dirpath, name, length);
+		char *output_filepath = path_join(output_dirpath, name, length);
+		header_filepath[strlen(header_filepath) - 1] = 'h';
+		output_filepath[strlen(output_filepath) - 1] = 'h';
+
+		if (lepk_file_exists(header_filepath)) {
+			char *implementation_define = string_alloc(length - 2 + strlen("_IMPLEMENTATION"));
+			for (Usize i = 0; i < length - 2; i++) {
+				implementation_define[i] = isalnum((unsigned char) name[i]) ? toupper((unsigned char) name[i]) : '_';
+			}
+			strcpy(implementation_define + length - 2, "_IMPLEMENTATION");
+			job_push(jobs, source_filepath, header_filepath, implementation_define, output_filepath);
+			free(implementation_define);
+		}
+
+		free(source_filepath);
+		free(header_filepath);
+		free(output_filepath);
+	}
+	lepk_file_dir_close(dir);
+
+	/* Directory order is arbitrary, keep runs reproducible. */
+	qsort(*jobs, lepk_da_count(*jobs), sizeof(Job), compare_jobs);
+	return true;
+}
+
+/*
+ * Fill in hash and mtime of every job whose output has a line in the cache.
+ * Every line is "HASH MTIME OUTPUT", a missing or broken cache just means everything is compiled.
+ */
+static void cache_read(Job *jobs, const char *cache_filepath) {
+	char *cache = lepk_file_read(cache_filepath, NULL);
+	if (cache == NULL) {
+		return;
+	}
+
+	char *cursor = cache;
+	if (strncmp(cursor, CACHE_VERSION "\n", strlen(CACHE_VERSION "\n")) != 0) {
+		free(cache);
+		return;
 	}
+	cursor += strlen(CACHE_VERSION "\n");
 
-	const char *source_filepath       = argv[1];
-	const char *header_filepath       = argv[2];
-	const char *implementation_define = argv[3];
-	const char *output_filepath       = argv[4];
+	while (*cursor != '\0') {
+		char *line_end = strchr(cursor, '\n');
+		if (line_end == NULL) {
+			break;
+		}
+		*line_end = '\0';
+
+		unsigned long long hash;
+		long long mtime;
+		I32 path_offset;
+		if (sscanf(cursor, "%llx %lld %n", &hash, &mtime, &path_offset) == 2) {
+			for (Usize i = 0; i < lepk_da_count(jobs); i++) {
+				if (strcmp(jobs[i].output_filepath, cursor + path_offset) == 0) {
+					jobs[i].hash = hash;
+					jobs[i].mtime = mtime;
+				}
+			}
+		}
 
-	char *source = lepk_file_read(source_filepath, NULL);
-	char *header = lepk_file_read(header_filepath, NULL);
+		cursor = line_end + 1;
+	}
+
+	free(cache);
+}
+
+/* Write a line for every compiled job. */
+static void cache_write(const Job *jobs, const char *cache_filepath) {
+	char *cache = lepk_da_create(sizeof(char));
+	lepk_da_push_array(cache, CACHE_VERSION "\n", strlen(CACHE_VERSION "\n"));
+	for (Usize i = 0; i < lepk_da_count((void *) jobs); i++) {
+		if (!jobs[i].compiled) {
+			continue;
+		}
+		char line[64];
+		I32 length = sprintf(line, "%016llx %lld ", (unsigned long long) jobs[i].hash, (long long) jobs[i].mtime);
+		lepk_da_push_array(cache, line, length);
+		lepk_da_push_array(cache, jobs[i].output_filepath, strlen(jobs[i].output_filepath));
+		lepk_da_push_array(cache, "\n", 1);
+	}
+
+	if (lepk_file_write_atomic(cache_filepath, cache, lepk_da_count(cache), LEPK_FILE_DURABILITY_NONE, NULL) != LEPK_FILE_STATUS_OK) {
+		fprintf(stderr, "%s: unable to write %s\n", program, cache_filepath);
+	}
+	lepk_da_destroy(cache);
+}
+
+/* Compiled lepk header inlined into a bundle. */
+typedef struct {
+	char *filepath;
+	const char *text;
+	Usize length;
+} Dependency;
+
+/* Hash of everything the output depends on. */
+static U64 hash_inputs(const char *source, Usize source_length, const char *header, Usize header_length, const char *implementation_define, const Dependency *dependencies, const Settings *settings) {
+	LepkHash64 state;
+	lepk_hash64_init(&state, 0);
+	/* Include the lengths so moving bytes between inputs changes the hash. */
+	lepk_hash64_update(&state, CACHE_VERSION, strlen(CACHE_VERSION) + 1);
+	U8 modes[3] = {settings->strip, settings->keep_license, settings->split};
+	lepk_hash64_update(&state, modes, sizeof(modes));
+	lepk_hash64_update(&state, implementation_define, strlen(implementation_define) + 1);
+	U64 lengths[2] = {source_length, header_length};
+	lepk_hash64_update(&state, lengths, sizeof(lengths));
+	lepk_hash64_update(&state, source, source_length);
+	lepk_hash64_update(&state, header, header_length);
+	for (Usize i = 0; i < lepk_da_count((void *) dependencies); i++) {
+		U64 length = dependencies[i].length;
+		lepk_hash64_update(&state, &length, sizeof(length));
+		lepk_hash64_update(&state, dependencies[i].text, dependencies[i].length);
+	}
+	return lepk_hash64_final(&state);
+}
+
+static Usize slices_length(const LepkFileSlice *slices, Usize count) {
+	Usize length = 0;
+	for (Usize i = 0; i < count; i++) {
+		length += slices[i].length;
+	}
+	return length;
+}
+
+/* Check whether the file at filepath already holds exactly the content of count slices. */
+static B8 file_equals(const char *filepath, const LepkFileSlice *slices, Usize count) {
+	LepkFileStatus status;
+	Usize length = slices_length(slices, count);
+	if (lepk_file_size(filepath, &status) != length || status != LEPK_FILE_STATUS_OK) {
+		return false;
+	}
+	Usize existing_length;
+	const char *existing = lepk_file_map(filepath, &existing_length, NULL);
+	if (existing == NULL || existing_length != length) {
+		lepk_file_unmap(existing, existing_length);
+		return false;
+	}
+	B8 equal = true;
+	Usize offset = 0;
+	for (Usize i = 0; equal && i < count; i++) {
+		equal = memcmp(existing + offset, slices[i].data, slices[i].length) == 0;
+		offset += slices[i].length;
+	}
+	lepk_file_unmap(existing, existing_length);
+	return equal;
+}
+
+/* Kind of a preprocessor directive. */
+typedef enum {
+	DIRECTIVE_IF,
+	DIRECTIVE_ELSE,
+	DIRECTIVE_ENDIF,
+	DIRECTIVE_INCLUDE,
+	DIRECTIVE_PRAGMA_ONCE,
+	DIRECTIVE_OTHER,
+} DirectiveKind;
+
+/* Preprocessor directive found by scan. */
+typedef struct {
+	DirectiveKind kind;
+	/* Offset of the line the directive is on and of the byte after the newline ending the directive. */
+	Usize start;
+	Usize end;
+	/* Amount of enclosing #if blocks, #else and #endif count as part of the block they continue or close. */
+	U32 depth;
+} Directive;
+
+static B8 is_blank(char c) {
+	return c == ' ' || c == '\t' || c == '\v' || c == '\f' || c == '\r';
+}
+
+static B8 word_equals(const char *word, Usize length, const char *expected) {
+	return length == strlen(expected) && memcmp(word, expected, length) == 0;
+}
+
+static DirectiveKind directive_kind(const char *text, Usize start, Usize end) {
+	Usize i = start + 1;
+	for (; i < end && is_blank(text[i]); i++);
+	Usize name = i;
+	for (; i < end && (isalnum((unsigned char) text[i]) || text[i] == '_'); i++);
+	const char *word = text + name;
+	Usize length = i - name;
+
+	if (word_equals(word, length, "if") || word_equals(word, length, "ifdef") || word_equals(word, length, "ifndef")) {
+		return DIRECTIVE_IF;
+	}
+	if (word_equals(word, length, "else") || word_equals(word, length, "elif")) {
+		return DIRECTIVE_ELSE;
+	}
+	if (word_equals(word, length, "endif")) {
+		return DIRECTIVE_ENDIF;
+	}
+	if (word_equals(word, length, "include")) {
+		return DIRECTIVE_INCLUDE;
+	}
+	if (word_equals(word, length, "pragma")) {
+		for (; i < end && is_blank(text[i]); i++);
+		Usize argument = i;
+		for (; i < end && isalnum((unsigned char) text[i]); i++);
+		if (word_equals(text + argument, i - argument, "once")) {
+			return DIRECTIVE_PRAGMA_ONCE;
+		}
+	}
+	return DIRECTIVE_OTHER;
+}
+
+/*
+ * Find every directive in length bytes of text, skipping comments, string and character literals.
+ * Lines are found with memchr and only lines outside block comments starting with '#' are looked at closer, so this stays linear.
+ * Output is a dynamic array which the caller destroys.
+ */
+static Directive *scan(const char *text, Usize length) {
+	Directive *directives = lepk_da_create(sizeof(Directive));
+	B8 in_comment = false;
+	U32 depth = 0;
+
+	for (Usize line = 0; line < length;) {
+		const char *newline = memchr(text + line, '\n', length - line);
+		Usize line_end = newline != NULL ? (Usize) (newline - text) + 1 : length;
+		Usize i = line;
+
+		if (!in_comment) {
+			for (; i < line_end && is_blank(text[i]); i++);
+			if (i < line_end && text[i] == '#') {
+				/* Directives continue over lines ending with a backslash. */
+				while (line_end < length && line_end >= 2 && text[line_end - 2] == '\\') {
+					newline = memchr(text + line_end, '\n', length - line_end);
+					line_end = newline != NULL ? (Usize) (newline - text) + 1 : length;
+				}
+
+				Directive directive = {directive_kind(text, i, line_end), line, line_end, depth};
+				if (directive.kind == DIRECTIVE_IF) {
+					depth++;
+				} else if (directive.kind == DIRECTIVE_ENDIF && depth > 0) {
+					depth--;
+					directive.depth = depth;
+				} else if (directive.kind == DIRECTIVE_ELSE && depth > 0) {
+					directive.depth = depth - 1;
+				}
+				lepk_da_push(directives, directive);
+			}
+		}
+
+		/* Track comments and literals for the rest of the line. */
+		while (i < line_end) {
+			if (in_comment) {
+				const char *star = memchr(text + i, '*', line_end - i);
+				if (star == NULL) {
+					i = line_end;
+				} else {
+					i = star - text + 1;
+					if (i < line_end && text[i] == '/') {
+						in_comment = false;
+						i++;
+					}
+				}
+				continue;
+			}
+
+			char c = text[i];
+			if (c == '/' && i + 1 < line_end && text[i + 1] == '*') {
+				in_comment = true;
+				i += 2;
+			} else if (c == '/' && i + 1 < line_end && text[i + 1] == '/') {
+				i = line_end;
+			} else if (c == '"' || c == '\'') {
+				for (i++; i < line_end && text[i] != c && text[i] != '\n'; i++) {
+					if (text[i] == '\\') {
+						i++;
+					}
+				}
+				i++;
+			} else {
+				i++;
+			}
+		}
+
+		line = line_end;
+	}
+
+	return directives;
+}
+
+/* Read the identifier following the directive name of directive, NULL when there is none. */
+static const char *directive_argument(const char *text, const Directive *directive, Usize *length) {
+	Usize i = directive->start;
+	for (; text[i] != '#'; i++);
+	for (i++; i < directive->end && is_blank(text[i]); i++);
+	for (; i < directive->end && isalnum((unsigned char) text[i]); i++);
+	for (; i < directive->end && is_blank(text[i]); i++);
+	Usize argument = i;
+	for (; i < directive->end && (isalnum((unsigned char) text[i]) || text[i] == '_'); i++);
+	*length = i - argument;
+	return *length > 0 ? text + argument : NULL;
+}
+
+/* Name of the include guard of a header, NULL when it does not start with #ifndef. */
+static const char *include_guard(const char *text, const Directive *directives, Usize *length) {
+	if (lepk_da_count((void *) directives) == 0 || directives[0].kind != DIRECTIVE_IF) {
+		return NULL;
+	}
+	Usize i = directives[0].start;
+	Usize end = directives[0].end;
+	for (; text[i] != '#'; i++);
+	for (i++; i < end && is_blank(text[i]); i++);
+	if (end - i < 6 || memcmp(text + i, "ifndef", 6) != 0) {
+		return NULL;
+	}
+	return directive_argument(text, &directives[0], length);
+}
+
+/* Name of the file included by an #include "lepk_*.h" directive which exists in dirpath, NULL otherwise. */
+static const char *internal_include(const char *text, const Directive *directive, const char *dirpath, Usize *length) {
+	if (directive->kind != DIRECTIVE_INCLUDE) {
+		return NULL;
+	}
+	const char *quote = memchr(text + directive->start, '"', directive->end - directive->start);
+	if (quote == NULL) {
+		return NULL;
+	}
+	const char *name = quote + 1;
+	const char *name_end = memchr(name, '"', text + directive->end - name);
+	if (name_end == NULL || name_end - name < 7 || strncmp(name, "lepk_", 5) != 0 || strncmp(name_end - 2, ".h", 2) != 0) {
+		return NULL;
+	}
+
+	char *filepath = path_join(dirpath, name, name_end - name);
+	B8 exists = lepk_file_exists(filepath);
+	free(filepath);
+	*length = name_end - name;
+	return exists ? name : NULL;
+}
+
+/* Add a name to visited, false return value means it already was there. */
+static B8 visit(char ***visited, const char *name, Usize length) {
+	for (Usize i = 0; i < lepk_da_count(*visited); i++) {
+		if (strlen((*visited)[i]) == length && memcmp((*visited)[i], name, length) == 0) {
+			return false;
+		}
+	}
+	char *copy = string_copy(name, length);
+	lepk_da_push(*visited, copy);
+	return true;
+}
+
+/* Append the dependencies of text to dependencies, dependencies of a dependency come before it. */
+static B8 collect_dependencies(Dependency **dependencies, char ***visited, const char *text, Usize text_length, const char *dirpath) {
+	Directive *directives = scan(text, text_length);
+	B8 ok = true;
+	for (Usize i = 0; ok && i < lepk_da_count(directives); i++) {
+		Usize length;
+		const char *name = internal_include(text, &directives[i], dirpath, &length);
+		if (name == NULL || !visit(visited, name, length)) {
+			continue;
+		}
+
+		char *filepath = path_join(dirpath, name, length);
+		Dependency dependency = {filepath, NULL, 0};
+		dependency.text = lepk_file_map(filepath, &dependency.length, NULL);
+		if (dependency.text == NULL) {
+			fprintf(stderr, "%s: unable to read %s\n", program, filepath);
+			free(filepath);
+			ok = false;
+			break;
+		}
+
+		/* Two files with the same guard would only be included once by the preprocessor too. */
+		Directive *dependency_directives = scan(dependency.text, dependency.length);
+		const char *guard = include_guard(dependency.text, dependency_directives, &length);
+		B8 is_new = guard == NULL || visit(visited, guard, length);
+		lepk_da_destroy(dependency_directives);
+		if (!is_new) {
+			free(dependency.filepath);
+			lepk_file_unmap(dependency.text, dependency.length);
+			continue;
+		}
+
+		ok = collect_dependencies(dependencies, visited, dependency.text, dependency.length, dirpath);
+		lepk_da_push(*dependencies, dependency);
+		if (!ok) {
+			break;
+		}
+	}
+	lepk_da_destroy(directives);
+	return ok;
+}
+
+static void dependencies_destroy(Dependency *dependencies) {
+	for (Usize i = 0; i < lepk_da_count(dependencies); i++) {
+		free(dependencies[i].filepath);
+		lepk_file_unmap(dependencies[i].text, dependencies[i].length);
+	}
+	lepk_da_destroy(dependencies);
+}
+
+/* Append a slice of length bytes of data to output, a dynamic array of slices. */
+static void output_push(LepkFileSlice **output, const char *data, Usize length) {
+	if (length > 0) {
+		LepkFileSlice slice = {data, length};
+		lepk_da_push(*output, slice);
+	}
+}
+
+static void output_push_string(LepkFileSlice **output, const char *string) {
+	output_push(output, string, strlen(string));
+}
+
+/* Append length bytes of text, leaving out every include of a header in dirpath when it is not NULL. */
+static void output_push_text(LepkFileSlice **output, const char *text, Usize length, const char *dirpath) {
+	if (dirpath == NULL) {
+		output_push(output, text, length);
+		return;
+	}
+
+	Directive *directives = scan(text, length);
+	Usize written = 0;
+	for (Usize i = 0; i < lepk_da_count(directives); i++) {
+		Usize name_length;
+		if (internal_include(text, &directives[i], dirpath, &name_length) != NULL) {
+			output_push(output, text + written, directives[i].start - written);
+			written = directives[i].end;
+		}
+	}
+	output_push(output, text + written, length - written);
+	lepk_da_destroy(directives);
+}
+
+/* Offset right after the include guard or #pragma once of header, where dependencies are inlined. */
+static Usize bundle_offset(const Directive *directives) {
+	if (lepk_da_count((void *) directives) >= 1 && directives[0].kind == DIRECTIVE_PRAGMA_ONCE) {
+		return directives[0].end;
+	} else if (lepk_da_count((void *) directives) >= 2 && directives[0].kind == DIRECTIVE_IF && directives[1].kind == DIRECTIVE_OTHER) {
+		return directives[1].end;
+	}
+	return 0;
+}
+
+/* Append a path to a make rule, escaping what make would otherwise split on. */
+static void push_make_path(char **rule, const char *path) {
+	for (; *path != '\0'; path++) {
+		if (*path == ' ' || *path == '#' || *path == '\\') {
+			lepk_da_push(*rule, '\\');
+		} else if (*path == '$') {
+			lepk_da_push(*rule, '$');
+		}
+		lepk_da_push(*rule, *path);
+	}
+}
+
+/*
+ * Write "OUTPUT.d" with a rule making output depend on every input.
+ * Every input also gets an empty rule, so make does not fail once an input is deleted.
+ */
+static B8 write_depfile(const Job *job, const Dependency *dependencies, B8 split) {
+	const char *inputs[2] = {job->source_filepath, job->header_filepath};
+	Usize input_count = 2 + lepk_da_count((void *) dependencies);
+
+	char *rule = lepk_da_create(sizeof(char));
+	push_make_path(&rule, job->output_filepath);
+	if (split) {
+		const char *suffixes[2] = {".decl.h", ".c"};
+		for (Usize i = 0; i < 2; i++) {
+			char *filepath = split_filepath(job->output_filepath, suffixes[i]);
+			lepk_da_push(rule, ' ');
+			push_make_path(&rule, filepath);
+			free(filepath);
+		}
+	}
+	lepk_da_push(rule, ':');
+	for (Usize i = 0; i < input_count; i++) {
+		lepk_da_push_array(rule, " \\\n  ", 5);
+		push_make_path(&rule, i < 2 ? inputs[i] : dependencies[i - 2].filepath);
+	}
+	lepk_da_push(rule, '\n');
+	for (Usize i = 0; i < input_count; i++) {
+		lepk_da_push(rule, '\n');
+		push_make_path(&rule, i < 2 ? inputs[i] : dependencies[i - 2].filepath);
+		lepk_da_push_array(rule, ":\n", 2);
+	}
+
+	Usize output_length = strlen(job->output_filepath);
+	char *depfile_filepath = string_alloc(output_length + 2);
+	memcpy(depfile_filepath, job->output_filepath, output_length);
+	memcpy(depfile_filepath + output_length, ".d", 2);
+	LepkFileStatus status = LEPK_FILE_STATUS_OK;
+	LepkFileSlice slice = {rule, lepk_da_count(rule)};
+	if (!file_equals(depfile_filepath, &slice, 1)) {
+		status = lepk_file_write_atomic(depfile_filepath, rule, lepk_da_count(rule), LEPK_FILE_DURABILITY_NONE, NULL);
+	}
+	if (status != LEPK_FILE_STATUS_OK) {
+		fprintf(stderr, "%s: unable to write %s\n", program, depfile_filepath);
+	}
+
+	free(depfile_filepath);
+	lepk_da_destroy(rule);
+	return status == LEPK_FILE_STATUS_OK;
+}
+
+/* Check whether directive is an #ifdef of a LEPK_*_TEST macro. */
+static B8 is_test_block(const char *text, const Directive *directive) {
+	Usize length;
+	const char *argument = directive->kind == DIRECTIVE_IF ? directive_argument(text, directive, &length) : NULL;
+	return argument != NULL && length > 10 && strncmp(argument, "LEPK_", 5) == 0 && strncmp(argument + length - 5, "_TEST", 5) == 0;
+}
+
+/*
+ * Copy text leaving out LEPK_*_TEST blocks, comments, indentation, trailing whitespace and blank lines.
+ * Whitespace between tokens is collapsed to a single space but never removed and line splices are joined,
+ * so the preprocessor sees the same tokens and directives as before.
+ */
+static char *strip(const char *output, Usize length, B8 keep_license) {
+	/* Find the ranges of the test blocks first. */
+	Directive *directives = scan(output, length);
+	Usize *tests = lepk_da_create(sizeof(Usize));
+	for (Usize i = 0; i < lepk_da_count(directives); i++) {
+		if (!is_test_block(output, &directives[i])) {
+			continue;
+		}
+		Usize end = i + 1;
+		for (; end < lepk_da_count(directives) && !(directives[end].kind == DIRECTIVE_ENDIF && directives[end].depth == directives[i].depth); end++);
+		if (end == lepk_da_count(directives)) {
+			break;
+		}
+		lepk_da_push(tests, directives[i].start);
+		lepk_da_push(tests, directives[end].end);
+		i = end;
+	}
+	lepk_da_destroy(directives);
+
+	char *stripped = lepk_da_create(sizeof(char));
+	B8 line_empty = true;
+	B8 space = false;
+	Usize test = 0;
+	for (Usize i = 0; i < length;) {
+		if (test < lepk_da_count(tests) && i == tests[test]) {
+			i = tests[test + 1];
+			test += 2;
+			continue;
+		}
+
+		char c = output[i];
+		char next = i + 1 < length ? output[i + 1] : '\0';
+		if (c == '/' && next == '*') {
+			const char *close = memmem(output + i + 2, length - i - 2, "*/", 2);
+			Usize end = close != NULL ? (Usize) (close - output) + 2 : length;
+			if (keep_license) {
+				if (memmem(output + i, end - i, "Copyright", 9) != NULL) {
+					if (!line_empty) {
+						lepk_da_push(stripped, '\n');
+					}
+					lepk_da_push_array(stripped, output + i, end - i);
+					lepk_da_push(stripped, '\n');
+					keep_license = false;
+					line_empty = true;
+					space = false;
+					i = end;
+					continue;
+				}
+			}
+			/* A comment separates tokens like a space does. */
+			space = !line_empty;
+			i = end;
+		} else if (c == '/' && next == '/') {
+			for (; i < length && output[i] != '\n'; i++);
+		} else if (c == '\\' && next == '\n') {
+			i += 2;
+		} else if (c == '\n') {
+			if (!line_empty) {
+				lepk_da_push(stripped, '\n');
+			}
+			line_empty = true;
+			space = false;
+			i++;
+		} else if (is_blank(c)) {
+			space = !line_empty;
+			i++;
+		} else {
+			if (space) {
+				lepk_da_push(stripped, ' ');
+				space = false;
+			}
+			Usize start = i++;
+			if (c == '"' || c == '\'') {
+				for (; i < length && output[i] != c && output[i] != '\n'; i++) {
+					if (output[i] == '\\') {
+						i++;
+					}
+				}
+				i++;
+			}
+			lepk_da_push_array(stripped, output + start, (i < length ? i : length) - start);
+			line_empty = false;
+		}
+	}
+	if (!line_empty) {
+		lepk_da_push(stripped, '\n');
+	}
+
+	lepk_da_destroy(tests);
+	return stripped;
+}
+
+/* Implementation is the source without the include of its own header. */
+static void write_impl(LepkFileSlice **output, const char *source, Usize source_length, Usize first_header, Usize first_header_end, const char *dirpath) {
+	output_push_text(output, source, first_header, dirpath);
+	output_push_text(output, source + first_header_end, source_length - first_header_end, dirpath);
+}
+
+static void write_impl_begin(LepkFileSlice **output, const char *def) {
+	output_push_string(output, "#ifdef ");
+	output_push_string(output, def);
+	output_push_string(output, "\n");
+}
+
+static void write_impl_end(LepkFileSlice **output, const char *def) {
+	output_push_string(output, "#endif /*");
+	output_push_string(output, def);
+	output_push_string(output, "*/");
+	output_push_string(output, "\n");
+}
+
+/* Copy slices into one dynamic array of chars. */
+static char *flatten(const LepkFileSlice *slices, Usize count) {
+	char *flat = lepk_da_create(sizeof(char));
+	for (Usize i = 0; i < count; i++) {
+		lepk_da_push_array(flat, slices[i].data, slices[i].length);
+	}
+	return flat;
+}
+
+/* Strip slices if asked to, then write them to filepath at once unless it already holds them, so nobody sees a half written file. */
+static B8 publish(const char *filepath, const LepkFileSlice *slices, Usize count, const Settings *settings) {
+	char *stripped = NULL;
+	LepkFileSlice slice;
+	if (settings->strip) {
+		char *full = flatten(slices, count);
+		stripped = strip(full, lepk_da_count(full), settings->keep_license);
+		printf("%s: stripped %s from %lu to %lu bytes, %.1f%% smaller\n", program, filepath, lepk_da_count(full), lepk_da_count(stripped), 100.0 - 100.0 * lepk_da_count(stripped) / lepk_da_count(full));
+		lepk_da_destroy(full);
+		slice.data = stripped;
+		slice.length = lepk_da_count(stripped);
+		slices = &slice;
+		count = 1;
+	}
+
+	LepkFileStatus status = LEPK_FILE_STATUS_OK;
+	if (!file_equals(filepath, slices, count)) {
+		status = lepk_file_write_atomic_slices(filepath, slices, count, LEPK_FILE_DURABILITY_NONE, NULL);
+	}
+	if (status != LEPK_FILE_STATUS_OK) {
+		fprintf(stderr, "%s: unable to write %s\n", program, filepath);
+	}
+
+	if (stripped != NULL) {
+		lepk_da_destroy(stripped);
+	}
+	return status == LEPK_FILE_STATUS_OK;
+}
+
+/* First lines of a split implementation unit, before the implementation itself. */
+static char *split_prelude(const char *def, const char *declaration_filepath) {
+	const char *name = strrchr(declaration_filepath, '/');
+	name = name != NULL ? name + 1 : declaration_filepath;
+	char *prelude = lepk_da_create(sizeof(char));
+	lepk_da_push_array(prelude, "#define ", 8);
+	lepk_da_push_array(prelude, def, strlen(def));
+	lepk_da_push_array(prelude, "\n#include \"", 11);
+	lepk_da_push_array(prelude, name, strlen(name));
+	lepk_da_push_array(prelude, "\"\n", 2);
+	return prelude;
+}
+
+/*
+ * Check that the single header on disk is exactly the declaration header with the implementation unit,
+ * without its prelude, wrapped in the implementation define where the include guard ends.
+ * Report tells whether a mismatch is printed.
+ */
+static B8 check_split(const Job *job, const Settings *settings, B8 report) {
+	const char *def = job->implementation_define;
+	char *filepaths[3] = {
+		string_copy(job->output_filepath, strlen(job->output_filepath)),
+		split_filepath(job->output_filepath, ".decl.h"),
+		split_filepath(job->output_filepath, ".c"),
+	};
+	const char *texts[3];
+	Usize lengths[3];
+	for (Usize i = 0; i < 3; i++) {
+		texts[i] = lepk_file_map(filepaths[i], &lengths[i], NULL);
+	}
+	char *prelude = split_prelude(def, filepaths[1]);
+
+	B8 consistent = texts[0] != NULL && texts[1] != NULL && texts[2] != NULL;
+	if (consistent) {
+		char *stripped_prelude = settings->strip ? strip(prelude, lepk_da_count(prelude), false) : NULL;
+		const char *expected_prelude = stripped_prelude != NULL ? stripped_prelude : prelude;
+		Usize prelude_length = lepk_da_count((void *) expected_prelude);
+		consistent = lengths[2] >= prelude_length && memcmp(texts[2], expected_prelude, prelude_length) == 0;
+		if (stripped_prelude != NULL) {
+			lepk_da_destroy(stripped_prelude);
+		}
+
+		/* Split the declarations where the implementation goes, the same way compile does. */
+		Directive *directives = scan(texts[1], lengths[1]);
+		Usize split = lengths[1];
+		for (Usize i = 0; i < lepk_da_count(directives); i++) {
+			if (directives[i].kind == DIRECTIVE_PRAGMA_ONCE) {
+				split = lengths[1];
+				break;
+			}
+			if (directives[i].kind == DIRECTIVE_ENDIF && directives[i].depth == 0) {
+				split = directives[i].start;
+			}
+		}
+		lepk_da_destroy(directives);
+
+		if (consistent) {
+			LepkFileSlice *expected = lepk_da_create(sizeof(LepkFileSlice));
+			output_push(&expected, texts[1], split);
+			write_impl_begin(&expected, def);
+			output_push(&expected, texts[2] + prelude_length, lengths[2] - prelude_length);
+			write_impl_end(&expected, def);
+			output_push(&expected, texts[1] + split, lengths[1] - split);
+
+			char *flat = flatten(expected, lepk_da_count(expected));
+			if (settings->strip) {
+				char *stripped = strip(flat, lepk_da_count(flat), settings->keep_license);
+				lepk_da_destroy(flat);
+				flat = stripped;
+			}
+			consistent = lepk_da_count(flat) == lengths[0] && memcmp(flat, texts[0], lengths[0]) == 0;
+			lepk_da_destroy(flat);
+			lepk_da_destroy(expected);
+		}
+	}
+
+	if (!consistent && report) {
+		fprintf(stderr, "%s: %s, %s and %s are not consistent\n", program, filepaths[0], filepaths[1], filepaths[2]);
+	}
+
+	lepk_da_destroy(prelude);
+	for (Usize i = 0; i < 3; i++) {
+		lepk_file_unmap(texts[i], lengths[i]);
+		free(filepaths[i]);
+	}
+	return consistent;
+}
+
+/*
+ * Compile a single library, false return value means it failed.
+ * When incremental is set and the inputs hash to the hash of job the output is not touched as long as nobody else changed it.
+ */
+static B8 compile(Job *job, const Settings *settings) {
+	const char *source_filepath       = job->source_filepath;
+	const char *header_filepath       = job->header_filepath;
+	const char *implementation_define = job->implementation_define;
+	const char *output_filepath       = job->output_filepath;
+	const char *bundle_dirpath        = settings->bundle_dirpath;
+
+	Usize source_length;
+	Usize header_length;
+	const char *source = lepk_file_map(source_filepath, &source_length, NULL);
+	const char *header = lepk_file_map(header_filepath, &header_length, NULL);
+	if (source == NULL || header == NULL) {
+		fprintf(stderr, "%s: unable to read %s\n", program, source == NULL ? source_filepath : header_filepath);
+		lepk_file_unmap(source, source_length);
+		lepk_file_unmap(header, header_length);
+		return false;
+	}
+	Directive *header_directives = scan(header, header_length);
+
+	/* The library itself is never inlined into its own bundle. */
+	Dependency *dependencies = lepk_da_create(sizeof(Dependency));
+	B8 ok = true;
+	if (bundle_dirpath != NULL) {
+		char **visited = lepk_da_create(sizeof(char *));
+		const char *header_name = strrchr(header_filepath, '/');
+		const char *output_name = strrchr(output_filepath, '/');
+		header_name = header_name != NULL ? header_name + 1 : header_filepath;
+		output_name = output_name != NULL ? output_name + 1 : output_filepath;
+		visit(&visited, header_name, strlen(header_name));
+		visit(&visited, output_name, strlen(output_name));
+		Usize guard_length;
+		const char *guard = include_guard(header, header_directives, &guard_length);
+		if (guard != NULL) {
+			visit(&visited, guard, guard_length);
+		}
+
+		ok = collect_dependencies(&dependencies, &visited, header, header_length, bundle_dirpath) &&
+		     collect_dependencies(&dependencies, &visited, source, source_length, bundle_dirpath);
+		for (Usize i = 0; i < lepk_da_count(visited); i++) {
+			free(visited[i]);
+		}
+		lepk_da_destroy(visited);
+
+		/* Remember what was inlined so watching knows which changes affect this job. */
+		for (Usize i = 0; i < lepk_da_count(job->dependency_filepaths); i++) {
+			free(job->dependency_filepaths[i]);
+		}
+		lepk_da_destroy(job->dependency_filepaths);
+		job->dependency_filepaths = lepk_da_create(sizeof(char *));
+		for (Usize i = 0; i < lepk_da_count(dependencies); i++) {
+			char *filepath = string_copy(dependencies[i].filepath, strlen(dependencies[i].filepath));
+			lepk_da_push(job->dependency_filepaths, filepath);
+		}
+	}
+
+	if (ok && settings->depfile) {
+		ok = write_depfile(job, dependencies, settings->split);
+	}
 
 	/*
 	 * Check if "#pragma once" is present.
-	 * Find last "#endif".
+	 * Otherwise find the "#endif" closing the include guard.
 	 */
 	B8 is_pragma = false;
-	U32 last_endif = 0;
-	for (U32 i = 0; header[i] != '\0'; i++) {
-		if (header[i] == '#') {
-			if (strncmp(header + i, "#endif", 6) == 0) {
-				last_endif = i;
-				i += 6;
-			} else if (strncmp(header + i, "#pragma once", 12) == 0) {
-				is_pragma = true;
-				break;
-			}
+	B8 has_guard = false;
+	Usize last_endif = 0;
+	for (Usize i = 0; i < lepk_da_count(header_directives); i++) {
+		if (header_directives[i].kind == DIRECTIVE_PRAGMA_ONCE) {
+			is_pragma = true;
+			break;
+		}
+		if (header_directives[i].kind == DIRECTIVE_ENDIF && header_directives[i].depth == 0) {
+			has_guard = true;
+			last_endif = header_directives[i].start;
 		}
 	}
 
-
 	/* Find the first "#include" which should be the header. */
-	I32 first_header = -1;
-	U32 first_header_end = 0;
-	for (U32 i = 0; source[i] != '\0'; i++) {
-		if (strncmp(source + i, "#include", 8) == 0 && first_header == -1) {
-			first_header = i;
-			for (; source[i] != '\n'; i++);
-			for (; source[i] == '\n'; i++);
-			first_header_end = i;
+	Directive *source_directives = scan(source, source_length);
+	B8 has_include = false;
+	Usize first_header = 0;
+	Usize first_header_end = 0;
+	for (Usize i = 0; i < lepk_da_count(source_directives); i++) {
+		if (source_directives[i].kind == DIRECTIVE_INCLUDE) {
+			has_include = true;
+			first_header = source_directives[i].start;
+			first_header_end = source_directives[i].end;
+			for (; first_header_end < source_length && source[first_header_end] == '\n'; first_header_end++);
 			break;
 		}
 	}
+	lepk_da_destroy(source_directives);
 
-	/* Create final file. */
-	if (is_pragma) {
-		lepk_file_write(output_filepath, header, strlen(header), LEPK_FILE_MODE_BINARY);
+	if (ok && !has_include) {
+		fprintf(stderr, "%s: %s has no #include of its header\n", program, source_filepath);
+		ok = false;
+	} else if (ok && !is_pragma && !has_guard) {
+		fprintf(stderr, "%s: %s has neither #pragma once nor an include guard\n", program, header_filepath);
+		ok = false;
+	}
 
-		write_impl(output_filepath, source, implementation_define, first_header, first_header_end);
-	} else {
-		lepk_file_write(output_filepath, header, last_endif, LEPK_FILE_MODE_BINARY);
+	U64 hash = hash_inputs(source, source_length, header, header_length, implementation_define, dependencies, settings);
+	B8 skip = false;
+	if (ok && settings->incremental && hash == job->hash) {
+		LepkFileStatus status;
+		I64 mtime = lepk_file_mtime(output_filepath, &status);
+		skip = status == LEPK_FILE_STATUS_OK && mtime == job->mtime;
+	}
+
+	/* Regenerate split outputs which went missing or were changed by hand. */
+	if (skip && settings->split) {
+		skip = check_split(job, settings, false);
+	}
 
-		write_impl(output_filepath, source, implementation_define, first_header, first_header_end);
+	if (ok && !skip) {
+		/* The outputs are lists of slices of the inputs, dependencies are inlined right after the include guard. */
+		Usize top = bundle_dirpath != NULL ? bundle_offset(header_directives) : 0;
+		Usize header_split = is_pragma ? header_length : last_endif;
+		LepkFileSlice *declarations = lepk_da_create(sizeof(LepkFileSlice));
+		output_push_text(&declarations, header, top, bundle_dirpath);
+		for (Usize i = 0; i < lepk_da_count(dependencies); i++) {
+			output_push_text(&declarations, dependencies[i].text, dependencies[i].length, bundle_dirpath);
+		}
+		output_push_text(&declarations, header + top, header_split - top, bundle_dirpath);
+		Usize declarations_split = lepk_da_count(declarations);
+		output_push_text(&declarations, header + header_split, header_length - header_split, bundle_dirpath);
+
+		LepkFileSlice *implementation = lepk_da_create(sizeof(LepkFileSlice));
+		write_impl(&implementation, source, source_length, first_header, first_header_end, bundle_dirpath);
+
+		LepkFileSlice *output = lepk_da_create(sizeof(LepkFileSlice));
+		lepk_da_push_array(output, declarations, declarations_split);
+		write_impl_begin(&output, implementation_define);
+		lepk_da_push_array(output, implementation, lepk_da_count(implementation));
+		write_impl_end(&output, implementation_define);
+		lepk_da_push_array(output, declarations + declarations_split, lepk_da_count(declarations) - declarations_split);
+		ok = publish(output_filepath, output, lepk_da_count(output), settings);
 
-		lepk_file_append(output_filepath, header + last_endif, strlen(header + last_endif), LEPK_FILE_MODE_BINARY);
+		if (ok && settings->split) {
+			char *declaration_filepath = split_filepath(output_filepath, ".decl.h");
+			char *implementation_filepath = split_filepath(output_filepath, ".c");
+			char *prelude = split_prelude(implementation_define, declaration_filepath);
+			LepkFileSlice slice = {prelude, lepk_da_count(prelude)};
+			lepk_da_insert(implementation, slice, 0);
+
+			ok = publish(declaration_filepath, declarations, lepk_da_count(declarations), settings) &&
+			     publish(implementation_filepath, implementation, lepk_da_count(implementation), settings) &&
+			     check_split(job, settings, true);
+
+			lepk_da_destroy(prelude);
+			free(declaration_filepath);
+			free(implementation_filepath);
+		}
+
+		lepk_da_destroy(output);
+		lepk_da_destroy(implementation);
+		lepk_da_destroy(declarations);
 	}
 
-	free(source);
-	free(header);
+	if (ok) {
+		job->hash = hash;
+		job->mtime = skip ? job->mtime : lepk_file_mtime(output_filepath, NULL);
+		job->compiled = true;
+	}
 
-	return 0;
+	lepk_da_destroy(header_directives);
+	dependencies_destroy(dependencies);
+	lepk_file_unmap(source, source_length);
+	lepk_file_unmap(header, header_length);
+	return ok;
+}
+
+static void *worker(void *arg) {
+	Queue *queue = arg;
+	for (;;) {
+		pthread_mutex_lock(&queue->mutex);
+		Usize index = queue->next++;
+		pthread_mutex_unlock(&queue->mutex);
+		if (index >= lepk_da_count(queue->jobs)) {
+			break;
+		}
+		if (!queue->jobs[index].dirty) {
+			continue;
+		}
+
+		queue->jobs[index].dirty = false;
+		if (!compile(&queue->jobs[index], queue->settings)) {
+			pthread_mutex_lock(&queue->mutex);
+			queue->failed = true;
+			pthread_mutex_unlock(&queue->mutex);
+		}
+	}
+	return NULL;
+}
+
+/* Compile every job on job_count threads, the calling thread is one of them. */
+static B8 run_jobs(Job *jobs, U32 job_count, const Settings *settings) {
+	Queue queue = {0};
+	queue.jobs = jobs;
+	queue.settings = settings;
+	pthread_mutex_init(&queue.mutex, NULL);
+
+	if (job_count > lepk_da_count(jobs)) {
+		job_count = lepk_da_count(jobs);
+	}
+	pthread_t *threads = job_count > 1 ? malloc((job_count - 1) * sizeof(pthread_t)) : NULL;
+	U32 thread_count = 0;
+	for (; threads != NULL && thread_count < job_count - 1; thread_count++) {
+		if (pthread_create(&threads[thread_count], NULL, worker, &queue) != 0) {
+			break;
+		}
+	}
+	worker(&queue);
+	for (U32 i = 0; i < thread_count; i++) {
+		pthread_join(threads[i], NULL);
+	}
+	free(threads);
+
+	pthread_mutex_destroy(&queue.mutex);
+	return !queue.failed;
+}
+
+/* Path a directory watch reports for filepath, the directory of filepath joined with its name. */
+static char *watched_path(const char *filepath) {
+	const char *slash = strrchr(filepath, '/');
+	return slash != NULL ? string_copy(filepath, strlen(filepath)) : path_join(".", filepath, strlen(filepath));
+}
+
+/* Start watching the directory of filepath unless it is watched already. */
+static void watch_directory(LepkFileWatch *watch, char ***watched, const char *filepath) {
+	const char *slash = strrchr(filepath, '/');
+	const char *dirpath = slash != NULL ? filepath : ".";
+	Usize length = slash != NULL ? (Usize) (slash - filepath) : 1;
+	if (!visit(watched, dirpath, length)) {
+		return;
+	}
+	char *directory = (*watched)[lepk_da_count(*watched) - 1];
+	if (lepk_file_watch_add(watch, directory) != LEPK_FILE_STATUS_OK) {
+		fprintf(stderr, "%s: unable to watch %s\n", program, directory);
+	}
+}
+
+/* Mark every job with an input at path dirty, NULL path marks every job. Returns amount marked. */
+static Usize mark_dirty(Job *jobs, const char *path) {
+	Usize marked = 0;
+	for (Usize i = 0; i < lepk_da_count(jobs); i++) {
+		B8 affected = path == NULL;
+		const char *inputs[2] = {jobs[i].source_filepath, jobs[i].header_filepath};
+		for (Usize j = 0; !affected && j < 2 + lepk_da_count(jobs[i].dependency_filepaths); j++) {
+			char *input = watched_path(j < 2 ? inputs[j] : jobs[i].dependency_filepaths[j - 2]);
+			affected = strcmp(input, path) == 0;
+			free(input);
+		}
+		if (affected && !jobs[i].dirty) {
+			jobs[i].dirty = true;
+			marked++;
+		}
+	}
+	return marked;
+}
+
+static F64 seconds(void) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/* Milliseconds without changes before a burst of changes is compiled. */
+#define WATCH_DEBOUNCE_MS 20
+
+/* Recompile jobs whose inputs change, forever. False return value means watching could not start. */
+static B8 watch_jobs(Job *jobs, U32 job_count, const Settings *settings, const char *cache_filepath) {
+	LepkFileWatch *watch = lepk_file_watch_create(NULL);
+	if (watch == NULL) {
+		fprintf(stderr, "%s: unable to watch files\n", program);
+		return false;
+	}
+	char **watched = lepk_da_create(sizeof(char *));
+	LepkFileChangeRecord records[64];
+	struct pollfd fd = {lepk_file_watch_fd(watch), POLLIN, 0};
+
+	for (;;) {
+		/* Dependencies may change with every compile. */
+		for (Usize i = 0; i < lepk_da_count(jobs); i++) {
+			watch_directory(watch, &watched, jobs[i].source_filepath);
+			watch_directory(watch, &watched, jobs[i].header_filepath);
+			for (Usize j = 0; j < lepk_da_count(jobs[i].dependency_filepaths); j++) {
+				watch_directory(watch, &watched, jobs[i].dependency_filepaths[j]);
+			}
+		}
+
+		/* Wait for a change, then until changes stop coming. */
+		Usize marked = 0;
+		I32 timeout = -1;
+		while (poll(&fd, 1, timeout) > 0) {
+			Usize count;
+			while ((count = lepk_file_watch_drain(watch, records, sizeof(records) / sizeof(records[0]))) > 0) {
+				for (Usize i = 0; i < count; i++) {
+					marked += mark_dirty(jobs, records[i].changes & LEPK_FILE_CHANGE_OVERFLOW ? NULL : records[i].path);
+				}
+			}
+			timeout = marked > 0 ? WATCH_DEBOUNCE_MS : -1;
+		}
+		if (marked == 0) {
+			continue;
+		}
+
+		F64 start = seconds();
+		B8 ok = run_jobs(jobs, job_count, settings);
+		printf("%s: compiled %lu %s in %.3f ms%s\n", program, marked, marked == 1 ? "library" : "libraries", (seconds() - start) * 1e3, ok ? "" : ", some failed");
+		fflush(stdout);
+		if (cache_filepath != NULL) {
+			cache_write(jobs, cache_filepath);
+		}
+	}
+
+	/* Not reached, watching ends when lepkc is interrupted. */
+	for (Usize i = 0; i < lepk_da_count(watched); i++) {
+		free(watched[i]);
+	}
+	lepk_da_destroy(watched);
+	lepk_file_watch_destroy(watch);
+	return true;
+}
+
+I32 main(I32 argc, char **argv) {
+	program = argv[0];
+
+	U32 job_count = 1;
+	const char *cache_filepath = NULL;
+	Settings settings = {0};
+	I32 arg = 1;
+	while (arg + 1 < argc) {
+		B8 *flag = NULL;
+		if (strcmp(argv[arg], "-MD") == 0) {
+			flag = &settings.depfile;
+		} else if (strcmp(argv[arg], "--watch") == 0) {
+			flag = &settings.watch;
+		} else if (strcmp(argv[arg], "--strip") == 0) {
+			flag = &settings.strip;
+		} else if (strcmp(argv[arg], "--keep-license") == 0) {
+			flag = &settings.keep_license;
+		} else if (strcmp(argv[arg], "--split") == 0) {
+			flag = &settings.split;
+		}
+		if (flag != NULL) {
+			*flag = true;
+			arg++;
+			continue;
+		}
+		if (strcmp(argv[arg], "-j") == 0) {
+			char *end;
+			long count = strtol(argv[arg + 1], &end, 10);
+			if (*end != '\0' || count < 1) {
+				usage();
+			}
+			job_count = count;
+		} else if (strcmp(argv[arg], "-c") == 0) {
+			cache_filepath = argv[arg + 1];
+		} else if (strcmp(argv[arg], "-b") == 0) {
+			settings.bundle_dirpath = argv[arg + 1];
+		} else {
+			break;
+		}
+		arg += 2;
+	}
+
+	Job *jobs = lepk_da_create(sizeof(Job));
+	B8 ok = true;
+	if (argc - arg == 4 && argv[arg][0] != '-') {
+		job_push(&jobs, argv[arg], argv[arg + 1], argv[arg + 2], argv[arg + 3]);
+	} else if (argc - arg == 2 && strcmp(argv[arg], "-m") == 0) {
+		ok = jobs_from_manifest(&jobs, argv[arg + 1]);
+	} else if (argc - arg == 4 && strcmp(argv[arg], "-d") == 0) {
+		ok = jobs_from_dirs(&jobs, argv[arg + 1], argv[arg + 2], argv[arg + 3]);
+	} else {
+		lepk_da_destroy(jobs);
+		usage();
+		return 1;
+	}
+
+	/* Nothing is written when the manifest is broken. */
+	if (ok) {
+		if (cache_filepath != NULL) {
+			cache_read(jobs, cache_filepath);
+		}
+		settings.incremental = cache_filepath != NULL || settings.watch;
+		ok = run_jobs(jobs, job_count, &settings);
+		if (cache_filepath != NULL) {
+			cache_write(jobs, cache_filepath);
+		}
+		if (settings.watch) {
+			ok = watch_jobs(jobs, job_count, &settings, cache_filepath);
+		}
+	}
+
+	jobs_destroy(jobs);
+	return ok ? 0 : 1;
 }
@@ -0,0 +1,152 @@
+/* Version: 1.0 */
+
+/*
+ * MIT License
+ * 
+ * Copyright (c) 2022 Linus Erik Pontus Kåreblom
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Checksums and hashes.
+ *
+ * Add:
+ *     #define LEPK_CHECKSUM_IMPLEMENTATION
+ * in one C or C++ file, before #include "lepk_checksum.h", to create the implementation.
+ *
+ * If LEPK_CHECKSUM_STATIC is defined the implementation will be local to a single file only.
+ */
+
+/*
+ * === Documentation ===
+ * lepk_crc32c computes the Castagnoli CRC used by iSCSI, ext4 and most storage formats. On x86-64 CPUs with SSE4.2 it
+ * uses the crc32 instruction on three interleaved streams, elsewhere a slicing-by-8 table.
+ * lepk_hash64 is XXH64, a fast non-cryptographic 64-bit hash for hash tables and content addressing.
+ * Both can be fed data piece by piece, so they can be computed while data streams through a buffer.
+ *
+ * Usage:
+ * unsigned int crc = lepk_crc32c(0, header, header_length);
+ * crc = lepk_crc32c(crc, body, body_length);
+ *
+ * LepkHash64 state;
+ * lepk_hash64_init(&state, 0);
+ * lepk_hash64_update(&state, data, length);
+ * unsigned long long hash = lepk_hash64_final(&state);
+ */
+
+#ifndef LEPK_CHECKSUM_H
+#define LEPK_CHECKSUM_H
+
+#ifdef LEPK_CHECKSUM_STATIC
+#define LEPKCHECKSUM static
+#define LEPKCHECKSUMIMPL static
+#else /* LEPK_CHECKSUM_STATIC */
+#define LEPKCHECKSUM extern
+#define LEPKCHECKSUMIMPL
+#endif /* LEPK_CHECKSUM_STATIC */
+
+/* State of a streaming lepk_hash64. */
+typedef struct {
+	unsigned long long lanes[4];
+	unsigned long long seed;
+	unsigned long long total;
+	/* Input not yet making up a full 32 byte stripe. */
+	unsigned char buffer[32];
+	unsigned int buffered;
+} LepkHash64;
+
+/* Continue crc, 0 for the first piece, with length bytes of data. */
+LEPKCHECKSUM unsigned int lepk_crc32c(unsigned int crc, const void *data, unsigned long length);
+/* crc32c of two pieces put together, given the crc32c of each and the length of the second. */
+LEPKCHECKSUM unsigned int lepk_crc32c_combine(unsigned int crc1, unsigned int crc2, unsigned long length2);
+
+/* Hash length bytes of data in one go. */
+LEPKCHECKSUM unsigned long long lepk_hash64(const void *data, unsigned long length, unsigned long long seed);
+/* Start a streaming hash. */
+LEPKCHECKSUM void lepk_hash64_init(LepkHash64 *state, unsigned long long seed);
+/* Add length bytes of data to a streaming hash. */
+LEPKCHECKSUM void lepk_hash64_update(LepkHash64 *state, const void *data, unsigned long length);
+/* Hash of everything added so far, more data can still be added afterwards. */
+LEPKCHECKSUM unsigned long long lepk_hash64_final(const LepkHash64 *state);
+
+#ifdef LEPK_CHECKSUM_TEST
+
+#include <assert.h>
+#include <stdlib.h>
+
+/* Bit at a time reference. */
+static unsigned int lepk__checksum_test_crc(const unsigned char *data, unsigned long length) {
+	unsigned int crc = 0xffffffffu;
+	for (unsigned long i = 0; i < length; i++) {
+		crc ^= data[i];
+		for (int j = 0; j < 8; j++) {
+			crc = crc & 1 ? (crc >> 1) ^ 0x82f63b78u : crc >> 1;
+		}
+	}
+	return ~crc;
+}
+
+static void lepk_checksum_test(void) {
+	assert(lepk_crc32c(0, "123456789", 9) == 0xe3069283u && "lepk_crc32c failed.");
+	assert(lepk_crc32c(0, "", 0) == 0 && "lepk_crc32c of nothing failed.");
+
+	/* Large enough for the interleaved path, odd offsets and lengths for the unaligned edges. */
+	unsigned long size = 100000;
+	unsigned char *data = malloc(size + 8);
+	assert(data != NULL && "malloc failed.");
+	unsigned int seed = 1;
+	for (unsigned long i = 0; i < size + 8; i++) {
+		seed = seed * 1103515245u + 12345u;
+		data[i] = seed >> 16;
+	}
+	unsigned long lengths[] = { 0, 1, 7, 8, 255, 256, 769, 4096, 24577, 99991 };
+	for (unsigned long i = 0; i < sizeof(lengths) / sizeof(lengths[0]); i++) {
+		for (unsigned long offset = 0; offset < 8; offset += 3) {
+			unsigned int expected = lepk__checksum_test_crc(data + offset, lengths[i]);
+			assert(lepk_crc32c(0, data + offset, lengths[i]) == expected && "lepk_crc32c of buffer failed.");
+
+			unsigned long half = lengths[i] / 3;
+			unsigned int first = lepk_crc32c(0, data + offset, half);
+			assert(lepk_crc32c(first, data + offset + half, lengths[i] - half) == expected && "lepk_crc32c streaming failed.");
+			unsigned int second = lepk_crc32c(0, data + offset + half, lengths[i] - half);
+			assert(lepk_crc32c_combine(first, second, lengths[i] - half) == expected && "lepk_crc32c_combine failed.");
+		}
+	}
+
+	assert(lepk_hash64("", 0, 0) == 0xef46db3751d8e999ull && "lepk_hash64 failed.");
+	assert(lepk_hash64("abc", 3, 0) == 0x44bc2cf5ad770999ull && "lepk_hash64 failed.");
+	unsigned char bytes[512];
+	for (int i = 0; i < 512; i++) {
+		bytes[i] = i;
+	}
+	assert(lepk_hash64(bytes, sizeof(bytes), 7) == 0x84fcd079c539a9daull && "lepk_hash64 with seed failed.");
+
+	LepkHash64 state;
+	unsigned long long expected = lepk_hash64(data, size, 42);
+	lepk_hash64_init(&state, 42);
+	for (unsigned long done = 0, step = 1; done < size; done += step, step = step * 2 + 1) {
+		lepk_hash64_update(&state, data + done, done + step < size ? step : size - done);
+	}
+	assert(lepk_hash64_final(&state) == expected && "lepk_hash64 streaming failed.");
+	free(data);
+}
+
+#endif /* LEPK_CHECKSUM_TEST */
+#endif /* LEPK_CHECKSUM_H */
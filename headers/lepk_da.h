@@ -1,4 +1,4 @@
-/* Version: 1.1 */
+/* Version: 1.3 */
 
 /*
  * MIT License
@@ -47,6 +47,11 @@
  *     printf("%d\n", da[i]);
  * }
  * lepk_da_destroy(da);
+ *
+ * Snapshots:
+ * lepk_da_snapshot writes the item size, count and raw bytes of a dynamic array to a file, lepk_da_load reads it back
+ * with a single allocation and read, so loading costs as much as reading the file no matter how many items it holds.
+ * Items are copied byte for byte, so arrays holding pointers can not be snapshotted.
  */
 
 #ifndef LEPK_DA_H
@@ -60,6 +65,8 @@
 #define LEPKDAIMPL
 #endif /* LEPK_DA_STATIC */
 
+#include <stdbool.h>
+
 /*
  * Data needed for dynamic array operations.
  * Stored before dynamic array returned to user.
@@ -80,6 +87,10 @@ LEPKDA void *lepk_da_create(unsigned long size);
 LEPKDA void lepk_da_destroy(void *da);
 /* Get current amount of items stored in dynamic array. */
 LEPKDA unsigned long lepk_da_count(void *da);
+/* Write dynamic array to file at filepath, replacing it atomically so a crash leaves the old or the new file. Returns false if the file could not be written. */
+LEPKDA bool lepk_da_snapshot(void *da, const char *filepath);
+/* Read dynamic array written by lepk_da_snapshot. NULL return value means function failed. */
+LEPKDA void *lepk_da_load(const char *filepath);
 /* Insert data into dynamic array at index, preserving insertion order. */
 LEPKDA void lepk__da_insert(void **da, const void *data, unsigned int index);
 /* Remove item from dynamic array at index, preserving insertion order. */
@@ -163,6 +174,30 @@ static void lepk_da_test(void) {
 	}
 
 	assert(lepk_da_count(da) == 6 && "lepk_da_count failed.");
+	{
+		int arr[300];
+		for (int i = 0; i < 300; i++) {
+			arr[i] = i;
+		}
+		lepk_da_push_array(da, arr, 300);
+		assert(lepk_da_count(da) == 306 && memcmp(da + 6, arr, 300 * sizeof(int)) == 0 && "lepk_da_push_array with large array failed.");
+	}
+	{
+		assert(lepk_da_snapshot(da, "da_test.snapshot") && "lepk_da_snapshot failed.");
+		int *loaded = lepk_da_load("da_test.snapshot");
+		assert(loaded != NULL && lepk_da_count(loaded) == 306 && memcmp(loaded, da, 306 * sizeof(int)) == 0 && "lepk_da_load failed.");
+		lepk_da_push(loaded, 7);
+		assert(lepk_da_count(loaded) == 307 && loaded[306] == 7 && "lepk_da_push after lepk_da_load failed.");
+		lepk_da_destroy(loaded);
+
+		/* A count larger than the file holds is rejected before anything is allocated. */
+		FILE *file = fopen("da_test.snapshot", "r+b");
+		unsigned long long count = ~0ull;
+		assert(file != NULL && fseek(file, 16, SEEK_SET) == 0 && fwrite(&count, sizeof(count), 1, file) == 1 && fclose(file) == 0 &&
+			"Corrupting snapshot failed.");
+		assert(lepk_da_load("da_test.snapshot") == NULL && "lepk_da_load accepted a corrupt count.");
+		remove("da_test.snapshot");
+	}
 	lepk_da_destroy(da);
 }
 
@@ -1,4 +1,4 @@
-/* Version: 1.0 */
+/* Version: 1.6 */
 
 /*
  * MIT License
@@ -32,6 +32,12 @@
  * in one C or C++ file, before #include "lepk_file.h", to create the implementation.
  *
  * If LEPK_FILE_STATIC is defined the implementation will be local to a single file only.
+ *
+ * Reading, writing, appending, creating, removing, exists and size only need standard C.
+ * Every other function needs POSIX.1-2008 (_POSIX_C_SOURCE >= 200809L) and lepk_da.h with its implementation
+ * included before this one, they are left out of the implementation otherwise.
+ * With _GNU_SOURCE on Linux statx, getdents64, copy_file_range, reflinks and inotify are used as well,
+ * watching files only works there and needs lepk_ht.h with its implementation included before this one.
  */
 
 #ifndef LEPK_FILE_H
@@ -65,20 +71,191 @@ typedef enum {
 	LEPK_FILE_STATUS_OUT_OF_MEMORY,
 	/* Deleting file failed. */
 	LEPK_FILE_STATUS_REMOVE_FAILED,
+	/* File does not exist or its metadata could not be read. */
+	LEPK_FILE_STATUS_STAT_FAILED,
+	/* Copying data between files failed. */
+	LEPK_FILE_STATUS_COPY_FAILED,
+	/* Not all content could be written. */
+	LEPK_FILE_STATUS_WRITE_FAILED,
+	/* Flushing data to disk failed, what is on disk is unknown. */
+	LEPK_FILE_STATUS_SYNC_FAILED,
+	/* Replacing the target file failed. */
+	LEPK_FILE_STATUS_RENAME_FAILED,
+	/* Source and destination are the same file. */
+	LEPK_FILE_STATUS_SAME_FILE,
 } LepkFileStatus;
 
+/* How much of an atomic write survives a crash. */
+typedef enum {
+	/* Readers never see a torn file, a crash may still lose the write or leave an empty file. */
+	LEPK_FILE_DURABILITY_NONE,
+	/* Data is flushed before it replaces the target, after a crash the file is either old or new and complete. */
+	LEPK_FILE_DURABILITY_DATA,
+	/* Data and the rename are flushed, the write survives a crash once the function returns. */
+	LEPK_FILE_DURABILITY_FULL,
+} LepkFileDurability;
+
+/*
+ * Writers sharing flushes. Concurrent writers hand their files to one of them, which flushes the whole batch while the others wait
+ * instead of every writer flushing on its own.
+ * A failed flush is only reported to the writer whose file it was.
+ */
+typedef struct LepkFileCommitGroup LepkFileCommitGroup;
+
+/* Piece of the content of a file, written back to back with the other pieces. */
+typedef struct {
+	const void *data;
+	unsigned long length;
+} LepkFileSlice;
+
+/* File metadata. */
+typedef struct {
+	/* False if the file does not exist, every other field is zero then. */
+	bool exists;
+	/* True if the file is a directory. */
+	bool is_dir;
+	/* Size in bytes. */
+	unsigned long size;
+	/* Last modification time in nanoseconds since the Unix epoch. */
+	long long mtime;
+} LepkFileStat;
+
+/* Type of a directory entry. */
+typedef enum {
+	LEPK_FILE_TYPE_UNKNOWN,
+	LEPK_FILE_TYPE_REGULAR,
+	LEPK_FILE_TYPE_DIRECTORY,
+	LEPK_FILE_TYPE_SYMLINK,
+	/* Devices, sockets and pipes. */
+	LEPK_FILE_TYPE_OTHER,
+} LepkFileType;
+
+/* Directory iterator. */
+typedef struct LepkFileDir LepkFileDir;
+
+/* View of a path, the string is null terminated and owned by the walk it came from. */
+typedef struct {
+	const char *path;
+	unsigned long length;
+	LepkFileType type;
+} LepkFilePath;
+
+/* What a walk should report. */
+typedef struct {
+	/* Glob matched against file names (not directories), NULL matches everything. */
+	const char *pattern;
+	/* Suffix file names must end with, NULL matches everything. */
+	const char *suffix;
+	/* Descend into subdirectories. */
+	bool recursive;
+	/* Report directories as well as files. */
+	bool directories;
+	/* Amount of threads walking subtrees, 0 or 1 walks on the calling thread. */
+	unsigned int threads;
+} LepkFileWalkOptions;
+
+/* What happened to a watched path, combined as a bitmask. */
+typedef enum {
+	LEPK_FILE_CHANGE_MODIFIED = 1 << 0,
+	LEPK_FILE_CHANGE_CREATED  = 1 << 1,
+	LEPK_FILE_CHANGE_REMOVED  = 1 << 2,
+	/* Permissions, owner or timestamps changed. */
+	LEPK_FILE_CHANGE_ATTRIB   = 1 << 3,
+	/* The kernel dropped events, everything watched should be considered changed. Path is empty. */
+	LEPK_FILE_CHANGE_OVERFLOW = 1 << 4,
+} LepkFileChange;
+
+/* Every change to one path since the last drain. */
+typedef struct {
+	/* Watched path, joined with the entry name for changes inside a watched directory. Valid until the next drain. */
+	const char *path;
+	/* Bitmask of LepkFileChange. */
+	unsigned int changes;
+} LepkFileChangeRecord;
+
+/* Set of watched files and directories. */
+typedef struct LepkFileWatch LepkFileWatch;
+
+/* Result of a walk. */
+typedef struct {
+	/* Dynamic array of every path found, unordered when walking on multiple threads. */
+	LepkFilePath *paths;
+	/* Memory every path points into. */
+	struct Lepk__FileArena *arena;
+} LepkFileWalk;
+
 /* Read file and return its contents. NULL return value means function failed, read status for more specific error. */
 LEPKFILE char *lepk_file_read(const char *filepath, LepkFileStatus *status);
+/*
+ * Map file at filepath read-only into memory without copying it, length is set to its size in bytes.
+ * Content is not null terminated. NULL return value means function failed, read status for more specific error.
+ */
+LEPKFILE const char *lepk_file_map(const char *filepath, unsigned long *length, LepkFileStatus *status);
+/* Unmap content returned by lepk_file_map. */
+LEPKFILE void lepk_file_unmap(const char *data, unsigned long length);
 /* Write content to file at filepath. */
 LEPKFILE LepkFileStatus lepk_file_write(const char *filepath, const char *content, unsigned long length, LepkFileMode mode);
+/*
+ * Replace file at filepath with content without ever exposing a partially written file.
+ * Content goes to a temporary file next to the target which is renamed over it, flushed according to durability.
+ * Group may be NULL, otherwise flushes are shared with other writers of the group.
+ */
+LEPKFILE LepkFileStatus lepk_file_write_atomic(const char *filepath, const char *content, unsigned long length, LepkFileDurability durability, LepkFileCommitGroup *group);
+/* Same as lepk_file_write_atomic with the content gathered from count slices by vectored writes. */
+LEPKFILE LepkFileStatus lepk_file_write_atomic_slices(const char *filepath, const LepkFileSlice *slices, unsigned long count, LepkFileDurability durability, LepkFileCommitGroup *group);
+/* Create a commit group. NULL return value means out of memory. */
+LEPKFILE LepkFileCommitGroup *lepk_file_commit_group_create(void);
+/* Destroy a commit group, no writer may be using it. */
+LEPKFILE void lepk_file_commit_group_destroy(LepkFileCommitGroup *group);
 /* Append conntent to file at filepath. */
 LEPKFILE LepkFileStatus lepk_file_append(const char *filepath, const char *content, unsigned long length, LepkFileMode mode);
 /* Create file at filepath. */
 LEPKFILE LepkFileStatus lepk_file_create(const char *filepath);
 /* Remove file at filepath. */
 LEPKFILE LepkFileStatus lepk_file_remove(const char *filepath);
-/* Check if file exists at filepath. */
+/* Check if file exists at filepath. Never opens the file. */
 LEPKFILE bool lepk_file_exists(const char *filepath);
+/* Size in bytes of file at filepath. Returns 0 on failure, read status for more specific error. */
+LEPKFILE unsigned long lepk_file_size(const char *filepath, LepkFileStatus *status);
+/* Last modification time of file at filepath in nanoseconds since the Unix epoch. Returns 0 on failure. */
+LEPKFILE long long lepk_file_mtime(const char *filepath, LepkFileStatus *status);
+/*
+ * Read metadata of count files at once without opening any of them.
+ * Relative filepaths are resolved against dirpath, NULL means the current directory.
+ * Files that do not exist are reported through output[i].exists.
+ */
+LEPKFILE LepkFileStatus lepk_file_stat_many(const char *dirpath, const char *const *filepaths, unsigned long count, LepkFileStat *output);
+/*
+ * Copy file, data is shared (reflinked) or copied inside the kernel when the filesystem supports it.
+ * Returns LEPK_FILE_STATUS_SAME_FILE and leaves both untouched if dst_filepath is src_filepath or a link to it.
+ */
+LEPKFILE LepkFileStatus lepk_file_copy(const char *src_filepath, const char *dst_filepath);
+/*
+ * Copy length bytes of src_filepath at src_offset into dst_filepath at dst_offset, data never passes through user space where possible.
+ * Destination is created if missing and never truncated. Copying stops early at the end of the source.
+ */
+LEPKFILE LepkFileStatus lepk_file_copy_range(const char *src_filepath, unsigned long src_offset, const char *dst_filepath, unsigned long dst_offset, unsigned long length);
+/* Create a watch, backed by inotify on Linux. NULL return value means function failed. */
+LEPKFILE LepkFileWatch *lepk_file_watch_create(LepkFileStatus *status);
+/* Start watching file or directory at path, directories report changes of their direct entries. */
+LEPKFILE LepkFileStatus lepk_file_watch_add(LepkFileWatch *watch, const char *path);
+/* Descriptor which becomes readable when changes are pending, for poll/select/epoll. */
+LEPKFILE int lepk_file_watch_fd(const LepkFileWatch *watch);
+/* Copy up to max pending change records to records without blocking, changes of one path are coalesced. Returns amount copied. */
+LEPKFILE unsigned long lepk_file_watch_drain(LepkFileWatch *watch, LepkFileChangeRecord *records, unsigned long max);
+/* Stop watching everything and free watch. */
+LEPKFILE void lepk_file_watch_destroy(LepkFileWatch *watch);
+
+/* Open directory at dirpath for iteration. NULL return value means function failed. */
+LEPKFILE LepkFileDir *lepk_file_dir_open(const char *dirpath, LepkFileStatus *status);
+/* Get next entry of directory, "." and ".." are skipped. Name is valid until the next call. Returns false when done. */
+LEPKFILE bool lepk_file_dir_next(LepkFileDir *dir, const char **name, LepkFileType *type);
+/* Close directory. */
+LEPKFILE void lepk_file_dir_close(LepkFileDir *dir);
+/* Walk directory at dirpath and collect every matching path, paths are prefixed with dirpath. Options may be NULL. */
+LEPKFILE LepkFileStatus lepk_file_walk(const char *dirpath, const LepkFileWalkOptions *options, LepkFileWalk *output);
+/* Free paths and memory of a walk. */
+LEPKFILE void lepk_file_walk_destroy(LepkFileWalk *walk);
 
 #ifdef LEPK_FILE_TEST
 
@@ -100,8 +277,134 @@ static void lepk_file_test(void) {
 	status = lepk_file_append("file_test.txt", "World Hello!", 12, LEPK_FILE_MODE_BINARY);
 	assert(status == LEPK_FILE_STATUS_OK && "lepk_file_append failed.");
 
+	assert(lepk_file_size("file_test.txt", &status) == 24 && status == LEPK_FILE_STATUS_OK && "lepk_file_size failed.");
+	assert(lepk_file_mtime("file_test.txt", &status) > 0 && status == LEPK_FILE_STATUS_OK && "lepk_file_mtime failed.");
+	lepk_file_size("file_test_missing.txt", &status);
+	assert(status == LEPK_FILE_STATUS_STAT_FAILED && "lepk_file_size on missing file failed.");
+
+	{
+		const char *filepaths[2] = { "file_test.txt", "file_test_missing.txt" };
+		LepkFileStat stats[2];
+		status = lepk_file_stat_many(NULL, filepaths, 2, stats);
+		assert(status == LEPK_FILE_STATUS_OK && "lepk_file_stat_many failed.");
+		assert(stats[0].exists && !stats[0].is_dir && stats[0].size == 24 && "lepk_file_stat_many failed.");
+		assert(!stats[1].exists && "lepk_file_stat_many on missing file failed.");
+	}
+
 	char *content = lepk_file_read("file_test.txt", &status);
 	assert(strcmp(content, "Hello World!World Hello!") == 0 && "lepk_file_read failed!");
+	free(content);
+
+	{
+		unsigned long length;
+		const char *mapped = lepk_file_map("file_test.txt", &length, &status);
+		assert(mapped != NULL && status == LEPK_FILE_STATUS_OK && length == 24 && memcmp(mapped, "Hello World!World Hello!", 24) == 0 && "lepk_file_map failed.");
+		lepk_file_unmap(mapped, length);
+		assert(lepk_file_map("file_test_missing.txt", &length, &status) == NULL && status == LEPK_FILE_STATUS_UNABLE_TO_OPEN_CREATE && "lepk_file_map on missing file failed.");
+	}
+
+	{
+		LepkFileCommitGroup *group = lepk_file_commit_group_create();
+		status = lepk_file_write_atomic("file_test_atomic.txt", "Hello", 5, LEPK_FILE_DURABILITY_NONE, NULL);
+		assert(status == LEPK_FILE_STATUS_OK && "lepk_file_write_atomic failed.");
+		status = lepk_file_write_atomic("file_test_atomic.txt", "Hello Atomic!", 13, LEPK_FILE_DURABILITY_FULL, group);
+		assert(status == LEPK_FILE_STATUS_OK && "lepk_file_write_atomic with commit group failed.");
+		content = lepk_file_read("file_test_atomic.txt", &status);
+		assert(strcmp(content, "Hello Atomic!") == 0 && "lepk_file_write_atomic failed.");
+		free(content);
+
+		LepkFileSlice slices[4] = {{"Hello", 5}, {"", 0}, {" ", 1}, {"Slices!", 7}};
+		status = lepk_file_write_atomic_slices("file_test_atomic.txt", slices, 4, LEPK_FILE_DURABILITY_NONE, NULL);
+		assert(status == LEPK_FILE_STATUS_OK && "lepk_file_write_atomic_slices failed.");
+		content = lepk_file_read("file_test_atomic.txt", &status);
+		assert(strcmp(content, "Hello Slices!") == 0 && "lepk_file_write_atomic_slices failed.");
+		free(content);
+		lepk_file_remove("file_test_atomic.txt");
+		lepk_file_commit_group_destroy(group);
+	}
+
+#if defined(__linux__) && defined(_GNU_SOURCE)
+	{
+		LepkFileWatch *watch = lepk_file_watch_create(&status);
+		assert(watch != NULL && status == LEPK_FILE_STATUS_OK && "lepk_file_watch_create failed.");
+		status = lepk_file_watch_add(watch, "file_test.txt");
+		assert(status == LEPK_FILE_STATUS_OK && "lepk_file_watch_add failed.");
+
+		lepk_file_append("file_test.txt", "", 0, LEPK_FILE_MODE_BINARY);
+		lepk_file_append("file_test.txt", "", 0, LEPK_FILE_MODE_BINARY);
+		LepkFileChangeRecord records[4];
+		unsigned long count = lepk_file_watch_drain(watch, records, 4);
+		assert(count == 1 && strcmp(records[0].path, "file_test.txt") == 0 && "lepk_file_watch_drain failed to coalesce.");
+		assert(lepk_file_watch_drain(watch, records, 4) == 0 && "lepk_file_watch_drain failed.");
+		lepk_file_watch_destroy(watch);
+
+		/* Records of a directory keep their order when drained in pieces. */
+		watch = lepk_file_watch_create(&status);
+		assert(watch != NULL && status == LEPK_FILE_STATUS_OK && "lepk_file_watch_create failed.");
+		status = lepk_file_watch_add(watch, ".");
+		assert(status == LEPK_FILE_STATUS_OK && "lepk_file_watch_add failed.");
+		const char *watched[] = {"file_watch_0.txt", "file_watch_1.txt", "file_watch_2.txt"};
+		for (int i = 0; i < 2; i++) {
+			for (int j = 0; j < 3; j++) {
+				lepk_file_append(watched[j], "x", 1, LEPK_FILE_MODE_BINARY);
+			}
+		}
+		assert(lepk_file_watch_drain(watch, records, 2) == 2 && "lepk_file_watch_drain failed.");
+		assert(strcmp(records[0].path, "./file_watch_0.txt") == 0 && strcmp(records[1].path, "./file_watch_1.txt") == 0 && "lepk_file_watch_drain failed to keep order.");
+		assert((records[0].changes & (LEPK_FILE_CHANGE_CREATED | LEPK_FILE_CHANGE_MODIFIED)) == (LEPK_FILE_CHANGE_CREATED | LEPK_FILE_CHANGE_MODIFIED) && "lepk_file_watch_drain failed to coalesce.");
+		assert(lepk_file_watch_drain(watch, records, 4) == 1 && strcmp(records[0].path, "./file_watch_2.txt") == 0 && "lepk_file_watch_drain failed.");
+		lepk_file_watch_destroy(watch);
+		for (int j = 0; j < 3; j++) {
+			lepk_file_remove(watched[j]);
+		}
+	}
+#endif /* __linux__ && _GNU_SOURCE */
+
+	status = lepk_file_copy("file_test.txt", "file_test_copy.txt");
+	assert(status == LEPK_FILE_STATUS_OK && "lepk_file_copy failed.");
+	content = lepk_file_read("file_test_copy.txt", &status);
+	assert(strcmp(content, "Hello World!World Hello!") == 0 && "lepk_file_copy failed.");
+	free(content);
+	status = lepk_file_copy("file_test.txt", "file_test.txt");
+	assert(status == LEPK_FILE_STATUS_SAME_FILE && lepk_file_size("file_test.txt", NULL) == 24 && "lepk_file_copy onto itself failed.");
+
+	status = lepk_file_copy_range("file_test.txt", 6, "file_test_copy.txt", 0, 5);
+	assert(status == LEPK_FILE_STATUS_OK && "lepk_file_copy_range failed.");
+	content = lepk_file_read("file_test_copy.txt", &status);
+	assert(strcmp(content, "World World!World Hello!") == 0 && "lepk_file_copy_range failed.");
+	free(content);
+	lepk_file_remove("file_test_copy.txt");
+
+	{
+		LepkFileWalkOptions options = {0};
+		options.suffix = ".txt";
+		options.recursive = true;
+		options.threads = 2;
+		LepkFileWalk walk;
+		status = lepk_file_walk(".", &options, &walk);
+		assert(status == LEPK_FILE_STATUS_OK && "lepk_file_walk failed.");
+
+		bool found = false;
+		for (unsigned long i = 0; i < lepk_da_count(walk.paths); i++) {
+			if (strcmp(walk.paths[i].path, "./file_test.txt") == 0) {
+				found = walk.paths[i].type == LEPK_FILE_TYPE_REGULAR && walk.paths[i].length == 15;
+			}
+		}
+		assert(found && "lepk_file_walk failed.");
+		lepk_file_walk_destroy(&walk);
+
+		/* The root keeps its only slash, children are joined without doubling it. */
+		options.suffix = NULL;
+		options.recursive = false;
+		options.directories = true;
+		status = lepk_file_walk("/", &options, &walk);
+		assert(status == LEPK_FILE_STATUS_OK && lepk_da_count(walk.paths) > 0 && "lepk_file_walk of root failed.");
+		for (unsigned long i = 0; i < lepk_da_count(walk.paths); i++) {
+			assert(walk.paths[i].path[0] == '/' && walk.paths[i].path[1] != '/' && walk.paths[i].length == strlen(walk.paths[i].path) &&
+				"lepk_file_walk of root failed.");
+		}
+		lepk_file_walk_destroy(&walk);
+	}
 
 	lepk_file_remove("file_test.txt");
 	exists = lepk_file_exists("file_test.txt");
@@ -1,4 +1,4 @@
-/* Version: 1.0 */
+/* Version: 1.2 */
 
 /*
  * MIT License
@@ -32,16 +32,17 @@
  * in one C or C++ file, before #include "lepk_ht.h", to create the implementation.
  *
  * If LEPK_HT_STATIS is defined the implementation will be local to a single file only.
- */
-
-/*
- * TODO: ACTUALLY MAKE THE THING WORK.
- * Currently, when getting an entry, if it collided and the object at the original collision point has been removed a dead entry is returned instead of the actual entry.
+ *
+ * The lepk_ht_image_* functions map files with POSIX.1-2008 calls, define _POSIX_C_SOURCE as 200809L (or _GNU_SOURCE) before
+ * including any system header when compiling with -std=c99. Without it, or with LEPK_HT_NO_IMAGE defined, they are left out
+ * and the rest of the hash table is plain C99.
  */
 
 #ifndef LEPK_HT_H
 #define LEPK_HT_H
 
+#include <stdbool.h>
+
 #ifndef LEPK_HT_STATIC
 #define LEPKHT extern
 #else /* LEPK_HT_STATIC */
@@ -65,16 +66,48 @@ LEPKHT unsigned long lepk_ht_count(const LepkHt *table);
 
 /* Set the pair in hash table. */
 LEPKHT void lepk__ht_set(LepkHt *table, const void *key, const void *data);
-/* Get pair from hash table. */
-LEPKHT void lepk__ht_get(LepkHt *table, const void *key, void *output);
-/* Remove pair from hash table. */
-LEPKHT void lepk__ht_remove(LepkHt *table, const void *key, void *output);
+/* Get pair from hash table. Returns false and leaves output untouched if key is missing. */
+LEPKHT bool lepk__ht_get(LepkHt *table, const void *key, void *output);
+/* Remove pair from hash table. Returns false if key is missing. */
+LEPKHT bool lepk__ht_remove(LepkHt *table, const void *key, void *output);
+/*
+ * Iterate over every pair, set *iterator to 0 before the first call. Key and data may be NULL.
+ * Returns false when there are no pairs left. Removing the returned pair while iterating is allowed.
+ */
+LEPKHT bool lepk_ht_next(const LepkHt *table, unsigned long *iterator, void *key, void *data);
+
 
-/* Pre-written hashing function for strings. */
+/*
+ * Write table to file at filepath as a flat image of its slots and stored hashes. Keys and data are copied byte for byte,
+ * so tables holding pointers, like string keys, can not be snapshotted. The file is replaced atomically, a crash leaves the old or the new image.
+ * Returns false if the file could not be written.
+ */
+LEPKHT bool lepk_ht_snapshot(const LepkHt *table, const char *filepath);
+/*
+ * Create a hash table from an image written by lepk_ht_snapshot. Pairs keep their slots and stay in the memory the image is read into,
+ * so nothing is rehashed or allocated per pair.
+ * Hash and compare must be the functions the image was written with. NULL return value means function failed.
+ */
+LEPKHT LepkHt *lepk_ht_load(const char *filepath, LepkHtHash hash, LepkHtCompare compare, unsigned long key_size, unsigned long data_size);
+#ifndef LEPK_HT_NO_IMAGE
+/* Read-only view of a hash table image, lookups read the mapped file directly. */
+typedef struct LepkHtImage LepkHtImage;
+
+/* Map an image read-only, opening costs the same no matter how many pairs it holds. NULL return value means function failed. */
+LEPKHT LepkHtImage *lepk_ht_image_open(const char *filepath, LepkHtHash hash, LepkHtCompare compare, unsigned long key_size, unsigned long data_size);
+/* Unmap an image. */
+LEPKHT void lepk_ht_image_close(LepkHtImage *image);
+/* Retrieve item count from image. */
+LEPKHT unsigned long lepk_ht_image_count(const LepkHtImage *image);
+/* Find data of key inside the mapped image. Returns NULL if key is missing. */
+LEPKHT const void *lepk_ht_image_find(const LepkHtImage *image, const void *key);
+#endif /* LEPK_HT_NO_IMAGE */
+
+/* Pre-written hashing function for strings, keys are const char *. */
 LEPKHT unsigned long lepk_ht_hash_string(const void *key, unsigned long size);
 /* Pre-written generic hashing function for any type of data structure. */
 LEPKHT unsigned long lepk_ht_hash_generic(const void *key, unsigned long size);
-/* Pre-written compare function for strings. */
+/* Pre-written compare function for strings, keys are const char *. */
 LEPKHT int lepk_ht_compare_string(const void *a, const void *b, unsigned long size);
 /* Pre-written generic compare function for any type of data structure. */
 LEPKHT int lepk_ht_compare_generic(const void *a, const void *b, unsigned long size);
@@ -85,13 +118,82 @@ LEPKHT int lepk_ht_compare_generic(const void *a, const void *b, unsigned long s
 
 #ifdef LEPK_HT_TEST
 
+#include <assert.h>
+#include <stdio.h>
+
 static void lepk_ht_test(void) {
 	LepkHt *table = lepk_ht_create(lepk_ht_hash_string, lepk_ht_compare_string, sizeof(const char *), sizeof(int));
-	lepk_ht_set(table, "key", 8);
+	const char *key = "key";
+	lepk_ht_set(table, key, 8);
 	int output = 0;
-	lepk_ht_get(table, "key", &output);
+	lepk_ht_get(table, key, &output);
 	assert(output == 8 && "lepk_ht failed.");
 	lepk_ht_destroy(table);
+
+	/* Removed pairs must not hide pairs that collided with them. */
+	table = lepk_ht_create(lepk_ht_hash_generic, lepk_ht_compare_generic, sizeof(int), sizeof(int));
+	for (int i = 0; i < 100; i++) {
+		lepk_ht_set(table, i, i * 2);
+	}
+	for (int i = 0; i < 100; i += 2) {
+		lepk_ht_remove(table, i, NULL);
+	}
+	lepk_ht_set(table, 1, 3);
+	assert(lepk_ht_count(table) == 50 && "lepk_ht_remove failed.");
+	for (int i = 0; i < 100; i++) {
+		int k = i;
+		bool found = lepk__ht_get(table, &k, &output);
+		assert(found == (i % 2 == 1) && (!found || output == (i == 1 ? 3 : i * 2)) && "lepk_ht_get after lepk_ht_remove failed.");
+	}
+
+	unsigned long iterator = 0;
+	int count = 0;
+	while (lepk_ht_next(table, &iterator, NULL, NULL)) {
+		count++;
+	}
+	assert(count == 50 && "lepk_ht_next failed.");
+
+	/* Images keep removed slots, so collisions stay reachable without rehashing. */
+	assert(lepk_ht_snapshot(table, "ht_test.image") && "lepk_ht_snapshot failed.");
+	lepk_ht_destroy(table);
+	table = lepk_ht_load("ht_test.image", lepk_ht_hash_generic, lepk_ht_compare_generic, sizeof(int), sizeof(int));
+	assert(table != NULL && lepk_ht_count(table) == 50 && "lepk_ht_load failed.");
+#ifndef LEPK_HT_NO_IMAGE
+	LepkHtImage *image = lepk_ht_image_open("ht_test.image", lepk_ht_hash_generic, lepk_ht_compare_generic, sizeof(int), sizeof(int));
+	assert(image != NULL && lepk_ht_image_count(image) == 50 && "lepk_ht_image_open failed.");
+#endif /* LEPK_HT_NO_IMAGE */
+	for (int i = 0; i < 100; i++) {
+		int k = i;
+		bool found = lepk__ht_get(table, &k, &output);
+		assert(found == (i % 2 == 1) && (!found || output == (i == 1 ? 3 : i * 2)) && "lepk_ht_get after lepk_ht_load failed.");
+#ifndef LEPK_HT_NO_IMAGE
+		const int *data = lepk_ht_image_find(image, &k);
+		assert((data != NULL) == found && (data == NULL || *data == output) && "lepk_ht_image_find failed.");
+#endif /* LEPK_HT_NO_IMAGE */
+	}
+	lepk_ht_set(table, 200, 400);
+	lepk_ht_get(table, 200, &output);
+	assert(output == 400 && lepk_ht_count(table) == 51 && "lepk_ht_set after lepk_ht_load failed.");
+	/* Pairs living in the loaded image survive growing the table. */
+	for (int i = 300; i < 400; i++) {
+		lepk_ht_set(table, i, i);
+	}
+	lepk_ht_remove(table, 1, NULL);
+	lepk_ht_get(table, 3, &output);
+	assert(output == 6 && lepk_ht_count(table) == 150 && "lepk_ht_set after lepk_ht_load failed to grow.");
+#ifndef LEPK_HT_NO_IMAGE
+	lepk_ht_image_close(image);
+#endif /* LEPK_HT_NO_IMAGE */
+	lepk_ht_destroy(table);
+
+	/* Slots that disagree with the header are rejected. */
+	FILE *file = fopen("ht_test.image", "r+b");
+	unsigned long long corrupt_count = 49;
+	assert(file != NULL && fseek(file, 40, SEEK_SET) == 0 && fwrite(&corrupt_count, sizeof(corrupt_count), 1, file) == 1 && fclose(file) == 0 &&
+		"Corrupting image failed.");
+	assert(lepk_ht_load("ht_test.image", lepk_ht_hash_generic, lepk_ht_compare_generic, sizeof(int), sizeof(int)) == NULL &&
+		"lepk_ht_load accepted a corrupt image.");
+	remove("ht_test.image");
 }
 
 #endif /* LEPK_HT_TEST */
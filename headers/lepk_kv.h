@@ -0,0 +1,221 @@
+/* Version: 1.1 */
+
+/*
+ * MIT License
+ * 
+ * Copyright (c) 2022 Linus Erik Pontus Kåreblom
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Persistent key-value store.
+ *
+ * Add:
+ *     #define LEPK_KV_IMPLEMENTATION
+ * in one C or C++ file, before #include "lepk_kv.h", to create the implementation.
+ *
+ * If LEPK_KV_STATIC is defined the implementation will be local to a single file only.
+ *
+ * The implementation uses POSIX.1-2008 calls, define _POSIX_C_SOURCE as 200809L (or _GNU_SOURCE) before including
+ * any system header when compiling with -std=c99.
+ *
+ * The implementation uses lepk_da.h, lepk_ht.h, lepk_checksum.h and lepk_file.h, their implementations must be included before this one.
+ */
+
+/*
+ * === Documentation ===
+ * Every write is appended to the active data file of a directory, an in memory lepk_ht maps every key to
+ * the file, offset and length of its newest value. Reading a value costs one pread, writing costs one buffered append.
+ * Once a data file reaches its maximum size it is sealed and a hint file listing its keys is written next to it,
+ * so opening the store reads the small hint files instead of every value.
+ * Compaction rewrites the live values of sealed files into new files and deletes the old ones, optionally on a background thread.
+ * The old files are marked obsolete before they are deleted, so opening finishes a deletion a crash interrupted.
+ *
+ * Usage:
+ * LepkKv *kv = lepk_kv_open("store", NULL, NULL);
+ * lepk_kv_put(kv, "key", 3, "value", 5);
+ * char value[16];
+ * unsigned long length;
+ * if (lepk_kv_get(kv, "key", 3, value, sizeof(value), &length) == LEPK_KV_STATUS_OK) {
+ *     ...
+ * }
+ * lepk_kv_close(kv);
+ */
+
+#ifndef LEPK_KV_H
+#define LEPK_KV_H
+
+#ifdef LEPK_KV_STATIC
+#define LEPKKV static
+#define LEPKKVIMPL static
+#else /* LEPK_KV_STATIC */
+#define LEPKKV extern
+#define LEPKKVIMPL
+#endif /* LEPK_KV_STATIC */
+
+#include <stdbool.h>
+
+/* Status code for functions. */
+typedef enum {
+	/* OK. */
+	LEPK_KV_STATUS_OK,
+	/* Directory or data file failed to be opened or created. */
+	LEPK_KV_STATUS_UNABLE_TO_OPEN_CREATE,
+	/* OS is out of memory. */
+	LEPK_KV_STATUS_OUT_OF_MEMORY,
+	/* Writing a data file failed. */
+	LEPK_KV_STATUS_WRITE_FAILED,
+	/* Reading a data file failed. */
+	LEPK_KV_STATUS_READ_FAILED,
+	/* Flushing a data file to disk failed. */
+	LEPK_KV_STATUS_SYNC_FAILED,
+	/* Key does not exist. */
+	LEPK_KV_STATUS_NOT_FOUND,
+	/* Key or value is too large. */
+	LEPK_KV_STATUS_TOO_LARGE,
+	/* A compaction is already running. */
+	LEPK_KV_STATUS_BUSY,
+} LepkKvStatus;
+
+/* Configuration of a store, zero fields use defaults. */
+typedef struct {
+	/* Size a data file is sealed at, default 64 MiB. */
+	unsigned long file_size;
+	/* Bytes buffered before writes reach the data file, default 64 KiB. */
+	unsigned long buffer_size;
+} LepkKvOptions;
+
+/* Key-value store. */
+typedef struct LepkKv LepkKv;
+
+/* Open store in directory at dirpath, directory is created if missing. Options may be NULL. NULL return value means function failed. */
+LEPKKV LepkKv *lepk_kv_open(const char *dirpath, const LepkKvOptions *options, LepkKvStatus *status);
+/* Wait for compaction, flush and close store. */
+LEPKKV void lepk_kv_close(LepkKv *kv);
+/* Set value of key. */
+LEPKKV LepkKvStatus lepk_kv_put(LepkKv *kv, const void *key, unsigned long key_length, const void *value, unsigned long value_length);
+/* Copy up to capacity bytes of the value of key into buffer, length is set to the full length of the value. */
+LEPKKV LepkKvStatus lepk_kv_get(LepkKv *kv, const void *key, unsigned long key_length, void *buffer, unsigned long capacity, unsigned long *length);
+/* Remove key. */
+LEPKKV LepkKvStatus lepk_kv_delete(LepkKv *kv, const void *key, unsigned long key_length);
+/* Amount of keys in store. */
+LEPKKV unsigned long lepk_kv_count(LepkKv *kv);
+/* Write buffered values to the active data file. */
+LEPKKV LepkKvStatus lepk_kv_flush(LepkKv *kv);
+/* Flush and wait for the values to reach the disk. */
+LEPKKV LepkKvStatus lepk_kv_sync(LepkKv *kv);
+/* Rewrite live values of every sealed data file and delete the old files. Reads and writes continue while compacting in the background. */
+LEPKKV LepkKvStatus lepk_kv_compact(LepkKv *kv, bool background);
+
+#ifdef LEPK_KV_TEST
+
+#include <assert.h>
+#include <string.h>
+#include <stdio.h>
+
+static void lepk_kv_test(void) {
+	LepkKvStatus status;
+	LepkKvOptions options = {0};
+	options.file_size = 4096;
+	options.buffer_size = 512;
+
+	LepkKv *kv = lepk_kv_open("kv_test", &options, &status);
+	assert(kv != NULL && status == LEPK_KV_STATUS_OK && "lepk_kv_open failed.");
+
+	/* Overwrite every key a few times so there is something to compact. */
+	char key[16];
+	char value[64];
+	unsigned long length;
+	for (int round = 0; round < 3; round++) {
+		for (int i = 0; i < 100; i++) {
+			sprintf(key, "key%d", i);
+			sprintf(value, "value%d-%d", i, round);
+			status = lepk_kv_put(kv, key, strlen(key), value, strlen(value));
+			assert(status == LEPK_KV_STATUS_OK && "lepk_kv_put failed.");
+		}
+	}
+	for (int i = 0; i < 100; i += 2) {
+		sprintf(key, "key%d", i);
+		status = lepk_kv_delete(kv, key, strlen(key));
+		assert(status == LEPK_KV_STATUS_OK && "lepk_kv_delete failed.");
+	}
+	assert(lepk_kv_count(kv) == 50 && "lepk_kv_count failed.");
+
+	status = lepk_kv_get(kv, "key1", 4, value, sizeof(value), &length);
+	assert(status == LEPK_KV_STATUS_OK && length == 8 && memcmp(value, "value1-2", 8) == 0 && "lepk_kv_get failed.");
+	status = lepk_kv_get(kv, "key2", 4, value, sizeof(value), &length);
+	assert(status == LEPK_KV_STATUS_NOT_FOUND && "lepk_kv_get of deleted key failed.");
+
+	/* Keep the oldest data file to put it back as if a crash stopped compaction from deleting it. */
+	status = lepk_kv_flush(kv);
+	assert(status == LEPK_KV_STATUS_OK && lepk_file_copy("kv_test/0000000000.data", "kv_test/kept") == LEPK_FILE_STATUS_OK && "Keeping data file failed.");
+	status = lepk_kv_compact(kv, false);
+	assert(status == LEPK_KV_STATUS_OK && "lepk_kv_compact failed.");
+	assert(lepk_file_copy("kv_test/kept", "kv_test/0000000000.data") == LEPK_FILE_STATUS_OK && "Restoring data file failed.");
+	status = lepk_kv_get(kv, "key99", 5, value, sizeof(value), &length);
+	assert(status == LEPK_KV_STATUS_OK && length == 9 && memcmp(value, "value99-2", 9) == 0 && "lepk_kv_get after lepk_kv_compact failed.");
+	/* The delete lands in a data file older than the compacted copy of the value. */
+	status = lepk_kv_delete(kv, "key1", 4);
+	assert(status == LEPK_KV_STATUS_OK && lepk_kv_count(kv) == 49 && "lepk_kv_delete after lepk_kv_compact failed.");
+	lepk_kv_close(kv);
+
+	/* Reopening restores the index from hint and data files. */
+	kv = lepk_kv_open("kv_test", &options, &status);
+	assert(kv != NULL && lepk_kv_count(kv) == 49 && "lepk_kv_open failed to restore.");
+	for (int i = 0; i < 100; i++) {
+		sprintf(key, "key%d", i);
+		sprintf(value, "value%d-2", i);
+		char output[64];
+		status = lepk_kv_get(kv, key, strlen(key), output, sizeof(output), &length);
+		assert((i % 2 == 0 || i == 1 ? status == LEPK_KV_STATUS_NOT_FOUND : (status == LEPK_KV_STATUS_OK && length == strlen(value) && memcmp(output, value, length) == 0)) && "lepk_kv_get after lepk_kv_open failed.");
+	}
+	lepk_kv_close(kv);
+
+	/* Reopening continues in the newest data file instead of starting another one. */
+	LepkFileDir *dir = lepk_file_dir_open("kv_test", NULL);
+	const char *name;
+	char filepath[64];
+	int files = 0;
+	while (lepk_file_dir_next(dir, &name, NULL)) {
+		files += strstr(name, ".data") != NULL;
+	}
+	lepk_file_dir_close(dir);
+	kv = lepk_kv_open("kv_test", &options, &status);
+	assert(kv != NULL && lepk_kv_put(kv, "key1", 4, "value", 5) == LEPK_KV_STATUS_OK && "lepk_kv_open failed to resume.");
+	lepk_kv_close(kv);
+	dir = lepk_file_dir_open("kv_test", NULL);
+	while (lepk_file_dir_next(dir, &name, NULL)) {
+		files -= strstr(name, ".data") != NULL;
+	}
+	lepk_file_dir_close(dir);
+	assert(files == 0 && "lepk_kv_open created a new data file.");
+
+	dir = lepk_file_dir_open("kv_test", NULL);
+	while (lepk_file_dir_next(dir, &name, NULL)) {
+		strcpy(filepath, "kv_test/");
+		strcat(filepath, name);
+		lepk_file_remove(filepath);
+	}
+	lepk_file_dir_close(dir);
+	lepk_file_remove("kv_test");
+}
+
+#endif /* LEPK_KV_TEST */
+#endif /* LEPK_KV_H */
@@ -0,0 +1,225 @@
+/* Version: 1.1 */
+
+/*
+ * MIT License
+ * 
+ * Copyright (c) 2022 Linus Erik Pontus Kåreblom
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Append-only record log.
+ *
+ * Add:
+ *     #define LEPK_LOG_IMPLEMENTATION
+ * in one C or C++ file, before #include "lepk_log.h", to create the implementation.
+ *
+ * If LEPK_LOG_STATIC is defined the implementation will be local to a single file only.
+ *
+ * The implementation uses POSIX.1-2008 calls, define _POSIX_C_SOURCE as 200809L (or _GNU_SOURCE) before including
+ * any system header when compiling with -std=c99.
+ *
+ * The implementation uses lepk_da.h, lepk_checksum.h and lepk_file.h, their implementations must be included before this one.
+ */
+
+/*
+ * === Documentation ===
+ * A log is a directory of fixed size, preallocated segments. Every record is length prefixed and checksummed.
+ * One writer appends through a buffer, any amount of readers (in any process) tail the segments through mmap.
+ * Records only become visible to readers once the writer flushes them.
+ *
+ * Usage:
+ * LepkLog *log = lepk_log_open("events", NULL, NULL);
+ * lepk_log_append(log, "Hello", 5);
+ * lepk_log_flush(log);
+ *
+ * LepkLogReader *reader = lepk_log_reader_open("events", NULL);
+ * const void *data;
+ * unsigned long length;
+ * while (lepk_log_reader_next(reader, &data, &length)) {
+ *     ...
+ * }
+ * lepk_log_reader_close(reader);
+ * lepk_log_close(log);
+ *
+ * On disk, in native byte order:
+ * Segment "<id>.log": LepkLog magic, version and global index of its first record, followed by records.
+ * Record: size (length + 1, 0 is unwritten space), crc32c of size and data, data, padding to 8 bytes.
+ * Index "<id>.idx": record count and the offset of every record, written when a segment fills up.
+ */
+
+#ifndef LEPK_LOG_H
+#define LEPK_LOG_H
+
+#ifdef LEPK_LOG_STATIC
+#define LEPKLOG static
+#define LEPKLOGIMPL static
+#else /* LEPK_LOG_STATIC */
+#define LEPKLOG extern
+#define LEPKLOGIMPL
+#endif /* LEPK_LOG_STATIC */
+
+#include <stdbool.h>
+
+/* Status code for functions. */
+typedef enum {
+	/* OK. */
+	LEPK_LOG_STATUS_OK,
+	/* Directory or segment failed to be opened or created. */
+	LEPK_LOG_STATUS_UNABLE_TO_OPEN_CREATE,
+	/* OS is out of memory. */
+	LEPK_LOG_STATUS_OUT_OF_MEMORY,
+	/* Writing to a segment failed. */
+	LEPK_LOG_STATUS_WRITE_FAILED,
+	/* Flushing a segment to disk failed. */
+	LEPK_LOG_STATUS_SYNC_FAILED,
+	/* Record does not fit in an empty segment. */
+	LEPK_LOG_STATUS_TOO_LARGE,
+	/* Segment is not a lepk_log segment or of an unknown version. */
+	LEPK_LOG_STATUS_CORRUPT,
+	/* Record does not exist (yet). */
+	LEPK_LOG_STATUS_OUT_OF_RANGE,
+} LepkLogStatus;
+
+/* Configuration of a log writer, zero fields use defaults. */
+typedef struct {
+	/* Bytes preallocated per segment, default 64 MiB. */
+	unsigned long segment_size;
+	/* Bytes buffered before records are written, default 64 KiB. */
+	unsigned long buffer_size;
+} LepkLogOptions;
+
+/* Log writer. */
+typedef struct LepkLog LepkLog;
+/* Log reader. */
+typedef struct LepkLogReader LepkLogReader;
+
+/* Open log in directory at dirpath for appending, directory is created if missing. Options may be NULL. NULL return value means function failed. */
+LEPKLOG LepkLog *lepk_log_open(const char *dirpath, const LepkLogOptions *options, LepkLogStatus *status);
+/* Flush and close log. */
+LEPKLOG void lepk_log_close(LepkLog *log);
+/* Append record, it is buffered until the buffer fills or the log is flushed. */
+LEPKLOG LepkLogStatus lepk_log_append(LepkLog *log, const void *data, unsigned long length);
+/* Write buffered records to the segment, making them visible to readers. */
+LEPKLOG LepkLogStatus lepk_log_flush(LepkLog *log);
+/* Flush and wait for the records to reach the disk. */
+LEPKLOG LepkLogStatus lepk_log_sync(LepkLog *log);
+/* Amount of records ever appended to log. */
+LEPKLOG unsigned long long lepk_log_count(const LepkLog *log);
+
+/* Open reader at the first record of log in directory at dirpath. NULL return value means function failed. */
+LEPKLOG LepkLogReader *lepk_log_reader_open(const char *dirpath, LepkLogStatus *status);
+/* Close reader, data returned by it becomes invalid. */
+LEPKLOG void lepk_log_reader_close(LepkLogReader *reader);
+/*
+ * Get next record, data points into the mapped segment and is valid until the reader moves to another segment.
+ * Returns false when no more complete records are flushed, call again later to tail the log.
+ */
+LEPKLOG bool lepk_log_reader_next(LepkLogReader *reader, const void **data, unsigned long *length);
+/* Move reader to record at index, using the segment indexes instead of reading every record before it. */
+LEPKLOG LepkLogStatus lepk_log_reader_seek(LepkLogReader *reader, unsigned long long index);
+
+#ifdef LEPK_LOG_TEST
+
+#include <assert.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+static void lepk_log_test(void) {
+	LepkLogStatus status;
+	LepkLogOptions options = {0};
+	options.segment_size = 4096;
+	options.buffer_size = 256;
+
+	LepkLog *log = lepk_log_open("log_test", &options, &status);
+	assert(log != NULL && status == LEPK_LOG_STATUS_OK && "lepk_log_open failed.");
+
+	/* Enough records to fill a couple of segments. */
+	char record[64];
+	for (int i = 0; i < 300; i++) {
+		memset(record, 'a' + i % 26, sizeof(record));
+		status = lepk_log_append(log, record, i % 64);
+		assert(status == LEPK_LOG_STATUS_OK && "lepk_log_append failed.");
+	}
+	assert(lepk_log_count(log) == 300 && "lepk_log_count failed.");
+
+	LepkLogReader *reader = lepk_log_reader_open("log_test", &status);
+	assert(reader != NULL && status == LEPK_LOG_STATUS_OK && "lepk_log_reader_open failed.");
+
+	const void *data;
+	unsigned long length;
+	status = lepk_log_flush(log);
+	assert(status == LEPK_LOG_STATUS_OK && "lepk_log_flush failed.");
+	for (int i = 0; i < 300; i++) {
+		bool found = lepk_log_reader_next(reader, &data, &length);
+		assert(found && length == (unsigned long) i % 64 && "lepk_log_reader_next failed.");
+		assert((length == 0 || ((const char *) data)[length - 1] == 'a' + i % 26) && "lepk_log_reader_next returned wrong data.");
+	}
+	assert(!lepk_log_reader_next(reader, &data, &length) && "lepk_log_reader_next read past the end.");
+
+	/* Tail records appended after reaching the end. */
+	status = lepk_log_append(log, "tail", 4);
+	lepk_log_close(log);
+	assert(lepk_log_reader_next(reader, &data, &length) && length == 4 && memcmp(data, "tail", 4) == 0 && "lepk_log_reader_next failed to tail.");
+
+	status = lepk_log_reader_seek(reader, 250);
+	assert(status == LEPK_LOG_STATUS_OK && "lepk_log_reader_seek failed.");
+	assert(lepk_log_reader_next(reader, &data, &length) && length == 250 % 64 && "lepk_log_reader_seek moved to the wrong record.");
+	lepk_log_reader_close(reader);
+
+	/* Reopening continues after the last record. */
+	log = lepk_log_open("log_test", &options, &status);
+	assert(log != NULL && lepk_log_count(log) == 301 && "lepk_log_open failed to recover.");
+	lepk_log_close(log);
+
+	/* A crash right after creating the next segment leaves it zeroed, opening starts it over instead of failing. */
+	LepkFileDir *dir = lepk_file_dir_open("log_test", NULL);
+	const char *name;
+	char filepath[64];
+	unsigned long long last = 0;
+	while (lepk_file_dir_next(dir, &name, NULL)) {
+		unsigned long long segment = strtoull(name, NULL, 10);
+		last = strstr(name, ".log") != NULL && segment > last ? segment : last;
+	}
+	lepk_file_dir_close(dir);
+	char zeroes[4096] = {0};
+	snprintf(filepath, sizeof(filepath), "log_test/%020llu.log", last + 1);
+	lepk_file_write(filepath, zeroes, sizeof(zeroes), LEPK_FILE_MODE_BINARY);
+	log = lepk_log_open("log_test", &options, &status);
+	assert(log != NULL && lepk_log_count(log) == 301 && "lepk_log_open failed on a blank segment.");
+	status = lepk_log_append(log, "next", 4);
+	lepk_log_close(log);
+	log = lepk_log_open("log_test", &options, &status);
+	assert(log != NULL && lepk_log_count(log) == 302 && "lepk_log_append after a blank segment failed.");
+	lepk_log_close(log);
+
+	dir = lepk_file_dir_open("log_test", NULL);
+	while (lepk_file_dir_next(dir, &name, NULL)) {
+		strcpy(filepath, "log_test/");
+		strcat(filepath, name);
+		lepk_file_remove(filepath);
+	}
+	lepk_file_dir_close(dir);
+	lepk_file_remove("log_test");
+}
+
+#endif /* LEPK_LOG_TEST */
+#endif /* LEPK_LOG_H */
@@ -0,0 +1,238 @@
+/* Version: 1.0 */
+
+/*
+ * MIT License
+ * 
+ * Copyright (c) 2022 Linus Erik Pontus Kåreblom
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Fast LZ compression.
+ *
+ * Add:
+ *     #define LEPK_LZ_IMPLEMENTATION
+ * in one C or C++ file, before #include "lepk_lz.h", to create the implementation.
+ *
+ * If LEPK_LZ_STATIC is defined the implementation will be local to a single file only.
+ *
+ * The implementation uses POSIX.1-2008 calls, define _POSIX_C_SOURCE as 200809L (or _GNU_SOURCE) before including
+ * any system header when compiling with -std=c99.
+ *
+ * The implementation uses lepk_checksum.h and lepk_file.h, their implementations must be included before this one.
+ *
+ * Use:
+ *     #define LEPK_LZ_HASH_LOG [int]
+ * to define the log2 of the amount of match finder entries, more finds more matches but costs cache, default 12.
+ */
+
+/*
+ * === Documentation ===
+ * Blocks use the LZ4 block format: sequences of literals followed by a match of at least 4 bytes up to 64 KiB back.
+ * The compressor is a single greedy pass with a hash table, the decompressor copies 8 bytes at a time and checks
+ * every length and offset, so malformed input fails with LEPK_LZ_STATUS_CORRUPT instead of reading or writing out of bounds.
+ *
+ * Files are framed: a header, then blocks that each carry their compressed and original length and a crc32c of the
+ * original data. Blocks that do not compress are stored as they are. lepk_lz_file_write and lepk_lz_file_read handle
+ * whole files, writers and readers stream a file block by block.
+ *
+ * Usage:
+ * lepk_lz_file_write("snapshot.lz", data, length);
+ * unsigned long length;
+ * char *data = lepk_lz_file_read("snapshot.lz", &length, NULL);
+ *
+ * LepkLzWriter *writer = lepk_lz_writer_open("log.lz", 0, NULL);
+ * lepk_lz_writer_write(writer, data, length);
+ * lepk_lz_writer_close(writer);
+ */
+
+#ifndef LEPK_LZ_H
+#define LEPK_LZ_H
+
+#ifdef LEPK_LZ_STATIC
+#define LEPKLZ static
+#define LEPKLZIMPL static
+#else /* LEPK_LZ_STATIC */
+#define LEPKLZ extern
+#define LEPKLZIMPL
+#endif /* LEPK_LZ_STATIC */
+
+/* Status code for functions. */
+typedef enum {
+	/* OK. */
+	LEPK_LZ_STATUS_OK,
+	/* File failed to be opened or created. */
+	LEPK_LZ_STATUS_UNABLE_TO_OPEN_CREATE,
+	/* OS is out of memory. */
+	LEPK_LZ_STATUS_OUT_OF_MEMORY,
+	/* Writing the file failed. */
+	LEPK_LZ_STATUS_WRITE_FAILED,
+	/* Reading the file failed. */
+	LEPK_LZ_STATUS_READ_FAILED,
+	/* Compressed data is malformed or fails its checksum. */
+	LEPK_LZ_STATUS_CORRUPT,
+	/* Output buffer is too small. */
+	LEPK_LZ_STATUS_TOO_SMALL,
+} LepkLzStatus;
+
+/* Streaming writer of a compressed file. */
+typedef struct LepkLzWriter LepkLzWriter;
+/* Streaming reader of a compressed file. */
+typedef struct LepkLzReader LepkLzReader;
+
+/* Largest compressed length of length bytes. */
+LEPKLZ unsigned long lepk_lz_bound(unsigned long length);
+/* Compress length bytes of source, less than 4 GiB, into destination. Returns the compressed length, 0 if capacity is below lepk_lz_bound(length). */
+LEPKLZ unsigned long lepk_lz_compress(const void *source, unsigned long length, void *destination, unsigned long capacity);
+/* Decompress a block into destination, output_length is set to the decompressed length. */
+LEPKLZ LepkLzStatus lepk_lz_decompress(const void *source, unsigned long length, void *destination, unsigned long capacity, unsigned long *output_length);
+
+/* Compress content into a file at filepath, the file is replaced atomically. */
+LEPKLZ LepkLzStatus lepk_lz_file_write(const char *filepath, const char *content, unsigned long length);
+/* Read and decompress a file, the contents are null terminated. NULL return value means function failed, read status for more specific error. */
+LEPKLZ char *lepk_lz_file_read(const char *filepath, unsigned long *length, LepkLzStatus *status);
+
+/* Create a compressed file at filepath. Block size 0 uses the default of 256 KiB. NULL return value means function failed. */
+LEPKLZ LepkLzWriter *lepk_lz_writer_open(const char *filepath, unsigned long block_size, LepkLzStatus *status);
+/* Add data to the file, full blocks are compressed and written as they fill up. */
+LEPKLZ LepkLzStatus lepk_lz_writer_write(LepkLzWriter *writer, const void *data, unsigned long length);
+/* Write the last block and close the file. Returns the first error of any write. */
+LEPKLZ LepkLzStatus lepk_lz_writer_close(LepkLzWriter *writer);
+/* Open a compressed file for reading. NULL return value means function failed. */
+LEPKLZ LepkLzReader *lepk_lz_reader_open(const char *filepath, LepkLzStatus *status);
+/* Copy up to capacity decompressed bytes into buffer, length is set to 0 at the end of the file. */
+LEPKLZ LepkLzStatus lepk_lz_reader_read(LepkLzReader *reader, void *buffer, unsigned long capacity, unsigned long *length);
+/* Close reader. */
+LEPKLZ void lepk_lz_reader_close(LepkLzReader *reader);
+
+#ifdef LEPK_LZ_TEST
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+static unsigned int lepk__lz_test_random(unsigned int *state) {
+	*state ^= *state << 13;
+	*state ^= *state >> 17;
+	*state ^= *state << 5;
+	return *state;
+}
+
+/* Data between random noise and long repeats, depending on how many symbols and repeats are picked. */
+static void lepk__lz_test_fill(unsigned char *data, unsigned long length, unsigned int *state) {
+	unsigned int symbols = 1 + lepk__lz_test_random(state) % 256;
+	unsigned int repeats = lepk__lz_test_random(state) % 100;
+	for (unsigned long i = 0; i < length;) {
+		if (i > 0 && lepk__lz_test_random(state) % 100 < repeats) {
+			unsigned long back = 1 + lepk__lz_test_random(state) % (i < 70000 ? i : 70000);
+			unsigned long run = 1 + lepk__lz_test_random(state) % 300;
+			for (unsigned long j = 0; j < run && i < length; j++, i++) {
+				data[i] = data[i - back];
+			}
+		} else {
+			data[i++] = lepk__lz_test_random(state) % symbols;
+		}
+	}
+}
+
+static void lepk_lz_test(void) {
+	unsigned int state = 0x2545f491u;
+	unsigned long max = 200000;
+	unsigned char *data = malloc(max);
+	unsigned char *compressed = malloc(lepk_lz_bound(max));
+	unsigned char *output = malloc(max);
+	assert(data != NULL && compressed != NULL && output != NULL && "malloc failed.");
+
+	/* Round trip fuzzing, then feed the decompressor damaged blocks, which must fail cleanly (run with a sanitizer to be sure). */
+	for (int round = 0; round < 300; round++) {
+		unsigned long length = round < 20 ? (unsigned long) round : lepk__lz_test_random(&state) % max;
+		lepk__lz_test_fill(data, length, &state);
+		unsigned long size = lepk_lz_compress(data, length, compressed, lepk_lz_bound(length));
+		assert(size > 0 && size <= lepk_lz_bound(length) && "lepk_lz_compress failed.");
+
+		unsigned long output_length;
+		LepkLzStatus status = lepk_lz_decompress(compressed, size, output, max, &output_length);
+		assert(status == LEPK_LZ_STATUS_OK && output_length == length && memcmp(data, output, length) == 0 && "lepk_lz_decompress failed.");
+		if (length > 0) {
+			status = lepk_lz_decompress(compressed, size, output, length - 1, &output_length);
+			assert(status != LEPK_LZ_STATUS_OK && "lepk_lz_decompress into a small buffer failed.");
+		}
+
+		for (int damage = 0; damage < 8; damage++) {
+			unsigned long position = lepk__lz_test_random(&state) % size;
+			unsigned char old = compressed[position];
+			compressed[position] ^= 1 + lepk__lz_test_random(&state) % 255;
+			lepk_lz_decompress(compressed, size, output, max, &output_length);
+			lepk_lz_decompress(compressed, position, output, max, &output_length);
+			compressed[position] = old;
+		}
+	}
+	assert(lepk_lz_compress(data, 1000, compressed, 10) == 0 && "lepk_lz_compress into a small buffer failed.");
+
+	/* Whole files. */
+	unsigned long length = 150000;
+	lepk__lz_test_fill(data, length, &state);
+	LepkLzStatus status = lepk_lz_file_write("lz_test.lz", (const char *) data, length);
+	assert(status == LEPK_LZ_STATUS_OK && "lepk_lz_file_write failed.");
+	unsigned long read_length;
+	char *content = lepk_lz_file_read("lz_test.lz", &read_length, &status);
+	assert(content != NULL && read_length == length && memcmp(content, data, length) == 0 && "lepk_lz_file_read failed.");
+	free(content);
+
+	/* Streams with blocks smaller than the pieces and pieces smaller than the blocks. */
+	LepkLzWriter *writer = lepk_lz_writer_open("lz_test.lz", 4096, &status);
+	assert(writer != NULL && "lepk_lz_writer_open failed.");
+	for (unsigned long done = 0, step = 1; done < length; done += step, step = step * 3 + 1) {
+		status = lepk_lz_writer_write(writer, data + done, done + step < length ? step : length - done);
+		assert(status == LEPK_LZ_STATUS_OK && "lepk_lz_writer_write failed.");
+	}
+	assert(lepk_lz_writer_close(writer) == LEPK_LZ_STATUS_OK && "lepk_lz_writer_close failed.");
+
+	LepkLzReader *reader = lepk_lz_reader_open("lz_test.lz", &status);
+	assert(reader != NULL && "lepk_lz_reader_open failed.");
+	unsigned long total = 0;
+	for (unsigned long step = 1;; step = step * 2 + 1) {
+		status = lepk_lz_reader_read(reader, output + total, step < max - total ? step : max - total, &read_length);
+		assert(status == LEPK_LZ_STATUS_OK && "lepk_lz_reader_read failed.");
+		if (read_length == 0) {
+			break;
+		}
+		total += read_length;
+	}
+	assert(total == length && memcmp(output, data, length) == 0 && "lepk_lz_reader_read content failed.");
+	lepk_lz_reader_close(reader);
+
+	/* A flipped bit in the file is caught by the block checksum. */
+	content = lepk_file_read("lz_test.lz", NULL);
+	unsigned long file_size = lepk_file_size("lz_test.lz", NULL);
+	content[file_size / 2] ^= 0x10;
+	lepk_file_write("lz_test.lz", content, file_size, LEPK_FILE_MODE_BINARY);
+	free(content);
+	content = lepk_lz_file_read("lz_test.lz", &read_length, &status);
+	assert(content == NULL && status == LEPK_LZ_STATUS_CORRUPT && "lepk_lz_file_read of damaged file failed.");
+	lepk_file_remove("lz_test.lz");
+
+	free(data);
+	free(compressed);
+	free(output);
+}
+
+#endif /* LEPK_LZ_TEST */
+#endif /* LEPK_LZ_H */
@@ -1,3 +1,12 @@
+/* Version: 1.5 */
+
+/*
+ * Define LEPK_WINDOW_OS_LINUX and link with -lX11 -lXext to use Xlib,
+ * also define LEPK_WINDOW_XCB and link with -lxcb instead to skip Xlib.
+ * The implementation uses POSIX.1-2008 calls, define _POSIX_C_SOURCE as 200809L (or _GNU_SOURCE) before including
+ * any system header when compiling with -std=c99.
+ */
+
 #ifndef LEPK_WINDOW_H
 #define LEPK_WINDOW_H
 
@@ -123,6 +132,52 @@ typedef enum {
 	LEPK_MOD_SUPER     = 1 << 6,
 } LepkMod;
 
+typedef enum {
+	LEPK_EVENT_NONE,
+	LEPK_EVENT_CLOSE,
+	LEPK_EVENT_RESIZE,
+	LEPK_EVENT_KEY,
+	LEPK_EVENT_FOCUS,
+} LepkEventType;
+
+/* Event decoded from the window system, type tells which member of data is set. */
+typedef struct {
+	LepkEventType type;
+	/* Monotonic clock in nanoseconds when the event was decoded. */
+	unsigned long long time;
+	union {
+		struct {
+			int width;
+			int height;
+		} resize;
+		struct {
+			LepkKey key;
+			int scancode;
+			bool pressed;
+			LepkMod mods;
+		} key;
+		struct {
+			bool focused;
+		} focus;
+	} data;
+} LepkEvent;
+
+typedef struct {
+	int x;
+	int y;
+	int width;
+	int height;
+} LepkRect;
+
+typedef struct {
+	/* Pixel bytes and rects sent by the last present. */
+	unsigned long long bytes;
+	int rects;
+	/* Pixel bytes sent by all presents. */
+	unsigned long long total_bytes;
+	unsigned long long frames;
+} LepkPresentStats;
+
 /* Use void as type to hinder access to window variables. */
 typedef void LepkWindow;
 /* Resize callback. */
@@ -132,7 +187,38 @@ typedef void (*LepkKeyCallback)(LepkWindow *window, LepkKey keycode, int scancod
 LEPKWINDOW LepkWindow *lepk_window_create(int width, int height, const char *title, bool resizable);
 LEPKWINDOW void lepk_window_destroy(LepkWindow *window);
 LEPKWINDOW bool lepk_window_is_open(const LepkWindow *window);
+/* Call the callbacks for every pending event. */
 LEPKWINDOW void lepk_window_poll_events(LepkWindow *window);
+/* Take the oldest pending event without blocking, false return value means there was none. */
+LEPKWINDOW bool lepk_window_next_event(LepkWindow *window, LepkEvent *event);
+/* Take up to capacity pending events in order, returns how many were written to events. */
+LEPKWINDOW int lepk_window_drain_events(LepkWindow *window, LepkEvent *events, int capacity);
+/*
+ * Sleep until events are pending, lepk_window_post_empty_event is called or timeout_ns nanoseconds pass.
+ * Negative timeout waits forever, false return value means the timeout passed without events.
+ */
+LEPKWINDOW bool lepk_window_wait_events(LepkWindow *window, long long timeout_ns);
+/* Wake lepk_window_wait_events, safe to call from any thread. */
+LEPKWINDOW void lepk_window_post_empty_event(LepkWindow *window);
+
+/*
+ * Pixels to draw into as 0x00RRGGBB with width pixels per row, NULL when the window can not show them.
+ * The pixels hold the last presented frame and stay valid until the next present or until the window is resized.
+ */
+LEPKWINDOW unsigned int *lepk_window_framebuffer(LepkWindow *window, int *width, int *height);
+/* Add rect to the damage sent by the next present, overlapping damage is merged. */
+LEPKWINDOW void lepk_window_damage(LepkWindow *window, LepkRect rect);
+/*
+ * Show the framebuffer, every pixel drawn since the last present must be inside dirty_rects or the damage.
+ * Everything is presented when neither dirty_rects nor damage is given.
+ * Uses MIT-SHM when the X server shares memory with us, the XCB backend always copies through the connection.
+ */
+LEPKWINDOW bool lepk_window_present(LepkWindow *window, const LepkRect *dirty_rects, int count);
+LEPKWINDOW LepkPresentStats lepk_window_present_stats(const LepkWindow *window);
+
+/* User pointer for callbacks to find their state. */
+LEPKWINDOW void lepk_window_set_user_pointer(LepkWindow *window, void *user_pointer);
+LEPKWINDOW void *lepk_window_get_user_pointer(const LepkWindow *window);
 
 /* Set resize callback for window. */
 LEPKWINDOW void lepk_window_callback_resize(LepkWindow *window, LepkResizeCallback callback);
@@ -1,7 +1,60 @@
 #include "lepk_file.h"
 
 #include <stdio.h>
-#include <malloc.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+/* Everything past reading and writing whole files needs POSIX.1-2008. */
+#if defined(_POSIX_C_SOURCE) && _POSIX_C_SOURCE >= 200809L
+#define LEPK__FILE_POSIX
+#include "lepk_da.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <dirent.h>
+#include <fnmatch.h>
+#include <pthread.h>
+#endif /* _POSIX_C_SOURCE */
+
+/* statx, getdents64, copy_file_range, sendfile, reflinks and inotify, the POSIX fallbacks are used otherwise. */
+#if defined(LEPK__FILE_POSIX) && defined(__linux__) && defined(_GNU_SOURCE)
+#define LEPK__FILE_LINUX
+#include "lepk_ht.h"
+
+#include <sys/syscall.h>
+#include <sys/sendfile.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#include <sys/inotify.h>
+#endif /* __linux__ && _GNU_SOURCE */
+
+#ifdef LEPK__FILE_POSIX
+/* fdatasync is an optional part of POSIX, fsync flushes the same data plus metadata. */
+#if defined(_POSIX_SYNCHRONIZED_IO) && _POSIX_SYNCHRONIZED_IO > 0
+#define LEPK__FILE_DATASYNC(fd) fdatasync((fd))
+#else /* _POSIX_SYNCHRONIZED_IO */
+#define LEPK__FILE_DATASYNC(fd) fsync((fd))
+#endif /* _POSIX_SYNCHRONIZED_IO */
+#endif /* LEPK__FILE_POSIX */
+
+/* Size of the buffer used when data has to be copied through user space. */
+#ifndef LEPK_FILE_COPY_BUFFER
+#define LEPK_FILE_COPY_BUFFER (64 * 1024)
+#endif /* LEPK_FILE_COPY_BUFFER */
+
+/* Bytes of directory entries read per system call. */
+#ifndef LEPK_FILE_DIR_BUFFER
+#define LEPK_FILE_DIR_BUFFER (64 * 1024)
+#endif /* LEPK_FILE_DIR_BUFFER */
+
+/* Size of the blocks walk paths are allocated from. */
+#ifndef LEPK_FILE_ARENA_BLOCK
+#define LEPK_FILE_ARENA_BLOCK (64 * 1024)
+#endif /* LEPK_FILE_ARENA_BLOCK */
 
 #define LEPK__FILE_SET_STATUS(p, s) do {if ((p)) { *(p) = (s); }} while (0)
 
@@ -31,6 +84,48 @@ LEPKFILEIMPL char *lepk_file_read(const char *filepath, LepkFileStatus *status)
 	return buffer;
 }
 
+#ifdef LEPK__FILE_POSIX
+LEPKFILEIMPL const char *lepk_file_map(const char *filepath, unsigned long *length, LepkFileStatus *status) {
+	*length = 0;
+	int fd = open(filepath, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		LEPK__FILE_SET_STATUS(status, LEPK_FILE_STATUS_UNABLE_TO_OPEN_CREATE);
+		return NULL;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) != 0) {
+		close(fd);
+		LEPK__FILE_SET_STATUS(status, LEPK_FILE_STATUS_STAT_FAILED);
+		return NULL;
+	}
+
+	/* Empty files cannot be mapped. */
+	if (st.st_size == 0) {
+		close(fd);
+		LEPK__FILE_SET_STATUS(status, LEPK_FILE_STATUS_OK);
+		return "";
+	}
+
+	void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED) {
+		LEPK__FILE_SET_STATUS(status, LEPK_FILE_STATUS_OUT_OF_MEMORY);
+		return NULL;
+	}
+
+	*length = st.st_size;
+	LEPK__FILE_SET_STATUS(status, LEPK_FILE_STATUS_OK);
+	return data;
+}
+
+LEPKFILEIMPL void lepk_file_unmap(const char *data, unsigned long length) {
+	if (data != NULL && length > 0) {
+		munmap((void *) data, length);
+	}
+}
+#endif /* LEPK__FILE_POSIX */
+
 LEPKFILEIMPL LepkFileStatus lepk_file_write(const char *filepath, const char *content, unsigned long length, LepkFileMode mode) {
 	char *str_mode = mode == LEPK_FILE_MODE_NORMAL ? "w" : "wb";
 	FILE *f = fopen(filepath, str_mode);
@@ -44,6 +139,192 @@ LEPKFILEIMPL LepkFileStatus lepk_file_write(const char *filepath, const char *co
 	return LEPK_FILE_STATUS_OK;
 }
 
+#ifdef LEPK__FILE_POSIX
+/* Flush handed to a commit group, lives on the stack of its writer until a leader covered it. */
+typedef struct Lepk__FileFlush Lepk__FileFlush;
+struct Lepk__FileFlush {
+	int fd;
+	/* Directories need fsync, fdatasync is enough for file content. */
+	bool directory;
+	bool done;
+	bool failed;
+	Lepk__FileFlush *next;
+};
+
+struct LepkFileCommitGroup {
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	/* Flushes handed over that no leader took yet. */
+	Lepk__FileFlush *queue;
+	bool flushing;
+};
+
+/* Used to give temporary files of concurrent writers unique names. */
+static unsigned long lepk__file_temp_counter = 0;
+
+/* Flush fd, through the group if there is one. */
+static LepkFileStatus lepk__file_flush(LepkFileCommitGroup *group, int fd, bool directory) {
+	if (group == NULL) {
+		return (directory ? fsync(fd) : LEPK__FILE_DATASYNC(fd)) == 0 ? LEPK_FILE_STATUS_OK : LEPK_FILE_STATUS_SYNC_FAILED;
+	}
+
+	Lepk__FileFlush flush = { fd, directory, false, false, NULL };
+	pthread_mutex_lock(&group->mutex);
+	flush.next = group->queue;
+	group->queue = &flush;
+	while (!flush.done) {
+		if (group->flushing) {
+			pthread_cond_wait(&group->cond, &group->mutex);
+			continue;
+		}
+
+		/* Become the leader and flush every descriptor handed over so far, the writers wait with them open. */
+		Lepk__FileFlush *batch = group->queue;
+		group->queue = NULL;
+		group->flushing = true;
+		pthread_mutex_unlock(&group->mutex);
+		for (Lepk__FileFlush *member = batch; member != NULL; member = member->next) {
+			member->failed = (member->directory ? fsync(member->fd) : LEPK__FILE_DATASYNC(member->fd)) != 0;
+		}
+		pthread_mutex_lock(&group->mutex);
+		/* Members only return once they own the mutex again, so the list stays valid while it is marked. */
+		for (Lepk__FileFlush *member = batch; member != NULL; member = member->next) {
+			member->done = true;
+		}
+		group->flushing = false;
+		pthread_cond_broadcast(&group->cond);
+	}
+	pthread_mutex_unlock(&group->mutex);
+
+	return flush.failed ? LEPK_FILE_STATUS_SYNC_FAILED : LEPK_FILE_STATUS_OK;
+}
+
+/* Flush the directory entry of filepath so a rename survives a crash. */
+static LepkFileStatus lepk__file_flush_parent(LepkFileCommitGroup *group, const char *filepath) {
+	const char *slash = strrchr(filepath, '/');
+	char *dirpath;
+	if (slash == NULL) {
+		dirpath = strdup(".");
+	} else if (slash == filepath) {
+		dirpath = strdup("/");
+	} else {
+		dirpath = strndup(filepath, slash - filepath);
+	}
+	if (dirpath == NULL) {
+		return LEPK_FILE_STATUS_OUT_OF_MEMORY;
+	}
+
+	int fd = open(dirpath, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	free(dirpath);
+	if (fd < 0) {
+		return LEPK_FILE_STATUS_UNABLE_TO_OPEN_CREATE;
+	}
+
+	LepkFileStatus status = lepk__file_flush(group, fd, true);
+	close(fd);
+	return status;
+}
+
+LEPKFILEIMPL LepkFileStatus lepk_file_write_atomic_slices(const char *filepath, const LepkFileSlice *slices, unsigned long count, LepkFileDurability durability, LepkFileCommitGroup *group) {
+	/* Temporary file next to the target so the rename never crosses filesystems. */
+	unsigned long temp_length = strlen(filepath) + 64;
+	char *temp = malloc(temp_length);
+	if (temp == NULL) {
+		return LEPK_FILE_STATUS_OUT_OF_MEMORY;
+	}
+	snprintf(temp, temp_length, "%s.%ld.%lu.tmp", filepath, (long) getpid(), __atomic_add_fetch(&lepk__file_temp_counter, 1, __ATOMIC_RELAXED));
+
+	int fd = open(temp, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0666);
+	if (fd < 0) {
+		free(temp);
+		return LEPK_FILE_STATUS_UNABLE_TO_OPEN_CREATE;
+	}
+
+	/* Keep the permissions of the file being replaced. */
+	struct stat st;
+	if (stat(filepath, &st) == 0) {
+		fchmod(fd, st.st_mode & 07777);
+	}
+
+	/* Write every slice with as few system calls as possible, a short write resumes inside the slice it stopped in. */
+	LepkFileStatus status = LEPK_FILE_STATUS_OK;
+	struct iovec iov[64];
+	unsigned long slice = 0;
+	unsigned long offset = 0;
+	while (slice < count) {
+		int iov_count = 0;
+		for (unsigned long i = slice; i < count && iov_count < (int) (sizeof(iov) / sizeof(iov[0])); i++) {
+			unsigned long skip = i == slice ? offset : 0;
+			if (slices[i].length > skip) {
+				iov[iov_count].iov_base = (char *) slices[i].data + skip;
+				iov[iov_count].iov_len = slices[i].length - skip;
+				iov_count++;
+			}
+		}
+		if (iov_count == 0) {
+			break;
+		}
+
+		ssize_t bytes = writev(fd, iov, iov_count);
+		if (bytes < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			status = LEPK_FILE_STATUS_WRITE_FAILED;
+			break;
+		}
+		unsigned long written = bytes;
+		while (slice < count && written >= slices[slice].length - offset) {
+			written -= slices[slice].length - offset;
+			slice++;
+			offset = 0;
+		}
+		offset += written;
+	}
+
+	if (status == LEPK_FILE_STATUS_OK && durability != LEPK_FILE_DURABILITY_NONE) {
+		status = lepk__file_flush(group, fd, false);
+	}
+	close(fd);
+
+	if (status == LEPK_FILE_STATUS_OK && rename(temp, filepath) != 0) {
+		status = LEPK_FILE_STATUS_RENAME_FAILED;
+	}
+	if (status != LEPK_FILE_STATUS_OK) {
+		unlink(temp);
+		free(temp);
+		return status;
+	}
+	free(temp);
+
+	if (durability == LEPK_FILE_DURABILITY_FULL) {
+		status = lepk__file_flush_parent(group, filepath);
+	}
+	return status;
+}
+
+LEPKFILEIMPL LepkFileStatus lepk_file_write_atomic(const char *filepath, const char *content, unsigned long length, LepkFileDurability durability, LepkFileCommitGroup *group) {
+	LepkFileSlice slice = {content, length};
+	return lepk_file_write_atomic_slices(filepath, &slice, 1, durability, group);
+}
+
+LEPKFILEIMPL LepkFileCommitGroup *lepk_file_commit_group_create(void) {
+	LepkFileCommitGroup *group = calloc(1, sizeof(LepkFileCommitGroup));
+	if (group == NULL) {
+		return NULL;
+	}
+	pthread_mutex_init(&group->mutex, NULL);
+	pthread_cond_init(&group->cond, NULL);
+	return group;
+}
+
+LEPKFILEIMPL void lepk_file_commit_group_destroy(LepkFileCommitGroup *group) {
+	pthread_cond_destroy(&group->cond);
+	pthread_mutex_destroy(&group->mutex);
+	free(group);
+}
+#endif /* LEPK__FILE_POSIX */
+
 LEPKFILEIMPL LepkFileStatus lepk_file_append(const char *filepath, const char *content, unsigned long length, LepkFileMode mode) {
 	char *str_mode = mode == LEPK_FILE_MODE_NORMAL ? "a" : "ab";
 	FILE *f = fopen(filepath, str_mode);
@@ -62,6 +343,7 @@ LEPKFILEIMPL LepkFileStatus lepk_file_create(const char *filepath) {
 	if (f == NULL) {
 		return LEPK_FILE_STATUS_UNABLE_TO_OPEN_CREATE;
 	}
+	fclose(f);
 
 	return LEPK_FILE_STATUS_OK;
 }
@@ -73,6 +355,952 @@ LEPKFILEIMPL LepkFileStatus lepk_file_remove(const char *filepath) {
 	return LEPK_FILE_STATUS_OK;
 }
 
+#ifdef LEPK__FILE_POSIX
+/* Fill output from the metadata of filepath relative to dirfd. Uses statx where available so only the requested fields are fetched. */
+static void lepk__file_stat_at(int dirfd, const char *filepath, LepkFileStat *output) {
+	memset(output, 0, sizeof(LepkFileStat));
+
+#if defined(LEPK__FILE_LINUX) && defined(STATX_BASIC_STATS)
+	struct statx stx;
+	if (statx(dirfd, filepath, AT_STATX_DONT_SYNC, STATX_TYPE | STATX_SIZE | STATX_MTIME, &stx) == 0) {
+		output->exists = true;
+		output->is_dir = S_ISDIR(stx.stx_mode);
+		output->size   = stx.stx_size;
+		output->mtime  = (long long) stx.stx_mtime.tv_sec * 1000000000ll + stx.stx_mtime.tv_nsec;
+		return;
+	}
+	if (errno != ENOSYS) {
+		return;
+	}
+#endif /* LEPK__FILE_LINUX && STATX_BASIC_STATS */
+
+	struct stat st;
+	if (fstatat(dirfd, filepath, &st, 0) != 0) {
+		return;
+	}
+	output->exists = true;
+	output->is_dir = S_ISDIR(st.st_mode);
+	output->size   = st.st_size;
+	output->mtime  = (long long) st.st_mtim.tv_sec * 1000000000ll + st.st_mtim.tv_nsec;
+}
+
+#endif /* LEPK__FILE_POSIX */
+
 LEPKFILEIMPL bool lepk_file_exists(const char *filepath) {
-	return fopen(filepath, "r") != NULL;
+#ifdef LEPK__FILE_POSIX
+	struct stat st;
+	return stat(filepath, &st) == 0;
+#else /* LEPK__FILE_POSIX */
+	/* Standard C can only tell by opening the file. */
+	FILE *f = fopen(filepath, "rb");
+	if (f == NULL) {
+		return false;
+	}
+	fclose(f);
+	return true;
+#endif /* LEPK__FILE_POSIX */
+}
+
+LEPKFILEIMPL unsigned long lepk_file_size(const char *filepath, LepkFileStatus *status) {
+#ifdef LEPK__FILE_POSIX
+	LepkFileStat st;
+	lepk__file_stat_at(AT_FDCWD, filepath, &st);
+	LEPK__FILE_SET_STATUS(status, st.exists ? LEPK_FILE_STATUS_OK : LEPK_FILE_STATUS_STAT_FAILED);
+	return st.size;
+#else /* LEPK__FILE_POSIX */
+	FILE *f = fopen(filepath, "rb");
+	if (f == NULL) {
+		LEPK__FILE_SET_STATUS(status, LEPK_FILE_STATUS_STAT_FAILED);
+		return 0;
+	}
+	long length = fseek(f, 0, SEEK_END) == 0 ? ftell(f) : -1;
+	fclose(f);
+	if (length < 0) {
+		LEPK__FILE_SET_STATUS(status, LEPK_FILE_STATUS_STAT_FAILED);
+		return 0;
+	}
+	LEPK__FILE_SET_STATUS(status, LEPK_FILE_STATUS_OK);
+	return length;
+#endif /* LEPK__FILE_POSIX */
+}
+
+LEPKFILEIMPL long long lepk_file_mtime(const char *filepath, LepkFileStatus *status) {
+#ifdef LEPK__FILE_POSIX
+	LepkFileStat st;
+	lepk__file_stat_at(AT_FDCWD, filepath, &st);
+	LEPK__FILE_SET_STATUS(status, st.exists ? LEPK_FILE_STATUS_OK : LEPK_FILE_STATUS_STAT_FAILED);
+	return st.mtime;
+#else /* LEPK__FILE_POSIX */
+	/* Standard C has no way to read modification times. */
+	(void) filepath;
+	LEPK__FILE_SET_STATUS(status, LEPK_FILE_STATUS_STAT_FAILED);
+	return 0;
+#endif /* LEPK__FILE_POSIX */
+}
+
+#ifdef LEPK__FILE_POSIX
+
+LEPKFILEIMPL LepkFileStatus lepk_file_stat_many(const char *dirpath, const char *const *filepaths, unsigned long count, LepkFileStat *output) {
+	int dirfd = AT_FDCWD;
+	if (dirpath != NULL) {
+		dirfd = open(dirpath, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+		if (dirfd < 0) {
+			return LEPK_FILE_STATUS_UNABLE_TO_OPEN_CREATE;
+		}
+	}
+
+	for (unsigned long i = 0; i < count; i++) {
+		lepk__file_stat_at(dirfd, filepaths[i], &output[i]);
+	}
+
+	if (dirfd != AT_FDCWD) {
+		close(dirfd);
+	}
+	return LEPK_FILE_STATUS_OK;
+}
+
+/* Copy length bytes between descriptors, returns the amount of bytes copied or -1 on failure. */
+static long lepk__file_copy_fd(int src, off_t src_offset, int dst, off_t dst_offset, unsigned long length) {
+	unsigned long remaining = length;
+
+#ifdef LEPK__FILE_LINUX
+	/* Reflink the range, only works on block aligned ranges of filesystems with shared extents. */
+#ifdef FICLONERANGE
+	struct file_clone_range range;
+	range.src_fd = src;
+	range.src_offset = src_offset;
+	range.src_length = length;
+	range.dest_offset = dst_offset;
+	if (length > 0 && ioctl(dst, FICLONERANGE, &range) == 0) {
+		return length;
+	}
+#endif /* FICLONERANGE */
+
+	/* copy_file_range keeps the data in the kernel and copies server side on network filesystems. */
+	errno = 0;
+	while (remaining > 0) {
+		ssize_t copied = copy_file_range(src, &src_offset, dst, &dst_offset, remaining, 0);
+		if (copied <= 0) {
+			break;
+		}
+		remaining -= copied;
+	}
+	if (remaining == 0 || (errno != EXDEV && errno != ENOSYS && errno != EINVAL && errno != EOPNOTSUPP)) {
+		return length - remaining;
+	}
+
+	/* sendfile for older kernels and cross filesystem copies. */
+	if (lseek(dst, dst_offset, SEEK_SET) == dst_offset) {
+		errno = 0;
+		while (remaining > 0) {
+			ssize_t copied = sendfile(dst, src, &src_offset, remaining);
+			if (copied <= 0) {
+				break;
+			}
+			dst_offset += copied;
+			remaining -= copied;
+		}
+		if (remaining == 0 || (errno != EINVAL && errno != ENOSYS)) {
+			return length - remaining;
+		}
+	}
+#endif /* LEPK__FILE_LINUX */
+
+	char *buffer = malloc(LEPK_FILE_COPY_BUFFER);
+	if (buffer == NULL) {
+		return -1;
+	}
+	while (remaining > 0) {
+		ssize_t bytes = pread(src, buffer, remaining < LEPK_FILE_COPY_BUFFER ? remaining : LEPK_FILE_COPY_BUFFER, src_offset);
+		if (bytes <= 0) {
+			break;
+		}
+		if (pwrite(dst, buffer, bytes, dst_offset) != bytes) {
+			free(buffer);
+			return -1;
+		}
+		src_offset += bytes;
+		dst_offset += bytes;
+		remaining -= bytes;
+	}
+	free(buffer);
+
+	return length - remaining;
+}
+
+LEPKFILEIMPL LepkFileStatus lepk_file_copy(const char *src_filepath, const char *dst_filepath) {
+	int src = open(src_filepath, O_RDONLY | O_CLOEXEC);
+	if (src < 0) {
+		return LEPK_FILE_STATUS_UNABLE_TO_OPEN_CREATE;
+	}
+	struct stat st;
+	if (fstat(src, &st) != 0) {
+		close(src);
+		return LEPK_FILE_STATUS_STAT_FAILED;
+	}
+	int dst = open(dst_filepath, O_WRONLY | O_CREAT | O_CLOEXEC, st.st_mode & 0777);
+	if (dst < 0) {
+		close(src);
+		return LEPK_FILE_STATUS_UNABLE_TO_OPEN_CREATE;
+	}
+
+	/* Truncating a destination that is the source itself, through the same path or a link, would destroy the data. */
+	struct stat dst_st;
+	LepkFileStatus status = LEPK_FILE_STATUS_OK;
+	if (fstat(dst, &dst_st) != 0) {
+		status = LEPK_FILE_STATUS_STAT_FAILED;
+	} else if (dst_st.st_dev == st.st_dev && dst_st.st_ino == st.st_ino) {
+		status = LEPK_FILE_STATUS_SAME_FILE;
+	} else if (ftruncate(dst, 0) != 0) {
+		status = LEPK_FILE_STATUS_WRITE_FAILED;
+	}
+	if (status != LEPK_FILE_STATUS_OK) {
+		close(src);
+		close(dst);
+		return status;
+	}
+
+#ifdef FICLONE
+	/* Share every extent of the source, no data is copied at all. */
+	if (ioctl(dst, FICLONE, src) == 0) {
+		close(src);
+		close(dst);
+		return status;
+	}
+#endif /* FICLONE */
+	if (lepk__file_copy_fd(src, 0, dst, 0, st.st_size) != (long) st.st_size) {
+		status = LEPK_FILE_STATUS_COPY_FAILED;
+	}
+
+	close(src);
+	close(dst);
+	return status;
+}
+
+LEPKFILEIMPL LepkFileStatus lepk_file_copy_range(const char *src_filepath, unsigned long src_offset, const char *dst_filepath, unsigned long dst_offset, unsigned long length) {
+	int src = open(src_filepath, O_RDONLY | O_CLOEXEC);
+	if (src < 0) {
+		return LEPK_FILE_STATUS_UNABLE_TO_OPEN_CREATE;
+	}
+	int dst = open(dst_filepath, O_WRONLY | O_CREAT | O_CLOEXEC, 0666);
+	if (dst < 0) {
+		close(src);
+		return LEPK_FILE_STATUS_UNABLE_TO_OPEN_CREATE;
+	}
+
+	LepkFileStatus status = LEPK_FILE_STATUS_OK;
+	if (lepk__file_copy_fd(src, src_offset, dst, dst_offset, length) < 0) {
+		status = LEPK_FILE_STATUS_COPY_FAILED;
+	}
+
+	close(src);
+	close(dst);
+	return status;
+}
+
+#ifdef LEPK__FILE_LINUX
+/* A watched path and its watch descriptor. */
+typedef struct {
+	int wd;
+	char *path;
+} Lepk__FileWatchTarget;
+
+struct LepkFileWatch {
+	int fd;
+	/* Dynamic array of watched paths. */
+	Lepk__FileWatchTarget *targets;
+	/* Queue of coalesced records not drained yet, oldest at head, paths are owned. */
+	LepkFileChangeRecord *pending;
+	unsigned long head;
+	unsigned long tail;
+	unsigned long cap;
+	/* Records are numbered in the order they were queued, this is the number of the one at head. */
+	unsigned long first;
+	/* Path of every pending record to its number. */
+	LepkHt *index;
+	/* Path of the event being recorded, only copied when it starts a new record. */
+	char *scratch;
+	unsigned long scratch_cap;
+	/* Dynamic array of records handed out by the last drain, freed by the next one. */
+	LepkFileChangeRecord *drained;
+};
+#endif /* LEPK__FILE_LINUX */
+
+LEPKFILEIMPL LepkFileWatch *lepk_file_watch_create(LepkFileStatus *status) {
+#ifdef LEPK__FILE_LINUX
+	LepkFileWatch *watch = calloc(1, sizeof(LepkFileWatch));
+	if (watch == NULL) {
+		LEPK__FILE_SET_STATUS(status, LEPK_FILE_STATUS_OUT_OF_MEMORY);
+		return NULL;
+	}
+
+	watch->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (watch->fd < 0) {
+		free(watch);
+		LEPK__FILE_SET_STATUS(status, LEPK_FILE_STATUS_UNABLE_TO_OPEN_CREATE);
+		return NULL;
+	}
+	watch->targets = lepk_da_create(sizeof(Lepk__FileWatchTarget));
+	watch->index = lepk_ht_create(lepk_ht_hash_string, lepk_ht_compare_string, sizeof(const char *), sizeof(unsigned long));
+	watch->drained = lepk_da_create(sizeof(LepkFileChangeRecord));
+
+	LEPK__FILE_SET_STATUS(status, LEPK_FILE_STATUS_OK);
+	return watch;
+#else /* LEPK__FILE_LINUX */
+	LEPK__FILE_SET_STATUS(status, LEPK_FILE_STATUS_UNABLE_TO_OPEN_CREATE);
+	return NULL;
+#endif /* LEPK__FILE_LINUX */
+}
+
+LEPKFILEIMPL LepkFileStatus lepk_file_watch_add(LepkFileWatch *watch, const char *path) {
+#ifdef LEPK__FILE_LINUX
+	const unsigned int mask = IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB | IN_CREATE | IN_DELETE | IN_DELETE_SELF | IN_MOVED_FROM | IN_MOVED_TO | IN_MOVE_SELF;
+	int wd = inotify_add_watch(watch->fd, path, mask);
+	if (wd < 0) {
+		return LEPK_FILE_STATUS_UNABLE_TO_OPEN_CREATE;
+	}
+
+	/* Watching the same inode twice returns the same descriptor. */
+	for (unsigned long i = 0; i < lepk_da_count(watch->targets); i++) {
+		if (watch->targets[i].wd == wd) {
+			return LEPK_FILE_STATUS_OK;
+		}
+	}
+
+	Lepk__FileWatchTarget target;
+	target.wd = wd;
+	target.path = strdup(path);
+	if (target.path == NULL) {
+		inotify_rm_watch(watch->fd, wd);
+		return LEPK_FILE_STATUS_OUT_OF_MEMORY;
+	}
+	lepk_da_push(watch->targets, target);
+	return LEPK_FILE_STATUS_OK;
+#else /* LEPK__FILE_LINUX */
+	(void) watch;
+	(void) path;
+	return LEPK_FILE_STATUS_UNABLE_TO_OPEN_CREATE;
+#endif /* LEPK__FILE_LINUX */
+}
+
+LEPKFILEIMPL int lepk_file_watch_fd(const LepkFileWatch *watch) {
+#ifdef LEPK__FILE_LINUX
+	return watch->fd;
+#else /* LEPK__FILE_LINUX */
+	(void) watch;
+	return -1;
+#endif /* LEPK__FILE_LINUX */
+}
+
+#ifdef LEPK__FILE_LINUX
+/* Merge changes into the pending record of path, or start a new one. */
+static void lepk__file_watch_record(LepkFileWatch *watch, const char *dirpath, const char *name, unsigned int changes) {
+	unsigned long dir_length = strlen(dirpath);
+	unsigned long name_length = name != NULL ? strlen(name) : 0;
+	unsigned long length = dir_length + (name_length > 0 ? name_length + 1 : 0);
+
+	if (length + 1 > watch->scratch_cap) {
+		char *scratch = realloc(watch->scratch, length + 1);
+		if (scratch == NULL) {
+			return;
+		}
+		watch->scratch = scratch;
+		watch->scratch_cap = length + 1;
+	}
+	memcpy(watch->scratch, dirpath, dir_length);
+	if (name_length > 0) {
+		watch->scratch[dir_length] = '/';
+		memcpy(watch->scratch + dir_length + 1, name, name_length + 1);
+	} else {
+		watch->scratch[dir_length] = '\0';
+	}
+
+	const char *key = watch->scratch;
+	unsigned long number;
+	if (lepk__ht_get(watch->index, &key, &number)) {
+		watch->pending[watch->head + (number - watch->first)].changes |= changes;
+		return;
+	}
+
+	if (watch->tail == watch->cap) {
+		/* Reuse space freed by drains before growing. */
+		if (watch->head > 0) {
+			memmove(watch->pending, watch->pending + watch->head, (watch->tail - watch->head) * sizeof(LepkFileChangeRecord));
+			watch->tail -= watch->head;
+			watch->head = 0;
+		} else {
+			unsigned long cap = watch->cap ? watch->cap * 2 : 64;
+			LepkFileChangeRecord *pending = realloc(watch->pending, cap * sizeof(LepkFileChangeRecord));
+			if (pending == NULL) {
+				return;
+			}
+			watch->pending = pending;
+			watch->cap = cap;
+		}
+	}
+
+	char *path = malloc(length + 1);
+	if (path == NULL) {
+		return;
+	}
+	memcpy(path, watch->scratch, length + 1);
+
+	LepkFileChangeRecord record;
+	record.path = path;
+	record.changes = changes;
+	number = watch->first + (watch->tail - watch->head);
+	watch->pending[watch->tail++] = record;
+	lepk__ht_set(watch->index, &record.path, &number);
+}
+
+static void lepk__file_watch_read(LepkFileWatch *watch) {
+	/* inotify records are aligned like struct inotify_event. */
+	unsigned long long buffer[4096 / sizeof(unsigned long long)];
+	for (;;) {
+		ssize_t length = read(watch->fd, buffer, sizeof(buffer));
+		if (length <= 0) {
+			return;
+		}
+
+		for (ssize_t offset = 0; offset < length;) {
+			const struct inotify_event *event = (const struct inotify_event *) ((const char *) buffer + offset);
+			offset += sizeof(struct inotify_event) + event->len;
+
+			if (event->mask & IN_Q_OVERFLOW) {
+				lepk__file_watch_record(watch, "", NULL, LEPK_FILE_CHANGE_OVERFLOW);
+				continue;
+			}
+
+			unsigned long index = 0;
+			while (index < lepk_da_count(watch->targets) && watch->targets[index].wd != event->wd) {
+				index++;
+			}
+			if (index == lepk_da_count(watch->targets)) {
+				continue;
+			}
+
+			/* Kernel dropped the watch because the path is gone. */
+			if (event->mask & IN_IGNORED) {
+				Lepk__FileWatchTarget target;
+				lepk_da_remove_fast(watch->targets, index, &target);
+				free(target.path);
+				continue;
+			}
+
+			unsigned int changes = 0;
+			if (event->mask & (IN_MODIFY | IN_CLOSE_WRITE))                            { changes |= LEPK_FILE_CHANGE_MODIFIED; }
+			if (event->mask & (IN_CREATE | IN_MOVED_TO))                               { changes |= LEPK_FILE_CHANGE_CREATED;  }
+			if (event->mask & (IN_DELETE | IN_DELETE_SELF | IN_MOVED_FROM | IN_MOVE_SELF)) { changes |= LEPK_FILE_CHANGE_REMOVED;  }
+			if (event->mask & IN_ATTRIB)                                               { changes |= LEPK_FILE_CHANGE_ATTRIB;   }
+			if (changes != 0) {
+				lepk__file_watch_record(watch, watch->targets[index].path, event->len > 0 ? event->name : NULL, changes);
+			}
+		}
+	}
+}
+#endif /* LEPK__FILE_LINUX */
+
+LEPKFILEIMPL unsigned long lepk_file_watch_drain(LepkFileWatch *watch, LepkFileChangeRecord *records, unsigned long max) {
+#ifdef LEPK__FILE_LINUX
+	while (lepk_da_count(watch->drained) > 0) {
+		LepkFileChangeRecord record;
+		lepk_da_pop(watch->drained, &record);
+		free((char *) record.path);
+	}
+
+	lepk__file_watch_read(watch);
+
+	unsigned long count = watch->tail - watch->head < max ? watch->tail - watch->head : max;
+	memcpy(records, watch->pending + watch->head, count * sizeof(LepkFileChangeRecord));
+	lepk_da_push_array(watch->drained, records, count);
+	for (unsigned long i = 0; i < count; i++) {
+		lepk__ht_remove(watch->index, &records[i].path, NULL);
+	}
+	watch->head += count;
+	watch->first += count;
+	if (watch->head == watch->tail) {
+		watch->head = 0;
+		watch->tail = 0;
+	}
+	return count;
+#else /* LEPK__FILE_LINUX */
+	(void) watch;
+	(void) records;
+	(void) max;
+	return 0;
+#endif /* LEPK__FILE_LINUX */
+}
+
+LEPKFILEIMPL void lepk_file_watch_destroy(LepkFileWatch *watch) {
+#ifdef LEPK__FILE_LINUX
+	for (unsigned long i = 0; i < lepk_da_count(watch->targets); i++) {
+		free(watch->targets[i].path);
+	}
+	for (unsigned long i = watch->head; i < watch->tail; i++) {
+		free((char *) watch->pending[i].path);
+	}
+	for (unsigned long i = 0; i < lepk_da_count(watch->drained); i++) {
+		free((char *) watch->drained[i].path);
+	}
+	lepk_da_destroy(watch->targets);
+	free(watch->pending);
+	lepk_ht_destroy(watch->index);
+	free(watch->scratch);
+	lepk_da_destroy(watch->drained);
+	close(watch->fd);
+	free(watch);
+#else /* LEPK__FILE_LINUX */
+	(void) watch;
+#endif /* LEPK__FILE_LINUX */
+}
+
+struct LepkFileDir {
+	int fd;
+#ifdef LEPK__FILE_LINUX
+	long position;
+	long length;
+	/* Raw getdents64 records, unsigned long long for alignment. */
+	unsigned long long buffer[LEPK_FILE_DIR_BUFFER / sizeof(unsigned long long)];
+#else /* LEPK__FILE_LINUX */
+	DIR *dir;
+#endif /* LEPK__FILE_LINUX */
+};
+
+#ifdef LEPK__FILE_LINUX
+/* Layout of the records returned by getdents64. */
+typedef struct {
+	unsigned long long d_ino;
+	long long d_off;
+	unsigned short d_reclen;
+	unsigned char d_type;
+	char d_name[];
+} Lepk__FileDirent;
+#endif /* LEPK__FILE_LINUX */
+
+/* d_type is an extension, without it every entry costs a stat. */
+#ifdef DT_UNKNOWN
+static LepkFileType lepk__file_type_from_dirent(unsigned char d_type) {
+	switch (d_type) {
+		case DT_REG:     return LEPK_FILE_TYPE_REGULAR;
+		case DT_DIR:     return LEPK_FILE_TYPE_DIRECTORY;
+		case DT_LNK:     return LEPK_FILE_TYPE_SYMLINK;
+		case DT_UNKNOWN: return LEPK_FILE_TYPE_UNKNOWN;
+		default:         return LEPK_FILE_TYPE_OTHER;
+	}
+}
+#endif /* DT_UNKNOWN */
+
+static LepkFileType lepk__file_type_from_mode(mode_t mode) {
+	if (S_ISREG(mode)) { return LEPK_FILE_TYPE_REGULAR;   }
+	if (S_ISDIR(mode)) { return LEPK_FILE_TYPE_DIRECTORY; }
+	if (S_ISLNK(mode)) { return LEPK_FILE_TYPE_SYMLINK;   }
+	return LEPK_FILE_TYPE_OTHER;
+}
+
+static LepkFileDir *lepk__file_dir_open_at(int dirfd, const char *dirpath) {
+	int fd = openat(dirfd, dirpath, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd < 0) {
+		return NULL;
+	}
+
+	LepkFileDir *dir = malloc(sizeof(LepkFileDir));
+	if (dir == NULL) {
+		close(fd);
+		return NULL;
+	}
+	dir->fd = fd;
+#ifdef LEPK__FILE_LINUX
+	dir->position = 0;
+	dir->length = 0;
+#else /* LEPK__FILE_LINUX */
+	dir->dir = fdopendir(fd);
+	if (dir->dir == NULL) {
+		close(fd);
+		free(dir);
+		return NULL;
+	}
+#endif /* LEPK__FILE_LINUX */
+
+	return dir;
+}
+
+LEPKFILEIMPL LepkFileDir *lepk_file_dir_open(const char *dirpath, LepkFileStatus *status) {
+	LepkFileDir *dir = lepk__file_dir_open_at(AT_FDCWD, dirpath);
+	LEPK__FILE_SET_STATUS(status, dir != NULL ? LEPK_FILE_STATUS_OK : LEPK_FILE_STATUS_UNABLE_TO_OPEN_CREATE);
+	return dir;
+}
+
+LEPKFILEIMPL bool lepk_file_dir_next(LepkFileDir *dir, const char **name, LepkFileType *type) {
+	for (;;) {
+#ifdef LEPK__FILE_LINUX
+		if (dir->position >= dir->length) {
+			long length = syscall(SYS_getdents64, dir->fd, dir->buffer, sizeof(dir->buffer));
+			if (length <= 0) {
+				return false;
+			}
+			dir->position = 0;
+			dir->length = length;
+		}
+		const Lepk__FileDirent *entry = (const Lepk__FileDirent *) ((const char *) dir->buffer + dir->position);
+		dir->position += entry->d_reclen;
+#else /* LEPK__FILE_LINUX */
+		const struct dirent *entry = readdir(dir->dir);
+		if (entry == NULL) {
+			return false;
+		}
+#endif /* LEPK__FILE_LINUX */
+
+		const char *entry_name = entry->d_name;
+		if (entry_name[0] == '.' && (entry_name[1] == '\0' || (entry_name[1] == '.' && entry_name[2] == '\0'))) {
+			continue;
+		}
+
+		/* Only filesystems which do not fill in d_type cost a stat. */
+#ifdef DT_UNKNOWN
+		LepkFileType entry_type = lepk__file_type_from_dirent(entry->d_type);
+#else /* DT_UNKNOWN */
+		LepkFileType entry_type = LEPK_FILE_TYPE_UNKNOWN;
+#endif /* DT_UNKNOWN */
+		if (entry_type == LEPK_FILE_TYPE_UNKNOWN) {
+			struct stat st;
+			if (fstatat(dir->fd, entry_name, &st, AT_SYMLINK_NOFOLLOW) == 0) {
+				entry_type = lepk__file_type_from_mode(st.st_mode);
+			}
+		}
+
+		*name = entry_name;
+		if (type != NULL) {
+			*type = entry_type;
+		}
+		return true;
+	}
+}
+
+LEPKFILEIMPL void lepk_file_dir_close(LepkFileDir *dir) {
+#ifdef LEPK__FILE_LINUX
+	close(dir->fd);
+#else /* LEPK__FILE_LINUX */
+	closedir(dir->dir);
+#endif /* LEPK__FILE_LINUX */
+	free(dir);
+}
+
+/* Chain of memory blocks, paths never move once allocated. */
+typedef struct Lepk__FileArena Lepk__FileArena;
+struct Lepk__FileArena {
+	Lepk__FileArena *next;
+	unsigned long used;
+	unsigned long cap;
+	char data[];
+};
+
+static char *lepk__file_arena_alloc(Lepk__FileArena **arena, unsigned long size) {
+	Lepk__FileArena *block = *arena;
+	if (block == NULL || block->used + size > block->cap) {
+		unsigned long cap = size > LEPK_FILE_ARENA_BLOCK ? size : LEPK_FILE_ARENA_BLOCK;
+		block = malloc(sizeof(Lepk__FileArena) + cap);
+		if (block == NULL) {
+			return NULL;
+		}
+		block->next = *arena;
+		block->used = 0;
+		block->cap = cap;
+		*arena = block;
+	}
+
+	char *ptr = block->data + block->used;
+	block->used += size;
+	return ptr;
+}
+
+static void lepk__file_arena_destroy(Lepk__FileArena *arena) {
+	while (arena != NULL) {
+		Lepk__FileArena *next = arena->next;
+		free(arena);
+		arena = next;
+	}
+}
+
+typedef struct Lepk__FileWalker Lepk__FileWalker;
+
+/* Per thread walk state. Directories are popped from the back by the owner and stolen from the front by other workers. */
+typedef struct {
+	pthread_mutex_t mutex;
+	LepkFilePath *queue;
+	unsigned long head;
+	unsigned long tail;
+	unsigned long cap;
+
+	/* Dynamic array of results. */
+	LepkFilePath *paths;
+	Lepk__FileArena *arena;
+	Lepk__FileWalker *walker;
+	unsigned int index;
+} Lepk__FileWalkWorker;
+
+struct Lepk__FileWalker {
+	const LepkFileWalkOptions *options;
+	Lepk__FileWalkWorker *workers;
+	unsigned int worker_count;
+	/* Directories queued or being walked, the walk is done when this reaches 0. */
+	unsigned long pending;
+	bool out_of_memory;
+
+	/* Idle workers sleep on cond until a push bumps pushed or pending reaches 0. */
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	unsigned long pushed;
+	unsigned int idle;
+};
+
+static bool lepk__file_walk_match(const LepkFileWalkOptions *options, const char *name) {
+	if (options->suffix != NULL) {
+		unsigned long name_length = strlen(name);
+		unsigned long suffix_length = strlen(options->suffix);
+		if (suffix_length > name_length || memcmp(name + name_length - suffix_length, options->suffix, suffix_length) != 0) {
+			return false;
+		}
+	}
+	if (options->pattern != NULL && fnmatch(options->pattern, name, 0) != 0) {
+		return false;
+	}
+	return true;
+}
+
+static void lepk__file_walk_push(Lepk__FileWalkWorker *worker, const LepkFilePath *dirpath) {
+	pthread_mutex_lock(&worker->mutex);
+	if (worker->tail == worker->cap) {
+		/* Reuse space freed by thieves before growing. */
+		if (worker->head > 0) {
+			memmove(worker->queue, worker->queue + worker->head, (worker->tail - worker->head) * sizeof(LepkFilePath));
+			worker->tail -= worker->head;
+			worker->head = 0;
+		} else {
+			unsigned long cap = worker->cap ? worker->cap * 2 : 64;
+			LepkFilePath *queue = realloc(worker->queue, cap * sizeof(LepkFilePath));
+			if (queue == NULL) {
+				__atomic_store_n(&worker->walker->out_of_memory, true, __ATOMIC_RELAXED);
+				pthread_mutex_unlock(&worker->mutex);
+				return;
+			}
+			worker->queue = queue;
+			worker->cap = cap;
+		}
+	}
+	worker->queue[worker->tail++] = *dirpath;
+	__atomic_add_fetch(&worker->walker->pending, 1, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&worker->mutex);
+
+	Lepk__FileWalker *walker = worker->walker;
+	pthread_mutex_lock(&walker->mutex);
+	__atomic_add_fetch(&walker->pushed, 1, __ATOMIC_RELEASE);
+	if (walker->idle > 0) {
+		pthread_cond_signal(&walker->cond);
+	}
+	pthread_mutex_unlock(&walker->mutex);
+}
+
+static bool lepk__file_walk_take(Lepk__FileWalkWorker *worker, LepkFilePath *output, bool steal) {
+	bool found = false;
+	pthread_mutex_lock(&worker->mutex);
+	if (worker->tail > worker->head) {
+		*output = steal ? worker->queue[worker->head++] : worker->queue[--worker->tail];
+		if (worker->head == worker->tail) {
+			worker->head = 0;
+			worker->tail = 0;
+		}
+		found = true;
+	}
+	pthread_mutex_unlock(&worker->mutex);
+	return found;
+}
+
+static void lepk__file_walk_dir(Lepk__FileWalkWorker *worker, const LepkFilePath *dirpath) {
+	const LepkFileWalkOptions *options = worker->walker->options;
+
+	/* Unreadable directories are skipped. */
+	LepkFileDir *dir = lepk__file_dir_open_at(AT_FDCWD, dirpath->path);
+	if (dir == NULL) {
+		return;
+	}
+
+	const char *name;
+	LepkFileType type;
+	while (lepk_file_dir_next(dir, &name, &type)) {
+		bool is_dir  = type == LEPK_FILE_TYPE_DIRECTORY;
+		bool report  = is_dir ? options->directories : lepk__file_walk_match(options, name);
+		bool descend = is_dir && options->recursive;
+		if (!report && !descend) {
+			continue;
+		}
+
+		/* Only the root can end with a slash, "/" itself. */
+		unsigned long separator = dirpath->path[dirpath->length - 1] != '/';
+		unsigned long name_length = strlen(name);
+		LepkFilePath path;
+		path.length = dirpath->length + separator + name_length;
+		path.type = type;
+
+		char *str = lepk__file_arena_alloc(&worker->arena, path.length + 1);
+		if (str == NULL) {
+			__atomic_store_n(&worker->walker->out_of_memory, true, __ATOMIC_RELAXED);
+			break;
+		}
+		memcpy(str, dirpath->path, dirpath->length);
+		str[dirpath->length] = '/';
+		memcpy(str + dirpath->length + separator, name, name_length + 1);
+		path.path = str;
+
+		if (report) {
+			lepk_da_push(worker->paths, path);
+		}
+		if (descend) {
+			lepk__file_walk_push(worker, &path);
+		}
+	}
+
+	lepk_file_dir_close(dir);
+}
+
+static void *lepk__file_walk_worker(void *arg) {
+	Lepk__FileWalkWorker *worker = arg;
+	Lepk__FileWalker *walker = worker->walker;
+
+	for (;;) {
+		/* Read before looking, so a push that lands after the queues were checked is never slept through. */
+		unsigned long pushed = __atomic_load_n(&walker->pushed, __ATOMIC_ACQUIRE);
+		LepkFilePath dirpath;
+		bool found = lepk__file_walk_take(worker, &dirpath, false);
+		for (unsigned int i = 1; !found && i < walker->worker_count; i++) {
+			found = lepk__file_walk_take(&walker->workers[(worker->index + i) % walker->worker_count], &dirpath, true);
+		}
+
+		if (found) {
+			lepk__file_walk_dir(worker, &dirpath);
+			if (__atomic_sub_fetch(&walker->pending, 1, __ATOMIC_ACQ_REL) == 0) {
+				pthread_mutex_lock(&walker->mutex);
+				pthread_cond_broadcast(&walker->cond);
+				pthread_mutex_unlock(&walker->mutex);
+			}
+			continue;
+		}
+
+		pthread_mutex_lock(&walker->mutex);
+		walker->idle++;
+		while (__atomic_load_n(&walker->pushed, __ATOMIC_ACQUIRE) == pushed && __atomic_load_n(&walker->pending, __ATOMIC_ACQUIRE) != 0) {
+			pthread_cond_wait(&walker->cond, &walker->mutex);
+		}
+		walker->idle--;
+		bool done = __atomic_load_n(&walker->pending, __ATOMIC_ACQUIRE) == 0;
+		pthread_mutex_unlock(&walker->mutex);
+		if (done) {
+			break;
+		}
+	}
+
+	return NULL;
+}
+
+LEPKFILEIMPL LepkFileStatus lepk_file_walk(const char *dirpath, const LepkFileWalkOptions *options, LepkFileWalk *output) {
+	LepkFileWalkOptions default_options = {0};
+	if (options == NULL) {
+		options = &default_options;
+	}
+	output->paths = NULL;
+	output->arena = NULL;
+
+	struct stat st;
+	if (stat(dirpath, &st) != 0 || !S_ISDIR(st.st_mode)) {
+		return LEPK_FILE_STATUS_UNABLE_TO_OPEN_CREATE;
+	}
+
+	Lepk__FileWalker walker = {0};
+	walker.options = options;
+	walker.worker_count = options->threads > 1 ? options->threads : 1;
+	walker.workers = calloc(walker.worker_count, sizeof(Lepk__FileWalkWorker));
+	if (walker.workers == NULL) {
+		return LEPK_FILE_STATUS_OUT_OF_MEMORY;
+	}
+	pthread_mutex_init(&walker.mutex, NULL);
+	pthread_cond_init(&walker.cond, NULL);
+	for (unsigned int i = 0; i < walker.worker_count; i++) {
+		Lepk__FileWalkWorker *worker = &walker.workers[i];
+		pthread_mutex_init(&worker->mutex, NULL);
+		worker->paths = lepk_da_create(sizeof(LepkFilePath));
+		worker->walker = &walker;
+		worker->index = i;
+	}
+
+	/* Root without trailing slashes, so joined paths never contain "//". */
+	LepkFilePath root;
+	root.length = strlen(dirpath);
+	while (root.length > 1 && dirpath[root.length - 1] == '/') {
+		root.length--;
+	}
+	root.type = LEPK_FILE_TYPE_DIRECTORY;
+	char *root_str = lepk__file_arena_alloc(&walker.workers[0].arena, root.length + 1);
+	if (root_str != NULL) {
+		memcpy(root_str, dirpath, root.length);
+		root_str[root.length] = '\0';
+		root.path = root_str;
+		lepk__file_walk_push(&walker.workers[0], &root);
+	} else {
+		__atomic_store_n(&walker.out_of_memory, true, __ATOMIC_RELAXED);
+	}
+
+	/* Worker 0 runs on the calling thread. Workers that fail to start never get work queued on them. */
+	pthread_t *threads = walker.worker_count > 1 ? malloc((walker.worker_count - 1) * sizeof(pthread_t)) : NULL;
+	bool *started = walker.worker_count > 1 ? calloc(walker.worker_count - 1, sizeof(bool)) : NULL;
+	if (threads != NULL && started != NULL) {
+		for (unsigned int i = 1; i < walker.worker_count; i++) {
+			started[i - 1] = pthread_create(&threads[i - 1], NULL, lepk__file_walk_worker, &walker.workers[i]) == 0;
+		}
+	}
+	lepk__file_walk_worker(&walker.workers[0]);
+	if (threads != NULL && started != NULL) {
+		for (unsigned int i = 1; i < walker.worker_count; i++) {
+			if (started[i - 1]) {
+				pthread_join(threads[i - 1], NULL);
+			}
+		}
+	}
+	free(threads);
+	free(started);
+
+	/* Merge results and arenas of every worker. */
+	output->paths = walker.workers[0].paths;
+	for (unsigned int i = 0; i < walker.worker_count; i++) {
+		Lepk__FileWalkWorker *worker = &walker.workers[i];
+		if (i > 0) {
+			lepk_da_push_array(output->paths, worker->paths, lepk_da_count(worker->paths));
+			lepk_da_destroy(worker->paths);
+		}
+
+		Lepk__FileArena *last = worker->arena;
+		while (last != NULL && last->next != NULL) {
+			last = last->next;
+		}
+		if (last != NULL) {
+			last->next = output->arena;
+			output->arena = worker->arena;
+		}
+
+		free(worker->queue);
+		pthread_mutex_destroy(&worker->mutex);
+	}
+	free(walker.workers);
+	pthread_cond_destroy(&walker.cond);
+	pthread_mutex_destroy(&walker.mutex);
+
+	return walker.out_of_memory ? LEPK_FILE_STATUS_OUT_OF_MEMORY : LEPK_FILE_STATUS_OK;
+}
+
+LEPKFILEIMPL void lepk_file_walk_destroy(LepkFileWalk *walk) {
+	if (walk->paths != NULL) {
+		lepk_da_destroy(walk->paths);
+	}
+	lepk__file_arena_destroy(walk->arena);
+	walk->paths = NULL;
+	walk->arena = NULL;
 }
+#endif /* LEPK__FILE_POSIX */
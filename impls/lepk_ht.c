@@ -5,6 +5,16 @@
 #include <string.h>
 #include <assert.h>
 #include <stdint.h>
+#include <stdio.h>
+
+/* Only images need POSIX, snapshots are synced when it is there and the rest is plain C99. */
+#if defined(_POSIX_C_SOURCE) && _POSIX_C_SOURCE >= 200809L
+#define LEPK__HT_POSIX
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif /* _POSIX_C_SOURCE */
 
 #undef LEPKHT
 #ifndef LEPK_HT_STATIC
@@ -20,8 +30,55 @@ typedef struct Lepk__HtEntry {
 	void *data;
 	size_t hash;
 	bool dead;
+	/* Dead because it was removed, lookups have to probe past it. */
+	bool tombstone;
 } Lepk__HtEntry;
 
+#define LEPK__HT_IMAGE_VERSION 1
+/* Keys and data are padded so every slot of an image is 8 byte aligned. */
+#define LEPK__HT_ALIGN(n) (((n) + 7ul) & ~7ul)
+
+/* Start of a hash table image, followed by cap slots in the same order as the entries of the table. */
+typedef struct {
+	char magic[8];
+	unsigned int version;
+	unsigned int reserved;
+	unsigned long long key_size;
+	unsigned long long data_size;
+	unsigned long long cap;
+	unsigned long long count;
+} Lepk__HtImageHeader;
+
+typedef enum {
+	LEPK__HT_SLOT_EMPTY,
+	LEPK__HT_SLOT_USED,
+	LEPK__HT_SLOT_TOMBSTONE,
+} Lepk__HtSlotState;
+
+/* Start of every slot of an image, followed by the key and the data. */
+typedef struct {
+	unsigned long long hash;
+	unsigned int state;
+	unsigned int reserved;
+} Lepk__HtImageSlot;
+
+static const char lepk__ht_magic[8] = { 'L', 'E', 'P', 'K', 'H', 'T', '\0', '\0' };
+
+#if defined(LEPK__HT_POSIX) && !defined(LEPK_HT_NO_IMAGE)
+struct LepkHtImage {
+	LepkHtHash hash;
+	LepkHtCompare compare;
+
+	const unsigned char *map;
+	size_t map_size;
+	size_t key_size;
+	size_t data_size;
+	size_t cap;
+	size_t count;
+	size_t stride;
+};
+#endif /* LEPK__HT_POSIX && !LEPK_HT_NO_IMAGE */
+
 struct LepkHt {
 	LepkHtHash hash;
 	LepkHtCompare compare;
@@ -30,25 +87,39 @@ struct LepkHt {
 	size_t data_size;
 	size_t cap;
 	size_t count;
+	size_t tombstones;
 	Lepk__HtEntry *entires;
+	/* Image a loaded table was read into, keys and data of its slots point into it and are not freed on their own. */
+	unsigned char *image;
+	size_t image_size;
 };
 
-static Lepk__HtEntry *lepk__ht_find_entry(Lepk__HtEntry *entires, LepkHtCompare compare, unsigned long hash, unsigned long cap, const void *key, unsigned long key_size) {
-	size_t index = hash % cap;
-	Lepk__HtEntry *entry = &entires[index];
-
-	/* No entry at index. */
-	if (entry->dead) {
-		return entry;
+/* Free a key or data allocation, unless it points into the image the table was loaded from. */
+static void lepk__ht_free(const LepkHt *table, void *ptr) {
+	uintptr_t address = (uintptr_t) ptr;
+	uintptr_t image = (uintptr_t) table->image;
+	if (address < image || address >= image + table->image_size) {
+		free(ptr);
 	}
+}
+
+/* Find entry holding key, or the slot key should be inserted at if it is missing. */
+static Lepk__HtEntry *lepk__ht_find_entry(Lepk__HtEntry *entires, LepkHtCompare compare, unsigned long hash, unsigned long cap, const void *key, unsigned long key_size) {
+	size_t index = hash & (cap - 1);
+	Lepk__HtEntry *tombstone = NULL;
 
-	/* Entry at current location. */
 	for (;;) {
-		entry = &entires[index];
-		/* printf("%s\n", entry->dead ? "dead" : "alive"); */
+		Lepk__HtEntry *entry = &entires[index];
 
-		/* Found entry with same key or an empty slot. */
-		if (entry->dead || compare(key, entry->key, key_size) == 0) {
+		if (entry->dead) {
+			/* Never used slot ends the probe, reuse the first tombstone passed on the way. */
+			if (!entry->tombstone) {
+				return tombstone != NULL ? tombstone : entry;
+			}
+			if (tombstone == NULL) {
+				tombstone = entry;
+			}
+		} else if (entry->hash == hash && compare(key, entry->key, key_size) == 0) {
 			return entry;
 		}
 
@@ -66,13 +137,17 @@ LEPKHT LepkHt *lepk_ht_create(LepkHtHash hash, LepkHtCompare compare, unsigned l
 	table->data_size = data_size;
 	table->cap = 8;
 	table->count = 0;
+	table->tombstones = 0;
 	table->entires = malloc(table->cap * sizeof(Lepk__HtEntry));
+	table->image = NULL;
+	table->image_size = 0;
 
 	for (size_t i = 0; i < table->cap; i++) {
 		table->entires[i].key = NULL;
 		table->entires[i].data = NULL;
 		table->entires[i].hash = 0;
 		table->entires[i].dead = true;
+		table->entires[i].tombstone = false;
 	}
 
 	return table;
@@ -81,10 +156,11 @@ LEPKHT LepkHt *lepk_ht_create(LepkHtHash hash, LepkHtCompare compare, unsigned l
 LEPKHT void lepk_ht_destroy(LepkHt *table) {
 	for (size_t i = 0; i < table->cap; i++) {
 		Lepk__HtEntry *entry = &table->entires[i];
-		if (entry->key  != NULL) { free(entry->key);  }
-		if (entry->data != NULL) { free(entry->data); }
+		if (entry->key  != NULL) { lepk__ht_free(table, entry->key);  }
+		if (entry->data != NULL) { lepk__ht_free(table, entry->data); }
 	}
 	free(table->entires);
+	free(table->image);
 	free(table);
 }
 
@@ -93,9 +169,9 @@ LEPKHT unsigned long lepk_ht_count(const LepkHt *table) {
 }
 
 LEPKHT void lepk__ht_set(LepkHt *table, const void *key, const void *data) {
-	/* Resize table if needed. */
-	if (table->count >= (size_t) (table->cap * LEPK_HT_MAX_LOAD)) {
-		size_t new_cap = table->cap * 2;
+	/* Resize table if needed, tombstones count towards the load since they lengthen probes. */
+	if (table->count + table->tombstones >= (size_t) (table->cap * LEPK_HT_MAX_LOAD)) {
+		size_t new_cap = table->count * 2 >= table->cap ? table->cap * 2 : table->cap;
 
 		Lepk__HtEntry *new_entires = malloc(new_cap * sizeof(Lepk__HtEntry));
 		for (size_t i = 0; i < new_cap; i++) {
@@ -103,6 +179,7 @@ LEPKHT void lepk__ht_set(LepkHt *table, const void *key, const void *data) {
 			new_entires[i].data = NULL;
 			new_entires[i].hash = 0;
 			new_entires[i].dead = true;
+			new_entires[i].tombstone = false;
 		}
 		/* Loop through old entires and place then in the new list. */
 		for (size_t i = 0; i < table->cap; i++) {
@@ -110,10 +187,14 @@ LEPKHT void lepk__ht_set(LepkHt *table, const void *key, const void *data) {
 			if (!entry->dead) {
 				Lepk__HtEntry *new_entry = lepk__ht_find_entry(new_entires, table->compare, entry->hash, new_cap, entry->key, table->key_size);
 				memcpy(new_entry, entry, sizeof(Lepk__HtEntry));
+			} else {
+				lepk__ht_free(table, entry->key);
+				lepk__ht_free(table, entry->data);
 			}
 		}
 
 		table->cap = new_cap;
+		table->tombstones = 0;
 		free(table->entires);
 		table->entires = new_entires;
 	}
@@ -122,40 +203,67 @@ LEPKHT void lepk__ht_set(LepkHt *table, const void *key, const void *data) {
 	Lepk__HtEntry *entry = lepk__ht_find_entry(table->entires, table->compare, hash, table->cap, key, table->key_size);
 	if (entry->dead) {
 		table->count++;
+		if (entry->tombstone) {
+			table->tombstones--;
+		}
+
+		/* Slots keep their allocations, sizes are the same for every pair. */
+		if (entry->key == NULL) {
+			entry->key = malloc(table->key_size);
+		}
+		if (entry->data == NULL) {
+			entry->data = malloc(table->data_size);
+		}
+		memcpy(entry->key, key, table->key_size);
+		entry->hash = hash;
+		entry->dead = false;
+		entry->tombstone = false;
 	}
 
-	entry->data = malloc(table->data_size);
 	memcpy(entry->data, data, table->data_size);
-	entry->key = malloc(table->key_size);
-	memcpy(entry->key, key, table->key_size);
-	entry->hash = hash;
-	entry->dead = false;
 }
 
-LEPKHT void lepk__ht_get(LepkHt *table, const void *key, void *output) {
+LEPKHT bool lepk__ht_get(LepkHt *table, const void *key, void *output) {
 	assert(output != NULL && "Output pointer can't be NULL.");
 	Lepk__HtEntry *entry = lepk__ht_find_entry(table->entires, table->compare, table->hash(key, table->key_size), table->cap, key, table->key_size);
 	if (entry->dead) {
-		return;
+		return false;
 	}
 	memcpy(output, entry->data, table->data_size);
+	return true;
 }
 
-LEPKHT void lepk__ht_remove(LepkHt *table, const void *key, void *output) {
+LEPKHT bool lepk__ht_remove(LepkHt *table, const void *key, void *output) {
 	Lepk__HtEntry *entry = lepk__ht_find_entry(table->entires, table->compare, table->hash(key, table->key_size), table->cap, key, table->key_size);
 	if (entry->dead) {
-		return;
+		return false;
 	}
 	if (output != NULL) {
 		memcpy(output, entry->data, table->data_size);
 	}
 	entry->dead = true;
+	entry->tombstone = true;
 	table->count--;
+	table->tombstones++;
+	return true;
+}
+
+LEPKHT bool lepk_ht_next(const LepkHt *table, unsigned long *iterator, void *key, void *data) {
+	for (; *iterator < table->cap; (*iterator)++) {
+		const Lepk__HtEntry *entry = &table->entires[*iterator];
+		if (!entry->dead) {
+			if (key  != NULL) { memcpy(key,  entry->key,  table->key_size);  }
+			if (data != NULL) { memcpy(data, entry->data, table->data_size); }
+			(*iterator)++;
+			return true;
+		}
+	}
+	return false;
 }
 
 LEPKHT unsigned long lepk_ht_hash_string(const void *key, unsigned long size) {
 	(void) size;
-	const char *_key = key;
+	const char *_key = *(const char *const *) key;
 	unsigned long len = strlen(_key);
 	unsigned long hash = 2166136261lu;
 	for (unsigned long i = 0; i < len; i++) {
@@ -167,13 +275,13 @@ LEPKHT unsigned long lepk_ht_hash_string(const void *key, unsigned long size) {
 
 LEPKHT int lepk_ht_compare_string(const void *a, const void *b, unsigned long size) {
 	(void) size;
-	return strcmp((const char *) a, (const char *) b);
+	return strcmp(*(const char *const *) a, *(const char *const *) b);
 }
 
 LEPKHT unsigned long lepk_ht_hash_generic(const void *key, unsigned long size) {
 	size_t hash = 2166136261lu;
 	for (size_t i = 0; i < size; i++) {
-		hash ^= *(uint8_t *) key + i;
+		hash ^= ((const uint8_t *) key)[i];
 		hash *= 16777619;
 	}
 	return hash;
@@ -182,3 +290,205 @@ LEPKHT unsigned long lepk_ht_hash_generic(const void *key, unsigned long size) {
 LEPKHT int lepk_ht_compare_generic(const void *a, const void *b, unsigned long size) {
 	return memcmp(a, b, size);
 }
+
+static size_t lepk__ht_stride(size_t key_size, size_t data_size) {
+	return sizeof(Lepk__HtImageSlot) + LEPK__HT_ALIGN(key_size) + LEPK__HT_ALIGN(data_size);
+}
+
+/* Check that an image is complete and holds pairs of the expected sizes. */
+static const Lepk__HtImageHeader *lepk__ht_image_check(const unsigned char *image, size_t size, size_t key_size, size_t data_size) {
+	if (size < sizeof(Lepk__HtImageHeader)) {
+		return NULL;
+	}
+	const Lepk__HtImageHeader *header = (const Lepk__HtImageHeader *) image;
+	if (memcmp(header->magic, lepk__ht_magic, sizeof(lepk__ht_magic)) != 0 || header->version != LEPK__HT_IMAGE_VERSION ||
+		header->key_size != key_size || header->data_size != data_size || header->cap == 0 || (header->cap & (header->cap - 1)) != 0 ||
+		header->cap > (size - sizeof(Lepk__HtImageHeader)) / lepk__ht_stride(key_size, data_size) || header->count >= header->cap) {
+		return NULL;
+	}
+	return header;
+}
+
+/* Write data next to filepath and rename it over filepath once it is on disk, a crash leaves either the old or the new file. */
+static bool lepk__ht_save(const char *filepath, const void *data, size_t size) {
+	size_t length = strlen(filepath) + 5;
+	char *temp = malloc(length);
+	if (temp == NULL) {
+		return false;
+	}
+	snprintf(temp, length, "%s.tmp", filepath);
+
+	FILE *file = fopen(temp, "wb");
+	bool written = file != NULL && fwrite(data, size, 1, file) == 1 && fflush(file) == 0;
+#ifdef LEPK__HT_POSIX
+	written = written && fsync(fileno(file)) == 0;
+#endif /* LEPK__HT_POSIX */
+	if (file != NULL && fclose(file) != 0) {
+		written = false;
+	}
+	written = written && rename(temp, filepath) == 0;
+	if (!written) {
+		remove(temp);
+	}
+	free(temp);
+	return written;
+}
+
+LEPKHT bool lepk_ht_snapshot(const LepkHt *table, const char *filepath) {
+	size_t stride = lepk__ht_stride(table->key_size, table->data_size);
+	size_t size = sizeof(Lepk__HtImageHeader) + table->cap * stride;
+	unsigned char *image = calloc(1, size);
+	if (image == NULL) {
+		return false;
+	}
+
+	Lepk__HtImageHeader *header = (Lepk__HtImageHeader *) image;
+	memcpy(header->magic, lepk__ht_magic, sizeof(lepk__ht_magic));
+	header->version = LEPK__HT_IMAGE_VERSION;
+	header->key_size = table->key_size;
+	header->data_size = table->data_size;
+	header->cap = table->cap;
+	header->count = table->count;
+
+	/* Slots stay where they are, tombstones included, so probe sequences are the same after loading. */
+	for (size_t i = 0; i < table->cap; i++) {
+		const Lepk__HtEntry *entry = &table->entires[i];
+		unsigned char *ptr = image + sizeof(Lepk__HtImageHeader) + i * stride;
+		Lepk__HtImageSlot *slot = (Lepk__HtImageSlot *) ptr;
+		if (!entry->dead) {
+			slot->hash = entry->hash;
+			slot->state = LEPK__HT_SLOT_USED;
+			memcpy(ptr + sizeof(Lepk__HtImageSlot), entry->key, table->key_size);
+			memcpy(ptr + sizeof(Lepk__HtImageSlot) + LEPK__HT_ALIGN(table->key_size), entry->data, table->data_size);
+		} else if (entry->tombstone) {
+			slot->state = LEPK__HT_SLOT_TOMBSTONE;
+		}
+	}
+
+	bool written = lepk__ht_save(filepath, image, size);
+	free(image);
+	return written;
+}
+
+LEPKHT LepkHt *lepk_ht_load(const char *filepath, LepkHtHash hash, LepkHtCompare compare, unsigned long key_size, unsigned long data_size) {
+	/* Keys and data stay in the buffer the image is read into, loading allocates the same no matter how many pairs there are. */
+	FILE *file = fopen(filepath, "rb");
+	if (file == NULL) {
+		return NULL;
+	}
+	long size = -1;
+	if (fseek(file, 0, SEEK_END) == 0) {
+		size = ftell(file);
+	}
+	unsigned char *image = size > 0 && fseek(file, 0, SEEK_SET) == 0 ? malloc(size) : NULL;
+	bool ok = image != NULL && fread(image, size, 1, file) == 1;
+	fclose(file);
+
+	const Lepk__HtImageHeader *header = ok ? lepk__ht_image_check(image, size, key_size, data_size) : NULL;
+	LepkHt *table = header != NULL ? malloc(sizeof(LepkHt)) : NULL;
+	Lepk__HtEntry *entires = table != NULL ? calloc(header->cap, sizeof(Lepk__HtEntry)) : NULL;
+	ok = entires != NULL;
+	size_t stride = lepk__ht_stride(key_size, data_size);
+	size_t count = 0;
+	size_t tombstones = 0;
+	for (size_t i = 0; ok && i < header->cap; i++) {
+		unsigned char *ptr = image + sizeof(Lepk__HtImageHeader) + i * stride;
+		const Lepk__HtImageSlot *slot = (const Lepk__HtImageSlot *) ptr;
+		Lepk__HtEntry *entry = &entires[i];
+		entry->dead = slot->state != LEPK__HT_SLOT_USED;
+		entry->tombstone = slot->state == LEPK__HT_SLOT_TOMBSTONE;
+		if (!entry->dead) {
+			entry->hash = slot->hash;
+			entry->key = ptr + sizeof(Lepk__HtImageSlot);
+			entry->data = ptr + sizeof(Lepk__HtImageSlot) + LEPK__HT_ALIGN(key_size);
+		}
+		count += !entry->dead;
+		tombstones += entry->tombstone;
+		ok = slot->state <= LEPK__HT_SLOT_TOMBSTONE;
+	}
+
+	/* Probing in a loaded table is unbounded, so the slots have to match the header and leave an empty slot to stop at. */
+	ok = ok && count == header->count && count + tombstones < header->cap;
+	if (!ok) {
+		free(entires);
+		free(table);
+		free(image);
+		return NULL;
+	}
+
+	table->hash = hash;
+	table->compare = compare;
+	table->key_size = key_size;
+	table->data_size = data_size;
+	table->cap = header->cap;
+	table->count = count;
+	table->tombstones = tombstones;
+	table->entires = entires;
+	table->image = image;
+	table->image_size = size;
+	return table;
+}
+
+#if defined(LEPK__HT_POSIX) && !defined(LEPK_HT_NO_IMAGE)
+LEPKHT LepkHtImage *lepk_ht_image_open(const char *filepath, LepkHtHash hash, LepkHtCompare compare, unsigned long key_size, unsigned long data_size) {
+	int fd = open(filepath, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		return NULL;
+	}
+	struct stat st;
+	void *map = MAP_FAILED;
+	if (fstat(fd, &st) == 0 && st.st_size > 0) {
+		map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	}
+	close(fd);
+	if (map == MAP_FAILED) {
+		return NULL;
+	}
+
+	const Lepk__HtImageHeader *header = lepk__ht_image_check(map, st.st_size, key_size, data_size);
+	LepkHtImage *image = header != NULL ? malloc(sizeof(LepkHtImage)) : NULL;
+	if (image == NULL) {
+		munmap(map, st.st_size);
+		return NULL;
+	}
+
+	image->hash = hash;
+	image->compare = compare;
+	image->map = map;
+	image->map_size = st.st_size;
+	image->key_size = key_size;
+	image->data_size = data_size;
+	image->cap = header->cap;
+	image->count = header->count;
+	image->stride = lepk__ht_stride(key_size, data_size);
+	return image;
+}
+
+LEPKHT void lepk_ht_image_close(LepkHtImage *image) {
+	munmap((void *) image->map, image->map_size);
+	free(image);
+}
+
+LEPKHT unsigned long lepk_ht_image_count(const LepkHtImage *image) {
+	return image->count;
+}
+
+LEPKHT const void *lepk_ht_image_find(const LepkHtImage *image, const void *key) {
+	size_t hash = image->hash(key, image->key_size);
+	size_t index = hash & (image->cap - 1);
+
+	/* Same probing as lepk__ht_find_entry, bounded since an image comes from outside. */
+	for (size_t i = 0; i < image->cap; i++) {
+		const unsigned char *ptr = image->map + sizeof(Lepk__HtImageHeader) + index * image->stride;
+		const Lepk__HtImageSlot *slot = (const Lepk__HtImageSlot *) ptr;
+		if (slot->state == LEPK__HT_SLOT_EMPTY) {
+			return NULL;
+		}
+		if (slot->state == LEPK__HT_SLOT_USED && slot->hash == hash && image->compare(key, ptr + sizeof(Lepk__HtImageSlot), image->key_size) == 0) {
+			return ptr + sizeof(Lepk__HtImageSlot) + LEPK__HT_ALIGN(image->key_size);
+		}
+		index = (index + 1) & (image->cap - 1);
+	}
+	return NULL;
+}
+#endif /* LEPK__HT_POSIX && !LEPK_HT_NO_IMAGE */
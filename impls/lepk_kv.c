@@ -0,0 +1,1070 @@
+#include "lepk_kv.h"
+
+#include "lepk_da.h"
+#include "lepk_checksum.h"
+#include "lepk_ht.h"
+#include "lepk_file.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#if !defined(_POSIX_C_SOURCE) || _POSIX_C_SOURCE < 200809L
+#error "lepk_kv.h needs _POSIX_C_SOURCE defined as 200809L or _GNU_SOURCE defined before any system header is included."
+#endif /* _POSIX_C_SOURCE */
+
+#ifndef LEPK_KV_FILE_SIZE
+#define LEPK_KV_FILE_SIZE (64ul * 1024 * 1024)
+#endif /* LEPK_KV_FILE_SIZE */
+
+#ifndef LEPK_KV_BUFFER_SIZE
+#define LEPK_KV_BUFFER_SIZE (64ul * 1024)
+#endif /* LEPK_KV_BUFFER_SIZE */
+
+#define LEPK__KV_SET_STATUS(p, s) do {if ((p)) { *(p) = (s); }} while (0)
+
+#define LEPK__KV_VERSION 1
+/* Value length of a delete record. */
+#define LEPK__KV_TOMBSTONE 0xffffffffu
+
+/* Start of every data and hint file. */
+typedef struct {
+	char magic[8];
+	unsigned int version;
+	unsigned int reserved;
+} Lepk__KvFileHeader;
+
+/* Start of every record in a data file, followed by the key and the value. Records are packed, read them with memcpy. */
+typedef struct {
+	/* crc32c of everything after it, including key and value. */
+	unsigned int crc;
+	unsigned int key_length;
+	/* LEPK__KV_TOMBSTONE if the record deletes the key. */
+	unsigned int value_length;
+	unsigned int reserved;
+	/* Write order, when a key shows up more than once the highest sequence wins. */
+	unsigned long long sequence;
+} Lepk__KvRecord;
+
+/* Entry of a hint file, followed by the key. */
+typedef struct {
+	unsigned long long sequence;
+	/* Offset of the value in the data file. */
+	unsigned long long offset;
+	unsigned int key_length;
+	unsigned int value_length;
+} Lepk__KvHint;
+
+/* Key of the index, data is owned by the index. */
+typedef struct {
+	const unsigned char *data;
+	unsigned long length;
+} Lepk__KvKey;
+
+/* Where the newest value of a key is stored. */
+typedef struct {
+	unsigned long long sequence;
+	unsigned long long offset;
+	unsigned int file;
+	/* LEPK__KV_TOMBSTONE while the key is deleted but older values may still be on disk. */
+	unsigned int length;
+} Lepk__KvEntry;
+
+/* Open data file. */
+typedef struct {
+	unsigned int id;
+	int fd;
+} Lepk__KvFile;
+
+static const char lepk__kv_magic[8] = { 'L', 'E', 'P', 'K', 'K', 'V', '\0', '\0' };
+
+struct LepkKv {
+	char *dirpath;
+	unsigned long file_size;
+
+	/* Guards everything below, reads share it. */
+	pthread_rwlock_t lock;
+	LepkHt *index;
+	/* Keys that are not deleted. */
+	unsigned long count;
+	/* Dynamic array of every open data file, sealed or active. */
+	Lepk__KvFile *files;
+	unsigned int next_file;
+	unsigned long long sequence;
+
+	/* Active data file. */
+	unsigned int active;
+	int active_fd;
+	/* Offset where the next record goes. */
+	unsigned long offset;
+	/* Offset the buffer starts at, everything before it is written. */
+	unsigned long flushed;
+	char *buffer;
+	unsigned long buffer_size;
+	unsigned long buffered;
+
+	/* Guards the compaction state. */
+	pthread_mutex_t compact_mutex;
+	pthread_t compact_thread;
+	bool compacting;
+	bool compact_joinable;
+};
+
+static unsigned int lepk__kv_record_crc(const Lepk__KvRecord *record, const void *key, const void *value) {
+	unsigned int crc = lepk_crc32c(0, &record->key_length, sizeof(Lepk__KvRecord) - sizeof(record->crc));
+	crc = lepk_crc32c(crc, key, record->key_length);
+	return lepk_crc32c(crc, value, record->value_length == LEPK__KV_TOMBSTONE ? 0 : record->value_length);
+}
+
+static unsigned long lepk__kv_hash(const void *key, unsigned long size) {
+	(void) size;
+	const Lepk__KvKey *k = key;
+	return lepk_ht_hash_generic(k->data, k->length);
+}
+
+static int lepk__kv_compare(const void *a, const void *b, unsigned long size) {
+	(void) size;
+	const Lepk__KvKey *ka = a;
+	const Lepk__KvKey *kb = b;
+	if (ka->length != kb->length) {
+		return 1;
+	}
+	return memcmp(ka->data, kb->data, ka->length);
+}
+
+static char *lepk__kv_path(const char *dirpath, unsigned int id, const char *extension) {
+	unsigned long length = strlen(dirpath) + 32;
+	char *path = malloc(length);
+	if (path != NULL) {
+		snprintf(path, length, "%s/%010u.%s", dirpath, id, extension);
+	}
+	return path;
+}
+
+/* File holding the id of the oldest data file a finished compaction kept, every older one is obsolete. */
+static char *lepk__kv_compacted_path(const char *dirpath) {
+	unsigned long length = strlen(dirpath) + 16;
+	char *path = malloc(length);
+	if (path != NULL) {
+		snprintf(path, length, "%s/compacted", dirpath);
+	}
+	return path;
+}
+
+static bool lepk__kv_sync_dir(const char *dirpath) {
+	int fd = open(dirpath, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd < 0) {
+		return false;
+	}
+	bool synced = fsync(fd) == 0;
+	close(fd);
+	return synced;
+}
+
+/* Delete the data and hint file of id. */
+static void lepk__kv_remove_file(const char *dirpath, unsigned int id) {
+	char *path = lepk__kv_path(dirpath, id, "data");
+	if (path != NULL) {
+		lepk_file_remove(path);
+		free(path);
+	}
+	path = lepk__kv_path(dirpath, id, "hint");
+	if (path != NULL) {
+		lepk_file_remove(path);
+		free(path);
+	}
+}
+
+static bool lepk__kv_write(int fd, const void *data, unsigned long length, unsigned long offset) {
+	while (length > 0) {
+		ssize_t written = pwrite(fd, data, length, offset);
+		if (written < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return false;
+		}
+		data = (const char *) data + written;
+		length -= written;
+		offset += written;
+	}
+	return true;
+}
+
+static bool lepk__kv_read(int fd, void *data, unsigned long length, unsigned long offset) {
+	while (length > 0) {
+		ssize_t got = pread(fd, data, length, offset);
+		if (got <= 0) {
+			if (got < 0 && errno == EINTR) {
+				continue;
+			}
+			return false;
+		}
+		data = (char *) data + got;
+		length -= got;
+		offset += got;
+	}
+	return true;
+}
+
+/* Descriptor of data file id. Caller holds the lock. */
+static int lepk__kv_fd(const LepkKv *kv, unsigned int id) {
+	for (unsigned long i = 0; i < lepk_da_count(kv->files); i++) {
+		if (kv->files[i].id == id) {
+			return kv->files[i].fd;
+		}
+	}
+	return -1;
+}
+
+/* Create a data file, returns its descriptor. */
+static int lepk__kv_create_file(const char *dirpath, unsigned int id) {
+	char *path = lepk__kv_path(dirpath, id, "data");
+	if (path == NULL) {
+		return -1;
+	}
+	int fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+	free(path);
+	if (fd < 0) {
+		return -1;
+	}
+
+	Lepk__KvFileHeader header = {0};
+	memcpy(header.magic, lepk__kv_magic, sizeof(lepk__kv_magic));
+	header.version = LEPK__KV_VERSION;
+	if (!lepk__kv_write(fd, &header, sizeof(header), 0)) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+static const unsigned char *lepk__kv_map(int fd, unsigned long *size) {
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size < (off_t) sizeof(Lepk__KvFileHeader)) {
+		return NULL;
+	}
+	void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED) {
+		return NULL;
+	}
+
+	const Lepk__KvFileHeader *header = map;
+	if (memcmp(header->magic, lepk__kv_magic, sizeof(lepk__kv_magic)) != 0 || header->version != LEPK__KV_VERSION) {
+		munmap(map, st.st_size);
+		return NULL;
+	}
+
+	*size = st.st_size;
+	return map;
+}
+
+/* Called for every complete record of a data file, value_offset is the offset of the value in the file. */
+typedef void (*Lepk__KvVisit)(void *user, const Lepk__KvRecord *record, const unsigned char *key, unsigned long value_offset);
+
+/* Walk the records of a mapped data file, stopping at the first torn or corrupt one. Returns the offset after the last complete record, visit may be NULL. */
+static unsigned long lepk__kv_scan(const unsigned char *map, unsigned long size, Lepk__KvVisit visit, void *user) {
+	unsigned long offset = sizeof(Lepk__KvFileHeader);
+	while (offset + sizeof(Lepk__KvRecord) <= size) {
+		Lepk__KvRecord record;
+		memcpy(&record, map + offset, sizeof(record));
+		unsigned long value_length = record.value_length == LEPK__KV_TOMBSTONE ? 0 : record.value_length;
+		unsigned long available = size - offset - sizeof(record);
+		if (record.key_length > available || value_length > available - record.key_length) {
+			break;
+		}
+
+		const unsigned char *key = map + offset + sizeof(record);
+		if (lepk__kv_record_crc(&record, key, key + record.key_length) != record.crc) {
+			break;
+		}
+		if (visit != NULL) {
+			visit(user, &record, key, offset + sizeof(record) + record.key_length);
+		}
+		offset += sizeof(record) + record.key_length + value_length;
+	}
+	return offset;
+}
+
+static void lepk__kv_hint_visit(void *user, const Lepk__KvRecord *record, const unsigned char *key, unsigned long value_offset) {
+	unsigned char **hints = user;
+	Lepk__KvHint hint;
+	hint.sequence = record->sequence;
+	hint.offset = value_offset;
+	hint.key_length = record->key_length;
+	hint.value_length = record->value_length;
+	lepk_da_push_array(*hints, &hint, sizeof(hint));
+	lepk_da_push_array(*hints, key, record->key_length);
+}
+
+/* Write the hint file of a sealed data file. Hints are only an accelerator, opening scans the data file when they are missing. */
+static void lepk__kv_write_hint(const char *dirpath, unsigned int id, int fd) {
+	unsigned long size;
+	const unsigned char *map = lepk__kv_map(fd, &size);
+	unsigned char *hints = lepk_da_create(1);
+	char *path = lepk__kv_path(dirpath, id, "hint");
+	if (map != NULL && hints != NULL && path != NULL) {
+		Lepk__KvFileHeader header = {0};
+		memcpy(header.magic, lepk__kv_magic, sizeof(lepk__kv_magic));
+		header.version = LEPK__KV_VERSION;
+		lepk_da_push_array(hints, &header, sizeof(header));
+		lepk__kv_scan(map, size, lepk__kv_hint_visit, &hints);
+		lepk_file_write_atomic(path, (const char *) hints, lepk_da_count(hints), LEPK_FILE_DURABILITY_NONE, NULL);
+	}
+	if (map != NULL) {
+		munmap((void *) map, size);
+	}
+	if (hints != NULL) {
+		lepk_da_destroy(hints);
+	}
+	free(path);
+}
+
+/*
+ * Point key at entry, the key is copied the first time it is seen. Entries older than the indexed one are ignored. Caller holds the write lock.
+ * Tombstones of unseen keys are indexed too, data files are loaded by id and compaction gives older values higher ids than newer deletes.
+ */
+static bool lepk__kv_index(LepkKv *kv, const void *key, unsigned long key_length, const Lepk__KvEntry *entry) {
+	Lepk__KvKey lookup = { key, key_length };
+	Lepk__KvEntry old;
+	if (lepk__ht_get(kv->index, &lookup, &old)) {
+		if (old.sequence > entry->sequence) {
+			return true;
+		}
+		kv->count += (old.length == LEPK__KV_TOMBSTONE) - (entry->length == LEPK__KV_TOMBSTONE);
+		lepk__ht_set(kv->index, &lookup, entry);
+		return true;
+	}
+
+	unsigned char *copy = malloc(key_length != 0 ? key_length : 1);
+	if (copy == NULL) {
+		return false;
+	}
+	memcpy(copy, key, key_length);
+	Lepk__KvKey owned = { copy, key_length };
+	lepk__ht_set(kv->index, &owned, entry);
+	kv->count += entry->length != LEPK__KV_TOMBSTONE;
+	return true;
+}
+
+/* Callback state while rebuilding the index at open. */
+typedef struct {
+	LepkKv *kv;
+	unsigned int file;
+	bool failed;
+} Lepk__KvLoad;
+
+static void lepk__kv_load_visit(void *user, const Lepk__KvRecord *record, const unsigned char *key, unsigned long value_offset) {
+	Lepk__KvLoad *load = user;
+	Lepk__KvEntry entry;
+	entry.sequence = record->sequence;
+	entry.offset = value_offset;
+	entry.file = load->file;
+	entry.length = record->value_length;
+	if (!lepk__kv_index(load->kv, key, record->key_length, &entry)) {
+		load->failed = true;
+	}
+	if (record->sequence >= load->kv->sequence) {
+		load->kv->sequence = record->sequence + 1;
+	}
+}
+
+/* Index a sealed data file through its hint file, returns false if the hints are missing or damaged. */
+static bool lepk__kv_load_hint(Lepk__KvLoad *load) {
+	char *path = lepk__kv_path(load->kv->dirpath, load->file, "hint");
+	LepkFileStatus file_status;
+	unsigned long size = path != NULL ? lepk_file_size(path, &file_status) : 0;
+	const unsigned char *hints = size >= sizeof(Lepk__KvFileHeader) ? (const unsigned char *) lepk_file_read(path, &file_status) : NULL;
+	free(path);
+	if (hints == NULL) {
+		return false;
+	}
+
+	bool valid = memcmp(hints, lepk__kv_magic, sizeof(lepk__kv_magic)) == 0;
+	unsigned long offset = sizeof(Lepk__KvFileHeader);
+	while (valid && offset < size) {
+		Lepk__KvHint hint;
+		if (size - offset < sizeof(hint)) {
+			valid = false;
+			break;
+		}
+		memcpy(&hint, hints + offset, sizeof(hint));
+		offset += sizeof(hint);
+		if (size - offset < hint.key_length) {
+			valid = false;
+			break;
+		}
+
+		Lepk__KvRecord record = {0};
+		record.key_length = hint.key_length;
+		record.value_length = hint.value_length;
+		record.sequence = hint.sequence;
+		lepk__kv_load_visit(load, &record, hints + offset, hint.offset);
+		offset += hint.key_length;
+	}
+	free((void *) hints);
+	return valid;
+}
+
+static int lepk__kv_compare_id(const void *a, const void *b) {
+	unsigned int ia = *(const unsigned int *) a;
+	unsigned int ib = *(const unsigned int *) b;
+	return (ia > ib) - (ia < ib);
+}
+
+/* Open every data file of the directory and rebuild the index from them, oldest first. */
+static LepkKvStatus lepk__kv_load(LepkKv *kv) {
+	LepkFileDir *dir = lepk_file_dir_open(kv->dirpath, NULL);
+	if (dir == NULL) {
+		return LEPK_KV_STATUS_UNABLE_TO_OPEN_CREATE;
+	}
+	unsigned int *ids = lepk_da_create(sizeof(unsigned int));
+	if (ids == NULL) {
+		lepk_file_dir_close(dir);
+		return LEPK_KV_STATUS_OUT_OF_MEMORY;
+	}
+	const char *name;
+	while (lepk_file_dir_next(dir, &name, NULL)) {
+		if (strlen(name) == 15 && strcmp(name + 10, ".data") == 0) {
+			unsigned int id = strtoul(name, NULL, 10);
+			lepk_da_push(ids, id);
+		}
+	}
+	lepk_file_dir_close(dir);
+	qsort(ids, lepk_da_count(ids), sizeof(unsigned int), lepk__kv_compare_id);
+
+	/* Files a crash kept from being deleted after compaction may hold values their dropped tombstones deleted. */
+	unsigned int compacted = 0;
+	char *compacted_path = lepk__kv_compacted_path(kv->dirpath);
+	if (compacted_path != NULL && lepk_file_size(compacted_path, NULL) == sizeof(compacted)) {
+		char *content = lepk_file_read(compacted_path, NULL);
+		if (content != NULL) {
+			memcpy(&compacted, content, sizeof(compacted));
+			free(content);
+		}
+	}
+	free(compacted_path);
+
+	LepkKvStatus status = LEPK_KV_STATUS_OK;
+	for (unsigned long i = 0; i < lepk_da_count(ids) && status == LEPK_KV_STATUS_OK; i++) {
+		if (ids[i] < compacted) {
+			lepk__kv_remove_file(kv->dirpath, ids[i]);
+			continue;
+		}
+		char *path = lepk__kv_path(kv->dirpath, ids[i], "data");
+		int fd = path != NULL ? open(path, O_RDONLY | O_CLOEXEC) : -1;
+		free(path);
+		if (fd < 0) {
+			status = LEPK_KV_STATUS_UNABLE_TO_OPEN_CREATE;
+			break;
+		}
+		Lepk__KvFile file = { ids[i], fd };
+		lepk_da_push(kv->files, file);
+		kv->next_file = ids[i] + 1;
+
+		Lepk__KvLoad load = { kv, ids[i], false };
+		if (!lepk__kv_load_hint(&load)) {
+			unsigned long size;
+			const unsigned char *map = lepk__kv_map(fd, &size);
+			if (map != NULL) {
+				lepk__kv_scan(map, size, lepk__kv_load_visit, &load);
+				munmap((void *) map, size);
+				lepk__kv_write_hint(kv->dirpath, ids[i], fd);
+			}
+		}
+		if (load.failed) {
+			status = LEPK_KV_STATUS_OUT_OF_MEMORY;
+		}
+	}
+	lepk_da_destroy(ids);
+
+	/* With every file indexed no older value is left for the tombstones to hide. */
+	unsigned long iterator = 0;
+	Lepk__KvKey key;
+	Lepk__KvEntry entry;
+	while (lepk_ht_next(kv->index, &iterator, &key, &entry)) {
+		if (entry.length == LEPK__KV_TOMBSTONE) {
+			lepk__ht_remove(kv->index, &key, NULL);
+			free((void *) key.data);
+		}
+	}
+	return status;
+}
+
+/* Write out the buffer of the active data file. Caller holds the write lock. */
+static LepkKvStatus lepk__kv_flush(LepkKv *kv) {
+	if (kv->buffered == 0) {
+		return LEPK_KV_STATUS_OK;
+	}
+	if (!lepk__kv_write(kv->active_fd, kv->buffer, kv->buffered, kv->flushed)) {
+		return LEPK_KV_STATUS_WRITE_FAILED;
+	}
+	kv->flushed += kv->buffered;
+	kv->buffered = 0;
+	return LEPK_KV_STATUS_OK;
+}
+
+/* Seal the active data file and continue in a new one. Caller holds the write lock. */
+static LepkKvStatus lepk__kv_roll(LepkKv *kv) {
+	if (kv->active_fd >= 0) {
+		LepkKvStatus status = lepk__kv_flush(kv);
+		if (status != LEPK_KV_STATUS_OK) {
+			return status;
+		}
+		/* lepk_kv_sync only syncs the active file, so a sealed file must already be on disk. */
+		if (fdatasync(kv->active_fd) != 0) {
+			return LEPK_KV_STATUS_SYNC_FAILED;
+		}
+	}
+
+	unsigned int id = kv->next_file;
+	int fd = lepk__kv_create_file(kv->dirpath, id);
+	if (fd < 0) {
+		return LEPK_KV_STATUS_UNABLE_TO_OPEN_CREATE;
+	}
+	Lepk__KvFile file = { id, fd };
+	lepk_da_push(kv->files, file);
+	kv->next_file++;
+
+	if (kv->active_fd >= 0) {
+		lepk__kv_write_hint(kv->dirpath, kv->active, kv->active_fd);
+	}
+	kv->active = id;
+	kv->active_fd = fd;
+	kv->offset = sizeof(Lepk__KvFileHeader);
+	kv->flushed = kv->offset;
+	return LEPK_KV_STATUS_OK;
+}
+
+/*
+ * Continue in the newest data file when it has room left, otherwise in a new one.
+ * A torn record at its end is cut off and its hints are removed, they are rewritten once it is sealed again.
+ */
+static LepkKvStatus lepk__kv_resume(LepkKv *kv) {
+	unsigned long count = lepk_da_count(kv->files);
+	if (count == 0) {
+		return lepk__kv_roll(kv);
+	}
+	Lepk__KvFile *last = &kv->files[count - 1];
+	unsigned long size;
+	const unsigned char *map = lepk__kv_map(last->fd, &size);
+	if (map == NULL) {
+		return lepk__kv_roll(kv);
+	}
+	unsigned long end = lepk__kv_scan(map, size, NULL, NULL);
+	munmap((void *) map, size);
+	if (end >= kv->file_size) {
+		return lepk__kv_roll(kv);
+	}
+
+	char *path = lepk__kv_path(kv->dirpath, last->id, "data");
+	int fd = path != NULL ? open(path, O_RDWR | O_CLOEXEC) : -1;
+	free(path);
+	if (fd < 0 || (end < size && ftruncate(fd, end) != 0)) {
+		if (fd >= 0) {
+			close(fd);
+		}
+		return lepk__kv_roll(kv);
+	}
+	path = lepk__kv_path(kv->dirpath, last->id, "hint");
+	if (path != NULL) {
+		lepk_file_remove(path);
+		free(path);
+	}
+
+	close(last->fd);
+	last->fd = fd;
+	kv->active = last->id;
+	kv->active_fd = fd;
+	kv->offset = end;
+	kv->flushed = end;
+	return LEPK_KV_STATUS_OK;
+}
+
+/* Append a record to the active data file and index it. Caller holds the write lock. */
+static LepkKvStatus lepk__kv_append(LepkKv *kv, const void *key, unsigned long key_length, const void *value, unsigned int value_length) {
+	unsigned long value_bytes = value_length == LEPK__KV_TOMBSTONE ? 0 : value_length;
+	unsigned long record_size = sizeof(Lepk__KvRecord) + key_length + value_bytes;
+
+	LepkKvStatus status;
+	if (kv->offset + record_size > kv->file_size && kv->offset > sizeof(Lepk__KvFileHeader)) {
+		status = lepk__kv_roll(kv);
+		if (status != LEPK_KV_STATUS_OK) {
+			return status;
+		}
+	}
+
+	Lepk__KvRecord record = {0};
+	record.key_length = key_length;
+	record.value_length = value_length;
+	record.sequence = kv->sequence;
+	record.crc = lepk__kv_record_crc(&record, key, value);
+
+	if (kv->buffered + record_size > kv->buffer_size) {
+		status = lepk__kv_flush(kv);
+		if (status != LEPK_KV_STATUS_OK) {
+			return status;
+		}
+	}
+
+	if (record_size > kv->buffer_size) {
+		/* Larger than the buffer, write straight to the data file. */
+		if (!lepk__kv_write(kv->active_fd, &record, sizeof(record), kv->offset) ||
+			!lepk__kv_write(kv->active_fd, key, key_length, kv->offset + sizeof(record)) ||
+			!lepk__kv_write(kv->active_fd, value, value_bytes, kv->offset + sizeof(record) + key_length)) {
+			return LEPK_KV_STATUS_WRITE_FAILED;
+		}
+		kv->flushed = kv->offset + record_size;
+	} else {
+		char *ptr = kv->buffer + kv->buffered;
+		memcpy(ptr, &record, sizeof(record));
+		memcpy(ptr + sizeof(record), key, key_length);
+		if (value_bytes > 0) {
+			memcpy(ptr + sizeof(record) + key_length, value, value_bytes);
+		}
+		kv->buffered += record_size;
+	}
+
+	Lepk__KvEntry entry;
+	entry.sequence = kv->sequence++;
+	entry.offset = kv->offset + sizeof(record) + key_length;
+	entry.file = kv->active;
+	entry.length = value_length;
+	kv->offset += record_size;
+	return lepk__kv_index(kv, key, key_length, &entry) ? LEPK_KV_STATUS_OK : LEPK_KV_STATUS_OUT_OF_MEMORY;
+}
+
+LEPKKVIMPL LepkKv *lepk_kv_open(const char *dirpath, const LepkKvOptions *options, LepkKvStatus *status) {
+	if (mkdir(dirpath, 0777) != 0 && errno != EEXIST) {
+		LEPK__KV_SET_STATUS(status, LEPK_KV_STATUS_UNABLE_TO_OPEN_CREATE);
+		return NULL;
+	}
+
+	LepkKv *kv = calloc(1, sizeof(LepkKv));
+	if (kv == NULL) {
+		LEPK__KV_SET_STATUS(status, LEPK_KV_STATUS_OUT_OF_MEMORY);
+		return NULL;
+	}
+	pthread_rwlock_init(&kv->lock, NULL);
+	pthread_mutex_init(&kv->compact_mutex, NULL);
+	kv->active_fd = -1;
+	kv->file_size   = options != NULL && options->file_size   != 0 ? options->file_size   : LEPK_KV_FILE_SIZE;
+	kv->buffer_size = options != NULL && options->buffer_size != 0 ? options->buffer_size : LEPK_KV_BUFFER_SIZE;
+	kv->dirpath = strdup(dirpath);
+	kv->buffer = malloc(kv->buffer_size);
+	kv->files = lepk_da_create(sizeof(Lepk__KvFile));
+	kv->index = lepk_ht_create(lepk__kv_hash, lepk__kv_compare, sizeof(Lepk__KvKey), sizeof(Lepk__KvEntry));
+	if (kv->dirpath == NULL || kv->buffer == NULL || kv->files == NULL || kv->index == NULL) {
+		lepk_kv_close(kv);
+		LEPK__KV_SET_STATUS(status, LEPK_KV_STATUS_OUT_OF_MEMORY);
+		return NULL;
+	}
+
+	LepkKvStatus result = lepk__kv_load(kv);
+	if (result == LEPK_KV_STATUS_OK) {
+		result = lepk__kv_resume(kv);
+	}
+	if (result != LEPK_KV_STATUS_OK) {
+		lepk_kv_close(kv);
+		kv = NULL;
+	}
+	LEPK__KV_SET_STATUS(status, result);
+	return kv;
+}
+
+LEPKKVIMPL void lepk_kv_close(LepkKv *kv) {
+	pthread_mutex_lock(&kv->compact_mutex);
+	bool join = kv->compact_joinable;
+	kv->compact_joinable = false;
+	pthread_mutex_unlock(&kv->compact_mutex);
+	if (join) {
+		pthread_join(kv->compact_thread, NULL);
+	}
+
+	if (kv->active_fd >= 0) {
+		lepk__kv_flush(kv);
+	}
+	if (kv->files != NULL) {
+		for (unsigned long i = 0; i < lepk_da_count(kv->files); i++) {
+			close(kv->files[i].fd);
+		}
+		lepk_da_destroy(kv->files);
+	}
+	if (kv->index != NULL) {
+		unsigned long iterator = 0;
+		Lepk__KvKey key;
+		while (lepk_ht_next(kv->index, &iterator, &key, NULL)) {
+			free((void *) key.data);
+		}
+		lepk_ht_destroy(kv->index);
+	}
+	pthread_mutex_destroy(&kv->compact_mutex);
+	pthread_rwlock_destroy(&kv->lock);
+	free(kv->buffer);
+	free(kv->dirpath);
+	free(kv);
+}
+
+LEPKKVIMPL LepkKvStatus lepk_kv_put(LepkKv *kv, const void *key, unsigned long key_length, const void *value, unsigned long value_length) {
+	if (key_length > kv->file_size || value_length >= LEPK__KV_TOMBSTONE) {
+		return LEPK_KV_STATUS_TOO_LARGE;
+	}
+	pthread_rwlock_wrlock(&kv->lock);
+	LepkKvStatus status = lepk__kv_append(kv, key, key_length, value, value_length);
+	pthread_rwlock_unlock(&kv->lock);
+	return status;
+}
+
+LEPKKVIMPL LepkKvStatus lepk_kv_get(LepkKv *kv, const void *key, unsigned long key_length, void *buffer, unsigned long capacity, unsigned long *length) {
+	Lepk__KvKey lookup = { key, key_length };
+	Lepk__KvEntry entry;
+
+	pthread_rwlock_rdlock(&kv->lock);
+	if (!lepk__ht_get(kv->index, &lookup, &entry) || entry.length == LEPK__KV_TOMBSTONE) {
+		pthread_rwlock_unlock(&kv->lock);
+		return LEPK_KV_STATUS_NOT_FOUND;
+	}
+
+	LepkKvStatus status = LEPK_KV_STATUS_OK;
+	unsigned long copy = entry.length < capacity ? entry.length : capacity;
+	if (entry.file == kv->active && entry.offset >= kv->flushed) {
+		/* Still in the write buffer. */
+		memcpy(buffer, kv->buffer + (entry.offset - kv->flushed), copy);
+	} else if (!lepk__kv_read(lepk__kv_fd(kv, entry.file), buffer, copy, entry.offset)) {
+		status = LEPK_KV_STATUS_READ_FAILED;
+	}
+	pthread_rwlock_unlock(&kv->lock);
+
+	if (length != NULL) {
+		*length = entry.length;
+	}
+	return status;
+}
+
+LEPKKVIMPL LepkKvStatus lepk_kv_delete(LepkKv *kv, const void *key, unsigned long key_length) {
+	Lepk__KvKey lookup = { key, key_length };
+	Lepk__KvEntry entry;
+
+	pthread_rwlock_wrlock(&kv->lock);
+	LepkKvStatus status = LEPK_KV_STATUS_NOT_FOUND;
+	if (lepk__ht_get(kv->index, &lookup, &entry) && entry.length != LEPK__KV_TOMBSTONE) {
+		status = lepk__kv_append(kv, key, key_length, NULL, LEPK__KV_TOMBSTONE);
+	}
+	pthread_rwlock_unlock(&kv->lock);
+	return status;
+}
+
+LEPKKVIMPL unsigned long lepk_kv_count(LepkKv *kv) {
+	pthread_rwlock_rdlock(&kv->lock);
+	unsigned long count = kv->count;
+	pthread_rwlock_unlock(&kv->lock);
+	return count;
+}
+
+LEPKKVIMPL LepkKvStatus lepk_kv_flush(LepkKv *kv) {
+	pthread_rwlock_wrlock(&kv->lock);
+	LepkKvStatus status = lepk__kv_flush(kv);
+	pthread_rwlock_unlock(&kv->lock);
+	return status;
+}
+
+LEPKKVIMPL LepkKvStatus lepk_kv_sync(LepkKv *kv) {
+	pthread_rwlock_wrlock(&kv->lock);
+	LepkKvStatus status = lepk__kv_flush(kv);
+	if (status == LEPK_KV_STATUS_OK && fdatasync(kv->active_fd) != 0) {
+		status = LEPK_KV_STATUS_SYNC_FAILED;
+	}
+	pthread_rwlock_unlock(&kv->lock);
+	return status;
+}
+
+/* Value moved by compaction, applied to the index once the new copy is written. */
+typedef struct {
+	Lepk__KvKey key;
+	Lepk__KvEntry from;
+	Lepk__KvEntry to;
+} Lepk__KvMove;
+
+/* State of a running compaction. */
+typedef struct {
+	LepkKv *kv;
+	unsigned int file;
+	/* Output data file. */
+	unsigned int out;
+	int out_fd;
+	unsigned long offset;
+	unsigned long flushed;
+	char *buffer;
+	unsigned long buffered;
+	/* Dynamic array of moves waiting for the output to be written. */
+	Lepk__KvMove *moves;
+	LepkKvStatus status;
+} Lepk__KvCompaction;
+
+static bool lepk__kv_compact_flush(Lepk__KvCompaction *compaction) {
+	if (compaction->buffered > 0) {
+		if (!lepk__kv_write(compaction->out_fd, compaction->buffer, compaction->buffered, compaction->flushed)) {
+			return false;
+		}
+		compaction->flushed += compaction->buffered;
+		compaction->buffered = 0;
+	}
+	return true;
+}
+
+/* Make the moved values visible, unless the key was written again in the meantime. */
+static void lepk__kv_compact_apply(Lepk__KvCompaction *compaction) {
+	LepkKv *kv = compaction->kv;
+	pthread_rwlock_wrlock(&kv->lock);
+	for (unsigned long i = 0; i < lepk_da_count(compaction->moves); i++) {
+		Lepk__KvMove *move = &compaction->moves[i];
+		Lepk__KvEntry current;
+		if (lepk__ht_get(kv->index, &move->key, &current) && current.file == move->from.file && current.offset == move->from.offset) {
+			lepk__ht_set(kv->index, &move->key, &move->to);
+		}
+	}
+	pthread_rwlock_unlock(&kv->lock);
+	lepk_da_destroy(compaction->moves);
+	compaction->moves = lepk_da_create(sizeof(Lepk__KvMove));
+}
+
+/* Seal the output file, its values are already in the index. */
+static void lepk__kv_compact_seal(Lepk__KvCompaction *compaction) {
+	if (compaction->out_fd < 0) {
+		return;
+	}
+	if (fdatasync(compaction->out_fd) != 0) {
+		compaction->status = LEPK_KV_STATUS_SYNC_FAILED;
+	}
+	lepk__kv_write_hint(compaction->kv->dirpath, compaction->out, compaction->out_fd);
+	compaction->out_fd = -1;
+}
+
+static void lepk__kv_compact_visit(void *user, const Lepk__KvRecord *record, const unsigned char *key, unsigned long value_offset) {
+	Lepk__KvCompaction *compaction = user;
+	LepkKv *kv = compaction->kv;
+	if (compaction->status != LEPK_KV_STATUS_OK || record->value_length == LEPK__KV_TOMBSTONE) {
+		return;
+	}
+
+	/* Only the value the index points at is live. */
+	Lepk__KvKey lookup = { key, record->key_length };
+	Lepk__KvEntry entry;
+	pthread_rwlock_rdlock(&kv->lock);
+	bool live = lepk__ht_get(kv->index, &lookup, &entry) && entry.file == compaction->file && entry.offset == value_offset;
+	pthread_rwlock_unlock(&kv->lock);
+	if (!live) {
+		return;
+	}
+
+	unsigned long record_size = sizeof(Lepk__KvRecord) + record->key_length + record->value_length;
+	if (compaction->out_fd >= 0 && compaction->offset + record_size > kv->file_size && compaction->offset > sizeof(Lepk__KvFileHeader)) {
+		if (!lepk__kv_compact_flush(compaction)) {
+			compaction->status = LEPK_KV_STATUS_WRITE_FAILED;
+			return;
+		}
+		lepk__kv_compact_apply(compaction);
+		lepk__kv_compact_seal(compaction);
+	}
+	if (compaction->out_fd < 0) {
+		pthread_rwlock_wrlock(&kv->lock);
+		unsigned int id = kv->next_file;
+		int fd = lepk__kv_create_file(kv->dirpath, id);
+		if (fd >= 0) {
+			Lepk__KvFile file = { id, fd };
+			lepk_da_push(kv->files, file);
+			kv->next_file++;
+		}
+		pthread_rwlock_unlock(&kv->lock);
+		if (fd < 0) {
+			compaction->status = LEPK_KV_STATUS_UNABLE_TO_OPEN_CREATE;
+			return;
+		}
+		compaction->out = id;
+		compaction->out_fd = fd;
+		compaction->offset = sizeof(Lepk__KvFileHeader);
+		compaction->flushed = compaction->offset;
+	}
+
+	/* Records keep their sequence, so a newer write of the key always wins. */
+	const unsigned char *start = key - sizeof(Lepk__KvRecord);
+	if (compaction->buffered + record_size > kv->buffer_size && !lepk__kv_compact_flush(compaction)) {
+		compaction->status = LEPK_KV_STATUS_WRITE_FAILED;
+		return;
+	}
+	if (record_size > kv->buffer_size) {
+		if (!lepk__kv_write(compaction->out_fd, start, record_size, compaction->offset)) {
+			compaction->status = LEPK_KV_STATUS_WRITE_FAILED;
+			return;
+		}
+		compaction->flushed = compaction->offset + record_size;
+	} else {
+		memcpy(compaction->buffer + compaction->buffered, start, record_size);
+		compaction->buffered += record_size;
+	}
+
+	Lepk__KvMove move;
+	move.key.data = (const unsigned char *) key;
+	move.key.length = record->key_length;
+	move.from = entry;
+	move.to = entry;
+	move.to.file = compaction->out;
+	move.to.offset = compaction->offset + sizeof(Lepk__KvRecord) + record->key_length;
+	lepk_da_push(compaction->moves, move);
+	compaction->offset += record_size;
+}
+
+static LepkKvStatus lepk__kv_compact_run(LepkKv *kv) {
+	/* Everything written so far becomes sealed and takes part. */
+	pthread_rwlock_wrlock(&kv->lock);
+	LepkKvStatus status = LEPK_KV_STATUS_OK;
+	/* The active file is rolled unless it is empty and newer than any output of an earlier compaction, so every merged file is older. */
+	if (kv->offset > sizeof(Lepk__KvFileHeader) || kv->active + 1 != kv->next_file) {
+		status = lepk__kv_roll(kv);
+	}
+	unsigned int kept = kv->active;
+	unsigned int *merge = lepk_da_create(sizeof(unsigned int));
+	for (unsigned long i = 0; merge != NULL && i < lepk_da_count(kv->files); i++) {
+		if (kv->files[i].id != kv->active) {
+			lepk_da_push(merge, kv->files[i].id);
+		}
+	}
+	pthread_rwlock_unlock(&kv->lock);
+	if (merge == NULL) {
+		return LEPK_KV_STATUS_OUT_OF_MEMORY;
+	}
+	if (status != LEPK_KV_STATUS_OK || lepk_da_count(merge) == 0) {
+		lepk_da_destroy(merge);
+		return status;
+	}
+
+	Lepk__KvCompaction compaction = {0};
+	compaction.kv = kv;
+	compaction.out_fd = -1;
+	compaction.buffer = malloc(kv->buffer_size);
+	compaction.moves = lepk_da_create(sizeof(Lepk__KvMove));
+	compaction.status = compaction.buffer != NULL && compaction.moves != NULL ? LEPK_KV_STATUS_OK : LEPK_KV_STATUS_OUT_OF_MEMORY;
+
+	/* Only compaction closes sealed files, so their descriptors stay valid without the lock. */
+	for (unsigned long i = 0; i < lepk_da_count(merge) && compaction.status == LEPK_KV_STATUS_OK; i++) {
+		pthread_rwlock_rdlock(&kv->lock);
+		int fd = lepk__kv_fd(kv, merge[i]);
+		pthread_rwlock_unlock(&kv->lock);
+
+		unsigned long size;
+		const unsigned char *map = lepk__kv_map(fd, &size);
+		if (map == NULL) {
+			compaction.status = LEPK_KV_STATUS_READ_FAILED;
+			break;
+		}
+		compaction.file = merge[i];
+		lepk__kv_scan(map, size, lepk__kv_compact_visit, &compaction);
+		/* Moves point into the mapping, apply them before it goes away. */
+		if (compaction.status == LEPK_KV_STATUS_OK && !lepk__kv_compact_flush(&compaction)) {
+			compaction.status = LEPK_KV_STATUS_WRITE_FAILED;
+		}
+		if (compaction.status == LEPK_KV_STATUS_OK) {
+			lepk__kv_compact_apply(&compaction);
+		}
+		munmap((void *) map, size);
+	}
+	if (compaction.status == LEPK_KV_STATUS_OK) {
+		lepk__kv_compact_seal(&compaction);
+	}
+
+	/*
+	 * Old files are only deleted once every live value and the directory entries of the new files reached the disk.
+	 * Tombstones are not copied, so the merged files are marked obsolete first, opening deletes whatever a crash left of them.
+	 */
+	if (compaction.status == LEPK_KV_STATUS_OK && !lepk__kv_sync_dir(kv->dirpath)) {
+		compaction.status = LEPK_KV_STATUS_SYNC_FAILED;
+	}
+	if (compaction.status == LEPK_KV_STATUS_OK) {
+		char *path = lepk__kv_compacted_path(kv->dirpath);
+		if (path == NULL || lepk_file_write_atomic(path, (const char *) &kept, sizeof(kept), LEPK_FILE_DURABILITY_FULL, NULL) != LEPK_FILE_STATUS_OK) {
+			compaction.status = LEPK_KV_STATUS_SYNC_FAILED;
+		}
+		free(path);
+	}
+	if (compaction.status == LEPK_KV_STATUS_OK) {
+		pthread_rwlock_wrlock(&kv->lock);
+		unsigned long iterator = 0;
+		Lepk__KvKey key;
+		Lepk__KvEntry entry;
+		while (lepk_ht_next(kv->index, &iterator, &key, &entry)) {
+			if (entry.length != LEPK__KV_TOMBSTONE) {
+				continue;
+			}
+			for (unsigned long i = 0; i < lepk_da_count(merge); i++) {
+				if (merge[i] == entry.file) {
+					lepk__ht_remove(kv->index, &key, NULL);
+					free((void *) key.data);
+					break;
+				}
+			}
+		}
+
+		for (unsigned long i = 0; i < lepk_da_count(merge); i++) {
+			for (unsigned long j = 0; j < lepk_da_count(kv->files); j++) {
+				if (kv->files[j].id == merge[i]) {
+					close(kv->files[j].fd);
+					lepk_da_remove_fast(kv->files, j, NULL);
+					break;
+				}
+			}
+			lepk__kv_remove_file(kv->dirpath, merge[i]);
+		}
+		pthread_rwlock_unlock(&kv->lock);
+		if (!lepk__kv_sync_dir(kv->dirpath)) {
+			compaction.status = LEPK_KV_STATUS_SYNC_FAILED;
+		}
+	}
+
+	free(compaction.buffer);
+	if (compaction.moves != NULL) {
+		lepk_da_destroy(compaction.moves);
+	}
+	lepk_da_destroy(merge);
+	return compaction.status;
+}
+
+static void *lepk__kv_compact_thread(void *arg) {
+	LepkKv *kv = arg;
+	lepk__kv_compact_run(kv);
+	pthread_mutex_lock(&kv->compact_mutex);
+	kv->compacting = false;
+	pthread_mutex_unlock(&kv->compact_mutex);
+	return NULL;
+}
+
+LEPKKVIMPL LepkKvStatus lepk_kv_compact(LepkKv *kv, bool background) {
+	pthread_mutex_lock(&kv->compact_mutex);
+	if (kv->compacting) {
+		pthread_mutex_unlock(&kv->compact_mutex);
+		return LEPK_KV_STATUS_BUSY;
+	}
+	if (kv->compact_joinable) {
+		pthread_join(kv->compact_thread, NULL);
+		kv->compact_joinable = false;
+	}
+	kv->compacting = true;
+	if (background && pthread_create(&kv->compact_thread, NULL, lepk__kv_compact_thread, kv) == 0) {
+		kv->compact_joinable = true;
+		pthread_mutex_unlock(&kv->compact_mutex);
+		return LEPK_KV_STATUS_OK;
+	}
+	pthread_mutex_unlock(&kv->compact_mutex);
+
+	/* Without a thread the compaction runs right here. */
+	LepkKvStatus status = lepk__kv_compact_run(kv);
+	pthread_mutex_lock(&kv->compact_mutex);
+	kv->compacting = false;
+	pthread_mutex_unlock(&kv->compact_mutex);
+	return status;
+}
@@ -0,0 +1,695 @@
+#include "lepk_log.h"
+
+#include "lepk_da.h"
+#include "lepk_checksum.h"
+#include "lepk_file.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#if !defined(_POSIX_C_SOURCE) || _POSIX_C_SOURCE < 200809L
+#error "lepk_log.h needs _POSIX_C_SOURCE defined as 200809L or _GNU_SOURCE defined before any system header is included."
+#endif /* _POSIX_C_SOURCE */
+
+#ifndef LEPK_LOG_SEGMENT_SIZE
+#define LEPK_LOG_SEGMENT_SIZE (64ul * 1024 * 1024)
+#endif /* LEPK_LOG_SEGMENT_SIZE */
+
+#ifndef LEPK_LOG_BUFFER_SIZE
+#define LEPK_LOG_BUFFER_SIZE (64ul * 1024)
+#endif /* LEPK_LOG_BUFFER_SIZE */
+
+#define LEPK__LOG_SET_STATUS(p, s) do {if ((p)) { *(p) = (s); }} while (0)
+
+#define LEPK__LOG_VERSION 1
+/* Record size marking the end of a full segment, the log continues in the next one. */
+#define LEPK__LOG_SEALED 0xffffffffu
+/* Records are padded so every header is 8 byte aligned. */
+#define LEPK__LOG_ALIGN(n) (((n) + 7ul) & ~7ul)
+
+/* Start of every segment. */
+typedef struct {
+	char magic[8];
+	unsigned int version;
+	unsigned int reserved;
+	/* Global index of the first record in the segment. */
+	unsigned long long first_record;
+} Lepk__LogSegmentHeader;
+
+/* Start of every record. */
+typedef struct {
+	/* Length + 1 so empty records differ from unwritten (zeroed) space. */
+	unsigned int size;
+	/* crc32c of size and data. */
+	unsigned int crc;
+} Lepk__LogRecord;
+
+static const char lepk__log_magic[8] = { 'L', 'E', 'P', 'K', 'L', 'O', 'G', '\0' };
+
+struct LepkLog {
+	char *dirpath;
+	unsigned long segment_size;
+
+	/* Active segment. */
+	int fd;
+	unsigned long long segment;
+	unsigned long long first_record;
+	/* Dynamic array of record offsets in the active segment. */
+	unsigned long long *offsets;
+	/* Offset where the next record goes. */
+	unsigned long offset;
+	/* Offset the buffer starts at, everything before it is written. */
+	unsigned long flushed;
+
+	char *buffer;
+	unsigned long buffer_size;
+	unsigned long buffered;
+};
+
+struct LepkLogReader {
+	char *dirpath;
+	unsigned long long segment;
+	/* Mapping of the current segment, NULL while it does not exist yet. */
+	const unsigned char *map;
+	unsigned long map_size;
+	unsigned long offset;
+};
+
+static unsigned int lepk__log_record_crc(unsigned int size, const void *data, unsigned long length) {
+	return lepk_crc32c(lepk_crc32c(0, &size, sizeof(size)), data, length);
+}
+
+static char *lepk__log_path(const char *dirpath, unsigned long long segment, const char *extension) {
+	unsigned long length = strlen(dirpath) + 32;
+	char *path = malloc(length);
+	if (path != NULL) {
+		snprintf(path, length, "%s/%020llu.%s", dirpath, segment, extension);
+	}
+	return path;
+}
+
+/* Find the lowest and highest segment ids in dirpath. Returns false if there are none. */
+static bool lepk__log_segments(const char *dirpath, unsigned long long *first, unsigned long long *last) {
+	LepkFileDir *dir = lepk_file_dir_open(dirpath, NULL);
+	if (dir == NULL) {
+		return false;
+	}
+
+	bool found = false;
+	const char *name;
+	while (lepk_file_dir_next(dir, &name, NULL)) {
+		unsigned long length = strlen(name);
+		if (length != 24 || strcmp(name + 20, ".log") != 0) {
+			continue;
+		}
+		unsigned long long segment = strtoull(name, NULL, 10);
+		if (!found || segment < *first) { *first = segment; }
+		if (!found || segment > *last)  { *last  = segment; }
+		found = true;
+	}
+
+	lepk_file_dir_close(dir);
+	return found;
+}
+
+static const unsigned char *lepk__log_map(const char *dirpath, unsigned long long segment, unsigned long *size) {
+	char *path = lepk__log_path(dirpath, segment, "log");
+	if (path == NULL) {
+		return NULL;
+	}
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	free(path);
+	if (fd < 0) {
+		return NULL;
+	}
+
+	struct stat st;
+	void *map = MAP_FAILED;
+	if (fstat(fd, &st) == 0 && st.st_size >= (off_t) sizeof(Lepk__LogSegmentHeader)) {
+		map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	}
+	close(fd);
+	if (map == MAP_FAILED) {
+		return NULL;
+	}
+
+	const Lepk__LogSegmentHeader *header = map;
+	if (memcmp(header->magic, lepk__log_magic, sizeof(lepk__log_magic)) != 0 || header->version != LEPK__LOG_VERSION) {
+		munmap(map, st.st_size);
+		return NULL;
+	}
+
+	*size = st.st_size;
+	return map;
+}
+
+/*
+ * Read record at offset of a mapped segment. Returns the offset of the next record, 0 if there is no complete record
+ * or LEPK__LOG_SEALED as size if the segment is full.
+ */
+static unsigned long lepk__log_read(const unsigned char *map, unsigned long map_size, unsigned long offset, unsigned int *size, const void **data) {
+	if (offset + sizeof(Lepk__LogRecord) > map_size) {
+		return 0;
+	}
+	const Lepk__LogRecord *record = (const Lepk__LogRecord *) (map + offset);
+	*size = __atomic_load_n(&record->size, __ATOMIC_ACQUIRE);
+	if (*size == 0) {
+		return 0;
+	}
+	if (*size == LEPK__LOG_SEALED) {
+		return offset;
+	}
+
+	unsigned long length = *size - 1;
+	if (length > map_size - offset - sizeof(Lepk__LogRecord)) {
+		return 0;
+	}
+	*data = record + 1;
+	/* A record still being written (or torn by a crash) fails its checksum. */
+	if (lepk__log_record_crc(*size, *data, length) != record->crc) {
+		return 0;
+	}
+	return offset + LEPK__LOG_ALIGN(sizeof(Lepk__LogRecord) + length);
+}
+
+static LepkLogStatus lepk__log_write(int fd, const void *data, unsigned long length, unsigned long offset) {
+	while (length > 0) {
+		ssize_t written = pwrite(fd, data, length, offset);
+		if (written < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return LEPK_LOG_STATUS_WRITE_FAILED;
+		}
+		data = (const char *) data + written;
+		length -= written;
+		offset += written;
+	}
+	return LEPK_LOG_STATUS_OK;
+}
+
+static bool lepk__log_sync_dir(const char *dirpath) {
+	int fd = open(dirpath, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd < 0) {
+		return false;
+	}
+	bool synced = fsync(fd) == 0;
+	close(fd);
+	return synced;
+}
+
+/* Create and preallocate a segment, returns its descriptor. */
+static int lepk__log_create_segment(LepkLog *log, unsigned long long segment, unsigned long long first_record) {
+	char *path = lepk__log_path(log->dirpath, segment, "log");
+	if (path == NULL) {
+		return -1;
+	}
+	int fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+	free(path);
+	if (fd < 0) {
+		return -1;
+	}
+
+	/* Preallocated blocks read as zeroes, which is what marks unwritten space. */
+#if defined(__linux__) && defined(_GNU_SOURCE)
+	if (fallocate(fd, 0, 0, log->segment_size) != 0 && ftruncate(fd, log->segment_size) != 0) {
+#else /* __linux__ && _GNU_SOURCE */
+	if (posix_fallocate(fd, 0, log->segment_size) != 0 && ftruncate(fd, log->segment_size) != 0) {
+#endif /* __linux__ && _GNU_SOURCE */
+		close(fd);
+		return -1;
+	}
+
+	Lepk__LogSegmentHeader header = {0};
+	memcpy(header.magic, lepk__log_magic, sizeof(lepk__log_magic));
+	header.version = LEPK__LOG_VERSION;
+	header.first_record = first_record;
+	/* The header and the directory entry reach the disk before the previous segment is sealed. */
+	if (lepk__log_write(fd, &header, sizeof(header), 0) != LEPK_LOG_STATUS_OK || fdatasync(fd) != 0 || !lepk__log_sync_dir(log->dirpath)) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+/* Seal the active segment, write its index and continue in a new segment. */
+static LepkLogStatus lepk__log_roll(LepkLog *log) {
+	LepkLogStatus status = lepk_log_flush(log);
+	if (status != LEPK_LOG_STATUS_OK) {
+		return status;
+	}
+
+	unsigned long long count = lepk_da_count(log->offsets);
+	unsigned long long first_record = log->first_record + count;
+	int fd = lepk__log_create_segment(log, log->segment + 1, first_record);
+	if (fd < 0) {
+		return LEPK_LOG_STATUS_UNABLE_TO_OPEN_CREATE;
+	}
+
+	/* The next segment exists before readers can see the seal. */
+	Lepk__LogRecord seal = { LEPK__LOG_SEALED, 0 };
+	status = lepk__log_write(log->fd, &seal, sizeof(seal), log->offset);
+	/* lepk_log_sync only syncs the active segment, so the records and seal of this one must reach the disk now. */
+	if (status == LEPK_LOG_STATUS_OK && fdatasync(log->fd) != 0) {
+		status = LEPK_LOG_STATUS_SYNC_FAILED;
+	}
+	if (status != LEPK_LOG_STATUS_OK) {
+		close(fd);
+		return status;
+	}
+
+	/* Index is only an accelerator, readers scan the segment when it is missing. */
+	char *path = lepk__log_path(log->dirpath, log->segment, "idx");
+	unsigned long index_size = (count + 1) * sizeof(unsigned long long);
+	unsigned long long *index = malloc(index_size);
+	if (path != NULL && index != NULL) {
+		index[0] = count;
+		memcpy(index + 1, log->offsets, count * sizeof(unsigned long long));
+		lepk_file_write_atomic(path, (const char *) index, index_size, LEPK_FILE_DURABILITY_NONE, NULL);
+	}
+	free(path);
+	free(index);
+
+	close(log->fd);
+	log->fd = fd;
+	log->segment++;
+	log->first_record = first_record;
+	log->offset = sizeof(Lepk__LogSegmentHeader);
+	log->flushed = log->offset;
+	lepk_da_destroy(log->offsets);
+	log->offsets = lepk_da_create(sizeof(unsigned long long));
+	return LEPK_LOG_STATUS_OK;
+}
+
+/*
+ * Seal segment if a crash hit between creating the next segment and sealing this one, otherwise readers stop at its end.
+ * Only the segment before the last can be affected, every other one was sealed before its successor got a successor.
+ */
+static LepkLogStatus lepk__log_seal(LepkLog *log, unsigned long long segment) {
+	unsigned long map_size;
+	const unsigned char *map = lepk__log_map(log->dirpath, segment, &map_size);
+	if (map == NULL) {
+		return LEPK_LOG_STATUS_CORRUPT;
+	}
+	unsigned long offset = sizeof(Lepk__LogSegmentHeader);
+	unsigned int size = 0;
+	for (;;) {
+		const void *data;
+		unsigned long next = lepk__log_read(map, map_size, offset, &size, &data);
+		if (next == 0 || size == LEPK__LOG_SEALED) {
+			break;
+		}
+		offset = next;
+	}
+	munmap((void *) map, map_size);
+	if (size == LEPK__LOG_SEALED) {
+		return LEPK_LOG_STATUS_OK;
+	}
+
+	char *path = lepk__log_path(log->dirpath, segment, "log");
+	int fd = path != NULL ? open(path, O_RDWR | O_CLOEXEC) : -1;
+	free(path);
+	if (fd < 0) {
+		return LEPK_LOG_STATUS_UNABLE_TO_OPEN_CREATE;
+	}
+	Lepk__LogRecord seal = { LEPK__LOG_SEALED, 0 };
+	LepkLogStatus status = lepk__log_write(fd, &seal, sizeof(seal), offset);
+	if (status == LEPK_LOG_STATUS_OK && fdatasync(fd) != 0) {
+		status = LEPK_LOG_STATUS_SYNC_FAILED;
+	}
+	close(fd);
+	return status;
+}
+
+/* Check if segment is shorter than a header or has a zeroed one, what a crash before its header reached the disk leaves. */
+static bool lepk__log_blank(const char *dirpath, unsigned long long segment) {
+	char *path = lepk__log_path(dirpath, segment, "log");
+	int fd = path != NULL ? open(path, O_RDONLY | O_CLOEXEC) : -1;
+	free(path);
+	if (fd < 0) {
+		return false;
+	}
+	Lepk__LogSegmentHeader header = {0};
+	ssize_t length = pread(fd, &header, sizeof(header), 0);
+	close(fd);
+	static const Lepk__LogSegmentHeader zero = {0};
+	return length >= 0 && memcmp(&header, &zero, sizeof(header)) == 0;
+}
+
+/* Index of the record following the last one in a sealed segment. */
+static bool lepk__log_next_record(const char *dirpath, unsigned long long segment, unsigned long long *next_record) {
+	unsigned long map_size;
+	const unsigned char *map = lepk__log_map(dirpath, segment, &map_size);
+	if (map == NULL) {
+		return false;
+	}
+	*next_record = ((const Lepk__LogSegmentHeader *) map)->first_record;
+	unsigned long offset = sizeof(Lepk__LogSegmentHeader);
+	for (;;) {
+		unsigned int size;
+		const void *data;
+		unsigned long next = lepk__log_read(map, map_size, offset, &size, &data);
+		if (next == 0 || size == LEPK__LOG_SEALED) {
+			break;
+		}
+		(*next_record)++;
+		offset = next;
+	}
+	munmap((void *) map, map_size);
+	return true;
+}
+
+/* Find the end of the last segment and continue appending there. */
+static LepkLogStatus lepk__log_recover(LepkLog *log, unsigned long long segment) {
+	unsigned long map_size;
+	const unsigned char *map = lepk__log_map(log->dirpath, segment, &map_size);
+	if (map == NULL) {
+		/* A blank last segment holds no records, so it is created again following the one before it. */
+		unsigned long long first_record = 0;
+		if (!lepk__log_blank(log->dirpath, segment) || (segment > 0 && !lepk__log_next_record(log->dirpath, segment - 1, &first_record))) {
+			return LEPK_LOG_STATUS_CORRUPT;
+		}
+		log->fd = lepk__log_create_segment(log, segment, first_record);
+		if (log->fd < 0) {
+			return LEPK_LOG_STATUS_UNABLE_TO_OPEN_CREATE;
+		}
+		log->segment = segment;
+		log->first_record = first_record;
+		log->offset = sizeof(Lepk__LogSegmentHeader);
+		log->flushed = log->offset;
+		return LEPK_LOG_STATUS_OK;
+	}
+
+	char *path = lepk__log_path(log->dirpath, segment, "log");
+	log->fd = path != NULL ? open(path, O_RDWR | O_CLOEXEC) : -1;
+	free(path);
+	if (log->fd < 0) {
+		munmap((void *) map, map_size);
+		return LEPK_LOG_STATUS_UNABLE_TO_OPEN_CREATE;
+	}
+
+	log->segment = segment;
+	log->segment_size = map_size;
+	log->first_record = ((const Lepk__LogSegmentHeader *) map)->first_record;
+
+	unsigned long offset = sizeof(Lepk__LogSegmentHeader);
+	for (;;) {
+		unsigned int size;
+		const void *data;
+		unsigned long next = lepk__log_read(map, map_size, offset, &size, &data);
+		if (next == 0 || size == LEPK__LOG_SEALED) {
+			break;
+		}
+		unsigned long long record_offset = offset;
+		lepk_da_push(log->offsets, record_offset);
+		offset = next;
+	}
+
+	/* Clear whatever a crash left behind the last complete record, so it can never be mistaken for a record. */
+	bool dirty = offset + sizeof(Lepk__LogRecord) <= map_size && ((const Lepk__LogRecord *) (map + offset))->size != 0;
+	munmap((void *) map, map_size);
+	if (dirty) {
+#if defined(__linux__) && defined(_GNU_SOURCE) && defined(FALLOC_FL_ZERO_RANGE)
+		if (fallocate(log->fd, FALLOC_FL_ZERO_RANGE | FALLOC_FL_KEEP_SIZE, offset, map_size - offset) != 0)
+#endif /* __linux__ && _GNU_SOURCE && FALLOC_FL_ZERO_RANGE */
+		{
+			char zeroes[4096] = {0};
+			for (unsigned long position = offset; position < map_size; position += sizeof(zeroes)) {
+				unsigned long length = map_size - position < sizeof(zeroes) ? map_size - position : sizeof(zeroes);
+				if (lepk__log_write(log->fd, zeroes, length, position) != LEPK_LOG_STATUS_OK) {
+					return LEPK_LOG_STATUS_WRITE_FAILED;
+				}
+			}
+		}
+	}
+
+	log->offset = offset;
+	log->flushed = offset;
+	return LEPK_LOG_STATUS_OK;
+}
+
+LEPKLOGIMPL LepkLog *lepk_log_open(const char *dirpath, const LepkLogOptions *options, LepkLogStatus *status) {
+	if (mkdir(dirpath, 0777) != 0 && errno != EEXIST) {
+		LEPK__LOG_SET_STATUS(status, LEPK_LOG_STATUS_UNABLE_TO_OPEN_CREATE);
+		return NULL;
+	}
+
+	LepkLog *log = calloc(1, sizeof(LepkLog));
+	if (log == NULL) {
+		LEPK__LOG_SET_STATUS(status, LEPK_LOG_STATUS_OUT_OF_MEMORY);
+		return NULL;
+	}
+	log->fd = -1;
+	log->segment_size = options != NULL && options->segment_size != 0 ? options->segment_size : LEPK_LOG_SEGMENT_SIZE;
+	log->buffer_size  = options != NULL && options->buffer_size  != 0 ? options->buffer_size  : LEPK_LOG_BUFFER_SIZE;
+	log->dirpath = strdup(dirpath);
+	log->buffer = malloc(log->buffer_size);
+	log->offsets = lepk_da_create(sizeof(unsigned long long));
+	if (log->dirpath == NULL || log->buffer == NULL || log->offsets == NULL) {
+		lepk_log_close(log);
+		LEPK__LOG_SET_STATUS(status, LEPK_LOG_STATUS_OUT_OF_MEMORY);
+		return NULL;
+	}
+
+	LepkLogStatus result = LEPK_LOG_STATUS_OK;
+	unsigned long long first, last;
+	if (lepk__log_segments(dirpath, &first, &last)) {
+		if (last > first) {
+			result = lepk__log_seal(log, last - 1);
+		}
+		if (result == LEPK_LOG_STATUS_OK) {
+			result = lepk__log_recover(log, last);
+		}
+	} else {
+		log->fd = lepk__log_create_segment(log, 0, 0);
+		log->offset = sizeof(Lepk__LogSegmentHeader);
+		log->flushed = log->offset;
+		if (log->fd < 0) {
+			result = LEPK_LOG_STATUS_UNABLE_TO_OPEN_CREATE;
+		}
+	}
+
+	if (result != LEPK_LOG_STATUS_OK) {
+		lepk_log_close(log);
+		log = NULL;
+	}
+	LEPK__LOG_SET_STATUS(status, result);
+	return log;
+}
+
+LEPKLOGIMPL void lepk_log_close(LepkLog *log) {
+	if (log->fd >= 0) {
+		lepk_log_flush(log);
+		close(log->fd);
+	}
+	if (log->offsets != NULL) {
+		lepk_da_destroy(log->offsets);
+	}
+	free(log->buffer);
+	free(log->dirpath);
+	free(log);
+}
+
+LEPKLOGIMPL LepkLogStatus lepk_log_append(LepkLog *log, const void *data, unsigned long length) {
+	unsigned long record_size = LEPK__LOG_ALIGN(sizeof(Lepk__LogRecord) + length);
+	/* Room for the seal must always be left at the end. */
+	if (length >= LEPK__LOG_SEALED - 1 || sizeof(Lepk__LogSegmentHeader) + record_size + sizeof(Lepk__LogRecord) > log->segment_size) {
+		return LEPK_LOG_STATUS_TOO_LARGE;
+	}
+
+	LepkLogStatus status;
+	if (log->offset + record_size + sizeof(Lepk__LogRecord) > log->segment_size) {
+		status = lepk__log_roll(log);
+		if (status != LEPK_LOG_STATUS_OK) {
+			return status;
+		}
+	}
+
+	Lepk__LogRecord record;
+	record.size = length + 1;
+	record.crc = lepk__log_record_crc(record.size, data, length);
+
+	if (log->buffered + record_size > log->buffer_size) {
+		status = lepk_log_flush(log);
+		if (status != LEPK_LOG_STATUS_OK) {
+			return status;
+		}
+	}
+
+	if (record_size > log->buffer_size) {
+		/* Larger than the buffer, write straight to the segment. */
+		status = lepk__log_write(log->fd, &record, sizeof(record), log->offset);
+		if (status == LEPK_LOG_STATUS_OK) {
+			status = lepk__log_write(log->fd, data, length, log->offset + sizeof(record));
+		}
+		if (status != LEPK_LOG_STATUS_OK) {
+			return status;
+		}
+		log->flushed = log->offset + record_size;
+	} else {
+		char *ptr = log->buffer + log->buffered;
+		memcpy(ptr, &record, sizeof(record));
+		memcpy(ptr + sizeof(record), data, length);
+		memset(ptr + sizeof(record) + length, 0, record_size - sizeof(record) - length);
+		log->buffered += record_size;
+	}
+
+	unsigned long long record_offset = log->offset;
+	lepk_da_push(log->offsets, record_offset);
+	log->offset += record_size;
+	return LEPK_LOG_STATUS_OK;
+}
+
+LEPKLOGIMPL LepkLogStatus lepk_log_flush(LepkLog *log) {
+	if (log->buffered == 0) {
+		return LEPK_LOG_STATUS_OK;
+	}
+	LepkLogStatus status = lepk__log_write(log->fd, log->buffer, log->buffered, log->flushed);
+	if (status == LEPK_LOG_STATUS_OK) {
+		log->flushed += log->buffered;
+		log->buffered = 0;
+	}
+	return status;
+}
+
+LEPKLOGIMPL LepkLogStatus lepk_log_sync(LepkLog *log) {
+	LepkLogStatus status = lepk_log_flush(log);
+	if (status != LEPK_LOG_STATUS_OK) {
+		return status;
+	}
+	return fdatasync(log->fd) == 0 ? LEPK_LOG_STATUS_OK : LEPK_LOG_STATUS_SYNC_FAILED;
+}
+
+LEPKLOGIMPL unsigned long long lepk_log_count(const LepkLog *log) {
+	return log->first_record + lepk_da_count(log->offsets);
+}
+
+/* Point reader at the start of segment, mapping it if it exists. */
+static void lepk__log_reader_enter(LepkLogReader *reader, unsigned long long segment) {
+	if (reader->map != NULL) {
+		munmap((void *) reader->map, reader->map_size);
+	}
+	reader->segment = segment;
+	reader->offset = sizeof(Lepk__LogSegmentHeader);
+	reader->map = lepk__log_map(reader->dirpath, segment, &reader->map_size);
+}
+
+LEPKLOGIMPL LepkLogReader *lepk_log_reader_open(const char *dirpath, LepkLogStatus *status) {
+	unsigned long long first, last;
+	if (!lepk__log_segments(dirpath, &first, &last)) {
+		LEPK__LOG_SET_STATUS(status, LEPK_LOG_STATUS_UNABLE_TO_OPEN_CREATE);
+		return NULL;
+	}
+
+	LepkLogReader *reader = calloc(1, sizeof(LepkLogReader));
+	if (reader == NULL || (reader->dirpath = strdup(dirpath)) == NULL) {
+		free(reader);
+		LEPK__LOG_SET_STATUS(status, LEPK_LOG_STATUS_OUT_OF_MEMORY);
+		return NULL;
+	}
+
+	lepk__log_reader_enter(reader, first);
+	if (reader->map == NULL) {
+		lepk_log_reader_close(reader);
+		LEPK__LOG_SET_STATUS(status, LEPK_LOG_STATUS_CORRUPT);
+		return NULL;
+	}
+
+	LEPK__LOG_SET_STATUS(status, LEPK_LOG_STATUS_OK);
+	return reader;
+}
+
+LEPKLOGIMPL void lepk_log_reader_close(LepkLogReader *reader) {
+	if (reader->map != NULL) {
+		munmap((void *) reader->map, reader->map_size);
+	}
+	free(reader->dirpath);
+	free(reader);
+}
+
+LEPKLOGIMPL bool lepk_log_reader_next(LepkLogReader *reader, const void **data, unsigned long *length) {
+	for (;;) {
+		/* Writer has not created the segment yet. */
+		if (reader->map == NULL) {
+			unsigned long offset = reader->offset;
+			lepk__log_reader_enter(reader, reader->segment);
+			if (reader->map == NULL) {
+				return false;
+			}
+			reader->offset = offset;
+		}
+
+		unsigned int size;
+		unsigned long next = lepk__log_read(reader->map, reader->map_size, reader->offset, &size, data);
+		if (next == 0) {
+			return false;
+		}
+		if (size == LEPK__LOG_SEALED) {
+			lepk__log_reader_enter(reader, reader->segment + 1);
+			continue;
+		}
+
+		*length = size - 1;
+		reader->offset = next;
+		return true;
+	}
+}
+
+LEPKLOGIMPL LepkLogStatus lepk_log_reader_seek(LepkLogReader *reader, unsigned long long index) {
+	unsigned long long first, last;
+	if (!lepk__log_segments(reader->dirpath, &first, &last)) {
+		return LEPK_LOG_STATUS_UNABLE_TO_OPEN_CREATE;
+	}
+
+	/* Segments are numbered in order, walk back from the newest to the one holding index. */
+	unsigned long long segment = last;
+	for (;;) {
+		lepk__log_reader_enter(reader, segment);
+		if (reader->map == NULL) {
+			return LEPK_LOG_STATUS_CORRUPT;
+		}
+		if (((const Lepk__LogSegmentHeader *) reader->map)->first_record <= index) {
+			break;
+		}
+		if (segment == first) {
+			return LEPK_LOG_STATUS_OUT_OF_RANGE;
+		}
+		segment--;
+	}
+	unsigned long long skip = index - ((const Lepk__LogSegmentHeader *) reader->map)->first_record;
+
+	/* Jump straight to the record through the index of a full segment. */
+	char *path = lepk__log_path(reader->dirpath, segment, "idx");
+	LepkFileStatus file_status;
+	unsigned long index_size = path != NULL ? lepk_file_size(path, &file_status) : 0;
+	if (index_size >= sizeof(unsigned long long)) {
+		unsigned long long *offsets = (unsigned long long *) lepk_file_read(path, &file_status);
+		if (offsets != NULL) {
+			unsigned long long count = offsets[0];
+			if (count <= index_size / sizeof(unsigned long long) - 1 && skip < count) {
+				reader->offset = offsets[1 + skip];
+				skip = 0;
+			}
+			free(offsets);
+		}
+	}
+	free(path);
+
+	/* Scan the rest. */
+	for (; skip > 0; skip--) {
+		unsigned int size;
+		const void *data;
+		unsigned long next = lepk__log_read(reader->map, reader->map_size, reader->offset, &size, &data);
+		if (next == 0 || size == LEPK__LOG_SEALED) {
+			return LEPK_LOG_STATUS_OUT_OF_RANGE;
+		}
+		reader->offset = next;
+	}
+	return LEPK_LOG_STATUS_OK;
+}
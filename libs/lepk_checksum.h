@@ -0,0 +1,472 @@
+/* Version: 1.0 */
+
+/*
+ * MIT License
+ * 
+ * Copyright (c) 2022 Linus Erik Pontus Kåreblom
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Checksums and hashes.
+ *
+ * Add:
+ *     #define LEPK_CHECKSUM_IMPLEMENTATION
+ * in one C or C++ file, before #include "lepk_checksum.h", to create the implementation.
+ *
+ * If LEPK_CHECKSUM_STATIC is defined the implementation will be local to a single file only.
+ */
+
+/*
+ * === Documentation ===
+ * lepk_crc32c computes the Castagnoli CRC used by iSCSI, ext4 and most storage formats. On x86-64 CPUs with SSE4.2 it
+ * uses the crc32 instruction on three interleaved streams, elsewhere a slicing-by-8 table.
+ * lepk_hash64 is XXH64, a fast non-cryptographic 64-bit hash for hash tables and content addressing.
+ * Both can be fed data piece by piece, so they can be computed while data streams through a buffer.
+ *
+ * Usage:
+ * unsigned int crc = lepk_crc32c(0, header, header_length);
+ * crc = lepk_crc32c(crc, body, body_length);
+ *
+ * LepkHash64 state;
+ * lepk_hash64_init(&state, 0);
+ * lepk_hash64_update(&state, data, length);
+ * unsigned long long hash = lepk_hash64_final(&state);
+ */
+
+#ifndef LEPK_CHECKSUM_H
+#define LEPK_CHECKSUM_H
+
+#ifdef LEPK_CHECKSUM_STATIC
+#define LEPKCHECKSUM static
+#define LEPKCHECKSUMIMPL static
+#else /* LEPK_CHECKSUM_STATIC */
+#define LEPKCHECKSUM extern
+#define LEPKCHECKSUMIMPL
+#endif /* LEPK_CHECKSUM_STATIC */
+
+/* State of a streaming lepk_hash64. */
+typedef struct {
+	unsigned long long lanes[4];
+	unsigned long long seed;
+	unsigned long long total;
+	/* Input not yet making up a full 32 byte stripe. */
+	unsigned char buffer[32];
+	unsigned int buffered;
+} LepkHash64;
+
+/* Continue crc, 0 for the first piece, with length bytes of data. */
+LEPKCHECKSUM unsigned int lepk_crc32c(unsigned int crc, const void *data, unsigned long length);
+/* crc32c of two pieces put together, given the crc32c of each and the length of the second. */
+LEPKCHECKSUM unsigned int lepk_crc32c_combine(unsigned int crc1, unsigned int crc2, unsigned long length2);
+
+/* Hash length bytes of data in one go. */
+LEPKCHECKSUM unsigned long long lepk_hash64(const void *data, unsigned long length, unsigned long long seed);
+/* Start a streaming hash. */
+LEPKCHECKSUM void lepk_hash64_init(LepkHash64 *state, unsigned long long seed);
+/* Add length bytes of data to a streaming hash. */
+LEPKCHECKSUM void lepk_hash64_update(LepkHash64 *state, const void *data, unsigned long length);
+/* Hash of everything added so far, more data can still be added afterwards. */
+LEPKCHECKSUM unsigned long long lepk_hash64_final(const LepkHash64 *state);
+
+#ifdef LEPK_CHECKSUM_TEST
+
+#include <assert.h>
+#include <stdlib.h>
+
+/* Bit at a time reference. */
+static unsigned int lepk__checksum_test_crc(const unsigned char *data, unsigned long length) {
+	unsigned int crc = 0xffffffffu;
+	for (unsigned long i = 0; i < length; i++) {
+		crc ^= data[i];
+		for (int j = 0; j < 8; j++) {
+			crc = crc & 1 ? (crc >> 1) ^ 0x82f63b78u : crc >> 1;
+		}
+	}
+	return ~crc;
+}
+
+static void lepk_checksum_test(void) {
+	assert(lepk_crc32c(0, "123456789", 9) == 0xe3069283u && "lepk_crc32c failed.");
+	assert(lepk_crc32c(0, "", 0) == 0 && "lepk_crc32c of nothing failed.");
+
+	/* Large enough for the interleaved path, odd offsets and lengths for the unaligned edges. */
+	unsigned long size = 100000;
+	unsigned char *data = malloc(size + 8);
+	assert(data != NULL && "malloc failed.");
+	unsigned int seed = 1;
+	for (unsigned long i = 0; i < size + 8; i++) {
+		seed = seed * 1103515245u + 12345u;
+		data[i] = seed >> 16;
+	}
+	unsigned long lengths[] = { 0, 1, 7, 8, 255, 256, 769, 4096, 24577, 99991 };
+	for (unsigned long i = 0; i < sizeof(lengths) / sizeof(lengths[0]); i++) {
+		for (unsigned long offset = 0; offset < 8; offset += 3) {
+			unsigned int expected = lepk__checksum_test_crc(data + offset, lengths[i]);
+			assert(lepk_crc32c(0, data + offset, lengths[i]) == expected && "lepk_crc32c of buffer failed.");
+
+			unsigned long half = lengths[i] / 3;
+			unsigned int first = lepk_crc32c(0, data + offset, half);
+			assert(lepk_crc32c(first, data + offset + half, lengths[i] - half) == expected && "lepk_crc32c streaming failed.");
+			unsigned int second = lepk_crc32c(0, data + offset + half, lengths[i] - half);
+			assert(lepk_crc32c_combine(first, second, lengths[i] - half) == expected && "lepk_crc32c_combine failed.");
+		}
+	}
+
+	assert(lepk_hash64("", 0, 0) == 0xef46db3751d8e999ull && "lepk_hash64 failed.");
+	assert(lepk_hash64("abc", 3, 0) == 0x44bc2cf5ad770999ull && "lepk_hash64 failed.");
+	unsigned char bytes[512];
+	for (int i = 0; i < 512; i++) {
+		bytes[i] = i;
+	}
+	assert(lepk_hash64(bytes, sizeof(bytes), 7) == 0x84fcd079c539a9daull && "lepk_hash64 with seed failed.");
+
+	LepkHash64 state;
+	unsigned long long expected = lepk_hash64(data, size, 42);
+	lepk_hash64_init(&state, 42);
+	for (unsigned long done = 0, step = 1; done < size; done += step, step = step * 2 + 1) {
+		lepk_hash64_update(&state, data + done, done + step < size ? step : size - done);
+	}
+	assert(lepk_hash64_final(&state) == expected && "lepk_hash64 streaming failed.");
+	free(data);
+}
+
+#endif /* LEPK_CHECKSUM_TEST */
+#ifdef LEPK_CHECKSUM_IMPLEMENTATION
+#include <stdbool.h>
+#include <string.h>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define LEPK__CHECKSUM_SSE42
+#include <nmmintrin.h>
+#endif /* __x86_64__ && (__GNUC__ || __clang__) */
+
+#define LEPK__CRC32C_POLY 0x82f63b78u
+/* Lane lengths of the interleaved crc, long lanes for large buffers and short lanes for what is left. */
+#define LEPK__CRC32C_LONG 8192ul
+#define LEPK__CRC32C_SHORT 256ul
+
+/* Slicing-by-8 tables. */
+static unsigned int lepk__crc32c_table[8][256];
+/* Tables moving a crc past a long or short lane of zeroes, one per byte of the crc. */
+static unsigned int lepk__crc32c_long[4][256];
+static unsigned int lepk__crc32c_short[4][256];
+/* x^(2^n) modulo the polynomial, for combining. */
+static unsigned int lepk__crc32c_x2n[32];
+static bool lepk__crc32c_hardware = false;
+/* 0 before setup, 1 while some thread sets up and 2 once the tables are ready. */
+static int lepk__crc32c_state = 0;
+
+/* Multiply a and b modulo the polynomial, bits are reflected. */
+static unsigned int lepk__crc32c_multiply(unsigned int a, unsigned int b) {
+	unsigned int m = 1u << 31;
+	unsigned int p = 0;
+	while (m != 0) {
+		if (a & m) {
+			p ^= b;
+		}
+		m >>= 1;
+		b = b & 1 ? (b >> 1) ^ LEPK__CRC32C_POLY : b >> 1;
+	}
+	return p;
+}
+
+/* x^(8 * length) modulo the polynomial, multiplying a crc with it appends length zero bytes. */
+static unsigned int lepk__crc32c_zeroes(unsigned long length) {
+	unsigned int p = 1u << 31;
+	for (int k = 3; length != 0; length >>= 1, k++) {
+		if (length & 1) {
+			p = lepk__crc32c_multiply(lepk__crc32c_x2n[k & 31], p);
+		}
+	}
+	return p;
+}
+
+static void lepk__crc32c_setup(void) {
+	int expected = 0;
+	if (!__atomic_compare_exchange_n(&lepk__crc32c_state, &expected, 1, false, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE)) {
+		while (__atomic_load_n(&lepk__crc32c_state, __ATOMIC_ACQUIRE) != 2) {
+		}
+		return;
+	}
+
+	for (unsigned int i = 0; i < 256; i++) {
+		unsigned int value = i;
+		for (int j = 0; j < 8; j++) {
+			value = value & 1 ? (value >> 1) ^ LEPK__CRC32C_POLY : value >> 1;
+		}
+		lepk__crc32c_table[0][i] = value;
+	}
+	for (unsigned int i = 0; i < 256; i++) {
+		for (int k = 1; k < 8; k++) {
+			unsigned int value = lepk__crc32c_table[k - 1][i];
+			lepk__crc32c_table[k][i] = lepk__crc32c_table[0][value & 0xff] ^ (value >> 8);
+		}
+	}
+
+	unsigned int p = 1u << 30;
+	for (int n = 0; n < 32; n++) {
+		lepk__crc32c_x2n[n] = p;
+		p = lepk__crc32c_multiply(p, p);
+	}
+	unsigned int long_op = lepk__crc32c_zeroes(LEPK__CRC32C_LONG);
+	unsigned int short_op = lepk__crc32c_zeroes(LEPK__CRC32C_SHORT);
+	for (int k = 0; k < 4; k++) {
+		for (unsigned int i = 0; i < 256; i++) {
+			lepk__crc32c_long[k][i] = lepk__crc32c_multiply(long_op, i << (8 * k));
+			lepk__crc32c_short[k][i] = lepk__crc32c_multiply(short_op, i << (8 * k));
+		}
+	}
+
+#ifdef LEPK__CHECKSUM_SSE42
+	lepk__crc32c_hardware = __builtin_cpu_supports("sse4.2");
+#endif /* LEPK__CHECKSUM_SSE42 */
+	__atomic_store_n(&lepk__crc32c_state, 2, __ATOMIC_RELEASE);
+}
+
+static unsigned int lepk__crc32c_shift(unsigned int table[4][256], unsigned int crc) {
+	return table[0][crc & 0xff] ^ table[1][(crc >> 8) & 0xff] ^ table[2][(crc >> 16) & 0xff] ^ table[3][crc >> 24];
+}
+
+/* Load 8 bytes as a little endian word, whatever the byte order of the host. */
+static unsigned long long lepk__checksum_read64(const unsigned char *bytes) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	unsigned long long value;
+	memcpy(&value, bytes, sizeof(value));
+	return value;
+#else /* __BYTE_ORDER__ */
+	return (unsigned long long) bytes[0] | (unsigned long long) bytes[1] << 8 |
+		(unsigned long long) bytes[2] << 16 | (unsigned long long) bytes[3] << 24 |
+		(unsigned long long) bytes[4] << 32 | (unsigned long long) bytes[5] << 40 |
+		(unsigned long long) bytes[6] << 48 | (unsigned long long) bytes[7] << 56;
+#endif /* __BYTE_ORDER__ */
+}
+
+/* Slicing-by-8, crc is the raw register without the final inversion. */
+static unsigned int lepk__crc32c_software(unsigned int crc, const unsigned char *bytes, unsigned long length) {
+	while (length >= 8) {
+		unsigned long long word = lepk__checksum_read64(bytes) ^ crc;
+		crc = lepk__crc32c_table[7][word & 0xff] ^ lepk__crc32c_table[6][(word >> 8) & 0xff] ^
+			lepk__crc32c_table[5][(word >> 16) & 0xff] ^ lepk__crc32c_table[4][(word >> 24) & 0xff] ^
+			lepk__crc32c_table[3][(word >> 32) & 0xff] ^ lepk__crc32c_table[2][(word >> 40) & 0xff] ^
+			lepk__crc32c_table[1][(word >> 48) & 0xff] ^ lepk__crc32c_table[0][word >> 56];
+		bytes += 8;
+		length -= 8;
+	}
+	while (length > 0) {
+		crc = lepk__crc32c_table[0][(crc ^ *bytes++) & 0xff] ^ (crc >> 8);
+		length--;
+	}
+	return crc;
+}
+
+#ifdef LEPK__CHECKSUM_SSE42
+/*
+ * The crc32 instruction takes 3 cycles but a new one can start every cycle, so three lanes are computed at once
+ * and their crcs combined afterwards with the shift tables.
+ */
+__attribute__((target("sse4.2")))
+static unsigned int lepk__crc32c_sse42(unsigned int crc, const unsigned char *bytes, unsigned long length) {
+	unsigned long long crc0 = crc;
+	while (length > 0 && ((unsigned long) bytes & 7) != 0) {
+		crc0 = _mm_crc32_u8((unsigned int) crc0, *bytes++);
+		length--;
+	}
+
+	while (length >= 3 * LEPK__CRC32C_LONG) {
+		unsigned long long crc1 = 0;
+		unsigned long long crc2 = 0;
+		const unsigned char *end = bytes + LEPK__CRC32C_LONG;
+		do {
+			crc0 = _mm_crc32_u64(crc0, lepk__checksum_read64(bytes));
+			crc1 = _mm_crc32_u64(crc1, lepk__checksum_read64(bytes + LEPK__CRC32C_LONG));
+			crc2 = _mm_crc32_u64(crc2, lepk__checksum_read64(bytes + 2 * LEPK__CRC32C_LONG));
+			bytes += 8;
+		} while (bytes < end);
+		crc0 = lepk__crc32c_shift(lepk__crc32c_long, (unsigned int) crc0) ^ (unsigned int) crc1;
+		crc0 = lepk__crc32c_shift(lepk__crc32c_long, (unsigned int) crc0) ^ (unsigned int) crc2;
+		bytes += 2 * LEPK__CRC32C_LONG;
+		length -= 3 * LEPK__CRC32C_LONG;
+	}
+
+	while (length >= 3 * LEPK__CRC32C_SHORT) {
+		unsigned long long crc1 = 0;
+		unsigned long long crc2 = 0;
+		const unsigned char *end = bytes + LEPK__CRC32C_SHORT;
+		do {
+			crc0 = _mm_crc32_u64(crc0, lepk__checksum_read64(bytes));
+			crc1 = _mm_crc32_u64(crc1, lepk__checksum_read64(bytes + LEPK__CRC32C_SHORT));
+			crc2 = _mm_crc32_u64(crc2, lepk__checksum_read64(bytes + 2 * LEPK__CRC32C_SHORT));
+			bytes += 8;
+		} while (bytes < end);
+		crc0 = lepk__crc32c_shift(lepk__crc32c_short, (unsigned int) crc0) ^ (unsigned int) crc1;
+		crc0 = lepk__crc32c_shift(lepk__crc32c_short, (unsigned int) crc0) ^ (unsigned int) crc2;
+		bytes += 2 * LEPK__CRC32C_SHORT;
+		length -= 3 * LEPK__CRC32C_SHORT;
+	}
+
+	while (length >= 8) {
+		crc0 = _mm_crc32_u64(crc0, lepk__checksum_read64(bytes));
+		bytes += 8;
+		length -= 8;
+	}
+	while (length > 0) {
+		crc0 = _mm_crc32_u8((unsigned int) crc0, *bytes++);
+		length--;
+	}
+	return (unsigned int) crc0;
+}
+#endif /* LEPK__CHECKSUM_SSE42 */
+
+LEPKCHECKSUMIMPL unsigned int lepk_crc32c(unsigned int crc, const void *data, unsigned long length) {
+	if (__atomic_load_n(&lepk__crc32c_state, __ATOMIC_ACQUIRE) != 2) {
+		lepk__crc32c_setup();
+	}
+#ifdef LEPK__CHECKSUM_SSE42
+	if (lepk__crc32c_hardware) {
+		return ~lepk__crc32c_sse42(~crc, data, length);
+	}
+#endif /* LEPK__CHECKSUM_SSE42 */
+	return ~lepk__crc32c_software(~crc, data, length);
+}
+
+LEPKCHECKSUMIMPL unsigned int lepk_crc32c_combine(unsigned int crc1, unsigned int crc2, unsigned long length2) {
+	if (__atomic_load_n(&lepk__crc32c_state, __ATOMIC_ACQUIRE) != 2) {
+		lepk__crc32c_setup();
+	}
+	return lepk__crc32c_multiply(lepk__crc32c_zeroes(length2), crc1) ^ crc2;
+}
+
+#define LEPK__HASH64_PRIME1 0x9e3779b185ebca87ull
+#define LEPK__HASH64_PRIME2 0xc2b2ae3d27d4eb4full
+#define LEPK__HASH64_PRIME3 0x165667b19e3779f9ull
+#define LEPK__HASH64_PRIME4 0x85ebca77c2b2ae63ull
+#define LEPK__HASH64_PRIME5 0x27d4eb2f165667c5ull
+
+static unsigned long long lepk__hash64_rotate(unsigned long long value, int bits) {
+	return (value << bits) | (value >> (64 - bits));
+}
+
+static unsigned long long lepk__hash64_round(unsigned long long lane, unsigned long long input) {
+	lane += input * LEPK__HASH64_PRIME2;
+	lane = lepk__hash64_rotate(lane, 31);
+	return lane * LEPK__HASH64_PRIME1;
+}
+
+static unsigned long long lepk__hash64_merge(unsigned long long hash, unsigned long long lane) {
+	hash ^= lepk__hash64_round(0, lane);
+	return hash * LEPK__HASH64_PRIME1 + LEPK__HASH64_PRIME4;
+}
+
+/* Feed whole 32 byte stripes to the lanes, returns how many bytes were used. */
+static unsigned long lepk__hash64_stripes(unsigned long long lanes[4], const unsigned char *bytes, unsigned long length) {
+	unsigned long done = 0;
+	for (; length - done >= 32; done += 32) {
+		lanes[0] = lepk__hash64_round(lanes[0], lepk__checksum_read64(bytes + done));
+		lanes[1] = lepk__hash64_round(lanes[1], lepk__checksum_read64(bytes + done + 8));
+		lanes[2] = lepk__hash64_round(lanes[2], lepk__checksum_read64(bytes + done + 16));
+		lanes[3] = lepk__hash64_round(lanes[3], lepk__checksum_read64(bytes + done + 24));
+	}
+	return done;
+}
+
+LEPKCHECKSUMIMPL void lepk_hash64_init(LepkHash64 *state, unsigned long long seed) {
+	memset(state, 0, sizeof(LepkHash64));
+	state->seed = seed;
+	state->lanes[0] = seed + LEPK__HASH64_PRIME1 + LEPK__HASH64_PRIME2;
+	state->lanes[1] = seed + LEPK__HASH64_PRIME2;
+	state->lanes[2] = seed;
+	state->lanes[3] = seed - LEPK__HASH64_PRIME1;
+}
+
+LEPKCHECKSUMIMPL void lepk_hash64_update(LepkHash64 *state, const void *data, unsigned long length) {
+	const unsigned char *bytes = data;
+	state->total += length;
+
+	if (state->buffered > 0) {
+		unsigned long fill = 32 - state->buffered < length ? 32 - state->buffered : length;
+		memcpy(state->buffer + state->buffered, bytes, fill);
+		state->buffered += fill;
+		bytes += fill;
+		length -= fill;
+		if (state->buffered < 32) {
+			return;
+		}
+		lepk__hash64_stripes(state->lanes, state->buffer, 32);
+		state->buffered = 0;
+	}
+
+	unsigned long done = lepk__hash64_stripes(state->lanes, bytes, length);
+	memcpy(state->buffer, bytes + done, length - done);
+	state->buffered = length - done;
+}
+
+LEPKCHECKSUMIMPL unsigned long long lepk_hash64_final(const LepkHash64 *state) {
+	unsigned long long hash;
+	if (state->total >= 32) {
+		const unsigned long long *lanes = state->lanes;
+		hash = lepk__hash64_rotate(lanes[0], 1) + lepk__hash64_rotate(lanes[1], 7) + lepk__hash64_rotate(lanes[2], 12) + lepk__hash64_rotate(lanes[3], 18);
+		for (int i = 0; i < 4; i++) {
+			hash = lepk__hash64_merge(hash, lanes[i]);
+		}
+	} else {
+		hash = state->seed + LEPK__HASH64_PRIME5;
+	}
+	hash += state->total;
+
+	const unsigned char *bytes = state->buffer;
+	unsigned long length = state->buffered;
+	for (; length >= 8; bytes += 8, length -= 8) {
+		hash ^= lepk__hash64_round(0, lepk__checksum_read64(bytes));
+		hash = lepk__hash64_rotate(hash, 27) * LEPK__HASH64_PRIME1 + LEPK__HASH64_PRIME4;
+	}
+	if (length >= 4) {
+		unsigned int word;
+		memcpy(&word, bytes, sizeof(word));
+		hash ^= (unsigned long long) word * LEPK__HASH64_PRIME1;
+		hash = lepk__hash64_rotate(hash, 23) * LEPK__HASH64_PRIME2 + LEPK__HASH64_PRIME3;
+		bytes += 4;
+		length -= 4;
+	}
+	for (; length > 0; bytes++, length--) {
+		hash ^= *bytes * LEPK__HASH64_PRIME5;
+		hash = lepk__hash64_rotate(hash, 11) * LEPK__HASH64_PRIME1;
+	}
+
+	hash ^= hash >> 33;
+	hash *= LEPK__HASH64_PRIME2;
+	hash ^= hash >> 29;
+	hash *= LEPK__HASH64_PRIME3;
+	hash ^= hash >> 32;
+	return hash;
+}
+
+LEPKCHECKSUMIMPL unsigned long long lepk_hash64(const void *data, unsigned long length, unsigned long long seed) {
+	LepkHash64 state;
+	lepk_hash64_init(&state, seed);
+	/* Stripes straight from data, only the tail goes through the buffer. */
+	unsigned long done = lepk__hash64_stripes(state.lanes, data, length);
+	memcpy(state.buffer, (const unsigned char *) data + done, length - done);
+	state.buffered = length - done;
+	state.total = length;
+	return lepk_hash64_final(&state);
+}
+#endif /*LEPK_CHECKSUM_IMPLEMENTATION*/
+#endif /* LEPK_CHECKSUM_H */
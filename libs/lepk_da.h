@@ -1,4 +1,4 @@
-/* Version: 1.1 */
+/* Version: 1.3 */
 
 /*
  * MIT License
@@ -47,6 +47,11 @@
  *     printf("%d\n", da[i]);
  * }
  * lepk_da_destroy(da);
+ *
+ * Snapshots:
+ * lepk_da_snapshot writes the item size, count and raw bytes of a dynamic array to a file, lepk_da_load reads it back
+ * with a single allocation and read, so loading costs as much as reading the file no matter how many items it holds.
+ * Items are copied byte for byte, so arrays holding pointers can not be snapshotted.
  */
 
 #ifndef LEPK_DA_H
@@ -60,6 +65,8 @@
 #define LEPKDAIMPL
 #endif /* LEPK_DA_STATIC */
 
+#include <stdbool.h>
+
 /*
  * Data needed for dynamic array operations.
  * Stored before dynamic array returned to user.
@@ -80,6 +87,10 @@ LEPKDA void *lepk_da_create(unsigned long size);
 LEPKDA void lepk_da_destroy(void *da);
 /* Get current amount of items stored in dynamic array. */
 LEPKDA unsigned long lepk_da_count(void *da);
+/* Write dynamic array to file at filepath, replacing it atomically so a crash leaves the old or the new file. Returns false if the file could not be written. */
+LEPKDA bool lepk_da_snapshot(void *da, const char *filepath);
+/* Read dynamic array written by lepk_da_snapshot. NULL return value means function failed. */
+LEPKDA void *lepk_da_load(const char *filepath);
 /* Insert data into dynamic array at index, preserving insertion order. */
 LEPKDA void lepk__da_insert(void **da, const void *data, unsigned int index);
 /* Remove item from dynamic array at index, preserving insertion order. */
@@ -163,6 +174,30 @@ static void lepk_da_test(void) {
 	}
 
 	assert(lepk_da_count(da) == 6 && "lepk_da_count failed.");
+	{
+		int arr[300];
+		for (int i = 0; i < 300; i++) {
+			arr[i] = i;
+		}
+		lepk_da_push_array(da, arr, 300);
+		assert(lepk_da_count(da) == 306 && memcmp(da + 6, arr, 300 * sizeof(int)) == 0 && "lepk_da_push_array with large array failed.");
+	}
+	{
+		assert(lepk_da_snapshot(da, "da_test.snapshot") && "lepk_da_snapshot failed.");
+		int *loaded = lepk_da_load("da_test.snapshot");
+		assert(loaded != NULL && lepk_da_count(loaded) == 306 && memcmp(loaded, da, 306 * sizeof(int)) == 0 && "lepk_da_load failed.");
+		lepk_da_push(loaded, 7);
+		assert(lepk_da_count(loaded) == 307 && loaded[306] == 7 && "lepk_da_push after lepk_da_load failed.");
+		lepk_da_destroy(loaded);
+
+		/* A count larger than the file holds is rejected before anything is allocated. */
+		FILE *file = fopen("da_test.snapshot", "r+b");
+		unsigned long long count = ~0ull;
+		assert(file != NULL && fseek(file, 16, SEEK_SET) == 0 && fwrite(&count, sizeof(count), 1, file) == 1 && fclose(file) == 0 &&
+			"Corrupting snapshot failed.");
+		assert(lepk_da_load("da_test.snapshot") == NULL && "lepk_da_load accepted a corrupt count.");
+		remove("da_test.snapshot");
+	}
 	lepk_da_destroy(da);
 }
 
@@ -172,6 +207,16 @@ static void lepk_da_test(void) {
 #include <malloc.h>
 #include <assert.h>
 #include <string.h> 
+#include <stdio.h>
+#include <limits.h>
+
+/* Snapshots are only synced where POSIX provides fsync, plain C99 still replaces them atomically. */
+#if defined(_POSIX_C_SOURCE) && _POSIX_C_SOURCE >= 200112L
+#include <unistd.h>
+#define LEPK__DA_SYNC(file) (fsync(fileno(file)) == 0)
+#else /* _POSIX_C_SOURCE */
+#define LEPK__DA_SYNC(file) true
+#endif /* _POSIX_C_SOURCE */
 
 typedef unsigned char Lepk__U8;
 
@@ -181,10 +226,23 @@ typedef unsigned char Lepk__U8;
 #define LEPK_DA_START_CAP 8
 #endif /* LEPK_DA_START_CAP */
 
+#define LEPK__DA_SNAPSHOT_VERSION 1
+
+/* Start of a snapshot file, followed by count * size bytes of items. Fixed width fields keep the format independent of the platform. */
+typedef struct {
+	char magic[8];
+	unsigned int version;
+	unsigned int reserved;
+	unsigned long long count;
+	unsigned long long size;
+} Lepk__DaSnapshot;
+
+static const char lepk__da_magic[8] = { 'L', 'E', 'P', 'K', 'D', 'A', '\0', '\0' };
+
 LEPKDAIMPL void *lepk_da_create(unsigned long size) {
 	assert(size != 0 && "Size can't be 0.");
 
-	Lepk__DaHeader *head = head = malloc(size + sizeof(Lepk__DaHeader) * LEPK_DA_START_CAP);
+	Lepk__DaHeader *head = malloc(size * LEPK_DA_START_CAP + sizeof(Lepk__DaHeader));
 	head->count = 0;
 	head->cap = LEPK_DA_START_CAP;
 	head->size = size;
@@ -202,6 +260,84 @@ LEPKDAIMPL unsigned long lepk_da_count(void *da) {
 	return LEPK__HEAD_FROM_DA(da)->count;
 }
 
+LEPKDAIMPL bool lepk_da_snapshot(void *da, const char *filepath) {
+	assert(da != NULL && "Dynamic array can't be NULL.");
+
+	Lepk__DaHeader *head = LEPK__HEAD_FROM_DA(da);
+	Lepk__DaSnapshot snapshot = {0};
+	memcpy(snapshot.magic, lepk__da_magic, sizeof(lepk__da_magic));
+	snapshot.version = LEPK__DA_SNAPSHOT_VERSION;
+	snapshot.count = head->count;
+	snapshot.size = head->size;
+
+	/* Written next to filepath and renamed over it once on disk, a crash leaves either the old or the new snapshot. */
+	size_t length = strlen(filepath) + 5;
+	char *temp = malloc(length);
+	if (temp == NULL) {
+		return false;
+	}
+	snprintf(temp, length, "%s.tmp", filepath);
+
+	FILE *file = fopen(temp, "wb");
+	bool written = file != NULL && fwrite(&snapshot, sizeof(snapshot), 1, file) == 1 &&
+		(head->count == 0 || fwrite(da, head->size, head->count, file) == head->count) && fflush(file) == 0 && LEPK__DA_SYNC(file);
+	if (file != NULL && fclose(file) != 0) {
+		written = false;
+	}
+	written = written && rename(temp, filepath) == 0;
+	if (!written) {
+		remove(temp);
+	}
+	free(temp);
+	return written;
+}
+
+LEPKDAIMPL void *lepk_da_load(const char *filepath) {
+	FILE *file = fopen(filepath, "rb");
+	if (file == NULL) {
+		return NULL;
+	}
+
+	/* The file size bounds count * size, so a corrupt header can neither overflow the allocation nor request more than is there. */
+	long file_size = -1;
+	if (fseek(file, 0, SEEK_END) == 0) {
+		file_size = ftell(file);
+	}
+	Lepk__DaSnapshot snapshot;
+	if (file_size < (long) sizeof(snapshot) || fseek(file, 0, SEEK_SET) != 0 || fread(&snapshot, sizeof(snapshot), 1, file) != 1 ||
+		memcmp(snapshot.magic, lepk__da_magic, sizeof(lepk__da_magic)) != 0 || snapshot.version != LEPK__DA_SNAPSHOT_VERSION ||
+		snapshot.size == 0 || snapshot.size > (ULONG_MAX - sizeof(Lepk__DaHeader)) / LEPK_DA_START_CAP ||
+		snapshot.count > (unsigned long long) (file_size - sizeof(snapshot)) / snapshot.size) {
+		fclose(file);
+		return NULL;
+	}
+
+	/* Capacity follows the same doubling steps as an array that grew to count items, unless that would not fit. */
+	unsigned long cap = LEPK_DA_START_CAP;
+	while (cap < snapshot.count && cap <= ULONG_MAX / 2) {
+		cap *= 2;
+	}
+	if (cap < snapshot.count || cap > (ULONG_MAX - sizeof(Lepk__DaHeader)) / snapshot.size) {
+		cap = snapshot.count;
+	}
+	Lepk__DaHeader *head = malloc(cap * snapshot.size + sizeof(Lepk__DaHeader));
+	if (head == NULL) {
+		fclose(file);
+		return NULL;
+	}
+	head->count = snapshot.count;
+	head->cap = cap;
+	head->size = snapshot.size;
+
+	void *da = LEPK__DA_FROM_HEAD(head);
+	if (snapshot.count > 0 && fread(da, snapshot.size, snapshot.count, file) != snapshot.count) {
+		free(head);
+		da = NULL;
+	}
+	fclose(file);
+	return da;
+}
+
 LEPKDAIMPL void lepk__da_insert(void **da, const void *data, unsigned int index) {
 	assert(da != NULL && "Dynamic array pointer can't be NULL.");
 	assert(*da != NULL && "Dynamic array can't be NULL.");
@@ -214,7 +350,7 @@ LEPKDAIMPL void lepk__da_insert(void **da, const void *data, unsigned int index)
 	}
 
 	/* Resize */
-	if (head->count + 1 == head->cap) {
+	if (head->count == head->cap) {
 		head->cap *= 2;
 		Lepk__DaHeader *realloced_head = realloc(head, head->cap * head->size + sizeof(Lepk__DaHeader));
 		if (realloced_head == NULL) {
@@ -229,7 +365,7 @@ LEPKDAIMPL void lepk__da_insert(void **da, const void *data, unsigned int index)
 	Lepk__U8 *ptr_da = *da;
 
 	/* Move everything one block back. */
-	memmove(ptr_da + (index + 1) * head->size, ptr_da + index * head->size, (head->count - index + 1) * head->size);
+	memmove(ptr_da + (index + 1) * head->size, ptr_da + index * head->size, (head->count - index) * head->size);
 	memcpy(ptr_da + index * head->size, data, head->size);
 
 	head->count++;
@@ -264,9 +400,10 @@ LEPKDAIMPL void lepk__da_remove(void **da, unsigned int index, void *output) {
 		}
 		head = realloced_head;
 		*da = LEPK__DA_FROM_HEAD(head);
+		ptr_da = *da;
 	}
 
-	memmove(ptr_da + (index) * head->size, ptr_da + (index + 1) * head->size, (head->count - index + 1) * head->size);
+	memmove(ptr_da + (index) * head->size, ptr_da + (index + 1) * head->size, (head->count - index - 1) * head->size);
 
 	head->count--;
 }
@@ -333,6 +470,7 @@ LEPKDAIMPL void lepk__da_remove_fast(void **da, unsigned int index, void *output
 		}
 		head = realloced_head;
 		*da = LEPK__DA_FROM_HEAD(head);
+		ptr_da = *da;
 	}
 
 	memcpy(ptr_da + index * head->size, ptr_da + (head->count - 1) * head->size, head->size);
@@ -363,9 +501,26 @@ LEPKDAIMPL void lepk__da_push_array(void **da, const void *array, unsigned int a
 	}
 
 	Lepk__DaHeader *head = LEPK__HEAD_FROM_DA(*da);
-	for (Lepk__U8 i = 0; i < array_length; i++) {
-		lepk__da_insert_fast(da, (Lepk__U8 *) array + i * head->size, head->count);
+
+	/* Resize once for the whole array. */
+	if (head->count + array_length > head->cap) {
+		unsigned long cap = head->cap;
+		while (head->count + array_length > cap) {
+			cap *= 2;
+		}
+		Lepk__DaHeader *realloced_head = realloc(head, cap * head->size + sizeof(Lepk__DaHeader));
+		if (realloced_head == NULL) {
+			free(head);
+			*da = NULL;
+			return;
+		}
+		head = realloced_head;
+		head->cap = cap;
+		*da = LEPK__DA_FROM_HEAD(head);
 	}
+
+	memcpy((Lepk__U8 *) *da + head->count * head->size, array, array_length * head->size);
+	head->count += array_length;
 }
 #endif /*LEPK_DA_IMPLEMENTATION*/
 #endif /* LEPK_DA_H */
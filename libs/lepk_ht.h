@@ -1,4 +1,4 @@
-/* Version: 1.0 */
+/* Version: 1.2 */
 
 /*
  * MIT License
@@ -32,16 +32,17 @@
  * in one C or C++ file, before #include "lepk_ht.h", to create the implementation.
  *
  * If LEPK_HT_STATIS is defined the implementation will be local to a single file only.
- */
-
-/*
- * TODO: ACTUALLY MAKE THE THING WORK.
- * Currently, when getting an entry, if it collided and the object at the original collision point has been removed a dead entry is returned instead of the actual entry.
+ *
+ * The lepk_ht_image_* functions map files with POSIX.1-2008 calls, define _POSIX_C_SOURCE as 200809L (or _GNU_SOURCE) before
+ * including any system header when compiling with -std=c99. Without it, or with LEPK_HT_NO_IMAGE defined, they are left out
+ * and the rest of the hash table is plain C99.
  */
 
 #ifndef LEPK_HT_H
 #define LEPK_HT_H
 
+#include <stdbool.h>
+
 #ifndef LEPK_HT_STATIC
 #define LEPKHT extern
 #else /* LEPK_HT_STATIC */
@@ -65,16 +66,48 @@ LEPKHT unsigned long lepk_ht_count(const LepkHt *table);
 
 /* Set the pair in hash table. */
 LEPKHT void lepk__ht_set(LepkHt *table, const void *key, const void *data);
-/* Get pair from hash table. */
-LEPKHT void lepk__ht_get(LepkHt *table, const void *key, void *output);
-/* Remove pair from hash table. */
-LEPKHT void lepk__ht_remove(LepkHt *table, const void *key, void *output);
+/* Get pair from hash table. Returns false and leaves output untouched if key is missing. */
+LEPKHT bool lepk__ht_get(LepkHt *table, const void *key, void *output);
+/* Remove pair from hash table. Returns false if key is missing. */
+LEPKHT bool lepk__ht_remove(LepkHt *table, const void *key, void *output);
+/*
+ * Iterate over every pair, set *iterator to 0 before the first call. Key and data may be NULL.
+ * Returns false when there are no pairs left. Removing the returned pair while iterating is allowed.
+ */
+LEPKHT bool lepk_ht_next(const LepkHt *table, unsigned long *iterator, void *key, void *data);
+
 
-/* Pre-written hashing function for strings. */
+/*
+ * Write table to file at filepath as a flat image of its slots and stored hashes. Keys and data are copied byte for byte,
+ * so tables holding pointers, like string keys, can not be snapshotted. The file is replaced atomically, a crash leaves the old or the new image.
+ * Returns false if the file could not be written.
+ */
+LEPKHT bool lepk_ht_snapshot(const LepkHt *table, const char *filepath);
+/*
+ * Create a hash table from an image written by lepk_ht_snapshot. Pairs keep their slots and stay in the memory the image is read into,
+ * so nothing is rehashed or allocated per pair.
+ * Hash and compare must be the functions the image was written with. NULL return value means function failed.
+ */
+LEPKHT LepkHt *lepk_ht_load(const char *filepath, LepkHtHash hash, LepkHtCompare compare, unsigned long key_size, unsigned long data_size);
+#ifndef LEPK_HT_NO_IMAGE
+/* Read-only view of a hash table image, lookups read the mapped file directly. */
+typedef struct LepkHtImage LepkHtImage;
+
+/* Map an image read-only, opening costs the same no matter how many pairs it holds. NULL return value means function failed. */
+LEPKHT LepkHtImage *lepk_ht_image_open(const char *filepath, LepkHtHash hash, LepkHtCompare compare, unsigned long key_size, unsigned long data_size);
+/* Unmap an image. */
+LEPKHT void lepk_ht_image_close(LepkHtImage *image);
+/* Retrieve item count from image. */
+LEPKHT unsigned long lepk_ht_image_count(const LepkHtImage *image);
+/* Find data of key inside the mapped image. Returns NULL if key is missing. */
+LEPKHT const void *lepk_ht_image_find(const LepkHtImage *image, const void *key);
+#endif /* LEPK_HT_NO_IMAGE */
+
+/* Pre-written hashing function for strings, keys are const char *. */
 LEPKHT unsigned long lepk_ht_hash_string(const void *key, unsigned long size);
 /* Pre-written generic hashing function for any type of data structure. */
 LEPKHT unsigned long lepk_ht_hash_generic(const void *key, unsigned long size);
-/* Pre-written compare function for strings. */
+/* Pre-written compare function for strings, keys are const char *. */
 LEPKHT int lepk_ht_compare_string(const void *a, const void *b, unsigned long size);
 /* Pre-written generic compare function for any type of data structure. */
 LEPKHT int lepk_ht_compare_generic(const void *a, const void *b, unsigned long size);
@@ -85,13 +118,82 @@ LEPKHT int lepk_ht_compare_generic(const void *a, const void *b, unsigned long s
 
 #ifdef LEPK_HT_TEST
 
+#include <assert.h>
+#include <stdio.h>
+
 static void lepk_ht_test(void) {
 	LepkHt *table = lepk_ht_create(lepk_ht_hash_string, lepk_ht_compare_string, sizeof(const char *), sizeof(int));
-	lepk_ht_set(table, "key", 8);
+	const char *key = "key";
+	lepk_ht_set(table, key, 8);
 	int output = 0;
-	lepk_ht_get(table, "key", &output);
+	lepk_ht_get(table, key, &output);
 	assert(output == 8 && "lepk_ht failed.");
 	lepk_ht_destroy(table);
+
+	/* Removed pairs must not hide pairs that collided with them. */
+	table = lepk_ht_create(lepk_ht_hash_generic, lepk_ht_compare_generic, sizeof(int), sizeof(int));
+	for (int i = 0; i < 100; i++) {
+		lepk_ht_set(table, i, i * 2);
+	}
+	for (int i = 0; i < 100; i += 2) {
+		lepk_ht_remove(table, i, NULL);
+	}
+	lepk_ht_set(table, 1, 3);
+	assert(lepk_ht_count(table) == 50 && "lepk_ht_remove failed.");
+	for (int i = 0; i < 100; i++) {
+		int k = i;
+		bool found = lepk__ht_get(table, &k, &output);
+		assert(found == (i % 2 == 1) && (!found || output == (i == 1 ? 3 : i * 2)) && "lepk_ht_get after lepk_ht_remove failed.");
+	}
+
+	unsigned long iterator = 0;
+	int count = 0;
+	while (lepk_ht_next(table, &iterator, NULL, NULL)) {
+		count++;
+	}
+	assert(count == 50 && "lepk_ht_next failed.");
+
+	/* Images keep removed slots, so collisions stay reachable without rehashing. */
+	assert(lepk_ht_snapshot(table, "ht_test.image") && "lepk_ht_snapshot failed.");
+	lepk_ht_destroy(table);
+	table = lepk_ht_load("ht_test.image", lepk_ht_hash_generic, lepk_ht_compare_generic, sizeof(int), sizeof(int));
+	assert(table != NULL && lepk_ht_count(table) == 50 && "lepk_ht_load failed.");
+#ifndef LEPK_HT_NO_IMAGE
+	LepkHtImage *image = lepk_ht_image_open("ht_test.image", lepk_ht_hash_generic, lepk_ht_compare_generic, sizeof(int), sizeof(int));
+	assert(image != NULL && lepk_ht_image_count(image) == 50 && "lepk_ht_image_open failed.");
+#endif /* LEPK_HT_NO_IMAGE */
+	for (int i = 0; i < 100; i++) {
+		int k = i;
+		bool found = lepk__ht_get(table, &k, &output);
+		assert(found == (i % 2 == 1) && (!found || output == (i == 1 ? 3 : i * 2)) && "lepk_ht_get after lepk_ht_load failed.");
+#ifndef LEPK_HT_NO_IMAGE
+		const int *data = lepk_ht_image_find(image, &k);
+		assert((data != NULL) == found && (data == NULL || *data == output) && "lepk_ht_image_find failed.");
+#endif /* LEPK_HT_NO_IMAGE */
+	}
+	lepk_ht_set(table, 200, 400);
+	lepk_ht_get(table, 200, &output);
+	assert(output == 400 && lepk_ht_count(table) == 51 && "lepk_ht_set after lepk_ht_load failed.");
+	/* Pairs living in the loaded image survive growing the table. */
+	for (int i = 300; i < 400; i++) {
+		lepk_ht_set(table, i, i);
+	}
+	lepk_ht_remove(table, 1, NULL);
+	lepk_ht_get(table, 3, &output);
+	assert(output == 6 && lepk_ht_count(table) == 150 && "lepk_ht_set after lepk_ht_load failed to grow.");
+#ifndef LEPK_HT_NO_IMAGE
+	lepk_ht_image_close(image);
+#endif /* LEPK_HT_NO_IMAGE */
+	lepk_ht_destroy(table);
+
+	/* Slots that disagree with the header are rejected. */
+	FILE *file = fopen("ht_test.image", "r+b");
+	unsigned long long corrupt_count = 49;
+	assert(file != NULL && fseek(file, 40, SEEK_SET) == 0 && fwrite(&corrupt_count, sizeof(corrupt_count), 1, file) == 1 && fclose(file) == 0 &&
+		"Corrupting image failed.");
+	assert(lepk_ht_load("ht_test.image", lepk_ht_hash_generic, lepk_ht_compare_generic, sizeof(int), sizeof(int)) == NULL &&
+		"lepk_ht_load accepted a corrupt image.");
+	remove("ht_test.image");
 }
 
 #endif /* LEPK_HT_TEST */
@@ -102,6 +204,16 @@ static void lepk_ht_test(void) {
 #include <string.h>
 #include <assert.h>
 #include <stdint.h>
+#include <stdio.h>
+
+/* Only images need POSIX, snapshots are synced when it is there and the rest is plain C99. */
+#if defined(_POSIX_C_SOURCE) && _POSIX_C_SOURCE >= 200809L
+#define LEPK__HT_POSIX
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif /* _POSIX_C_SOURCE */
 
 #undef LEPKHT
 #ifndef LEPK_HT_STATIC
@@ -117,8 +229,55 @@ typedef struct Lepk__HtEntry {
 	void *data;
 	size_t hash;
 	bool dead;
+	/* Dead because it was removed, lookups have to probe past it. */
+	bool tombstone;
 } Lepk__HtEntry;
 
+#define LEPK__HT_IMAGE_VERSION 1
+/* Keys and data are padded so every slot of an image is 8 byte aligned. */
+#define LEPK__HT_ALIGN(n) (((n) + 7ul) & ~7ul)
+
+/* Start of a hash table image, followed by cap slots in the same order as the entries of the table. */
+typedef struct {
+	char magic[8];
+	unsigned int version;
+	unsigned int reserved;
+	unsigned long long key_size;
+	unsigned long long data_size;
+	unsigned long long cap;
+	unsigned long long count;
+} Lepk__HtImageHeader;
+
+typedef enum {
+	LEPK__HT_SLOT_EMPTY,
+	LEPK__HT_SLOT_USED,
+	LEPK__HT_SLOT_TOMBSTONE,
+} Lepk__HtSlotState;
+
+/* Start of every slot of an image, followed by the key and the data. */
+typedef struct {
+	unsigned long long hash;
+	unsigned int state;
+	unsigned int reserved;
+} Lepk__HtImageSlot;
+
+static const char lepk__ht_magic[8] = { 'L', 'E', 'P', 'K', 'H', 'T', '\0', '\0' };
+
+#if defined(LEPK__HT_POSIX) && !defined(LEPK_HT_NO_IMAGE)
+struct LepkHtImage {
+	LepkHtHash hash;
+	LepkHtCompare compare;
+
+	const unsigned char *map;
+	size_t map_size;
+	size_t key_size;
+	size_t data_size;
+	size_t cap;
+	size_t count;
+	size_t stride;
+};
+#endif /* LEPK__HT_POSIX && !LEPK_HT_NO_IMAGE */
+
 struct LepkHt {
 	LepkHtHash hash;
 	LepkHtCompare compare;
@@ -127,25 +286,39 @@ struct LepkHt {
 	size_t data_size;
 	size_t cap;
 	size_t count;
+	size_t tombstones;
 	Lepk__HtEntry *entires;
+	/* Image a loaded table was read into, keys and data of its slots point into it and are not freed on their own. */
+	unsigned char *image;
+	size_t image_size;
 };
 
-static Lepk__HtEntry *lepk__ht_find_entry(Lepk__HtEntry *entires, LepkHtCompare compare, unsigned long hash, unsigned long cap, const void *key, unsigned long key_size) {
-	size_t index = hash % cap;
-	Lepk__HtEntry *entry = &entires[index];
-
-	/* No entry at index. */
-	if (entry->dead) {
-		return entry;
+/* Free a key or data allocation, unless it points into the image the table was loaded from. */
+static void lepk__ht_free(const LepkHt *table, void *ptr) {
+	uintptr_t address = (uintptr_t) ptr;
+	uintptr_t image = (uintptr_t) table->image;
+	if (address < image || address >= image + table->image_size) {
+		free(ptr);
 	}
+}
+
+/* Find entry holding key, or the slot key should be inserted at if it is missing. */
+static Lepk__HtEntry *lepk__ht_find_entry(Lepk__HtEntry *entires, LepkHtCompare compare, unsigned long hash, unsigned long cap, const void *key, unsigned long key_size) {
+	size_t index = hash & (cap - 1);
+	Lepk__HtEntry *tombstone = NULL;
 
-	/* Entry at current location. */
 	for (;;) {
-		entry = &entires[index];
-		/* printf("%s\n", entry->dead ? "dead" : "alive"); */
+		Lepk__HtEntry *entry = &entires[index];
 
-		/* Found entry with same key or an empty slot. */
-		if (entry->dead || compare(key, entry->key, key_size) == 0) {
+		if (entry->dead) {
+			/* Never used slot ends the probe, reuse the first tombstone passed on the way. */
+			if (!entry->tombstone) {
+				return tombstone != NULL ? tombstone : entry;
+			}
+			if (tombstone == NULL) {
+				tombstone = entry;
+			}
+		} else if (entry->hash == hash && compare(key, entry->key, key_size) == 0) {
 			return entry;
 		}
 
@@ -163,13 +336,17 @@ LEPKHT LepkHt *lepk_ht_create(LepkHtHash hash, LepkHtCompare compare, unsigned l
 	table->data_size = data_size;
 	table->cap = 8;
 	table->count = 0;
+	table->tombstones = 0;
 	table->entires = malloc(table->cap * sizeof(Lepk__HtEntry));
+	table->image = NULL;
+	table->image_size = 0;
 
 	for (size_t i = 0; i < table->cap; i++) {
 		table->entires[i].key = NULL;
 		table->entires[i].data = NULL;
 		table->entires[i].hash = 0;
 		table->entires[i].dead = true;
+		table->entires[i].tombstone = false;
 	}
 
 	return table;
@@ -178,10 +355,11 @@ LEPKHT LepkHt *lepk_ht_create(LepkHtHash hash, LepkHtCompare compare, unsigned l
 LEPKHT void lepk_ht_destroy(LepkHt *table) {
 	for (size_t i = 0; i < table->cap; i++) {
 		Lepk__HtEntry *entry = &table->entires[i];
-		if (entry->key  != NULL) { free(entry->key);  }
-		if (entry->data != NULL) { free(entry->data); }
+		if (entry->key  != NULL) { lepk__ht_free(table, entry->key);  }
+		if (entry->data != NULL) { lepk__ht_free(table, entry->data); }
 	}
 	free(table->entires);
+	free(table->image);
 	free(table);
 }
 
@@ -190,9 +368,9 @@ LEPKHT unsigned long lepk_ht_count(const LepkHt *table) {
 }
 
 LEPKHT void lepk__ht_set(LepkHt *table, const void *key, const void *data) {
-	/* Resize table if needed. */
-	if (table->count >= (size_t) (table->cap * LEPK_HT_MAX_LOAD)) {
-		size_t new_cap = table->cap * 2;
+	/* Resize table if needed, tombstones count towards the load since they lengthen probes. */
+	if (table->count + table->tombstones >= (size_t) (table->cap * LEPK_HT_MAX_LOAD)) {
+		size_t new_cap = table->count * 2 >= table->cap ? table->cap * 2 : table->cap;
 
 		Lepk__HtEntry *new_entires = malloc(new_cap * sizeof(Lepk__HtEntry));
 		for (size_t i = 0; i < new_cap; i++) {
@@ -200,6 +378,7 @@ LEPKHT void lepk__ht_set(LepkHt *table, const void *key, const void *data) {
 			new_entires[i].data = NULL;
 			new_entires[i].hash = 0;
 			new_entires[i].dead = true;
+			new_entires[i].tombstone = false;
 		}
 		/* Loop through old entires and place then in the new list. */
 		for (size_t i = 0; i < table->cap; i++) {
@@ -207,10 +386,14 @@ LEPKHT void lepk__ht_set(LepkHt *table, const void *key, const void *data) {
 			if (!entry->dead) {
 				Lepk__HtEntry *new_entry = lepk__ht_find_entry(new_entires, table->compare, entry->hash, new_cap, entry->key, table->key_size);
 				memcpy(new_entry, entry, sizeof(Lepk__HtEntry));
+			} else {
+				lepk__ht_free(table, entry->key);
+				lepk__ht_free(table, entry->data);
 			}
 		}
 
 		table->cap = new_cap;
+		table->tombstones = 0;
 		free(table->entires);
 		table->entires = new_entires;
 	}
@@ -219,40 +402,67 @@ LEPKHT void lepk__ht_set(LepkHt *table, const void *key, const void *data) {
 	Lepk__HtEntry *entry = lepk__ht_find_entry(table->entires, table->compare, hash, table->cap, key, table->key_size);
 	if (entry->dead) {
 		table->count++;
+		if (entry->tombstone) {
+			table->tombstones--;
+		}
+
+		/* Slots keep their allocations, sizes are the same for every pair. */
+		if (entry->key == NULL) {
+			entry->key = malloc(table->key_size);
+		}
+		if (entry->data == NULL) {
+			entry->data = malloc(table->data_size);
+		}
+		memcpy(entry->key, key, table->key_size);
+		entry->hash = hash;
+		entry->dead = false;
+		entry->tombstone = false;
 	}
 
-	entry->data = malloc(table->data_size);
 	memcpy(entry->data, data, table->data_size);
-	entry->key = malloc(table->key_size);
-	memcpy(entry->key, key, table->key_size);
-	entry->hash = hash;
-	entry->dead = false;
 }
 
-LEPKHT void lepk__ht_get(LepkHt *table, const void *key, void *output) {
+LEPKHT bool lepk__ht_get(LepkHt *table, const void *key, void *output) {
 	assert(output != NULL && "Output pointer can't be NULL.");
 	Lepk__HtEntry *entry = lepk__ht_find_entry(table->entires, table->compare, table->hash(key, table->key_size), table->cap, key, table->key_size);
 	if (entry->dead) {
-		return;
+		return false;
 	}
 	memcpy(output, entry->data, table->data_size);
+	return true;
 }
 
-LEPKHT void lepk__ht_remove(LepkHt *table, const void *key, void *output) {
+LEPKHT bool lepk__ht_remove(LepkHt *table, const void *key, void *output) {
 	Lepk__HtEntry *entry = lepk__ht_find_entry(table->entires, table->compare, table->hash(key, table->key_size), table->cap, key, table->key_size);
 	if (entry->dead) {
-		return;
+		return false;
 	}
 	if (output != NULL) {
 		memcpy(output, entry->data, table->data_size);
 	}
 	entry->dead = true;
+	entry->tombstone = true;
 	table->count--;
+	table->tombstones++;
+	return true;
+}
+
+LEPKHT bool lepk_ht_next(const LepkHt *table, unsigned long *iterator, void *key, void *data) {
+	for (; *iterator < table->cap; (*iterator)++) {
+		const Lepk__HtEntry *entry = &table->entires[*iterator];
+		if (!entry->dead) {
+			if (key  != NULL) { memcpy(key,  entry->key,  table->key_size);  }
+			if (data != NULL) { memcpy(data, entry->data, table->data_size); }
+			(*iterator)++;
+			return true;
+		}
+	}
+	return false;
 }
 
 LEPKHT unsigned long lepk_ht_hash_string(const void *key, unsigned long size) {
 	(void) size;
-	const char *_key = key;
+	const char *_key = *(const char *const *) key;
 	unsigned long len = strlen(_key);
 	unsigned long hash = 2166136261lu;
 	for (unsigned long i = 0; i < len; i++) {
@@ -264,13 +474,13 @@ LEPKHT unsigned long lepk_ht_hash_string(const void *key, unsigned long size) {
 
 LEPKHT int lepk_ht_compare_string(const void *a, const void *b, unsigned long size) {
 	(void) size;
-	return strcmp((const char *) a, (const char *) b);
+	return strcmp(*(const char *const *) a, *(const char *const *) b);
 }
 
 LEPKHT unsigned long lepk_ht_hash_generic(const void *key, unsigned long size) {
 	size_t hash = 2166136261lu;
 	for (size_t i = 0; i < size; i++) {
-		hash ^= *(uint8_t *) key + i;
+		hash ^= ((const uint8_t *) key)[i];
 		hash *= 16777619;
 	}
 	return hash;
@@ -279,5 +489,207 @@ LEPKHT unsigned long lepk_ht_hash_generic(const void *key, unsigned long size) {
 LEPKHT int lepk_ht_compare_generic(const void *a, const void *b, unsigned long size) {
 	return memcmp(a, b, size);
 }
+
+static size_t lepk__ht_stride(size_t key_size, size_t data_size) {
+	return sizeof(Lepk__HtImageSlot) + LEPK__HT_ALIGN(key_size) + LEPK__HT_ALIGN(data_size);
+}
+
+/* Check that an image is complete and holds pairs of the expected sizes. */
+static const Lepk__HtImageHeader *lepk__ht_image_check(const unsigned char *image, size_t size, size_t key_size, size_t data_size) {
+	if (size < sizeof(Lepk__HtImageHeader)) {
+		return NULL;
+	}
+	const Lepk__HtImageHeader *header = (const Lepk__HtImageHeader *) image;
+	if (memcmp(header->magic, lepk__ht_magic, sizeof(lepk__ht_magic)) != 0 || header->version != LEPK__HT_IMAGE_VERSION ||
+		header->key_size != key_size || header->data_size != data_size || header->cap == 0 || (header->cap & (header->cap - 1)) != 0 ||
+		header->cap > (size - sizeof(Lepk__HtImageHeader)) / lepk__ht_stride(key_size, data_size) || header->count >= header->cap) {
+		return NULL;
+	}
+	return header;
+}
+
+/* Write data next to filepath and rename it over filepath once it is on disk, a crash leaves either the old or the new file. */
+static bool lepk__ht_save(const char *filepath, const void *data, size_t size) {
+	size_t length = strlen(filepath) + 5;
+	char *temp = malloc(length);
+	if (temp == NULL) {
+		return false;
+	}
+	snprintf(temp, length, "%s.tmp", filepath);
+
+	FILE *file = fopen(temp, "wb");
+	bool written = file != NULL && fwrite(data, size, 1, file) == 1 && fflush(file) == 0;
+#ifdef LEPK__HT_POSIX
+	written = written && fsync(fileno(file)) == 0;
+#endif /* LEPK__HT_POSIX */
+	if (file != NULL && fclose(file) != 0) {
+		written = false;
+	}
+	written = written && rename(temp, filepath) == 0;
+	if (!written) {
+		remove(temp);
+	}
+	free(temp);
+	return written;
+}
+
+LEPKHT bool lepk_ht_snapshot(const LepkHt *table, const char *filepath) {
+	size_t stride = lepk__ht_stride(table->key_size, table->data_size);
+	size_t size = sizeof(Lepk__HtImageHeader) + table->cap * stride;
+	unsigned char *image = calloc(1, size);
+	if (image == NULL) {
+		return false;
+	}
+
+	Lepk__HtImageHeader *header = (Lepk__HtImageHeader *) image;
+	memcpy(header->magic, lepk__ht_magic, sizeof(lepk__ht_magic));
+	header->version = LEPK__HT_IMAGE_VERSION;
+	header->key_size = table->key_size;
+	header->data_size = table->data_size;
+	header->cap = table->cap;
+	header->count = table->count;
+
+	/* Slots stay where they are, tombstones included, so probe sequences are the same after loading. */
+	for (size_t i = 0; i < table->cap; i++) {
+		const Lepk__HtEntry *entry = &table->entires[i];
+		unsigned char *ptr = image + sizeof(Lepk__HtImageHeader) + i * stride;
+		Lepk__HtImageSlot *slot = (Lepk__HtImageSlot *) ptr;
+		if (!entry->dead) {
+			slot->hash = entry->hash;
+			slot->state = LEPK__HT_SLOT_USED;
+			memcpy(ptr + sizeof(Lepk__HtImageSlot), entry->key, table->key_size);
+			memcpy(ptr + sizeof(Lepk__HtImageSlot) + LEPK__HT_ALIGN(table->key_size), entry->data, table->data_size);
+		} else if (entry->tombstone) {
+			slot->state = LEPK__HT_SLOT_TOMBSTONE;
+		}
+	}
+
+	bool written = lepk__ht_save(filepath, image, size);
+	free(image);
+	return written;
+}
+
+LEPKHT LepkHt *lepk_ht_load(const char *filepath, LepkHtHash hash, LepkHtCompare compare, unsigned long key_size, unsigned long data_size) {
+	/* Keys and data stay in the buffer the image is read into, loading allocates the same no matter how many pairs there are. */
+	FILE *file = fopen(filepath, "rb");
+	if (file == NULL) {
+		return NULL;
+	}
+	long size = -1;
+	if (fseek(file, 0, SEEK_END) == 0) {
+		size = ftell(file);
+	}
+	unsigned char *image = size > 0 && fseek(file, 0, SEEK_SET) == 0 ? malloc(size) : NULL;
+	bool ok = image != NULL && fread(image, size, 1, file) == 1;
+	fclose(file);
+
+	const Lepk__HtImageHeader *header = ok ? lepk__ht_image_check(image, size, key_size, data_size) : NULL;
+	LepkHt *table = header != NULL ? malloc(sizeof(LepkHt)) : NULL;
+	Lepk__HtEntry *entires = table != NULL ? calloc(header->cap, sizeof(Lepk__HtEntry)) : NULL;
+	ok = entires != NULL;
+	size_t stride = lepk__ht_stride(key_size, data_size);
+	size_t count = 0;
+	size_t tombstones = 0;
+	for (size_t i = 0; ok && i < header->cap; i++) {
+		unsigned char *ptr = image + sizeof(Lepk__HtImageHeader) + i * stride;
+		const Lepk__HtImageSlot *slot = (const Lepk__HtImageSlot *) ptr;
+		Lepk__HtEntry *entry = &entires[i];
+		entry->dead = slot->state != LEPK__HT_SLOT_USED;
+		entry->tombstone = slot->state == LEPK__HT_SLOT_TOMBSTONE;
+		if (!entry->dead) {
+			entry->hash = slot->hash;
+			entry->key = ptr + sizeof(Lepk__HtImageSlot);
+			entry->data = ptr + sizeof(Lepk__HtImageSlot) + LEPK__HT_ALIGN(key_size);
+		}
+		count += !entry->dead;
+		tombstones += entry->tombstone;
+		ok = slot->state <= LEPK__HT_SLOT_TOMBSTONE;
+	}
+
+	/* Probing in a loaded table is unbounded, so the slots have to match the header and leave an empty slot to stop at. */
+	ok = ok && count == header->count && count + tombstones < header->cap;
+	if (!ok) {
+		free(entires);
+		free(table);
+		free(image);
+		return NULL;
+	}
+
+	table->hash = hash;
+	table->compare = compare;
+	table->key_size = key_size;
+	table->data_size = data_size;
+	table->cap = header->cap;
+	table->count = count;
+	table->tombstones = tombstones;
+	table->entires = entires;
+	table->image = image;
+	table->image_size = size;
+	return table;
+}
+
+#if defined(LEPK__HT_POSIX) && !defined(LEPK_HT_NO_IMAGE)
+LEPKHT LepkHtImage *lepk_ht_image_open(const char *filepath, LepkHtHash hash, LepkHtCompare compare, unsigned long key_size, unsigned long data_size) {
+	int fd = open(filepath, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		return NULL;
+	}
+	struct stat st;
+	void *map = MAP_FAILED;
+	if (fstat(fd, &st) == 0 && st.st_size > 0) {
+		map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	}
+	close(fd);
+	if (map == MAP_FAILED) {
+		return NULL;
+	}
+
+	const Lepk__HtImageHeader *header = lepk__ht_image_check(map, st.st_size, key_size, data_size);
+	LepkHtImage *image = header != NULL ? malloc(sizeof(LepkHtImage)) : NULL;
+	if (image == NULL) {
+		munmap(map, st.st_size);
+		return NULL;
+	}
+
+	image->hash = hash;
+	image->compare = compare;
+	image->map = map;
+	image->map_size = st.st_size;
+	image->key_size = key_size;
+	image->data_size = data_size;
+	image->cap = header->cap;
+	image->count = header->count;
+	image->stride = lepk__ht_stride(key_size, data_size);
+	return image;
+}
+
+LEPKHT void lepk_ht_image_close(LepkHtImage *image) {
+	munmap((void *) image->map, image->map_size);
+	free(image);
+}
+
+LEPKHT unsigned long lepk_ht_image_count(const LepkHtImage *image) {
+	return image->count;
+}
+
+LEPKHT const void *lepk_ht_image_find(const LepkHtImage *image, const void *key) {
+	size_t hash = image->hash(key, image->key_size);
+	size_t index = hash & (image->cap - 1);
+
+	/* Same probing as lepk__ht_find_entry, bounded since an image comes from outside. */
+	for (size_t i = 0; i < image->cap; i++) {
+		const unsigned char *ptr = image->map + sizeof(Lepk__HtImageHeader) + index * image->stride;
+		const Lepk__HtImageSlot *slot = (const Lepk__HtImageSlot *) ptr;
+		if (slot->state == LEPK__HT_SLOT_EMPTY) {
+			return NULL;
+		}
+		if (slot->state == LEPK__HT_SLOT_USED && slot->hash == hash && image->compare(key, ptr + sizeof(Lepk__HtImageSlot), image->key_size) == 0) {
+			return ptr + sizeof(Lepk__HtImageSlot) + LEPK__HT_ALIGN(image->key_size);
+		}
+		index = (index + 1) & (image->cap - 1);
+	}
+	return NULL;
+}
+#endif /* LEPK__HT_POSIX && !LEPK_HT_NO_IMAGE */
 #endif /*LEPK_HT_IMPLEMENTATION*/
 #endif /* LEPK_HT_H */
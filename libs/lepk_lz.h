@@ -0,0 +1,915 @@
+/* Version: 1.0 */
+
+/*
+ * MIT License
+ * 
+ * Copyright (c) 2022 Linus Erik Pontus Kåreblom
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Fast LZ compression.
+ *
+ * Add:
+ *     #define LEPK_LZ_IMPLEMENTATION
+ * in one C or C++ file, before #include "lepk_lz.h", to create the implementation.
+ *
+ * If LEPK_LZ_STATIC is defined the implementation will be local to a single file only.
+ *
+ * The implementation uses POSIX.1-2008 calls, define _POSIX_C_SOURCE as 200809L (or _GNU_SOURCE) before including
+ * any system header when compiling with -std=c99.
+ *
+ * The implementation uses lepk_checksum.h and lepk_file.h, their implementations must be included before this one.
+ *
+ * Use:
+ *     #define LEPK_LZ_HASH_LOG [int]
+ * to define the log2 of the amount of match finder entries, more finds more matches but costs cache, default 12.
+ */
+
+/*
+ * === Documentation ===
+ * Blocks use the LZ4 block format: sequences of literals followed by a match of at least 4 bytes up to 64 KiB back.
+ * The compressor is a single greedy pass with a hash table, the decompressor copies 8 bytes at a time and checks
+ * every length and offset, so malformed input fails with LEPK_LZ_STATUS_CORRUPT instead of reading or writing out of bounds.
+ *
+ * Files are framed: a header, then blocks that each carry their compressed and original length and a crc32c of the
+ * original data. Blocks that do not compress are stored as they are. lepk_lz_file_write and lepk_lz_file_read handle
+ * whole files, writers and readers stream a file block by block.
+ *
+ * Usage:
+ * lepk_lz_file_write("snapshot.lz", data, length);
+ * unsigned long length;
+ * char *data = lepk_lz_file_read("snapshot.lz", &length, NULL);
+ *
+ * LepkLzWriter *writer = lepk_lz_writer_open("log.lz", 0, NULL);
+ * lepk_lz_writer_write(writer, data, length);
+ * lepk_lz_writer_close(writer);
+ */
+
+#ifndef LEPK_LZ_H
+#define LEPK_LZ_H
+
+#ifdef LEPK_LZ_STATIC
+#define LEPKLZ static
+#define LEPKLZIMPL static
+#else /* LEPK_LZ_STATIC */
+#define LEPKLZ extern
+#define LEPKLZIMPL
+#endif /* LEPK_LZ_STATIC */
+
+/* Status code for functions. */
+typedef enum {
+	/* OK. */
+	LEPK_LZ_STATUS_OK,
+	/* File failed to be opened or created. */
+	LEPK_LZ_STATUS_UNABLE_TO_OPEN_CREATE,
+	/* OS is out of memory. */
+	LEPK_LZ_STATUS_OUT_OF_MEMORY,
+	/* Writing the file failed. */
+	LEPK_LZ_STATUS_WRITE_FAILED,
+	/* Reading the file failed. */
+	LEPK_LZ_STATUS_READ_FAILED,
+	/* Compressed data is malformed or fails its checksum. */
+	LEPK_LZ_STATUS_CORRUPT,
+	/* Output buffer is too small. */
+	LEPK_LZ_STATUS_TOO_SMALL,
+} LepkLzStatus;
+
+/* Streaming writer of a compressed file. */
+typedef struct LepkLzWriter LepkLzWriter;
+/* Streaming reader of a compressed file. */
+typedef struct LepkLzReader LepkLzReader;
+
+/* Largest compressed length of length bytes. */
+LEPKLZ unsigned long lepk_lz_bound(unsigned long length);
+/* Compress length bytes of source, less than 4 GiB, into destination. Returns the compressed length, 0 if capacity is below lepk_lz_bound(length). */
+LEPKLZ unsigned long lepk_lz_compress(const void *source, unsigned long length, void *destination, unsigned long capacity);
+/* Decompress a block into destination, output_length is set to the decompressed length. */
+LEPKLZ LepkLzStatus lepk_lz_decompress(const void *source, unsigned long length, void *destination, unsigned long capacity, unsigned long *output_length);
+
+/* Compress content into a file at filepath, the file is replaced atomically. */
+LEPKLZ LepkLzStatus lepk_lz_file_write(const char *filepath, const char *content, unsigned long length);
+/* Read and decompress a file, the contents are null terminated. NULL return value means function failed, read status for more specific error. */
+LEPKLZ char *lepk_lz_file_read(const char *filepath, unsigned long *length, LepkLzStatus *status);
+
+/* Create a compressed file at filepath. Block size 0 uses the default of 256 KiB. NULL return value means function failed. */
+LEPKLZ LepkLzWriter *lepk_lz_writer_open(const char *filepath, unsigned long block_size, LepkLzStatus *status);
+/* Add data to the file, full blocks are compressed and written as they fill up. */
+LEPKLZ LepkLzStatus lepk_lz_writer_write(LepkLzWriter *writer, const void *data, unsigned long length);
+/* Write the last block and close the file. Returns the first error of any write. */
+LEPKLZ LepkLzStatus lepk_lz_writer_close(LepkLzWriter *writer);
+/* Open a compressed file for reading. NULL return value means function failed. */
+LEPKLZ LepkLzReader *lepk_lz_reader_open(const char *filepath, LepkLzStatus *status);
+/* Copy up to capacity decompressed bytes into buffer, length is set to 0 at the end of the file. */
+LEPKLZ LepkLzStatus lepk_lz_reader_read(LepkLzReader *reader, void *buffer, unsigned long capacity, unsigned long *length);
+/* Close reader. */
+LEPKLZ void lepk_lz_reader_close(LepkLzReader *reader);
+
+#ifdef LEPK_LZ_TEST
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+static unsigned int lepk__lz_test_random(unsigned int *state) {
+	*state ^= *state << 13;
+	*state ^= *state >> 17;
+	*state ^= *state << 5;
+	return *state;
+}
+
+/* Data between random noise and long repeats, depending on how many symbols and repeats are picked. */
+static void lepk__lz_test_fill(unsigned char *data, unsigned long length, unsigned int *state) {
+	unsigned int symbols = 1 + lepk__lz_test_random(state) % 256;
+	unsigned int repeats = lepk__lz_test_random(state) % 100;
+	for (unsigned long i = 0; i < length;) {
+		if (i > 0 && lepk__lz_test_random(state) % 100 < repeats) {
+			unsigned long back = 1 + lepk__lz_test_random(state) % (i < 70000 ? i : 70000);
+			unsigned long run = 1 + lepk__lz_test_random(state) % 300;
+			for (unsigned long j = 0; j < run && i < length; j++, i++) {
+				data[i] = data[i - back];
+			}
+		} else {
+			data[i++] = lepk__lz_test_random(state) % symbols;
+		}
+	}
+}
+
+static void lepk_lz_test(void) {
+	unsigned int state = 0x2545f491u;
+	unsigned long max = 200000;
+	unsigned char *data = malloc(max);
+	unsigned char *compressed = malloc(lepk_lz_bound(max));
+	unsigned char *output = malloc(max);
+	assert(data != NULL && compressed != NULL && output != NULL && "malloc failed.");
+
+	/* Round trip fuzzing, then feed the decompressor damaged blocks, which must fail cleanly (run with a sanitizer to be sure). */
+	for (int round = 0; round < 300; round++) {
+		unsigned long length = round < 20 ? (unsigned long) round : lepk__lz_test_random(&state) % max;
+		lepk__lz_test_fill(data, length, &state);
+		unsigned long size = lepk_lz_compress(data, length, compressed, lepk_lz_bound(length));
+		assert(size > 0 && size <= lepk_lz_bound(length) && "lepk_lz_compress failed.");
+
+		unsigned long output_length;
+		LepkLzStatus status = lepk_lz_decompress(compressed, size, output, max, &output_length);
+		assert(status == LEPK_LZ_STATUS_OK && output_length == length && memcmp(data, output, length) == 0 && "lepk_lz_decompress failed.");
+		if (length > 0) {
+			status = lepk_lz_decompress(compressed, size, output, length - 1, &output_length);
+			assert(status != LEPK_LZ_STATUS_OK && "lepk_lz_decompress into a small buffer failed.");
+		}
+
+		for (int damage = 0; damage < 8; damage++) {
+			unsigned long position = lepk__lz_test_random(&state) % size;
+			unsigned char old = compressed[position];
+			compressed[position] ^= 1 + lepk__lz_test_random(&state) % 255;
+			lepk_lz_decompress(compressed, size, output, max, &output_length);
+			lepk_lz_decompress(compressed, position, output, max, &output_length);
+			compressed[position] = old;
+		}
+	}
+	assert(lepk_lz_compress(data, 1000, compressed, 10) == 0 && "lepk_lz_compress into a small buffer failed.");
+
+	/* Whole files. */
+	unsigned long length = 150000;
+	lepk__lz_test_fill(data, length, &state);
+	LepkLzStatus status = lepk_lz_file_write("lz_test.lz", (const char *) data, length);
+	assert(status == LEPK_LZ_STATUS_OK && "lepk_lz_file_write failed.");
+	unsigned long read_length;
+	char *content = lepk_lz_file_read("lz_test.lz", &read_length, &status);
+	assert(content != NULL && read_length == length && memcmp(content, data, length) == 0 && "lepk_lz_file_read failed.");
+	free(content);
+
+	/* Streams with blocks smaller than the pieces and pieces smaller than the blocks. */
+	LepkLzWriter *writer = lepk_lz_writer_open("lz_test.lz", 4096, &status);
+	assert(writer != NULL && "lepk_lz_writer_open failed.");
+	for (unsigned long done = 0, step = 1; done < length; done += step, step = step * 3 + 1) {
+		status = lepk_lz_writer_write(writer, data + done, done + step < length ? step : length - done);
+		assert(status == LEPK_LZ_STATUS_OK && "lepk_lz_writer_write failed.");
+	}
+	assert(lepk_lz_writer_close(writer) == LEPK_LZ_STATUS_OK && "lepk_lz_writer_close failed.");
+
+	LepkLzReader *reader = lepk_lz_reader_open("lz_test.lz", &status);
+	assert(reader != NULL && "lepk_lz_reader_open failed.");
+	unsigned long total = 0;
+	for (unsigned long step = 1;; step = step * 2 + 1) {
+		status = lepk_lz_reader_read(reader, output + total, step < max - total ? step : max - total, &read_length);
+		assert(status == LEPK_LZ_STATUS_OK && "lepk_lz_reader_read failed.");
+		if (read_length == 0) {
+			break;
+		}
+		total += read_length;
+	}
+	assert(total == length && memcmp(output, data, length) == 0 && "lepk_lz_reader_read content failed.");
+	lepk_lz_reader_close(reader);
+
+	/* A flipped bit in the file is caught by the block checksum. */
+	content = lepk_file_read("lz_test.lz", NULL);
+	unsigned long file_size = lepk_file_size("lz_test.lz", NULL);
+	content[file_size / 2] ^= 0x10;
+	lepk_file_write("lz_test.lz", content, file_size, LEPK_FILE_MODE_BINARY);
+	free(content);
+	content = lepk_lz_file_read("lz_test.lz", &read_length, &status);
+	assert(content == NULL && status == LEPK_LZ_STATUS_CORRUPT && "lepk_lz_file_read of damaged file failed.");
+	lepk_file_remove("lz_test.lz");
+
+	free(data);
+	free(compressed);
+	free(output);
+}
+
+#endif /* LEPK_LZ_TEST */
+#ifdef LEPK_LZ_IMPLEMENTATION
+#include "lepk_checksum.h"
+#include "lepk_file.h"
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#if !defined(_POSIX_C_SOURCE) || _POSIX_C_SOURCE < 200809L
+#error "lepk_lz.h needs _POSIX_C_SOURCE defined as 200809L or _GNU_SOURCE defined before any system header is included."
+#endif /* _POSIX_C_SOURCE */
+
+#ifndef LEPK_LZ_HASH_LOG
+#define LEPK_LZ_HASH_LOG 12
+#endif /* LEPK_LZ_HASH_LOG */
+
+#define LEPK__LZ_SET_STATUS(p, s) do {if ((p)) { *(p) = (s); }} while (0)
+
+#define LEPK__LZ_MIN_MATCH 4
+/* The last 5 bytes are always literals and the last match starts at least 12 bytes before the end. */
+#define LEPK__LZ_LAST_LITERALS 5
+#define LEPK__LZ_MATCH_LIMIT 12
+#define LEPK__LZ_MAX_OFFSET 65535
+/* Searches without a match before the step between positions grows. */
+#define LEPK__LZ_SKIP 6
+
+#define LEPK__LZ_VERSION 1
+#define LEPK__LZ_BLOCK_SIZE (256ul * 1024)
+#define LEPK__LZ_MAX_BLOCK_SIZE (64ul * 1024 * 1024)
+/* Set in the stored size of a block kept uncompressed. */
+#define LEPK__LZ_RAW 0x80000000u
+
+/* Start of a compressed file. */
+typedef struct {
+	char magic[8];
+	unsigned int version;
+	unsigned int block_size;
+} Lepk__LzFileHeader;
+
+/* Start of every block, a block with a stored size of 0 ends the file. */
+typedef struct {
+	unsigned int stored_size;
+	unsigned int length;
+	/* crc32c of the decompressed data. */
+	unsigned int crc;
+} Lepk__LzBlockHeader;
+
+static const char lepk__lz_magic[8] = { 'L', 'E', 'P', 'K', 'L', 'Z', '\0', '\0' };
+
+struct LepkLzWriter {
+	int fd;
+	unsigned long block_size;
+	unsigned char *block;
+	unsigned long buffered;
+	/* Block header and compressed block. */
+	unsigned char *output;
+	LepkLzStatus status;
+};
+
+struct LepkLzReader {
+	int fd;
+	unsigned long block_size;
+	unsigned char *stored;
+	unsigned char *block;
+	unsigned long length;
+	unsigned long position;
+	bool end;
+};
+
+static unsigned int lepk__lz_read32(const unsigned char *bytes) {
+	unsigned int value;
+	memcpy(&value, bytes, sizeof(value));
+	return value;
+}
+
+static unsigned long long lepk__lz_read64(const unsigned char *bytes) {
+	unsigned long long value;
+	memcpy(&value, bytes, sizeof(value));
+	return value;
+}
+
+/* Hash of the 5 bytes at position, hashing one more byte than a match needs keeps fewer useless candidates. */
+static unsigned int lepk__lz_hash(const unsigned char *position) {
+	return (unsigned int) (((lepk__lz_read64(position) << 24) * 889523592379ull) >> (64 - LEPK_LZ_HASH_LOG));
+}
+
+/* Length of the common prefix of a and b, stopping at limit. */
+static unsigned long lepk__lz_common(const unsigned char *a, const unsigned char *b, const unsigned char *limit) {
+	const unsigned char *start = a;
+#if defined(__GNUC__) && defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	while (a + 8 <= limit) {
+		unsigned long long difference = lepk__lz_read64(a) ^ lepk__lz_read64(b);
+		if (difference != 0) {
+			return a - start + (__builtin_ctzll(difference) >> 3);
+		}
+		a += 8;
+		b += 8;
+	}
+#endif /* __GNUC__ && little endian */
+	while (a < limit && *a == *b) {
+		a++;
+		b++;
+	}
+	return a - start;
+}
+
+/* Write the continuation bytes of a length that did not fit its 4 bits. */
+static unsigned char *lepk__lz_write_length(unsigned char *op, unsigned long length) {
+	while (length >= 255) {
+		*op++ = 255;
+		length -= 255;
+	}
+	*op++ = length;
+	return op;
+}
+
+LEPKLZIMPL unsigned long lepk_lz_bound(unsigned long length) {
+	return length + length / 255 + 16;
+}
+
+LEPKLZIMPL unsigned long lepk_lz_compress(const void *source, unsigned long length, void *destination, unsigned long capacity) {
+	if (capacity < lepk_lz_bound(length) || length >= 0xffffffffu) {
+		return 0;
+	}
+
+	const unsigned char *src = source;
+	const unsigned char *ip = src;
+	const unsigned char *anchor = src;
+	const unsigned char *end = src + length;
+	unsigned char *op = destination;
+
+	if (length > LEPK__LZ_MATCH_LIMIT) {
+		const unsigned char *match_limit = end - LEPK__LZ_MATCH_LIMIT;
+		const unsigned char *compare_limit = end - LEPK__LZ_LAST_LITERALS;
+		unsigned int table[1 << LEPK_LZ_HASH_LOG];
+		memset(table, 0, sizeof(table));
+
+		ip++;
+		for (;;) {
+			/* Find a match, stepping faster through data that does not compress. */
+			const unsigned char *match;
+			unsigned long searches = 1ul << LEPK__LZ_SKIP;
+			for (;;) {
+				if (ip > match_limit) {
+					goto last_literals;
+				}
+				unsigned int sequence = lepk__lz_read32(ip);
+				unsigned int hash = lepk__lz_hash(ip);
+				match = src + table[hash];
+				table[hash] = ip - src;
+				if (match < ip && ip - match <= LEPK__LZ_MAX_OFFSET && lepk__lz_read32(match) == sequence) {
+					break;
+				}
+				ip += searches++ >> LEPK__LZ_SKIP;
+			}
+
+			while (ip > anchor && match > src && ip[-1] == match[-1]) {
+				ip--;
+				match--;
+			}
+
+			unsigned long literals = ip - anchor;
+			unsigned char *token = op++;
+			if (literals >= 15) {
+				*token = 15 << 4;
+				op = lepk__lz_write_length(op, literals - 15);
+			} else {
+				*token = literals << 4;
+			}
+			memcpy(op, anchor, literals);
+			op += literals;
+
+			unsigned long offset = ip - match;
+			*op++ = offset & 0xff;
+			*op++ = offset >> 8;
+
+			unsigned long match_length = lepk__lz_common(ip + LEPK__LZ_MIN_MATCH, match + LEPK__LZ_MIN_MATCH, compare_limit);
+			ip += LEPK__LZ_MIN_MATCH + match_length;
+			if (match_length >= 15) {
+				*token |= 15;
+				op = lepk__lz_write_length(op, match_length - 15);
+			} else {
+				*token |= match_length;
+			}
+
+			anchor = ip;
+			if (ip > match_limit) {
+				break;
+			}
+			table[lepk__lz_hash(ip - 2)] = ip - 2 - src;
+		}
+	}
+
+last_literals:
+	{
+		unsigned long literals = end - anchor;
+		if (literals >= 15) {
+			*op++ = 15 << 4;
+			op = lepk__lz_write_length(op, literals - 15);
+		} else {
+			*op++ = literals << 4;
+		}
+		memcpy(op, anchor, literals);
+		op += literals;
+	}
+	return op - (unsigned char *) destination;
+}
+
+/* Read the continuation bytes of a length, returns false if the input ends first. */
+static bool lepk__lz_read_length(const unsigned char **ip, const unsigned char *end, unsigned long *length) {
+	unsigned char byte;
+	do {
+		if (*ip >= end) {
+			return false;
+		}
+		byte = *(*ip)++;
+		*length += byte;
+	} while (byte == 255);
+	return true;
+}
+
+LEPKLZIMPL LepkLzStatus lepk_lz_decompress(const void *source, unsigned long length, void *destination, unsigned long capacity, unsigned long *output_length) {
+	const unsigned char *ip = source;
+	const unsigned char *end = ip + length;
+	unsigned char *dst = destination;
+	unsigned char *op = dst;
+	unsigned char *output_end = dst + capacity;
+
+	for (;;) {
+		if (ip >= end) {
+			return LEPK_LZ_STATUS_CORRUPT;
+		}
+		unsigned int token = *ip++;
+
+		unsigned long literals = token >> 4;
+		if (literals == 15 && !lepk__lz_read_length(&ip, end, &literals)) {
+			return LEPK_LZ_STATUS_CORRUPT;
+		}
+		if (literals > (unsigned long) (end - ip)) {
+			return LEPK_LZ_STATUS_CORRUPT;
+		}
+		if (literals > (unsigned long) (output_end - op)) {
+			return LEPK_LZ_STATUS_TOO_SMALL;
+		}
+		/* Short runs are copied with one fixed size move when both buffers have room to spare. */
+		if (literals <= 16 && end - ip >= 16 && output_end - op >= 16) {
+			memcpy(op, ip, 16);
+		} else {
+			memcpy(op, ip, literals);
+		}
+		op += literals;
+		ip += literals;
+
+		/* Only the last sequence has no match. */
+		if (ip == end) {
+			break;
+		}
+		if (end - ip < 2) {
+			return LEPK_LZ_STATUS_CORRUPT;
+		}
+		unsigned long offset = ip[0] | (ip[1] << 8);
+		ip += 2;
+		if (offset == 0 || offset > (unsigned long) (op - dst)) {
+			return LEPK_LZ_STATUS_CORRUPT;
+		}
+
+		unsigned long match_length = token & 15;
+		if (match_length == 15 && !lepk__lz_read_length(&ip, end, &match_length)) {
+			return LEPK_LZ_STATUS_CORRUPT;
+		}
+		match_length += LEPK__LZ_MIN_MATCH;
+		if (match_length > (unsigned long) (output_end - op)) {
+			return LEPK_LZ_STATUS_TOO_SMALL;
+		}
+
+		const unsigned char *match = op - offset;
+		if ((unsigned long) (output_end - op) >= match_length + 16) {
+			/* Chunks may overrun the match by up to 15 bytes, which the next sequence overwrites. */
+			if (offset >= 16) {
+				for (unsigned long i = 0; i < match_length; i += 16) {
+					memcpy(op + i, match + i, 16);
+				}
+			} else {
+				/*
+				 * Close matches repeat a pattern of offset bytes. Past the first step bytes, a multiple of offset of
+				 * at least 8, every 8 byte chunk only reads bytes that are already written.
+				 */
+				unsigned long step = offset >= 8 ? offset : offset * ((8 + offset - 1) / offset);
+				unsigned long i = 0;
+				for (; i < step && i < match_length; i++) {
+					op[i] = match[i];
+				}
+				for (; i < match_length; i += 8) {
+					memcpy(op + i, op + i - step, 8);
+				}
+			}
+		} else {
+			for (unsigned long i = 0; i < match_length; i++) {
+				op[i] = match[i];
+			}
+		}
+		op += match_length;
+	}
+
+	*output_length = op - dst;
+	return LEPK_LZ_STATUS_OK;
+}
+
+/* Compress a block with its header into output, raw if it does not get smaller. Returns the size of header and block. */
+static unsigned long lepk__lz_encode_block(const unsigned char *block, unsigned long length, unsigned char *output) {
+	Lepk__LzBlockHeader header;
+	header.length = length;
+	header.crc = lepk_crc32c(0, block, length);
+	unsigned long size = lepk_lz_compress(block, length, output + sizeof(header), lepk_lz_bound(length));
+	if (size == 0 || size >= length) {
+		memcpy(output + sizeof(header), block, length);
+		size = length;
+		header.stored_size = size | LEPK__LZ_RAW;
+	} else {
+		header.stored_size = size;
+	}
+	memcpy(output, &header, sizeof(header));
+	return sizeof(header) + size;
+}
+
+/* Decompress a stored block into exactly header->length bytes of output and check it. */
+static LepkLzStatus lepk__lz_decode_block(const Lepk__LzBlockHeader *header, const unsigned char *stored, unsigned char *output) {
+	unsigned long size = header->stored_size & ~LEPK__LZ_RAW;
+	if (header->stored_size & LEPK__LZ_RAW) {
+		if (size != header->length) {
+			return LEPK_LZ_STATUS_CORRUPT;
+		}
+		memcpy(output, stored, size);
+	} else {
+		unsigned long length;
+		if (lepk_lz_decompress(stored, size, output, header->length, &length) != LEPK_LZ_STATUS_OK || length != header->length) {
+			return LEPK_LZ_STATUS_CORRUPT;
+		}
+	}
+	return lepk_crc32c(0, output, header->length) == header->crc ? LEPK_LZ_STATUS_OK : LEPK_LZ_STATUS_CORRUPT;
+}
+
+static void lepk__lz_file_header(Lepk__LzFileHeader *header, unsigned long block_size) {
+	memset(header, 0, sizeof(Lepk__LzFileHeader));
+	memcpy(header->magic, lepk__lz_magic, sizeof(lepk__lz_magic));
+	header->version = LEPK__LZ_VERSION;
+	header->block_size = block_size;
+}
+
+static bool lepk__lz_check_header(const Lepk__LzFileHeader *header) {
+	return memcmp(header->magic, lepk__lz_magic, sizeof(lepk__lz_magic)) == 0 && header->version == LEPK__LZ_VERSION &&
+		header->block_size != 0 && header->block_size <= LEPK__LZ_MAX_BLOCK_SIZE;
+}
+
+LEPKLZIMPL LepkLzStatus lepk_lz_file_write(const char *filepath, const char *content, unsigned long length) {
+	unsigned long blocks = (length + LEPK__LZ_BLOCK_SIZE - 1) / LEPK__LZ_BLOCK_SIZE;
+	/* Blocks are compressed in place before falling back to raw, so each needs room for its bound. */
+	unsigned long capacity = sizeof(Lepk__LzFileHeader) + (blocks + 1) * sizeof(Lepk__LzBlockHeader) + length + length / 255 + blocks * 16;
+	unsigned char *frame = malloc(capacity);
+	if (frame == NULL) {
+		return LEPK_LZ_STATUS_OUT_OF_MEMORY;
+	}
+
+	lepk__lz_file_header((Lepk__LzFileHeader *) frame, LEPK__LZ_BLOCK_SIZE);
+	unsigned long size = sizeof(Lepk__LzFileHeader);
+	for (unsigned long offset = 0; offset < length; offset += LEPK__LZ_BLOCK_SIZE) {
+		unsigned long block = length - offset < LEPK__LZ_BLOCK_SIZE ? length - offset : LEPK__LZ_BLOCK_SIZE;
+		size += lepk__lz_encode_block((const unsigned char *) content + offset, block, frame + size);
+	}
+	Lepk__LzBlockHeader last = {0};
+	memcpy(frame + size, &last, sizeof(last));
+	size += sizeof(last);
+
+	LepkFileStatus status = lepk_file_write_atomic(filepath, (const char *) frame, size, LEPK_FILE_DURABILITY_NONE, NULL);
+	free(frame);
+	if (status == LEPK_FILE_STATUS_UNABLE_TO_OPEN_CREATE) {
+		return LEPK_LZ_STATUS_UNABLE_TO_OPEN_CREATE;
+	}
+	return status == LEPK_FILE_STATUS_OK ? LEPK_LZ_STATUS_OK : LEPK_LZ_STATUS_WRITE_FAILED;
+}
+
+LEPKLZIMPL char *lepk_lz_file_read(const char *filepath, unsigned long *length, LepkLzStatus *status) {
+	int fd = open(filepath, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		LEPK__LZ_SET_STATUS(status, LEPK_LZ_STATUS_UNABLE_TO_OPEN_CREATE);
+		return NULL;
+	}
+	struct stat st;
+	void *map = MAP_FAILED;
+	if (fstat(fd, &st) == 0 && st.st_size > 0) {
+		map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	}
+	close(fd);
+	if (map == MAP_FAILED) {
+		LEPK__LZ_SET_STATUS(status, LEPK_LZ_STATUS_READ_FAILED);
+		return NULL;
+	}
+	const unsigned char *file = map;
+	unsigned long size = st.st_size;
+
+	Lepk__LzFileHeader file_header;
+	if (size >= sizeof(file_header)) {
+		memcpy(&file_header, file, sizeof(file_header));
+	}
+	if (size < sizeof(file_header) || !lepk__lz_check_header(&file_header)) {
+		munmap(map, size);
+		LEPK__LZ_SET_STATUS(status, LEPK_LZ_STATUS_CORRUPT);
+		return NULL;
+	}
+
+	/* First walk the block headers for the total length, so the output is allocated once. */
+	unsigned long total = 0;
+	unsigned long offset = sizeof(Lepk__LzFileHeader);
+	bool valid = false;
+	while (size - offset >= sizeof(Lepk__LzBlockHeader)) {
+		Lepk__LzBlockHeader header;
+		memcpy(&header, file + offset, sizeof(header));
+		offset += sizeof(header);
+		if (header.stored_size == 0) {
+			valid = header.length == 0;
+			break;
+		}
+		unsigned long stored = header.stored_size & ~LEPK__LZ_RAW;
+		if (stored > size - offset || header.length > file_header.block_size) {
+			break;
+		}
+		offset += stored;
+		total += header.length;
+	}
+
+	char *content = valid ? malloc(total + 1) : NULL;
+	LepkLzStatus result = !valid ? LEPK_LZ_STATUS_CORRUPT : content == NULL ? LEPK_LZ_STATUS_OUT_OF_MEMORY : LEPK_LZ_STATUS_OK;
+	offset = sizeof(Lepk__LzFileHeader);
+	for (unsigned long position = 0; result == LEPK_LZ_STATUS_OK && position < total;) {
+		Lepk__LzBlockHeader header;
+		memcpy(&header, file + offset, sizeof(header));
+		offset += sizeof(header);
+		result = lepk__lz_decode_block(&header, file + offset, (unsigned char *) content + position);
+		offset += header.stored_size & ~LEPK__LZ_RAW;
+		position += header.length;
+	}
+	munmap(map, size);
+
+	if (result != LEPK_LZ_STATUS_OK) {
+		free(content);
+		LEPK__LZ_SET_STATUS(status, result);
+		return NULL;
+	}
+	content[total] = '\0';
+	if (length != NULL) {
+		*length = total;
+	}
+	LEPK__LZ_SET_STATUS(status, LEPK_LZ_STATUS_OK);
+	return content;
+}
+
+static bool lepk__lz_write(int fd, const void *data, unsigned long length) {
+	while (length > 0) {
+		ssize_t written = write(fd, data, length);
+		if (written < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return false;
+		}
+		data = (const char *) data + written;
+		length -= written;
+	}
+	return true;
+}
+
+/* Read exactly length bytes, a file ending early is corrupt. */
+static LepkLzStatus lepk__lz_read(int fd, void *data, unsigned long length) {
+	while (length > 0) {
+		ssize_t got = read(fd, data, length);
+		if (got < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return LEPK_LZ_STATUS_READ_FAILED;
+		}
+		if (got == 0) {
+			return LEPK_LZ_STATUS_CORRUPT;
+		}
+		data = (char *) data + got;
+		length -= got;
+	}
+	return LEPK_LZ_STATUS_OK;
+}
+
+LEPKLZIMPL LepkLzWriter *lepk_lz_writer_open(const char *filepath, unsigned long block_size, LepkLzStatus *status) {
+	if (block_size == 0) {
+		block_size = LEPK__LZ_BLOCK_SIZE;
+	}
+	if (block_size > LEPK__LZ_MAX_BLOCK_SIZE) {
+		block_size = LEPK__LZ_MAX_BLOCK_SIZE;
+	}
+
+	LepkLzWriter *writer = calloc(1, sizeof(LepkLzWriter));
+	if (writer == NULL) {
+		LEPK__LZ_SET_STATUS(status, LEPK_LZ_STATUS_OUT_OF_MEMORY);
+		return NULL;
+	}
+	writer->block_size = block_size;
+	writer->block = malloc(block_size);
+	writer->output = malloc(sizeof(Lepk__LzBlockHeader) + lepk_lz_bound(block_size));
+	if (writer->block == NULL || writer->output == NULL) {
+		free(writer->block);
+		free(writer->output);
+		free(writer);
+		LEPK__LZ_SET_STATUS(status, LEPK_LZ_STATUS_OUT_OF_MEMORY);
+		return NULL;
+	}
+
+	writer->fd = open(filepath, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+	Lepk__LzFileHeader header;
+	lepk__lz_file_header(&header, block_size);
+	if (writer->fd < 0 || !lepk__lz_write(writer->fd, &header, sizeof(header))) {
+		LEPK__LZ_SET_STATUS(status, writer->fd < 0 ? LEPK_LZ_STATUS_UNABLE_TO_OPEN_CREATE : LEPK_LZ_STATUS_WRITE_FAILED);
+		if (writer->fd >= 0) {
+			close(writer->fd);
+		}
+		free(writer->block);
+		free(writer->output);
+		free(writer);
+		return NULL;
+	}
+
+	LEPK__LZ_SET_STATUS(status, LEPK_LZ_STATUS_OK);
+	return writer;
+}
+
+static void lepk__lz_writer_flush(LepkLzWriter *writer) {
+	if (writer->buffered == 0 || writer->status != LEPK_LZ_STATUS_OK) {
+		return;
+	}
+	unsigned long size = lepk__lz_encode_block(writer->block, writer->buffered, writer->output);
+	if (!lepk__lz_write(writer->fd, writer->output, size)) {
+		writer->status = LEPK_LZ_STATUS_WRITE_FAILED;
+	}
+	writer->buffered = 0;
+}
+
+LEPKLZIMPL LepkLzStatus lepk_lz_writer_write(LepkLzWriter *writer, const void *data, unsigned long length) {
+	const unsigned char *bytes = data;
+	while (length > 0 && writer->status == LEPK_LZ_STATUS_OK) {
+		/* Full blocks are compressed straight from data. */
+		if (writer->buffered == 0 && length >= writer->block_size) {
+			unsigned long size = lepk__lz_encode_block(bytes, writer->block_size, writer->output);
+			if (!lepk__lz_write(writer->fd, writer->output, size)) {
+				writer->status = LEPK_LZ_STATUS_WRITE_FAILED;
+			}
+			bytes += writer->block_size;
+			length -= writer->block_size;
+			continue;
+		}
+
+		unsigned long fill = writer->block_size - writer->buffered < length ? writer->block_size - writer->buffered : length;
+		memcpy(writer->block + writer->buffered, bytes, fill);
+		writer->buffered += fill;
+		bytes += fill;
+		length -= fill;
+		if (writer->buffered == writer->block_size) {
+			lepk__lz_writer_flush(writer);
+		}
+	}
+	return writer->status;
+}
+
+LEPKLZIMPL LepkLzStatus lepk_lz_writer_close(LepkLzWriter *writer) {
+	lepk__lz_writer_flush(writer);
+	Lepk__LzBlockHeader last = {0};
+	if (writer->status == LEPK_LZ_STATUS_OK && !lepk__lz_write(writer->fd, &last, sizeof(last))) {
+		writer->status = LEPK_LZ_STATUS_WRITE_FAILED;
+	}
+	if (close(writer->fd) != 0 && writer->status == LEPK_LZ_STATUS_OK) {
+		writer->status = LEPK_LZ_STATUS_WRITE_FAILED;
+	}
+
+	LepkLzStatus status = writer->status;
+	free(writer->block);
+	free(writer->output);
+	free(writer);
+	return status;
+}
+
+LEPKLZIMPL LepkLzReader *lepk_lz_reader_open(const char *filepath, LepkLzStatus *status) {
+	int fd = open(filepath, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		LEPK__LZ_SET_STATUS(status, LEPK_LZ_STATUS_UNABLE_TO_OPEN_CREATE);
+		return NULL;
+	}
+
+	Lepk__LzFileHeader header;
+	LepkLzStatus result = lepk__lz_read(fd, &header, sizeof(header));
+	if (result == LEPK_LZ_STATUS_OK && !lepk__lz_check_header(&header)) {
+		result = LEPK_LZ_STATUS_CORRUPT;
+	}
+	LepkLzReader *reader = result == LEPK_LZ_STATUS_OK ? calloc(1, sizeof(LepkLzReader)) : NULL;
+	if (reader != NULL) {
+		reader->fd = fd;
+		reader->block_size = header.block_size;
+		reader->stored = malloc(header.block_size);
+		reader->block = malloc(header.block_size);
+		if (reader->stored == NULL || reader->block == NULL) {
+			free(reader->stored);
+			free(reader->block);
+			free(reader);
+			reader = NULL;
+		}
+	}
+	if (reader == NULL) {
+		close(fd);
+		LEPK__LZ_SET_STATUS(status, result == LEPK_LZ_STATUS_OK ? LEPK_LZ_STATUS_OUT_OF_MEMORY : result);
+		return NULL;
+	}
+
+	LEPK__LZ_SET_STATUS(status, LEPK_LZ_STATUS_OK);
+	return reader;
+}
+
+LEPKLZIMPL LepkLzStatus lepk_lz_reader_read(LepkLzReader *reader, void *buffer, unsigned long capacity, unsigned long *length) {
+	unsigned char *output = buffer;
+	*length = 0;
+	while (*length < capacity) {
+		if (reader->position == reader->length) {
+			if (reader->end) {
+				break;
+			}
+			Lepk__LzBlockHeader header;
+			LepkLzStatus status = lepk__lz_read(reader->fd, &header, sizeof(header));
+			if (status != LEPK_LZ_STATUS_OK) {
+				return status;
+			}
+			if (header.stored_size == 0) {
+				reader->end = true;
+				if (header.length != 0) {
+					return LEPK_LZ_STATUS_CORRUPT;
+				}
+				break;
+			}
+			/* Stored blocks are never larger than the block they hold. */
+			unsigned long stored = header.stored_size & ~LEPK__LZ_RAW;
+			if (stored > reader->block_size || header.length > reader->block_size) {
+				return LEPK_LZ_STATUS_CORRUPT;
+			}
+			status = lepk__lz_read(reader->fd, reader->stored, stored);
+			if (status == LEPK_LZ_STATUS_OK) {
+				status = lepk__lz_decode_block(&header, reader->stored, reader->block);
+			}
+			if (status != LEPK_LZ_STATUS_OK) {
+				return status;
+			}
+			reader->length = header.length;
+			reader->position = 0;
+		}
+
+		unsigned long copy = reader->length - reader->position < capacity - *length ? reader->length - reader->position : capacity - *length;
+		memcpy(output + *length, reader->block + reader->position, copy);
+		reader->position += copy;
+		*length += copy;
+	}
+	return LEPK_LZ_STATUS_OK;
+}
+
+LEPKLZIMPL void lepk_lz_reader_close(LepkLzReader *reader) {
+	close(reader->fd);
+	free(reader->stored);
+	free(reader->block);
+	free(reader);
+}
+#endif /*LEPK_LZ_IMPLEMENTATION*/
+#endif /* LEPK_LZ_H */
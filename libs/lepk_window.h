@@ -1,3 +1,12 @@
+/* Version: 1.5 */
+
+/*
+ * Define LEPK_WINDOW_OS_LINUX and link with -lX11 -lXext to use Xlib,
+ * also define LEPK_WINDOW_XCB and link with -lxcb instead to skip Xlib.
+ * The implementation uses POSIX.1-2008 calls, define _POSIX_C_SOURCE as 200809L (or _GNU_SOURCE) before including
+ * any system header when compiling with -std=c99.
+ */
+
 #ifndef LEPK_WINDOW_H
 #define LEPK_WINDOW_H
 
@@ -123,6 +132,52 @@ typedef enum {
 	LEPK_MOD_SUPER     = 1 << 6,
 } LepkMod;
 
+typedef enum {
+	LEPK_EVENT_NONE,
+	LEPK_EVENT_CLOSE,
+	LEPK_EVENT_RESIZE,
+	LEPK_EVENT_KEY,
+	LEPK_EVENT_FOCUS,
+} LepkEventType;
+
+/* Event decoded from the window system, type tells which member of data is set. */
+typedef struct {
+	LepkEventType type;
+	/* Monotonic clock in nanoseconds when the event was decoded. */
+	unsigned long long time;
+	union {
+		struct {
+			int width;
+			int height;
+		} resize;
+		struct {
+			LepkKey key;
+			int scancode;
+			bool pressed;
+			LepkMod mods;
+		} key;
+		struct {
+			bool focused;
+		} focus;
+	} data;
+} LepkEvent;
+
+typedef struct {
+	int x;
+	int y;
+	int width;
+	int height;
+} LepkRect;
+
+typedef struct {
+	/* Pixel bytes and rects sent by the last present. */
+	unsigned long long bytes;
+	int rects;
+	/* Pixel bytes sent by all presents. */
+	unsigned long long total_bytes;
+	unsigned long long frames;
+} LepkPresentStats;
+
 /* Use void as type to hinder access to window variables. */
 typedef void LepkWindow;
 /* Resize callback. */
@@ -132,7 +187,38 @@ typedef void (*LepkKeyCallback)(LepkWindow *window, LepkKey keycode, int scancod
 LEPKWINDOW LepkWindow *lepk_window_create(int width, int height, const char *title, bool resizable);
 LEPKWINDOW void lepk_window_destroy(LepkWindow *window);
 LEPKWINDOW bool lepk_window_is_open(const LepkWindow *window);
+/* Call the callbacks for every pending event. */
 LEPKWINDOW void lepk_window_poll_events(LepkWindow *window);
+/* Take the oldest pending event without blocking, false return value means there was none. */
+LEPKWINDOW bool lepk_window_next_event(LepkWindow *window, LepkEvent *event);
+/* Take up to capacity pending events in order, returns how many were written to events. */
+LEPKWINDOW int lepk_window_drain_events(LepkWindow *window, LepkEvent *events, int capacity);
+/*
+ * Sleep until events are pending, lepk_window_post_empty_event is called or timeout_ns nanoseconds pass.
+ * Negative timeout waits forever, false return value means the timeout passed without events.
+ */
+LEPKWINDOW bool lepk_window_wait_events(LepkWindow *window, long long timeout_ns);
+/* Wake lepk_window_wait_events, safe to call from any thread. */
+LEPKWINDOW void lepk_window_post_empty_event(LepkWindow *window);
+
+/*
+ * Pixels to draw into as 0x00RRGGBB with width pixels per row, NULL when the window can not show them.
+ * The pixels hold the last presented frame and stay valid until the next present or until the window is resized.
+ */
+LEPKWINDOW unsigned int *lepk_window_framebuffer(LepkWindow *window, int *width, int *height);
+/* Add rect to the damage sent by the next present, overlapping damage is merged. */
+LEPKWINDOW void lepk_window_damage(LepkWindow *window, LepkRect rect);
+/*
+ * Show the framebuffer, every pixel drawn since the last present must be inside dirty_rects or the damage.
+ * Everything is presented when neither dirty_rects nor damage is given.
+ * Uses MIT-SHM when the X server shares memory with us, the XCB backend always copies through the connection.
+ */
+LEPKWINDOW bool lepk_window_present(LepkWindow *window, const LepkRect *dirty_rects, int count);
+LEPKWINDOW LepkPresentStats lepk_window_present_stats(const LepkWindow *window);
+
+/* User pointer for callbacks to find their state. */
+LEPKWINDOW void lepk_window_set_user_pointer(LepkWindow *window, void *user_pointer);
+LEPKWINDOW void *lepk_window_get_user_pointer(const LepkWindow *window);
 
 /* Set resize callback for window. */
 LEPKWINDOW void lepk_window_callback_resize(LepkWindow *window, LepkResizeCallback callback);
@@ -146,37 +232,603 @@ LEPKWINDOW void lepk_window_callback_key(LepkWindow *window, LepkKeyCallback cal
 #define LEPKWINDOW
 #endif /* LEPK_WINDOW_STATIC */
 
-/* Linux. */
+#ifndef LEPK_WINDOW_EVENT_CAPACITY
+#define LEPK_WINDOW_EVENT_CAPACITY 256
+#endif /* LEPK_WINDOW_EVENT_CAPACITY */
+
+/* Merged damage rects kept per frame, more damage than fits is tracked per tile instead. */
+#ifndef LEPK_WINDOW_DAMAGE_CAPACITY
+#define LEPK_WINDOW_DAMAGE_CAPACITY 32
+#endif /* LEPK_WINDOW_DAMAGE_CAPACITY */
+
+/* Width and height of the tiles in pixels. */
+#ifndef LEPK_WINDOW_TILE_SIZE
+#define LEPK_WINDOW_TILE_SIZE 32
+#endif /* LEPK_WINDOW_TILE_SIZE */
+
+/*
+ * Linux.
+ * Xlib is used by default, define LEPK_WINDOW_XCB to talk to the X server through XCB alone.
+ * XCB sends every request of window creation before waiting for any reply, so creating a window costs one round trip.
+ */
 #ifdef LEPK_WINDOW_OS_LINUX
-#include <malloc.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <limits.h>
 #include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
 
+#ifdef LEPK_WINDOW_XCB
+#include <xcb/xcb.h>
+#include <xcb/xproto.h>
+#include <X11/keysym.h>
+#else /* LEPK_WINDOW_XCB */
 #include <X11/Xlib.h>
 #include <X11/Xutil.h>
 #include <X11/Xatom.h>
 #include <X11/XKBlib.h>
+#include <X11/extensions/XShm.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+
+/* Framebuffer image, pending counts presents the X server has not finished reading. */
+typedef struct {
+	XImage *image;
+	XShmSegmentInfo shm;
+	int pending;
+} Lepk__LinuxFramebuffer;
+#endif /* LEPK_WINDOW_XCB */
+
+#if !defined(_POSIX_C_SOURCE) || _POSIX_C_SOURCE < 200809L
+#error "lepk_window.h needs _POSIX_C_SOURCE defined as 200809L or _GNU_SOURCE defined before any system header is included."
+#endif /* _POSIX_C_SOURCE */
 
 typedef struct {
+#ifdef LEPK_WINDOW_XCB
+	xcb_connection_t *connection;
+	xcb_window_t window;
+	xcb_atom_t wm_delete_window;
+	xcb_gcontext_t gc;
+	/* Framebuffer and room to make rows of a narrower rect contiguous for xcb_put_image. */
+	unsigned int *pixels;
+	unsigned int *scratch;
+	unsigned long scratch_length;
+#else /* LEPK_WINDOW_XCB */
 	Display *display;
 	Window window;
-	bool is_open;
 	Atom wm_delete_window;
+	Visual *visual;
+	int depth;
+	GC gc;
+	/* With MIT-SHM the server reads one framebuffer while the other is drawn, without it only the first is used. */
+	bool shm;
+	int shm_completion;
+	Lepk__LinuxFramebuffer framebuffers[2];
+	int back;
+#endif /* LEPK_WINDOW_XCB */
+	bool is_open;
 	int width;
 	int height;
+	/* Written by lepk_window_post_empty_event to wake lepk_window_wait_events. */
+	int wake_fd;
+
+	/* Size of the framebuffer, zero until lepk_window_framebuffer is called. */
+	int framebuffer_width;
+	int framebuffer_height;
+
+	/* Damage since the last present, as merged rects until they overflow and always as a bitmap of dirty tiles. */
+	LepkRect damage[LEPK_WINDOW_DAMAGE_CAPACITY];
+	int damage_count;
+	bool damage_overflow;
+	unsigned char *tiles;
+	int tiles_x;
+	int tiles_y;
+	/* Rects made from the tiles and the rect ending above every tile column while making them. */
+	LepkRect *tile_rects;
+	int *tile_spans;
+	LepkPresentStats stats;
 
 	LepkKey key_table[256];
 	unsigned long scan_table[256];
 
+	/* Ring buffer of decoded events, X events stay queued in Xlib or XCB while it is full. */
+	LepkEvent events[LEPK_WINDOW_EVENT_CAPACITY];
+	int event_head;
+	int event_count;
+
+	void *user_pointer;
+
 	/* Callbacks. */
 	LepkResizeCallback resize_callback;
 	LepkKeyCallback key_callback;
 } Lepk__LinuxWindow;
 
+/* NOTE: Support for most of the keyboard, no cluse about the US layout though. */
+static const struct {
+	LepkKey key;
+	long x_key;
+} lepk__window_keymap[] = {
+	/* Letters */
+	{LEPK_KEY_A, XK_a},
+	{LEPK_KEY_B, XK_b},
+	{LEPK_KEY_C, XK_c},
+	{LEPK_KEY_D, XK_d},
+	{LEPK_KEY_E, XK_e},
+	{LEPK_KEY_F, XK_f},
+	{LEPK_KEY_G, XK_g},
+	{LEPK_KEY_H, XK_h},
+	{LEPK_KEY_I, XK_i},
+	{LEPK_KEY_J, XK_j},
+	{LEPK_KEY_K, XK_k},
+	{LEPK_KEY_L, XK_l},
+	{LEPK_KEY_M, XK_m},
+	{LEPK_KEY_N, XK_n},
+	{LEPK_KEY_O, XK_o},
+	{LEPK_KEY_P, XK_p},
+	{LEPK_KEY_Q, XK_q},
+	{LEPK_KEY_R, XK_r},
+	{LEPK_KEY_S, XK_s},
+	{LEPK_KEY_T, XK_t},
+	{LEPK_KEY_U, XK_u},
+	{LEPK_KEY_V, XK_v},
+	{LEPK_KEY_W, XK_w},
+	{LEPK_KEY_X, XK_x},
+	{LEPK_KEY_Y, XK_y},
+	{LEPK_KEY_Z, XK_z},
+
+	/* Numbers. */
+	{LEPK_KEY_0, XK_0},
+	{LEPK_KEY_1, XK_1},
+	{LEPK_KEY_2, XK_2},
+	{LEPK_KEY_3, XK_3},
+	{LEPK_KEY_4, XK_4},
+	{LEPK_KEY_5, XK_5},
+	{LEPK_KEY_6, XK_6},
+	{LEPK_KEY_7, XK_7},
+	{LEPK_KEY_8, XK_8},
+	{LEPK_KEY_9, XK_9},
+
+	/* Function keys. */
+	{LEPK_KEY_F1,  XK_F1},
+	{LEPK_KEY_F2,  XK_F2},
+	{LEPK_KEY_F3,  XK_F3},
+	{LEPK_KEY_F4,  XK_F4},
+	{LEPK_KEY_F5,  XK_F5},
+	{LEPK_KEY_F6,  XK_F6},
+	{LEPK_KEY_F7,  XK_F7},
+	{LEPK_KEY_F8,  XK_F8},
+	{LEPK_KEY_F9,  XK_F9},
+	{LEPK_KEY_F10, XK_F10},
+	{LEPK_KEY_F11, XK_F11},
+	{LEPK_KEY_F12, XK_F12},
+	{LEPK_KEY_F13, XK_F13},
+	{LEPK_KEY_F14, XK_F14},
+	{LEPK_KEY_F15, XK_F15},
+	{LEPK_KEY_F16, XK_F16},
+	{LEPK_KEY_F17, XK_F17},
+	{LEPK_KEY_F18, XK_F18},
+	{LEPK_KEY_F19, XK_F19},
+	{LEPK_KEY_F20, XK_F20},
+	{LEPK_KEY_F21, XK_F21},
+	{LEPK_KEY_F22, XK_F22},
+	{LEPK_KEY_F23, XK_F23},
+	{LEPK_KEY_F24, XK_F24},
+
+	/* Mod keys. */
+	{LEPK_KEY_SHIFT_L, XK_Shift_L},
+	{LEPK_KEY_SHIFT_R, XK_Shift_R},
+	{LEPK_KEY_CTRL_L,  XK_Control_L},
+	{LEPK_KEY_CTRL_R,  XK_Control_R},
+	{LEPK_KEY_ALT_L,   XK_Alt_L},
+	{LEPK_KEY_ALT_R,   XK_Alt_R},
+	{LEPK_KEY_SUPER_L, XK_Super_L},
+	{LEPK_KEY_SUPER_R, XK_Super_R},
+
+	{LEPK_KEY_BACKSPACE, XK_BackSpace},
+	{LEPK_KEY_ENTER,     XK_Return},
+	{LEPK_KEY_TAB,       XK_Tab},
+	{LEPK_KEY_SPACE,     XK_space},
+	{LEPK_KEY_ESCAPE,    XK_Escape},
+
+	/* Arrows. */
+	{LEPK_KEY_LEFT,  XK_Left},
+	{LEPK_KEY_DOWN,  XK_Down},
+	{LEPK_KEY_UP,    XK_Up},
+	{LEPK_KEY_RIGHT, XK_Right},
+
+	{LEPK_KEY_PERIOD,     XK_period},
+	{LEPK_KEY_COMMA,      XK_comma},
+	{LEPK_KEY_MINUS,      XK_minus},
+	{LEPK_KEY_PLUS,       XK_plus},
+	{LEPK_KEY_APOSTROPHE, XK_apostrophe},
+	{LEPK_KEY_SECTION,    XK_section},
+	{LEPK_KEY_LESS,       XK_less},
+	{LEPK_KEY_GREATER,    XK_greater},
+	{LEPK_KEY_BRACKET_L,  XK_bracketleft},
+	{LEPK_KEY_BRACKET_R,  XK_bracketright},
+};
+
+/* Translate scancode through the keysym it produces without modifiers. */
+static void lepk__window_map_key(Lepk__LinuxWindow *window, int scancode, unsigned long sym) {
+	window->key_table[scancode] = LEPK_KEY_NULL;
+	for (int i = 0; i < (int) (sizeof(lepk__window_keymap) / sizeof(lepk__window_keymap[0])); i++) {
+		if ((long) sym == lepk__window_keymap[i].x_key) {
+			window->key_table[scancode] = lepk__window_keymap[i].key;
+			/* Store with key index for easy translation. */
+			window->scan_table[lepk__window_keymap[i].key] = scancode;
+			break;
+		}
+	}
+}
+
+static unsigned long long lepk__window_time(void) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (unsigned long long) now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+/* Append an event of type to the queue, the caller makes sure there is room. */
+static LepkEvent *lepk__window_push_event(Lepk__LinuxWindow *window, LepkEventType type) {
+	LepkEvent *event = &window->events[(window->event_head + window->event_count) % LEPK_WINDOW_EVENT_CAPACITY];
+	window->event_count++;
+	memset(event, 0, sizeof(*event));
+	event->type = type;
+	event->time = lepk__window_time();
+	return event;
+}
+
+static Lepk__LinuxWindow *lepk__window_alloc(int width, int height) {
+	Lepk__LinuxWindow *window = calloc(1, sizeof(Lepk__LinuxWindow));
+	if (window == NULL) {
+		return NULL;
+	}
+	window->width  = width;
+	window->height = height;
+	window->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (window->wake_fd < 0) {
+		free(window);
+		return NULL;
+	}
+	return window;
+}
+
+static void lepk__window_release(Lepk__LinuxWindow *window) {
+	free(window->tiles);
+	free(window->tile_rects);
+	free(window->tile_spans);
+	close(window->wake_fd);
+	free(window);
+}
+
+#ifdef LEPK_WINDOW_XCB
+static void lepk__window_framebuffer_destroy(Lepk__LinuxWindow *window) {
+	free(window->pixels);
+	free(window->scratch);
+	window->pixels = NULL;
+	window->scratch = NULL;
+	window->scratch_length = 0;
+	window->framebuffer_width  = 0;
+	window->framebuffer_height = 0;
+}
+
+static void lepk__window_free(Lepk__LinuxWindow *window) {
+	lepk__window_framebuffer_destroy(window);
+	if (window->connection != NULL) {
+		xcb_disconnect(window->connection);
+	}
+	lepk__window_release(window);
+}
+
+static xcb_intern_atom_cookie_t lepk__window_intern_atom(xcb_connection_t *connection, const char *name) {
+	return xcb_intern_atom(connection, false, strlen(name), name);
+}
+
+static xcb_atom_t lepk__window_atom_reply(xcb_connection_t *connection, xcb_intern_atom_cookie_t cookie) {
+	xcb_intern_atom_reply_t *reply = xcb_intern_atom_reply(connection, cookie, NULL);
+	if (reply == NULL) {
+		return XCB_ATOM_NONE;
+	}
+	xcb_atom_t atom = reply->atom;
+	free(reply);
+	return atom;
+}
+
 LEPKWINDOW LepkWindow *lepk_window_create(int width, int height, const char *title, bool resizable) {
-	Lepk__LinuxWindow *window = malloc(sizeof(Lepk__LinuxWindow));
+	Lepk__LinuxWindow *window = lepk__window_alloc(width, height);
+	if (window == NULL) {
+		return NULL;
+	}
+
+	int screen_number = 0;
+	window->connection = xcb_connect(NULL, &screen_number);
+	if (xcb_connection_has_error(window->connection)) {
+		lepk__window_free(window);
+		return NULL;
+	}
+
+	/* Send every request needing a reply first, the replies are collected once the window is shown. */
+	const xcb_setup_t *setup = xcb_get_setup(window->connection);
+	xcb_intern_atom_cookie_t wm_protocols_cookie = lepk__window_intern_atom(window->connection, "WM_PROTOCOLS");
+	xcb_intern_atom_cookie_t wm_delete_window_cookie = lepk__window_intern_atom(window->connection, "WM_DELETE_WINDOW");
+	xcb_keycode_t min_keycode = setup->min_keycode;
+	xcb_get_keyboard_mapping_cookie_t keyboard_cookie = xcb_get_keyboard_mapping(window->connection, min_keycode, setup->max_keycode - min_keycode + 1);
+	/* Needed to split framebuffer presents into requests. */
+	xcb_prefetch_maximum_request_length(window->connection);
+
+	xcb_screen_iterator_t screens = xcb_setup_roots_iterator(setup);
+	for (int i = 0; i < screen_number && screens.rem > 0; i++) {
+		xcb_screen_next(&screens);
+	}
+	xcb_screen_t *screen = screens.data;
+
+	/* Check if display is compatible, the setup already lists every visual so this needs no request. */
+	int screen_bit_depth = 24;
+	xcb_visualtype_t *visual = NULL;
+	for (xcb_depth_iterator_t depths = xcb_screen_allowed_depths_iterator(screen); depths.rem > 0 && visual == NULL; xcb_depth_next(&depths)) {
+		if (depths.data->depth != screen_bit_depth) {
+			continue;
+		}
+		for (xcb_visualtype_iterator_t visuals = xcb_depth_visuals_iterator(depths.data); visuals.rem > 0; xcb_visualtype_next(&visuals)) {
+			if (visuals.data->_class == XCB_VISUAL_CLASS_TRUE_COLOR) {
+				visual = visuals.data;
+				break;
+			}
+		}
+	}
+	if (visual == NULL) {
+		xcb_discard_reply(window->connection, wm_protocols_cookie.sequence);
+		xcb_discard_reply(window->connection, wm_delete_window_cookie.sequence);
+		xcb_discard_reply(window->connection, keyboard_cookie.sequence);
+		lepk__window_free(window);
+		return NULL;
+	}
+
+	/* Configure window attributes, values are ordered by their mask bit. */
+	xcb_colormap_t colormap = xcb_generate_id(window->connection);
+	xcb_create_colormap(window->connection, XCB_COLORMAP_ALLOC_NONE, colormap, screen->root, visual->visual_id);
+	/* Events that the window will accept. */
+	uint32_t event_mask = XCB_EVENT_MASK_STRUCTURE_NOTIFY | XCB_EVENT_MASK_KEY_PRESS | XCB_EVENT_MASK_KEY_RELEASE | XCB_EVENT_MASK_FOCUS_CHANGE;
+	uint32_t attribute_values[] = {0, 0, event_mask, colormap};
+	uint32_t attribute_mask = XCB_CW_BACK_PIXEL | XCB_CW_BORDER_PIXEL | XCB_CW_EVENT_MASK | XCB_CW_COLORMAP;
+
+	/* Create window. */
+	window->window = xcb_generate_id(window->connection);
+	xcb_create_window(window->connection, screen_bit_depth, window->window, screen->root, 0, 0, width, height, 0, XCB_WINDOW_CLASS_INPUT_OUTPUT, visual->visual_id, attribute_mask, attribute_values);
+
+	/* Set title. */
+	xcb_change_property(window->connection, XCB_PROP_MODE_REPLACE, window->window, XCB_ATOM_WM_NAME, XCB_ATOM_STRING, 8, strlen(title), title);
+
+	/* Set resizability, WM_SIZE_HINTS is 18 values with min size at 5 and max size at 7. */
+	if (!resizable) {
+		uint32_t hints[18] = {0};
+		hints[0] = (1 << 4) | (1 << 5);
+		hints[5] = width;
+		hints[6] = height;
+		hints[7] = width;
+		hints[8] = height;
+		xcb_change_property(window->connection, XCB_PROP_MODE_REPLACE, window->window, XCB_ATOM_WM_NORMAL_HINTS, XCB_ATOM_WM_SIZE_HINTS, 32, 18, hints);
+	}
+
+	/* Show window. */
+	xcb_map_window(window->connection, window->window);
+
+	/* Get close command. */
+	xcb_atom_t wm_protocols = lepk__window_atom_reply(window->connection, wm_protocols_cookie);
+	window->wm_delete_window = lepk__window_atom_reply(window->connection, wm_delete_window_cookie);
+	if (wm_protocols == XCB_ATOM_NONE || window->wm_delete_window == XCB_ATOM_NONE) {
+		xcb_discard_reply(window->connection, keyboard_cookie.sequence);
+		lepk__window_free(window);
+		return NULL;
+	}
+	xcb_change_property(window->connection, XCB_PROP_MODE_REPLACE, window->window, wm_protocols, XCB_ATOM_ATOM, 32, 1, &window->wm_delete_window);
+
+	/* Create key lookup table from the first keysym of every keycode. */
+	for (int scancode = 0; scancode < 256; scancode++) {
+		window->key_table[scancode] = LEPK_KEY_NULL;
+	}
+	xcb_get_keyboard_mapping_reply_t *keyboard = xcb_get_keyboard_mapping_reply(window->connection, keyboard_cookie, NULL);
+	if (keyboard != NULL) {
+		xcb_keysym_t *syms = xcb_get_keyboard_mapping_keysyms(keyboard);
+		int keycode_count = xcb_get_keyboard_mapping_keysyms_length(keyboard) / keyboard->keysyms_per_keycode;
+		for (int i = 0; i < keycode_count && min_keycode + i < 256; i++) {
+			lepk__window_map_key(window, min_keycode + i, syms[i * keyboard->keysyms_per_keycode]);
+		}
+		free(keyboard);
+	}
+
+	/* Send all X commands to X-server. */
+	xcb_flush(window->connection);
+	window->is_open = true;
+
+	return window;
+}
+
+/* Without MIT-SHM in XCB the framebuffer is copied through the socket with xcb_put_image. */
+static bool lepk__window_framebuffer_create(Lepk__LinuxWindow *window, int width, int height) {
+	/* Pixels must be 32 bits for the 24 bit depth of the window. */
+	const xcb_setup_t *setup = xcb_get_setup(window->connection);
+	bool supported = false;
+	for (xcb_format_iterator_t formats = xcb_setup_pixmap_formats_iterator(setup); formats.rem > 0; xcb_format_next(&formats)) {
+		if (formats.data->depth == 24 && formats.data->bits_per_pixel == 32) {
+			supported = true;
+		}
+	}
+	if (!supported) {
+		return false;
+	}
+
+	window->pixels = calloc((unsigned long) width * height, sizeof(unsigned int));
+	if (window->pixels == NULL) {
+		return false;
+	}
+	if (window->gc == 0) {
+		window->gc = xcb_generate_id(window->connection);
+		xcb_create_gc(window->connection, window->gc, window->window, 0, NULL);
+	}
+	window->framebuffer_width  = width;
+	window->framebuffer_height = height;
+	return true;
+}
+
+static unsigned int *lepk__window_framebuffer_pixels(Lepk__LinuxWindow *window) {
+	return window->pixels;
+}
+
+/* Send rect in bands of rows which fit in a single request. */
+static bool lepk__window_framebuffer_put(Lepk__LinuxWindow *window, const LepkRect *rect) {
+	unsigned long row_length = (unsigned long) rect->width * sizeof(unsigned int);
+	/* The maximum request length is in units of four bytes and includes the put image request itself. */
+	unsigned long max_length = (unsigned long) xcb_get_maximum_request_length(window->connection) * 4 - sizeof(xcb_put_image_request_t);
+	int band = max_length / row_length > 0 ? max_length / row_length : 1;
+	band = band < rect->height ? band : rect->height;
+	bool contiguous = rect->width == window->framebuffer_width;
+	if (!contiguous && window->scratch_length < (unsigned long) band * rect->width) {
+		unsigned int *scratch = realloc(window->scratch, (unsigned long) band * row_length);
+		if (scratch == NULL) {
+			return false;
+		}
+		window->scratch = scratch;
+		window->scratch_length = (unsigned long) band * rect->width;
+	}
+
+	for (int y = rect->y; y < rect->y + rect->height; y += band) {
+		int rows = rect->y + rect->height - y < band ? rect->y + rect->height - y : band;
+		const unsigned int *data = window->pixels + (unsigned long) y * window->framebuffer_width + rect->x;
+		if (!contiguous) {
+			for (int row = 0; row < rows; row++) {
+				memcpy(window->scratch + (unsigned long) row * rect->width, data + (unsigned long) row * window->framebuffer_width, row_length);
+			}
+			data = window->scratch;
+		}
+		xcb_put_image(window->connection, XCB_IMAGE_FORMAT_Z_PIXMAP, window->window, window->gc, rect->width, rows, rect->x, y, 0, 24, rows * row_length, (const uint8_t *) data);
+	}
+	return true;
+}
+
+static void lepk__window_framebuffer_swap(Lepk__LinuxWindow *window) {
+	xcb_flush(window->connection);
+}
+
+static void lepk__window_framebuffer_sync(Lepk__LinuxWindow *window, const LepkRect *rect) {
+	(void) window;
+	(void) rect;
+}
+
+/* Send buffered requests and get the descriptor to sleep on for events. */
+static int lepk__window_connection_fd(Lepk__LinuxWindow *window) {
+	xcb_flush(window->connection);
+	return xcb_get_file_descriptor(window->connection);
+}
+
+/* Decode pending X events into the queue until it is full, only the first event may read from the connection. */
+static void lepk__window_decode_events(Lepk__LinuxWindow *window) {
+	bool read = false;
+	while (window->event_count < LEPK_WINDOW_EVENT_CAPACITY) {
+		xcb_generic_event_t *ev = read ? xcb_poll_for_queued_event(window->connection) : xcb_poll_for_event(window->connection);
+		read = true;
+		if (ev == NULL) {
+			break;
+		}
+		switch (ev->response_type & ~0x80) {
+			case XCB_DESTROY_NOTIFY: {
+				xcb_destroy_notify_event_t *e = (xcb_destroy_notify_event_t *) ev;
+				if (e->window == window->window && window->is_open) {
+					window->is_open = false;
+					lepk__window_push_event(window, LEPK_EVENT_CLOSE);
+				}
+			} break;
+			case XCB_CLIENT_MESSAGE: {
+				xcb_client_message_event_t *e = (xcb_client_message_event_t *) ev;
+				if (e->data.data32[0] == window->wm_delete_window && window->is_open) {
+					xcb_destroy_window(window->connection, window->window);
+					xcb_flush(window->connection);
+					window->is_open = false;
+					lepk__window_push_event(window, LEPK_EVENT_CLOSE);
+				}
+			} break;
+			case XCB_CONFIGURE_NOTIFY: {
+				xcb_configure_notify_event_t *e = (xcb_configure_notify_event_t *) ev;
+				if (window->width != e->width || window->height != e->height) {
+					window->width  = e->width;
+					window->height = e->height;
+					LepkEvent *event = lepk__window_push_event(window, LEPK_EVENT_RESIZE);
+					event->data.resize.width  = e->width;
+					event->data.resize.height = e->height;
+				}
+			} break;
+
+			/* Keyboard input. */
+			case XCB_KEY_PRESS:
+			case XCB_KEY_RELEASE: {
+				xcb_key_press_event_t *e = (xcb_key_press_event_t *) ev;
+				LepkEvent *event = lepk__window_push_event(window, LEPK_EVENT_KEY);
+				event->data.key.key      = window->key_table[e->detail];
+				event->data.key.scancode = e->detail;
+				event->data.key.pressed  = (e->response_type & ~0x80) == XCB_KEY_PRESS;
+				event->data.key.mods     = e->state;
+			} break;
+
+			/* Window focus. */
+			case XCB_FOCUS_IN:
+			case XCB_FOCUS_OUT: {
+				/* Only disable key repeats when window is in focuse because X disables it system wide for some reason. */
+				bool focused = (ev->response_type & ~0x80) == XCB_FOCUS_IN;
+				uint32_t auto_repeat = focused ? XCB_AUTO_REPEAT_MODE_OFF : XCB_AUTO_REPEAT_MODE_ON;
+				xcb_change_keyboard_control(window->connection, XCB_KB_AUTO_REPEAT_MODE, &auto_repeat);
+				xcb_flush(window->connection);
+				LepkEvent *event = lepk__window_push_event(window, LEPK_EVENT_FOCUS);
+				event->data.focus.focused = focused;
+			} break;
+		}
+		free(ev);
+	}
+}
+#else /* LEPK_WINDOW_XCB */
+static void lepk__window_framebuffer_destroy(Lepk__LinuxWindow *window) {
+	for (int i = 0; i < 2; i++) {
+		Lepk__LinuxFramebuffer *framebuffer = &window->framebuffers[i];
+		if (framebuffer->image == NULL) {
+			continue;
+		}
+		if (window->shm) {
+			XShmDetach(window->display, &framebuffer->shm);
+			/* Make sure the server let go of the segment before it is gone. */
+			XSync(window->display, false);
+			shmdt(framebuffer->shm.shmaddr);
+			framebuffer->image->data = NULL;
+		}
+		XDestroyImage(framebuffer->image);
+		memset(framebuffer, 0, sizeof(*framebuffer));
+	}
+	window->back = 0;
+	window->framebuffer_width  = 0;
+	window->framebuffer_height = 0;
+}
+
+static void lepk__window_free(Lepk__LinuxWindow *window) {
+	if (window->display != NULL) {
+		lepk__window_framebuffer_destroy(window);
+		if (window->gc != NULL) {
+			XFreeGC(window->display, window->gc);
+		}
+		XCloseDisplay(window->display);
+	}
+	lepk__window_release(window);
+}
+
+LEPKWINDOW LepkWindow *lepk_window_create(int width, int height, const char *title, bool resizable) {
+	Lepk__LinuxWindow *window = lepk__window_alloc(width, height);
+	if (window == NULL) {
+		return NULL;
+	}
 
 	window->display = XOpenDisplay(NULL);
 	if (window->display == NULL) {
+		lepk__window_free(window);
 		return NULL;
 	}
 
@@ -187,6 +839,7 @@ LEPKWINDOW LepkWindow *lepk_window_create(int width, int height, const char *tit
 	int screen_bit_depth = 24;
 	XVisualInfo visinfo = {0};
 	if (!XMatchVisualInfo(window->display, screen, screen_bit_depth, TrueColor, &visinfo)) {
+		lepk__window_free(window);
 		return NULL;
 	}
 
@@ -201,6 +854,7 @@ LEPKWINDOW LepkWindow *lepk_window_create(int width, int height, const char *tit
 	/* Create window. */
 	window->window = XCreateWindow(window->display, root, 0, 0, width, height, 0, visinfo.depth, InputOutput, visinfo.visual, attirubte_mask, &window_attrs);
 	if (!window->window) {
+		lepk__window_free(window);
 		return NULL;
 	}
 
@@ -226,180 +880,213 @@ LEPKWINDOW LepkWindow *lepk_window_create(int width, int height, const char *tit
 	/* Get close command. */
 	window->wm_delete_window = XInternAtom(window->display, "WM_DELETE_WINDOW", false);
 	if (!XSetWMProtocols(window->display, window->window, &window->wm_delete_window, 1)) {
+		lepk__window_free(window);
 		return NULL;
 	}
+	window->is_open = true;
+	window->visual = visinfo.visual;
+	window->depth  = visinfo.depth;
 
 	/* Create key lookup table. */
-	/* NOTE: Support for most of the keyboard, no cluse about the US layout though. */
-	const struct {
-		LepkKey key;
-		long x_key;
-	} keymap[] = {
-		/* Letters */
-		{LEPK_KEY_A, XK_a},
-		{LEPK_KEY_B, XK_b},
-		{LEPK_KEY_C, XK_c},
-		{LEPK_KEY_D, XK_d},
-		{LEPK_KEY_E, XK_e},
-		{LEPK_KEY_F, XK_f},
-		{LEPK_KEY_G, XK_g},
-		{LEPK_KEY_H, XK_h},
-		{LEPK_KEY_I, XK_i},
-		{LEPK_KEY_J, XK_j},
-		{LEPK_KEY_K, XK_k},
-		{LEPK_KEY_L, XK_l},
-		{LEPK_KEY_M, XK_m},
-		{LEPK_KEY_N, XK_n},
-		{LEPK_KEY_O, XK_o},
-		{LEPK_KEY_P, XK_p},
-		{LEPK_KEY_Q, XK_q},
-		{LEPK_KEY_R, XK_r},
-		{LEPK_KEY_S, XK_s},
-		{LEPK_KEY_T, XK_t},
-		{LEPK_KEY_U, XK_u},
-		{LEPK_KEY_V, XK_v},
-		{LEPK_KEY_W, XK_w},
-		{LEPK_KEY_X, XK_x},
-		{LEPK_KEY_Y, XK_y},
-		{LEPK_KEY_Z, XK_z},
-
-		/* Numbers. */
-		{LEPK_KEY_0, XK_0},
-		{LEPK_KEY_1, XK_1},
-		{LEPK_KEY_2, XK_2},
-		{LEPK_KEY_3, XK_3},
-		{LEPK_KEY_4, XK_4},
-		{LEPK_KEY_5, XK_5},
-		{LEPK_KEY_6, XK_6},
-		{LEPK_KEY_7, XK_7},
-		{LEPK_KEY_8, XK_8},
-		{LEPK_KEY_9, XK_9},
-
-		/* Function keys. */
-		{LEPK_KEY_F1,  XK_F1},
-		{LEPK_KEY_F2,  XK_F2},
-		{LEPK_KEY_F3,  XK_F3},
-		{LEPK_KEY_F4,  XK_F4},
-		{LEPK_KEY_F5,  XK_F5},
-		{LEPK_KEY_F6,  XK_F6},
-		{LEPK_KEY_F7,  XK_F7},
-		{LEPK_KEY_F8,  XK_F8},
-		{LEPK_KEY_F9,  XK_F9},
-		{LEPK_KEY_F10, XK_F10},
-		{LEPK_KEY_F11, XK_F11},
-		{LEPK_KEY_F12, XK_F12},
-		{LEPK_KEY_F13, XK_F13},
-		{LEPK_KEY_F14, XK_F14},
-		{LEPK_KEY_F15, XK_F15},
-		{LEPK_KEY_F16, XK_F16},
-		{LEPK_KEY_F17, XK_F17},
-		{LEPK_KEY_F18, XK_F18},
-		{LEPK_KEY_F19, XK_F19},
-		{LEPK_KEY_F20, XK_F20},
-		{LEPK_KEY_F21, XK_F21},
-		{LEPK_KEY_F22, XK_F22},
-		{LEPK_KEY_F23, XK_F23},
-		{LEPK_KEY_F24, XK_F24},
-
-		/* Mod keys. */
-		{LEPK_KEY_SHIFT_L, XK_Shift_L},
-		{LEPK_KEY_SHIFT_R, XK_Shift_R},
-		{LEPK_KEY_CTRL_L,  XK_Control_L},
-		{LEPK_KEY_CTRL_R,  XK_Control_R},
-		{LEPK_KEY_ALT_L,   XK_Alt_L},
-		{LEPK_KEY_ALT_R,   XK_Alt_R},
-		{LEPK_KEY_SUPER_L, XK_Super_L},
-		{LEPK_KEY_SUPER_R, XK_Super_R},
-
-		{LEPK_KEY_BACKSPACE, XK_BackSpace},
-		{LEPK_KEY_ENTER,     XK_Return},
-		{LEPK_KEY_TAB,       XK_Tab},
-		{LEPK_KEY_SPACE,     XK_space},
-		{LEPK_KEY_ESCAPE,    XK_Escape},
-
-		/* Arrows. */
-		{LEPK_KEY_LEFT,  XK_Left},
-		{LEPK_KEY_DOWN,  XK_Down},
-		{LEPK_KEY_UP,    XK_Up},
-		{LEPK_KEY_RIGHT, XK_Right},
-
-		{LEPK_KEY_PERIOD,     XK_period},
-		{LEPK_KEY_COMMA,      XK_comma},
-		{LEPK_KEY_MINUS,      XK_minus},
-		{LEPK_KEY_PLUS,       XK_plus},
-		{LEPK_KEY_APOSTROPHE, XK_apostrophe},
-		{LEPK_KEY_SECTION,    XK_section},
-		{LEPK_KEY_LESS,       XK_less},
-		{LEPK_KEY_GREATER,    XK_greater},
-		{LEPK_KEY_BRACKET_L,  XK_bracketleft},
-		{LEPK_KEY_BRACKET_R,  XK_bracketright},
-	};
-
 	for (int scancode = 0; scancode < 256; scancode++) {
-		KeySym sym = XkbKeycodeToKeysym(window->display, scancode, 0, 0);
-		for (int i = 0; i < (int) (sizeof(keymap) / sizeof(keymap[0])); i++) {
-			if ((const long) sym == keymap[i].x_key) {
-				window->key_table[scancode] = keymap[i].key;
-				/* Store with key index for easy translation. */
-				window->scan_table[keymap[i].key] = scancode;
-				break;
-			}
-			window->key_table[scancode] = LEPK_KEY_NULL;
-		}
+		lepk__window_map_key(window, scancode, XkbKeycodeToKeysym(window->display, scancode, 0, 0));
 	}
 
 	return window;
 }
 
-LEPKWINDOW void lepk_window_destroy(LepkWindow *window) {
-	Lepk__LinuxWindow *_window = window;
+/* Set when attaching a shared memory segment fails, for example because the X server runs on another machine. */
+static bool lepk__window_shm_failed;
+
+static int lepk__window_shm_error(Display *display, XErrorEvent *error) {
+	(void) display;
+	(void) error;
+	lepk__window_shm_failed = true;
+	return 0;
+}
 
-	XCloseDisplay(_window->display);
+static bool lepk__window_shm_image(Lepk__LinuxWindow *window, Lepk__LinuxFramebuffer *framebuffer, int width, int height) {
+	framebuffer->image = XShmCreateImage(window->display, window->visual, window->depth, ZPixmap, NULL, &framebuffer->shm, width, height);
+	if (framebuffer->image == NULL) {
+		return false;
+	}
+	framebuffer->shm.shmid = shmget(IPC_PRIVATE, (unsigned long) framebuffer->image->bytes_per_line * height, IPC_CREAT | 0600);
+	if (framebuffer->shm.shmid < 0) {
+		XDestroyImage(framebuffer->image);
+		framebuffer->image = NULL;
+		return false;
+	}
+	framebuffer->shm.shmaddr = shmat(framebuffer->shm.shmid, NULL, 0);
+	framebuffer->image->data = framebuffer->shm.shmaddr;
+	framebuffer->shm.readOnly = false;
+
+	bool attached = false;
+	if (framebuffer->shm.shmaddr != (char *) -1) {
+		lepk__window_shm_failed = false;
+		XErrorHandler handler = XSetErrorHandler(lepk__window_shm_error);
+		XShmAttach(window->display, &framebuffer->shm);
+		XSync(window->display, false);
+		XSetErrorHandler(handler);
+		attached = !lepk__window_shm_failed;
+		if (!attached) {
+			shmdt(framebuffer->shm.shmaddr);
+		}
+	}
+	/* The segment is freed once both sides detach, even if the process crashes. */
+	shmctl(framebuffer->shm.shmid, IPC_RMID, NULL);
 
-	free(_window);
+	if (!attached) {
+		framebuffer->image->data = NULL;
+		XDestroyImage(framebuffer->image);
+		memset(framebuffer, 0, sizeof(*framebuffer));
+	}
+	return attached;
 }
 
-LEPKWINDOW bool lepk_window_is_open(const LepkWindow *window) {
-	return ((Lepk__LinuxWindow *) window)->is_open;
+static bool lepk__window_framebuffer_create(Lepk__LinuxWindow *window, int width, int height) {
+	if (window->gc == NULL) {
+		window->gc = XCreateGC(window->display, window->window, 0, NULL);
+	}
+
+	window->shm = XShmQueryExtension(window->display);
+	if (window->shm) {
+		window->shm_completion = XShmGetEventBase(window->display) + ShmCompletion;
+		if (!lepk__window_shm_image(window, &window->framebuffers[0], width, height)) {
+			window->shm = false;
+		} else if (!lepk__window_shm_image(window, &window->framebuffers[1], width, height)) {
+			lepk__window_framebuffer_destroy(window);
+			window->shm = false;
+		}
+	}
+	if (!window->shm) {
+		char *data = calloc((unsigned long) width * height, sizeof(unsigned int));
+		if (data == NULL) {
+			return false;
+		}
+		window->framebuffers[0].image = XCreateImage(window->display, window->visual, window->depth, ZPixmap, 0, data, width, height, 32, 0);
+		if (window->framebuffers[0].image == NULL) {
+			free(data);
+			return false;
+		}
+	}
+
+	window->framebuffer_width  = width;
+	window->framebuffer_height = height;
+	/* Pixels are handed out as rows of 32 bit values. */
+	XImage *image = window->framebuffers[0].image;
+	if (image->bits_per_pixel != 32 || image->bytes_per_line != width * 4) {
+		lepk__window_framebuffer_destroy(window);
+		return false;
+	}
+	return true;
 }
 
-LEPKWINDOW void lepk_window_poll_events(LepkWindow *window) {
-	Lepk__LinuxWindow *_window = window;
+static unsigned int *lepk__window_framebuffer_pixels(Lepk__LinuxWindow *window) {
+	return (unsigned int *) window->framebuffers[window->back].image->data;
+}
+
+static void lepk__window_shm_completed(Lepk__LinuxWindow *window, const XEvent *ev) {
+	const XShmCompletionEvent *e = (const XShmCompletionEvent *) ev;
+	for (int i = 0; i < 2; i++) {
+		if (window->framebuffers[i].image != NULL && window->framebuffers[i].shm.shmseg == e->shmseg && window->framebuffers[i].pending > 0) {
+			window->framebuffers[i].pending--;
+		}
+	}
+}
+
+static Bool lepk__window_is_shm_completion(Display *display, XEvent *ev, XPointer arg) {
+	(void) display;
+	return ev->type == ((Lepk__LinuxWindow *) arg)->shm_completion;
+}
+
+static bool lepk__window_framebuffer_put(Lepk__LinuxWindow *window, const LepkRect *rect) {
+	Lepk__LinuxFramebuffer *framebuffer = &window->framebuffers[window->back];
+	if (window->shm) {
+		/* Ask for a completion event so the framebuffer is not drawn into while the server still reads it. */
+		XShmPutImage(window->display, window->window, window->gc, framebuffer->image, rect->x, rect->y, rect->x, rect->y, rect->width, rect->height, true);
+		framebuffer->pending++;
+	} else {
+		XPutImage(window->display, window->window, window->gc, framebuffer->image, rect->x, rect->y, rect->x, rect->y, rect->width, rect->height);
+	}
+	return true;
+}
+
+/* Switch to the other framebuffer once the server is done reading it. */
+static void lepk__window_framebuffer_swap(Lepk__LinuxWindow *window) {
+	XFlush(window->display);
+	if (!window->shm) {
+		return;
+	}
+
+	window->back = !window->back;
+	Lepk__LinuxFramebuffer *back = &window->framebuffers[window->back];
+	while (back->pending > 0) {
+		XEvent ev;
+		XIfEvent(window->display, &ev, lepk__window_is_shm_completion, (XPointer) window);
+		lepk__window_shm_completed(window, &ev);
+	}
+}
+
+/* Copy rect of the presented framebuffer to the back one, so drawing continues from the presented frame. */
+static void lepk__window_framebuffer_sync(Lepk__LinuxWindow *window, const LepkRect *rect) {
+	if (!window->shm) {
+		return;
+	}
+	const XImage *presented = window->framebuffers[!window->back].image;
+	XImage *back = window->framebuffers[window->back].image;
+	for (int y = rect->y; y < rect->y + rect->height; y++) {
+		unsigned long offset = (unsigned long) y * back->bytes_per_line + rect->x * 4;
+		memcpy(back->data + offset, presented->data + offset, (unsigned long) rect->width * 4);
+	}
+}
+
+/* Send buffered requests and get the descriptor to sleep on for events. */
+static int lepk__window_connection_fd(Lepk__LinuxWindow *window) {
+	XFlush(window->display);
+	return ConnectionNumber(window->display);
+}
+
+/* Decode pending X events into the queue until it is full. */
+static void lepk__window_decode_events(Lepk__LinuxWindow *window) {
 	XEvent ev = {0};
-	while (XPending(_window->display) > 0) {
-		XNextEvent(_window->display, &ev);
+	while (window->event_count < LEPK_WINDOW_EVENT_CAPACITY && XPending(window->display) > 0) {
+		XNextEvent(window->display, &ev);
 		switch (ev.type) {
 			case DestroyNotify: {
 				XDestroyWindowEvent *e = (XDestroyWindowEvent *) &ev;
-				if (e->window == _window->window) {
-					_window->is_open = false;
+				if (e->window == window->window && window->is_open) {
+					window->is_open = false;
+					lepk__window_push_event(window, LEPK_EVENT_CLOSE);
 				}
 			} break;
 			case ClientMessage: {
 				XClientMessageEvent *e = (XClientMessageEvent *) &ev;
-				if ((Atom) e->data.l[0] == _window->wm_delete_window) {
-					XDestroyWindow(_window->display, _window->window);
-					_window->is_open = false;
+				if ((Atom) e->data.l[0] == window->wm_delete_window && window->is_open) {
+					XDestroyWindow(window->display, window->window);
+					window->is_open = false;
+					lepk__window_push_event(window, LEPK_EVENT_CLOSE);
 				}
 			} break;
 			case ConfigureNotify: {
-			    XConfigureEvent *e = (XConfigureEvent *) &ev;
-			    if (_window->resize_callback) {
-					if (_window->width != e->width || _window->height != e->height) {
-						_window->width  = e->width;
-						_window->height = e->height;
-						_window->resize_callback(window, e->width, e->height);
-					}
-			    }
+				XConfigureEvent *e = (XConfigureEvent *) &ev;
+				if (window->width != e->width || window->height != e->height) {
+					window->width  = e->width;
+					window->height = e->height;
+					LepkEvent *event = lepk__window_push_event(window, LEPK_EVENT_RESIZE);
+					event->data.resize.width  = e->width;
+					event->data.resize.height = e->height;
+				}
 			} break;
 
 			/* Keyboard input. */
 			case KeyPress:
 			case KeyRelease: {
-				XKeyEvent *e  = (XKeyEvent *) &ev;
-				if (_window->key_callback) {
-					_window->key_callback(window, _window->key_table[e->keycode], e->keycode, e->type == KeyPress, e->state);
-				}
+				XKeyEvent *e = (XKeyEvent *) &ev;
+				LepkEvent *event = lepk__window_push_event(window, LEPK_EVENT_KEY);
+				event->data.key.key      = window->key_table[e->keycode];
+				event->data.key.scancode = e->keycode;
+				event->data.key.pressed  = e->type == KeyPress;
+				event->data.key.mods     = e->state;
 			} break;
 
 			/* Window focus. */
@@ -408,15 +1095,314 @@ LEPKWINDOW void lepk_window_poll_events(LepkWindow *window) {
 				/* Only disable key repeats when window is in focuse because X disables it system wide for some reason. */
 				XFocusChangeEvent *e = (XFocusChangeEvent *) &ev;
 				if (e->type == FocusIn) {
-					XAutoRepeatOff(_window->display);
+					XAutoRepeatOff(window->display);
 				} else {
-					XAutoRepeatOn(_window->display);
+					XAutoRepeatOn(window->display);
+				}
+				LepkEvent *event = lepk__window_push_event(window, LEPK_EVENT_FOCUS);
+				event->data.focus.focused = e->type == FocusIn;
+			} break;
+
+			default: {
+				if (window->shm && ev.type == window->shm_completion) {
+					lepk__window_shm_completed(window, &ev);
+				}
+			} break;
+		}
+	}
+}
+#endif /* LEPK_WINDOW_XCB */
+
+LEPKWINDOW void lepk_window_destroy(LepkWindow *window) {
+	lepk__window_free(window);
+}
+
+LEPKWINDOW bool lepk_window_is_open(const LepkWindow *window) {
+	return ((Lepk__LinuxWindow *) window)->is_open;
+}
+
+LEPKWINDOW bool lepk_window_next_event(LepkWindow *window, LepkEvent *event) {
+	Lepk__LinuxWindow *_window = window;
+	if (_window->event_count == 0) {
+		lepk__window_decode_events(_window);
+		if (_window->event_count == 0) {
+			return false;
+		}
+	}
+	*event = _window->events[_window->event_head];
+	_window->event_head = (_window->event_head + 1) % LEPK_WINDOW_EVENT_CAPACITY;
+	_window->event_count--;
+	return true;
+}
+
+LEPKWINDOW bool lepk_window_wait_events(LepkWindow *window, long long timeout_ns) {
+	Lepk__LinuxWindow *_window = window;
+	unsigned long long deadline = lepk__window_time() + (timeout_ns > 0 ? (unsigned long long) timeout_ns : 0);
+	for (;;) {
+		/* Events read from the connection while waiting for a reply are never signalled by the descriptor. */
+		lepk__window_decode_events(_window);
+		if (_window->event_count > 0) {
+			return true;
+		}
+
+		struct pollfd fds[2] = {
+			{lepk__window_connection_fd(_window), POLLIN, 0},
+			{_window->wake_fd, POLLIN, 0},
+		};
+		int timeout_ms = -1;
+		if (timeout_ns >= 0) {
+			unsigned long long now = lepk__window_time();
+			unsigned long long left = deadline > now ? deadline - now : 0;
+			/* Round up so a wait never returns before the deadline. */
+			unsigned long long left_ms = (left + 999999ull) / 1000000ull;
+			timeout_ms = left_ms > INT_MAX ? INT_MAX : (int) left_ms;
+		}
+		int ready = poll(fds, 2, timeout_ms);
+		if (ready < 0 && errno != EINTR) {
+			return false;
+		}
+		if (fds[1].revents & POLLIN) {
+			uint64_t count;
+			while (read(_window->wake_fd, &count, sizeof(count)) > 0);
+			return true;
+		}
+		if ((ready == 0 && lepk__window_time() >= deadline) || fds[0].revents & (POLLERR | POLLHUP)) {
+			/* Decode once more so nothing that arrived at the deadline waits for the next call. */
+			lepk__window_decode_events(_window);
+			return _window->event_count > 0;
+		}
+	}
+}
+
+LEPKWINDOW void lepk_window_post_empty_event(LepkWindow *window) {
+	uint64_t count = 1;
+	/* Fails only when the counter is about to overflow, then the wait wakes anyway. */
+	ssize_t written = write(((Lepk__LinuxWindow *) window)->wake_fd, &count, sizeof(count));
+	(void) written;
+}
+
+LEPKWINDOW int lepk_window_drain_events(LepkWindow *window, LepkEvent *events, int capacity) {
+	int count = 0;
+	while (count < capacity && lepk_window_next_event(window, &events[count])) {
+		count++;
+	}
+	return count;
+}
+
+LEPKWINDOW void lepk_window_poll_events(LepkWindow *window) {
+	Lepk__LinuxWindow *_window = window;
+	LepkEvent event;
+	while (lepk_window_next_event(window, &event)) {
+		switch (event.type) {
+			case LEPK_EVENT_RESIZE: {
+				if (_window->resize_callback) {
+					_window->resize_callback(window, event.data.resize.width, event.data.resize.height);
+				}
+			} break;
+			case LEPK_EVENT_KEY: {
+				if (_window->key_callback) {
+					_window->key_callback(window, event.data.key.key, event.data.key.scancode, event.data.key.pressed, event.data.key.mods);
 				}
+			} break;
+			default: break;
+		}
+	}
+}
+
+/* Size the damage tracking to the framebuffer, everything starts out undamaged. */
+static bool lepk__window_damage_create(Lepk__LinuxWindow *window) {
+	free(window->tiles);
+	free(window->tile_rects);
+	free(window->tile_spans);
+	window->tiles_x = (window->framebuffer_width  + LEPK_WINDOW_TILE_SIZE - 1) / LEPK_WINDOW_TILE_SIZE;
+	window->tiles_y = (window->framebuffer_height + LEPK_WINDOW_TILE_SIZE - 1) / LEPK_WINDOW_TILE_SIZE;
+	int tile_count = window->tiles_x * window->tiles_y;
+	window->tiles = calloc((tile_count + 7) / 8, 1);
+	/* Every dirty span is followed by a clean tile, so a row holds at most half its tiles rounded up in rects. */
+	window->tile_rects = malloc((unsigned long) (window->tiles_x + 1) / 2 * window->tiles_y * sizeof(LepkRect));
+	window->tile_spans = malloc(window->tiles_x * sizeof(int));
+	window->damage_count = 0;
+	window->damage_overflow = false;
+	return window->tiles != NULL && window->tile_rects != NULL && window->tile_spans != NULL;
+}
+
+static bool lepk__window_tile_dirty(const Lepk__LinuxWindow *window, int x, int y) {
+	int tile = y * window->tiles_x + x;
+	return (window->tiles[tile / 8] >> (tile % 8)) & 1;
+}
+
+/* Clip rect to the framebuffer, false return value means nothing is left. */
+static bool lepk__window_clip(const Lepk__LinuxWindow *window, const LepkRect *rect, LepkRect *clipped) {
+	int x0 = rect->x > 0 ? rect->x : 0;
+	int y0 = rect->y > 0 ? rect->y : 0;
+	int x1 = rect->x + rect->width  < window->framebuffer_width  ? rect->x + rect->width  : window->framebuffer_width;
+	int y1 = rect->y + rect->height < window->framebuffer_height ? rect->y + rect->height : window->framebuffer_height;
+	clipped->x = x0;
+	clipped->y = y0;
+	clipped->width  = x1 - x0;
+	clipped->height = y1 - y0;
+	return clipped->width > 0 && clipped->height > 0;
+}
+
+static LepkRect lepk__window_union(const LepkRect *a, const LepkRect *b) {
+	int x0 = a->x < b->x ? a->x : b->x;
+	int y0 = a->y < b->y ? a->y : b->y;
+	int x1 = a->x + a->width  > b->x + b->width  ? a->x + a->width  : b->x + b->width;
+	int y1 = a->y + a->height > b->y + b->height ? a->y + a->height : b->y + b->height;
+	LepkRect rect = {x0, y0, x1 - x0, y1 - y0};
+	return rect;
+}
+
+static long long lepk__window_area(const LepkRect *rect) {
+	return (long long) rect->width * rect->height;
+}
+
+static void lepk__window_damage_add(Lepk__LinuxWindow *window, const LepkRect *rect) {
+	LepkRect damage;
+	if (!lepk__window_clip(window, rect, &damage)) {
+		return;
+	}
+
+	for (int y = damage.y / LEPK_WINDOW_TILE_SIZE; y <= (damage.y + damage.height - 1) / LEPK_WINDOW_TILE_SIZE; y++) {
+		for (int x = damage.x / LEPK_WINDOW_TILE_SIZE; x <= (damage.x + damage.width - 1) / LEPK_WINDOW_TILE_SIZE; x++) {
+			int tile = y * window->tiles_x + x;
+			window->tiles[tile / 8] |= 1 << (tile % 8);
+		}
+	}
+	if (window->damage_overflow) {
+		return;
+	}
+
+	/*
+	 * Merge rects whose bounding box costs no more pixels than sending both, which is when it wastes no more than their overlap.
+	 * A merged rect can reach others, so start over after every merge.
+	 */
+	for (int i = 0; i < window->damage_count;) {
+		LepkRect merged = lepk__window_union(&window->damage[i], &damage);
+		if (lepk__window_area(&merged) <= lepk__window_area(&window->damage[i]) + lepk__window_area(&damage)) {
+			damage = merged;
+			window->damage[i] = window->damage[--window->damage_count];
+			i = 0;
+		} else {
+			i++;
+		}
+	}
+	if (window->damage_count == LEPK_WINDOW_DAMAGE_CAPACITY) {
+		window->damage_overflow = true;
+		return;
+	}
+	window->damage[window->damage_count++] = damage;
+}
+
+/* Make rects of the dirty tiles, spans of dirty tiles in a row grow the rect of the same span in the row above. */
+static int lepk__window_tile_rects(Lepk__LinuxWindow *window) {
+	int count = 0;
+	for (int x = 0; x < window->tiles_x; x++) {
+		window->tile_spans[x] = -1;
+	}
+	for (int y = 0; y < window->tiles_y; y++) {
+		for (int x = 0; x < window->tiles_x;) {
+			if (!lepk__window_tile_dirty(window, x, y)) {
+				x++;
+				continue;
+			}
+			int start = x;
+			while (x < window->tiles_x && lepk__window_tile_dirty(window, x, y)) {
+				x++;
+			}
+
+			LepkRect tiles = {start * LEPK_WINDOW_TILE_SIZE, y * LEPK_WINDOW_TILE_SIZE, (x - start) * LEPK_WINDOW_TILE_SIZE, LEPK_WINDOW_TILE_SIZE};
+			LepkRect rect;
+			lepk__window_clip(window, &tiles, &rect);
+			int above = window->tile_spans[start];
+			if (above >= 0 && window->tile_rects[above].width == rect.width && window->tile_rects[above].y + window->tile_rects[above].height == rect.y) {
+				window->tile_rects[above].height += rect.height;
+			} else {
+				window->tile_spans[start] = count;
+				window->tile_rects[count++] = rect;
 			}
 		}
 	}
+	return count;
+}
+
+LEPKWINDOW unsigned int *lepk_window_framebuffer(LepkWindow *window, int *width, int *height) {
+	Lepk__LinuxWindow *_window = window;
+	if (_window->framebuffer_width != _window->width || _window->framebuffer_height != _window->height) {
+		lepk__window_framebuffer_destroy(_window);
+		if (_window->width <= 0 || _window->height <= 0 || !lepk__window_framebuffer_create(_window, _window->width, _window->height)) {
+			return NULL;
+		}
+		if (!lepk__window_damage_create(_window)) {
+			lepk__window_framebuffer_destroy(_window);
+			return NULL;
+		}
+	}
+	if (width != NULL) {
+		*width = _window->framebuffer_width;
+	}
+	if (height != NULL) {
+		*height = _window->framebuffer_height;
+	}
+	return lepk__window_framebuffer_pixels(_window);
 }
 
+LEPKWINDOW void lepk_window_damage(LepkWindow *window, LepkRect rect) {
+	Lepk__LinuxWindow *_window = window;
+	if (_window->framebuffer_width > 0) {
+		lepk__window_damage_add(_window, &rect);
+	}
+}
+
+LEPKWINDOW bool lepk_window_present(LepkWindow *window, const LepkRect *dirty_rects, int count) {
+	Lepk__LinuxWindow *_window = window;
+	if (!_window->is_open || _window->framebuffer_width == 0) {
+		return false;
+	}
+	for (int i = 0; dirty_rects != NULL && i < count; i++) {
+		lepk__window_damage_add(_window, &dirty_rects[i]);
+	}
+	if (_window->damage_count == 0 && !_window->damage_overflow) {
+		LepkRect full = {0, 0, _window->framebuffer_width, _window->framebuffer_height};
+		lepk__window_damage_add(_window, &full);
+	}
+
+	const LepkRect *rects = _window->damage;
+	int rect_count = _window->damage_count;
+	if (_window->damage_overflow) {
+		rects = _window->tile_rects;
+		rect_count = lepk__window_tile_rects(_window);
+	}
+
+	bool ok = true;
+	unsigned long long bytes = 0;
+	for (int i = 0; i < rect_count; i++) {
+		ok = lepk__window_framebuffer_put(_window, &rects[i]) && ok;
+		bytes += lepk__window_area(&rects[i]) * sizeof(unsigned int);
+	}
+	lepk__window_framebuffer_swap(_window);
+	for (int i = 0; i < rect_count; i++) {
+		lepk__window_framebuffer_sync(_window, &rects[i]);
+	}
+
+	_window->stats.bytes = bytes;
+	_window->stats.rects = rect_count;
+	_window->stats.total_bytes += bytes;
+	_window->stats.frames++;
+
+	memset(_window->tiles, 0, (_window->tiles_x * _window->tiles_y + 7) / 8);
+	_window->damage_count = 0;
+	_window->damage_overflow = false;
+	return ok;
+}
+
+LEPKWINDOW LepkPresentStats lepk_window_present_stats(const LepkWindow *window) {
+	return ((const Lepk__LinuxWindow *) window)->stats;
+}
+
+LEPKWINDOW void lepk_window_set_user_pointer(LepkWindow *window, void *user_pointer) { ((Lepk__LinuxWindow *) window)->user_pointer = user_pointer; }
+LEPKWINDOW void *lepk_window_get_user_pointer(const LepkWindow *window)               { return ((const Lepk__LinuxWindow *) window)->user_pointer; }
+
 LEPKWINDOW void lepk_window_callback_resize(LepkWindow *window, LepkResizeCallback callback) { ((Lepk__LinuxWindow *) window)->resize_callback = callback; }
 LEPKWINDOW void lepk_window_callback_key(LepkWindow *window, LepkKeyCallback callback)       { ((Lepk__LinuxWindow *) window)->key_callback    = callback; }
 #endif /* LEPK_WINDOW_OS_LINUX */
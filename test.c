@@ -1,14 +1,34 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif /* _GNU_SOURCE */
+
 #define LEPK_DA_IMPLEMENTATION
 #define LEPK_DA_TEST
 #include "lepk_da.h"
 
+#define LEPK_HT_IMPLEMENTATION
+#define LEPK_HT_TEST
+#include "lepk_ht.h"
+
 #define LEPK_FILE_IMPLEMENTATION
 #define LEPK_FILE_TEST
 #include "lepk_file.h"
 
-#define LEPK_HT_IMPLEMENTATION
-#define LEPK_HT_TEST
-#include "lepk_ht.h"
+#define LEPK_CHECKSUM_IMPLEMENTATION
+#define LEPK_CHECKSUM_TEST
+#include "lepk_checksum.h"
+
+#define LEPK_LZ_IMPLEMENTATION
+#define LEPK_LZ_TEST
+#include "lepk_lz.h"
+
+#define LEPK_LOG_IMPLEMENTATION
+#define LEPK_LOG_TEST
+#include "lepk_log.h"
+
+#define LEPK_KV_IMPLEMENTATION
+#define LEPK_KV_TEST
+#include "lepk_kv.h"
 
 /* #define LEPK_WINDOW_IMPLEMENTATION */
 /* #include "lepk_window.h" */
@@ -27,12 +47,17 @@ int main(void) {
 	lepk_da_test();
 	lepk_file_test();
 	lepk_ht_test();
+	lepk_checksum_test();
+	lepk_lz_test();
+	lepk_log_test();
+	lepk_kv_test();
 
 	/* LepkWindow *window = lepk_window_create(800, 600, "Linux Window", true); */
 	/* lepk_window_callback_resize(window, resize_callback); */
 	/* lepk_window_callback_key(window, key_callback); */
 
 	/* while (lepk_window_is_open(window)) { */
+	/* 	lepk_window_wait_events(window, -1); */
 	/* 	lepk_window_poll_events(window); */
 	/* } */
 